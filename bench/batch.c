@@ -0,0 +1,88 @@
+#include "bench.h"
+#include "../src/parser.h"
+
+/*
+ * Applies one expression to a large array of addresses, first by formatting
+ * and parse()ing a string per address, then with bmath_exec_batch() at every
+ * SIMD level the CPU supports.
+ */
+
+#define EXPRESSION "align(x, 4096) >> 12"
+// parse() is slow enough that a sample is representative
+#define PARSE_SAMPLE (1 << 18)
+
+static const struct {
+	const char *label;
+	enum bmath_simd level;
+} levels[] = {
+	{ "batch scalar", BMATH_SIMD_SCALAR },
+	{ "batch avx2", BMATH_SIMD_AVX2 },
+	{ "batch avx512", BMATH_SIMD_AVX512 },
+};
+
+int main(int argc, char *argv[])
+{
+	struct parser_context *pctx;
+	struct bmath_program *prog;
+	struct parser_settings settings = { .max_parse_len = 512, NULL };
+	size_t count = 1 << 24, rounds = 5, len;
+	uint64_t *addrs, *out, start, ns, result, sink = 0;
+	uint64_t state = 0x9e3779b97f4a7c15;
+	char expr[128];
+
+	if (argc > 1)
+		count = strtoul(argv[1], NULL, 10);
+
+	if (argc > 2)
+		rounds = strtoul(argv[2], NULL, 10);
+
+	settings.err_stream = fopen("/dev/null", "w");
+	pctx = parser_new(&settings);
+	addrs = malloc(count * sizeof(*addrs));
+	out = malloc(count * sizeof(*out));
+	if (!pctx || !addrs || !out)
+		return EXIT_FAILURE;
+
+	for (size_t i = 0; i < count; i++) {
+		state ^= state << 13;
+		state ^= state >> 7;
+		state ^= state << 17;
+		addrs[i] = state >> 16;
+	}
+
+	start = bench_now_ns();
+	for (size_t i = 0; i < PARSE_SAMPLE && i < count; i++) {
+		len = snprintf(expr, sizeof(expr), "align(%llu, 4096) >> 12",
+			       (unsigned long long)addrs[i]);
+		parse(pctx, expr, len, &result);
+		sink += result;
+	}
+	ns = bench_now_ns() - start;
+	bench_report("parse()", ns, PARSE_SAMPLE < count ? PARSE_SAMPLE : count);
+
+	if (bmath_compile(pctx, EXPRESSION, strlen(EXPRESSION), &prog))
+		return EXIT_FAILURE;
+
+	for (size_t l = 0; l < sizeof(levels) / sizeof(levels[0]); l++) {
+		if (parser_set_simd(pctx, levels[l].level) != levels[l].level) {
+			printf("%-24s unsupported\n", levels[l].label);
+			continue;
+		}
+
+		start = bench_now_ns();
+		for (size_t r = 0; r < rounds; r++) {
+			bmath_exec_batch(pctx, prog, addrs, NULL, out, count);
+			sink += out[r % count];
+		}
+		ns = bench_now_ns() - start;
+		bench_report(levels[l].label, ns, count * rounds);
+	}
+	printf("checksum: %llu\n", (unsigned long long)sink);
+
+	bmath_program_free(prog);
+	free(addrs);
+	free(out);
+	parser_free(pctx);
+	fclose(settings.err_stream);
+	return EXIT_SUCCESS;
+}
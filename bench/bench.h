@@ -0,0 +1,91 @@
+#pragma once
+
+#define _GNU_SOURCE
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+struct bench_corpus {
+	char *buf;
+	char **lines;
+	size_t *lens;
+	size_t count;
+};
+
+static inline uint64_t bench_now_ns()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+/*
+ * Loads a gen-testdata.py corpus, one expression per line. Lines are NUL
+ * terminated in place.
+ */
+static inline int bench_corpus_load(const char *path, struct bench_corpus *c)
+{
+	FILE *fp;
+	long size;
+	size_t cap = 1024;
+
+	memset(c, 0, sizeof(*c));
+
+	fp = fopen(path, "r");
+	if (!fp) {
+		perror(path);
+		return -1;
+	}
+
+	fseek(fp, 0, SEEK_END);
+	size = ftell(fp);
+	fseek(fp, 0, SEEK_SET);
+
+	c->buf = malloc(size + 1);
+	c->lines = malloc(cap * sizeof(*c->lines));
+	c->lens = malloc(cap * sizeof(*c->lens));
+	if (!c->buf || !c->lines || !c->lens ||
+	    fread(c->buf, 1, size, fp) != (size_t)size) {
+		fclose(fp);
+		return -1;
+	}
+	c->buf[size] = '\0';
+	fclose(fp);
+
+	for (char *line = c->buf, *nl; *line; line = nl + 1) {
+		nl = strchr(line, '\n');
+		if (!nl)
+			nl = line + strlen(line);
+
+		if (c->count == cap) {
+			cap *= 2;
+			c->lines = realloc(c->lines, cap * sizeof(*c->lines));
+			c->lens = realloc(c->lens, cap * sizeof(*c->lens));
+		}
+
+		c->lines[c->count] = line;
+		c->lens[c->count] = nl - line;
+		c->count++;
+
+		if (!*nl)
+			break;
+		*nl = '\0';
+	}
+
+	return 0;
+}
+
+static inline void bench_corpus_free(struct bench_corpus *c)
+{
+	free(c->buf);
+	free(c->lines);
+	free(c->lens);
+}
+
+static inline void bench_report(const char *label, uint64_t ns, size_t evals)
+{
+	printf("%-24s %10zu evals %12.2f ns/eval\n", label, evals,
+	       evals ? (double)ns / (double)evals : 0.0);
+}
@@ -0,0 +1,86 @@
+#include "bench.h"
+#include "../src/parser.h"
+
+/*
+ * What bounding the work of each line costs lines that stay within their
+ * budget: parse() of the corpus without limits, with every limit set but
+ * never reached, and with a deadline too, which reads the clock.
+ */
+
+static const struct {
+	const char *label;
+	struct bmath_budget budget;
+} configs[] = {
+	{ "parse() no budget", { 0 } },
+	{ "parse() limits",
+	  { .max_tokens = 4096,
+	    .max_depth = 256,
+	    .max_calls = 256,
+	    .max_steps = 4096 } },
+	{ "parse() limits, deadline",
+	  { .max_tokens = 4096,
+	    .max_depth = 256,
+	    .max_calls = 256,
+	    .max_steps = 4096,
+	    .deadline_ns = 1000000 } },
+};
+
+#define NCONFIGS (sizeof(configs) / sizeof(configs[0]))
+
+int main(int argc, char *argv[])
+{
+	struct bench_corpus corpus;
+	struct parser_context *pctx;
+	struct parser_settings settings = { .max_parse_len = 512, NULL };
+	size_t rounds = 20;
+	uint64_t start, ns, best[NCONFIGS], result, sink = 0;
+
+	if (argc < 2) {
+		fprintf(stderr, "usage: %s CORPUS [ROUNDS]\n", argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	if (argc > 2)
+		rounds = strtoul(argv[2], NULL, 10);
+
+	if (bench_corpus_load(argv[1], &corpus))
+		return EXIT_FAILURE;
+
+	settings.err_stream = fopen("/dev/null", "w");
+	pctx = parser_new(&settings);
+	if (!pctx)
+		return EXIT_FAILURE;
+
+	for (size_t c = 0; c < NCONFIGS; c++)
+		best[c] = UINT64_MAX;
+
+	// configurations take turns, so drift in the machine hits them alike
+	for (size_t r = 0; r < rounds; r++) {
+		for (size_t c = 0; c < NCONFIGS; c++) {
+			parser_set_budget(pctx, &configs[c].budget);
+			start = bench_now_ns();
+			for (size_t i = 0; i < corpus.count; i++) {
+				if (parse(pctx, corpus.lines[i],
+					  corpus.lens[i],
+					  &result) == PE_BUDGET_EXCEEDED)
+					return EXIT_FAILURE;
+				sink += result;
+			}
+			ns = bench_now_ns() - start;
+			best[c] = ns < best[c] ? ns : best[c];
+		}
+	}
+
+	for (size_t c = 0; c < NCONFIGS; c++) {
+		bench_report(configs[c].label, best[c], corpus.count);
+		printf("%-24s %+.2f%% over no budget\n", "",
+		       100.0 * ((double)best[c] - (double)best[0]) /
+			       (double)best[0]);
+	}
+	printf("checksum: %llu\n", (unsigned long long)sink);
+
+	parser_free(pctx);
+	fclose(settings.err_stream);
+	bench_corpus_free(&corpus);
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,104 @@
+#include "bench.h"
+#include "../src/parser.h"
+
+#include <unistd.h>
+
+/*
+ * Times parse() over the corpus without a cache, with one that has room for
+ * every line twice over, so most lookups after the first round hit, and with
+ * one far smaller than the corpus, so nearly every lookup misses and evicts.
+ * The cache file is filled by a context that is then freed, and timed from a
+ * fresh one, like bmath -w after a restart.
+ */
+
+static const struct {
+	const char *label;
+	// entries per corpus line, 0 for no cache
+	double per_line;
+	bool file;
+} configs[] = {
+	{ "parse() uncached", 0, false },
+	{ "parse() cache fits", 2.0, false },
+	{ "parse() cache thrashes", 0.01, false },
+	{ "parse() cache file", 0, true },
+};
+
+static void parse_corpus(struct parser_context *pctx,
+			 const struct bench_corpus *corpus, uint64_t *sink)
+{
+	uint64_t result;
+
+	for (size_t i = 0; i < corpus->count; i++) {
+		parse(pctx, corpus->lines[i], corpus->lens[i], &result);
+		*sink += result;
+	}
+}
+
+int main(int argc, char *argv[])
+{
+	struct bench_corpus corpus;
+	struct parser_context *pctx;
+	struct parser_settings settings = { .max_parse_len = 0, NULL };
+	struct bmath_cache_stats stats;
+	size_t rounds = 20;
+	uint64_t start, ns, sink = 0;
+	char path[] = "/tmp/bmath-bench-XXXXXX";
+	int fd;
+
+	if (argc < 2) {
+		fprintf(stderr, "usage: %s CORPUS [ROUNDS]\n", argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	if (argc > 2)
+		rounds = strtoul(argv[2], NULL, 10);
+
+	if (bench_corpus_load(argv[1], &corpus))
+		return EXIT_FAILURE;
+
+	settings.err_stream = fopen("/dev/null", "w");
+
+	fd = mkstemp(path);
+	if (fd < 0)
+		return EXIT_FAILURE;
+	close(fd);
+
+	for (size_t c = 0; c < sizeof(configs) / sizeof(configs[0]); c++) {
+		settings.cache_size = configs[c].per_line * corpus.count;
+		if (configs[c].per_line && !settings.cache_size)
+			settings.cache_size = 1;
+		settings.cache_file = configs[c].file ? path : NULL;
+
+		if (configs[c].file) {
+			pctx = parser_new(&settings);
+			if (!pctx)
+				return EXIT_FAILURE;
+			parse_corpus(pctx, &corpus, &sink);
+			parser_free(pctx);
+		}
+
+		pctx = parser_new(&settings);
+		if (!pctx)
+			return EXIT_FAILURE;
+
+		start = bench_now_ns();
+		for (size_t r = 0; r < rounds; r++)
+			parse_corpus(pctx, &corpus, &sink);
+		ns = bench_now_ns() - start;
+		bench_report(configs[c].label, ns, corpus.count * rounds);
+
+		if (parser_cache_stats(pctx, &stats) && stats.capacity)
+			printf("%-24s %zu hits, %zu misses, %zu evictions\n",
+			       "", stats.hits, stats.misses, stats.evictions);
+		else if (parser_cache_stats(pctx, &stats))
+			printf("%-24s %zu hits, %zu misses\n", "",
+			       stats.file_hits, stats.file_misses);
+		parser_free(pctx);
+	}
+	printf("checksum: %llu\n", (unsigned long long)sink);
+
+	unlink(path);
+	fclose(settings.err_stream);
+	bench_corpus_free(&corpus);
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,103 @@
+#include "bench.h"
+#include "../src/parser.h"
+
+/*
+ * What calling a builtin costs on top of its work: chains of popcnt(x), as in
+ * popcnt(popcnt(x)), against x alone, interpreted with bmath_exec() and
+ * evaluated with parse(). The difference over the chain length is the cost of
+ * one call.
+ */
+
+#define CALLS_DEPTH 32
+#define CALLS_EVALS 1000000
+
+static size_t build_chain(char *buf, const char *arg, size_t depth)
+{
+	size_t len = 0;
+
+	for (size_t i = 0; i < depth; i++)
+		len += sprintf(buf + len, "popcnt(");
+	len += sprintf(buf + len, "%s", arg);
+	for (size_t i = 0; i < depth; i++)
+		buf[len++] = ')';
+	buf[len] = '\0';
+	return len;
+}
+
+static uint64_t run_exec(struct parser_context *pctx,
+			 struct bmath_program *prog, size_t evals,
+			 uint64_t *sink)
+{
+	uint64_t start = bench_now_ns(), result;
+
+	for (size_t i = 0; i < evals; i++) {
+		if (bmath_exec(pctx, prog, &result))
+			exit(EXIT_FAILURE);
+		*sink += result;
+	}
+
+	return bench_now_ns() - start;
+}
+
+static uint64_t run_parse(struct parser_context *pctx, const char *expr,
+			  size_t len, size_t evals, uint64_t *sink)
+{
+	uint64_t start = bench_now_ns(), result;
+
+	for (size_t i = 0; i < evals; i++) {
+		if (parse(pctx, expr, len, &result))
+			exit(EXIT_FAILURE);
+		*sink += result;
+	}
+
+	return bench_now_ns() - start;
+}
+
+static void report_call(const char *label, uint64_t chain_ns, uint64_t base_ns,
+			size_t evals)
+{
+	double ns = (double)chain_ns - (double)base_ns;
+
+	printf("%-24s %10zu calls %12.2f ns/call\n", label,
+	       evals * CALLS_DEPTH, ns / (double)(evals * CALLS_DEPTH));
+}
+
+int main(int argc, char *argv[])
+{
+	struct parser_settings settings = { .max_parse_len = 0, NULL };
+	struct bmath_program *chain, *base;
+	struct parser_context *pctx;
+	size_t evals = CALLS_EVALS, chain_len, base_len;
+	uint64_t chain_ns, base_ns, sink = 0;
+	char expr[CALLS_DEPTH * 8 + 32], literal[] = "0x123456789abcdef";
+
+	if (argc > 1)
+		evals = strtoul(argv[1], NULL, 10);
+
+	settings.err_stream = fopen("/dev/null", "w");
+	pctx = parser_new(&settings);
+	if (!pctx)
+		return EXIT_FAILURE;
+
+	chain_len = build_chain(expr, "x", CALLS_DEPTH);
+	if (bmath_compile(pctx, expr, chain_len, &chain) ||
+	    bmath_compile(pctx, "x", 1, &base))
+		return EXIT_FAILURE;
+
+	base_ns = run_exec(pctx, base, evals, &sink);
+	chain_ns = run_exec(pctx, chain, evals, &sink);
+	report_call("bmath_exec()", chain_ns, base_ns, evals);
+
+	base_len = strlen(literal);
+	chain_len = build_chain(expr, literal, CALLS_DEPTH);
+	base_ns = run_parse(pctx, literal, base_len, evals, &sink);
+	chain_ns = run_parse(pctx, expr, chain_len, evals, &sink);
+	report_call("parse()", chain_ns, base_ns, evals);
+	printf("checksum: %llu\n", (unsigned long long)sink);
+
+	bmath_program_free(chain);
+	bmath_program_free(base);
+	parser_free(pctx);
+	fclose(settings.err_stream);
+	return EXIT_SUCCESS;
+}
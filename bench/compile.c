@@ -0,0 +1,74 @@
+#include "bench.h"
+#include "../src/parser.h"
+
+/*
+ * Compares repeated parse() calls against compiling each expression once
+ * with bmath_compile() and re-running it with bmath_exec().
+ */
+int main(int argc, char *argv[])
+{
+	struct bench_corpus corpus;
+	struct parser_context *pctx;
+	struct bmath_program **progs;
+	struct parser_settings settings = { .max_parse_len = 512, NULL };
+	size_t rounds = 20;
+	uint64_t start, result, sink = 0;
+	uint64_t parse_ns = 0, compile_ns = 0, exec_ns = 0;
+	size_t evals = 0;
+
+	if (argc < 2) {
+		fprintf(stderr, "usage: %s CORPUS [ROUNDS]\n", argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	if (argc > 2)
+		rounds = strtoul(argv[2], NULL, 10);
+
+	if (bench_corpus_load(argv[1], &corpus))
+		return EXIT_FAILURE;
+
+	settings.err_stream = fopen("/dev/null", "w");
+	pctx = parser_new(&settings);
+	progs = calloc(corpus.count, sizeof(*progs));
+	if (!pctx || !progs)
+		return EXIT_FAILURE;
+
+	start = bench_now_ns();
+	for (size_t i = 0; i < corpus.count; i++)
+		bmath_compile(pctx, corpus.lines[i], corpus.lens[i], &progs[i]);
+	compile_ns = bench_now_ns() - start;
+
+	for (size_t r = 0; r < rounds; r++) {
+		start = bench_now_ns();
+		for (size_t i = 0; i < corpus.count; i++) {
+			parse(pctx, corpus.lines[i], corpus.lens[i], &result);
+			sink += result;
+		}
+		parse_ns += bench_now_ns() - start;
+
+		start = bench_now_ns();
+		for (size_t i = 0; i < corpus.count; i++) {
+			if (!progs[i])
+				continue;
+			bmath_exec(pctx, progs[i], &result);
+			sink += result;
+		}
+		exec_ns += bench_now_ns() - start;
+	}
+
+	for (size_t i = 0; i < corpus.count; i++)
+		evals += progs[i] != NULL;
+
+	bench_report("parse()", parse_ns, corpus.count * rounds);
+	bench_report("bmath_compile()", compile_ns, corpus.count);
+	bench_report("bmath_exec()", exec_ns, evals * rounds);
+	printf("checksum: %llu\n", (unsigned long long)sink);
+
+	for (size_t i = 0; i < corpus.count; i++)
+		bmath_program_free(progs[i]);
+	free(progs);
+	parser_free(pctx);
+	fclose(settings.err_stream);
+	bench_corpus_free(&corpus);
+	return EXIT_SUCCESS;
+}
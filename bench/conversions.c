@@ -0,0 +1,165 @@
+#include "bench.h"
+#include "../src/conversions.h"
+
+#include <errno.h>
+#include <stdbool.h>
+
+/*
+ * Parses uniformly distributed 1-20 digit decimals, 1-16 digit hex numbers
+ * and 17-64 digit hex blobs, each followed by a space, with the byte at a
+ * time loops the parser used before and with the word at a time ones from
+ * conversions.h. Like the parser's, the byte loops look digits up in a table,
+ * and like the lexer, each parse is given the rest of the buffer.
+ */
+
+#define COUNT (1 << 20)
+
+struct inputs {
+	char *buf;
+	size_t *offsets;
+	size_t *lens;
+};
+
+typedef ssize_t (*convert_t)(const char *input, size_t input_length,
+			     uint64_t *result);
+
+// digit values, 0xff for anything else
+static uint8_t dec_table[256], hex_table[256];
+
+static void make_tables(void)
+{
+	memset(dec_table, 0xff, sizeof(dec_table));
+	memset(hex_table, 0xff, sizeof(hex_table));
+	for (int c = 0; c < 10; c++) {
+		dec_table['0' + c] = c;
+		hex_table['0' + c] = c;
+	}
+	for (int c = 0; c < 6; c++) {
+		hex_table['a' + c] = 10 + c;
+		hex_table['A' + c] = 10 + c;
+	}
+}
+
+static ssize_t bytewise_dec(const char *input, size_t input_length,
+			    uint64_t *result)
+{
+	const char *p = input, *end = input + input_length;
+	uint64_t value = 0;
+
+	while (p < end && dec_table[(unsigned char)*p] != 0xff)
+		value = value * 10 + dec_table[(unsigned char)*p++];
+	*result = value;
+
+	return p - input;
+}
+
+static ssize_t bytewise_hex(const char *input, size_t input_length,
+			    uint64_t *result)
+{
+	const char *p = input + 2, *end = input + input_length;
+	uint64_t value = 0;
+
+	while (p < end && hex_table[(unsigned char)*p] != 0xff)
+		value = (value << 4) + hex_table[(unsigned char)*p++];
+	*result = value;
+
+	if (p - input - 2 > MAX_HEX_DIGITS) {
+		errno = E2BIG;
+		return -(p - input);
+	}
+
+	return p - input;
+}
+
+static uint64_t next(uint64_t *state)
+{
+	*state ^= *state << 13;
+	*state ^= *state >> 7;
+	*state ^= *state << 17;
+	return *state;
+}
+
+static int make_inputs(struct inputs *in, bool hex, size_t min, size_t max)
+{
+	static const char digits[] = "0123456789abcdefABCDEF";
+	uint64_t state = 0x9e3779b97f4a7c15;
+	size_t pos = 0, n;
+
+	in->buf = malloc(COUNT * (max + 3));
+	in->offsets = malloc(COUNT * sizeof(*in->offsets));
+	in->lens = malloc(COUNT * sizeof(*in->lens));
+	if (!in->buf || !in->offsets || !in->lens)
+		return -1;
+
+	for (size_t i = 0; i < COUNT; i++) {
+		n = min + next(&state) % (max - min + 1);
+		in->offsets[i] = pos;
+		if (hex) {
+			memcpy(in->buf + pos, "0x", 2);
+			pos += 2;
+		}
+
+		for (size_t k = 0; k < n; k++) {
+			in->buf[pos++] = hex ? digits[next(&state) % 22] :
+					       digits[next(&state) % 10];
+		}
+
+		in->buf[pos++] = ' ';
+	}
+
+	for (size_t i = 0; i < COUNT; i++)
+		in->lens[i] = pos - in->offsets[i];
+
+	return 0;
+}
+
+static void run(const char *label, convert_t convert, struct inputs *in,
+		size_t rounds, uint64_t *sink)
+{
+	uint64_t start, ns, result;
+
+	start = bench_now_ns();
+	for (size_t r = 0; r < rounds; r++) {
+		for (size_t i = 0; i < COUNT; i++) {
+			*sink += convert(in->buf + in->offsets[i], in->lens[i],
+					 &result);
+			*sink += result;
+		}
+	}
+	ns = bench_now_ns() - start;
+	bench_report(label, ns, COUNT * rounds);
+}
+
+int main(int argc, char *argv[])
+{
+	struct inputs dec, hex, blobs;
+	size_t rounds = 10;
+	uint64_t sink = 0;
+
+	if (argc > 1)
+		rounds = strtoul(argv[1], NULL, 10);
+
+	make_tables();
+	if (make_inputs(&dec, false, 1, 20) || make_inputs(&hex, true, 1, 16) ||
+	    make_inputs(&blobs, true, 17, 64))
+		return EXIT_FAILURE;
+
+	run("dec 1-20 bytewise", bytewise_dec, &dec, rounds, &sink);
+	run("dec 1-20 swar", str_dec_to_uint64, &dec, rounds, &sink);
+	run("hex 1-16 bytewise", bytewise_hex, &hex, rounds, &sink);
+	run("hex 1-16 swar", str_hex_to_uint64, &hex, rounds, &sink);
+	run("hex 17-64 bytewise", bytewise_hex, &blobs, rounds, &sink);
+	run("hex 17-64 swar", str_hex_to_uint64, &blobs, rounds, &sink);
+	printf("checksum: %llu\n", (unsigned long long)sink);
+
+	free(dec.buf);
+	free(dec.offsets);
+	free(dec.lens);
+	free(hex.buf);
+	free(hex.offsets);
+	free(hex.lens);
+	free(blobs.buf);
+	free(blobs.offsets);
+	free(blobs.lens);
+	return EXIT_SUCCESS;
+}
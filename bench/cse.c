@@ -0,0 +1,94 @@
+#include "bench.h"
+#include "../src/parser.h"
+
+/*
+ * parse()s generated lines that repeat their subterms, such as the same
+ * align(base + off, 4096) several times, with a base that only changes every
+ * few lines, without sharing subterms, sharing them within each line, and
+ * sharing them with the lines before too.
+ */
+
+#define CSE_LINES 4096
+#define CSE_MAX_LEN 256
+// lines with the same base
+#define CSE_RUN 8
+
+static const struct {
+	const char *label;
+	bool cse;
+	size_t window;
+} configs[] = {
+	{ "parse() no sharing", false, 0 },
+	{ "parse() cse", true, 0 },
+	{ "parse() cse window 8", true, CSE_RUN },
+};
+
+static size_t build_line(char *buf, size_t i)
+{
+	unsigned long base = 0x7f0000000000ul + (i / CSE_RUN) * 0x10000;
+	unsigned long off = (i % CSE_RUN) * 0x48;
+
+	return sprintf(buf,
+		       "align(0x%lx + 0x%lx, 4096) - (0x%lx + 0x%lx) + "
+		       "(align(0x%lx + 0x%lx, 4096) >> 12) ^ "
+		       "popcnt(align(0x%lx + 0x%lx, 4096) & 0xfff) | "
+		       "align_down(0x%lx, 0x200000)",
+		       base, off, base, off, base, off, base, off, base);
+}
+
+int main(int argc, char *argv[])
+{
+	struct parser_context *pctx;
+	struct parser_settings settings = { .max_parse_len = 0, NULL };
+	struct bmath_cse_stats stats;
+	size_t rounds = 200;
+	uint64_t start, ns, result, sink = 0;
+	size_t *lens;
+	char *lines;
+
+	if (argc > 1)
+		rounds = strtoul(argv[1], NULL, 10);
+
+	lines = malloc(CSE_LINES * CSE_MAX_LEN);
+	lens = malloc(CSE_LINES * sizeof(*lens));
+	if (!lines || !lens)
+		return EXIT_FAILURE;
+
+	for (size_t i = 0; i < CSE_LINES; i++)
+		lens[i] = build_line(lines + i * CSE_MAX_LEN, i);
+
+	settings.err_stream = fopen("/dev/null", "w");
+
+	for (size_t c = 0; c < sizeof(configs) / sizeof(configs[0]); c++) {
+		settings.cse = configs[c].cse;
+		settings.cse_window = configs[c].window;
+
+		pctx = parser_new(&settings);
+		if (!pctx)
+			return EXIT_FAILURE;
+
+		start = bench_now_ns();
+		for (size_t r = 0; r < rounds; r++) {
+			for (size_t i = 0; i < CSE_LINES; i++) {
+				if (parse(pctx, lines + i * CSE_MAX_LEN,
+					  lens[i], &result))
+					return EXIT_FAILURE;
+				sink += result;
+			}
+		}
+		ns = bench_now_ns() - start;
+		bench_report(configs[c].label, ns, CSE_LINES * rounds);
+
+		if (parser_cse_stats(pctx, &stats))
+			printf("%-24s %zu ops, %zu computed, %.2fx dedup\n", "",
+			       stats.ops, stats.computed,
+			       (double)stats.ops / (double)stats.computed);
+		parser_free(pctx);
+	}
+	printf("checksum: %llu\n", (unsigned long long)sink);
+
+	fclose(settings.err_stream);
+	free(lines);
+	free(lens);
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,98 @@
+#include "bench.h"
+#include "../src/parser.h"
+
+/*
+ * parse()s machine-generated expressions that nest deeply instead of being
+ * long: parenthesized chains, unary prefix chains and nested calls.
+ */
+
+// longest expression built below
+#define DEEP_MAX_LEN 32000
+
+static size_t build_parens(char *buf, size_t depth)
+{
+	size_t len = 0;
+
+	for (size_t i = 0; i < depth; i++)
+		buf[len++] = '(';
+	buf[len++] = '1';
+	for (size_t i = 0; i < depth; i++)
+		len += sprintf(buf + len, "+1)");
+	return len;
+}
+
+static size_t build_unary(char *buf, size_t depth)
+{
+	size_t len = 0;
+
+	for (size_t i = 0; i < depth; i++)
+		buf[len++] = i & 1 ? '-' : '~';
+	buf[len++] = '1';
+	return len;
+}
+
+static size_t build_calls(char *buf, size_t depth)
+{
+	size_t len = 0;
+
+	for (size_t i = 0; i < depth; i++)
+		len += sprintf(buf + len, "popcnt(");
+	buf[len++] = '1';
+	for (size_t i = 0; i < depth; i++)
+		buf[len++] = ')';
+	return len;
+}
+
+static const struct {
+	const char *label;
+	size_t (*build)(char *buf, size_t depth);
+	size_t depth;
+} shapes[] = {
+	{ "parens 100", build_parens, 100 },
+	{ "parens 7000", build_parens, 7000 },
+	{ "unary 100", build_unary, 100 },
+	{ "unary 30000", build_unary, 30000 },
+	{ "calls 100", build_calls, 100 },
+	{ "calls 3500", build_calls, 3500 },
+};
+
+int main(int argc, char *argv[])
+{
+	struct parser_context *pctx;
+	struct parser_settings settings = { .max_parse_len = 0, NULL };
+	size_t rounds = 2000, len, chars;
+	uint64_t start, ns, result, sink = 0;
+	char *expr;
+
+	if (argc > 1)
+		rounds = strtoul(argv[1], NULL, 10);
+
+	settings.err_stream = fopen("/dev/null", "w");
+	pctx = parser_new(&settings);
+	expr = malloc(DEEP_MAX_LEN + 16);
+	if (!pctx || !expr)
+		return EXIT_FAILURE;
+
+	for (size_t s = 0; s < sizeof(shapes) / sizeof(shapes[0]); s++) {
+		len = shapes[s].build(expr, shapes[s].depth);
+		// keep the total work per shape roughly even
+		chars = 0;
+
+		start = bench_now_ns();
+		for (size_t r = 0; chars < rounds * 1000; r++) {
+			if (parse(pctx, expr, len, &result))
+				return EXIT_FAILURE;
+			sink += result;
+			chars += len;
+		}
+		ns = bench_now_ns() - start;
+		printf("%-24s %10zu chars %12.2f ns/char\n", shapes[s].label,
+		       chars, (double)ns / (double)chars);
+	}
+	printf("checksum: %llu\n", (unsigned long long)sink);
+
+	free(expr);
+	parser_free(pctx);
+	fclose(settings.err_stream);
+	return EXIT_SUCCESS;
+}
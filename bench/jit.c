@@ -0,0 +1,96 @@
+#include "bench.h"
+#include "../src/parser.h"
+
+/*
+ * Compares the interpreter against promoted native code. The programs are
+ * left unoptimized so there is real work to do.
+ *
+ * The hot set models a long-lived evaluator running the same few expressions
+ * over and over, which is what the JIT is for. The full corpus promotes every
+ * expression, each into its own code page, and mostly measures iTLB misses.
+ */
+#define HOT_SET 64
+#define HOT_ROUNDS 1000
+static uint64_t run(struct parser_context *pctx, struct bmath_program **progs,
+		    size_t count, size_t rounds, uint64_t *sink)
+{
+	uint64_t start = bench_now_ns();
+	uint64_t result;
+
+	for (size_t r = 0; r < rounds; r++) {
+		for (size_t i = 0; i < count; i++) {
+			if (!progs[i])
+				continue;
+			bmath_exec(pctx, progs[i], &result);
+			*sink += result;
+		}
+	}
+
+	return bench_now_ns() - start;
+}
+
+int main(int argc, char *argv[])
+{
+	struct bench_corpus corpus;
+	struct parser_context *pctx;
+	struct bmath_program **progs;
+	struct parser_settings settings = { .max_parse_len = 512, NULL };
+	size_t rounds = 20, evals = 0, hot_evals = 0, jitted = 0;
+	size_t hot;
+	uint64_t sink = 0, interp_ns, jit_ns, promote_ns;
+	uint64_t hot_interp_ns, hot_jit_ns;
+
+	if (argc < 2) {
+		fprintf(stderr, "usage: %s CORPUS [ROUNDS]\n", argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	if (argc > 2)
+		rounds = strtoul(argv[2], NULL, 10);
+
+	if (bench_corpus_load(argv[1], &corpus))
+		return EXIT_FAILURE;
+
+	settings.err_stream = fopen("/dev/null", "w");
+	pctx = parser_new(&settings);
+	progs = calloc(corpus.count, sizeof(*progs));
+	if (!pctx || !progs)
+		return EXIT_FAILURE;
+
+	for (size_t i = 0; i < corpus.count; i++) {
+		bmath_compile(pctx, corpus.lines[i], corpus.lens[i], &progs[i]);
+		evals += progs[i] != NULL;
+	}
+
+	hot = corpus.count < HOT_SET ? corpus.count : HOT_SET;
+	for (size_t i = 0; i < hot; i++)
+		hot_evals += progs[i] != NULL;
+
+	hot_interp_ns = run(pctx, progs, hot, rounds * HOT_ROUNDS, &sink);
+	interp_ns = run(pctx, progs, corpus.count, rounds, &sink);
+
+	parser_set_jit_threshold(pctx, 1);
+	promote_ns = run(pctx, progs, corpus.count, 1, &sink);
+	hot_jit_ns = run(pctx, progs, hot, rounds * HOT_ROUNDS, &sink);
+	jit_ns = run(pctx, progs, corpus.count, rounds, &sink);
+
+	for (size_t i = 0; i < corpus.count; i++)
+		jitted += progs[i] && bmath_program_is_jitted(progs[i]);
+
+	printf("promoted %zu of %zu programs\n", jitted, evals);
+	bench_report("promotion + first exec", promote_ns, evals);
+	bench_report("hot set interpreted", hot_interp_ns,
+		     hot_evals * rounds * HOT_ROUNDS);
+	bench_report("hot set jit", hot_jit_ns, hot_evals * rounds * HOT_ROUNDS);
+	bench_report("corpus interpreted", interp_ns, evals * rounds);
+	bench_report("corpus jit", jit_ns, evals * rounds);
+	printf("checksum: %llu\n", (unsigned long long)sink);
+
+	for (size_t i = 0; i < corpus.count; i++)
+		bmath_program_free(progs[i]);
+	free(progs);
+	parser_free(pctx);
+	fclose(settings.err_stream);
+	bench_corpus_free(&corpus);
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,90 @@
+#include "bench.h"
+#include "../src/parser.h"
+
+/*
+ * Evaluates giant OR-reductions of flag masks, the kind of expression code
+ * generators produce, at 1 MB and 64 MB. Lexing should be linear, so the
+ * cost per byte shouldn't depend on the size.
+ */
+
+#define MB (1024 * 1024)
+
+static const size_t sizes[] = { 1 * MB, 64 * MB };
+
+static char *build_masks(size_t size, size_t *out_len)
+{
+	char *expr = malloc(size + 32);
+	size_t len = 0;
+
+	if (!expr)
+		return NULL;
+
+	for (unsigned int i = 0; len < size; i++) {
+		if (i & 1)
+			len += sprintf(expr + len, "(1 << %u) | ", i % 64);
+		else
+			len += sprintf(expr + len, "0x%llx | ",
+				       1ull << (i * 7 % 64));
+	}
+	len += sprintf(expr + len, "0");
+
+	*out_len = len;
+	return expr;
+}
+
+int main(int argc, char *argv[])
+{
+	struct parser_context *pctx;
+	struct bmath_program *prog;
+	struct parser_settings settings = { .max_parse_len = 0, NULL };
+	size_t rounds = 3, len;
+	uint64_t start, ns, result, sink = 0;
+	char label[32], *expr;
+
+	if (argc > 1)
+		rounds = strtoul(argv[1], NULL, 10);
+
+	settings.err_stream = fopen("/dev/null", "w");
+	pctx = parser_new(&settings);
+	if (!pctx)
+		return EXIT_FAILURE;
+
+	for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+		expr = build_masks(sizes[s], &len);
+		if (!expr)
+			return EXIT_FAILURE;
+
+		start = bench_now_ns();
+		for (size_t r = 0; r < rounds; r++) {
+			if (parse(pctx, expr, len, &result))
+				return EXIT_FAILURE;
+			sink += result;
+		}
+		ns = bench_now_ns() - start;
+		snprintf(label, sizeof(label), "parse() %zu MB", sizes[s] / MB);
+		printf("%-24s %10zu bytes %12.2f ns/byte\n", label,
+		       len * rounds, (double)ns / (double)(len * rounds));
+
+		// a program holds every op, so only compile the small one
+		if (sizes[s] <= MB) {
+			start = bench_now_ns();
+			if (bmath_compile(pctx, expr, len, &prog) ||
+			    bmath_exec(pctx, prog, &result))
+				return EXIT_FAILURE;
+			ns = bench_now_ns() - start;
+			sink -= result;
+			snprintf(label, sizeof(label), "compile+exec %zu MB",
+				 sizes[s] / MB);
+			printf("%-24s %10zu bytes %12.2f ns/byte\n", label, len,
+			       (double)ns / (double)len);
+			bmath_program_free(prog);
+		}
+
+		free(expr);
+	}
+	printf("checksum: %llu\n", (unsigned long long)sink);
+
+	parser_free(pctx);
+	fclose(settings.err_stream);
+	return EXIT_SUCCESS;
+}
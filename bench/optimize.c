@@ -0,0 +1,85 @@
+#include "bench.h"
+#include "../src/parser.h"
+
+/*
+ * Reports how many ops bmath_optimize() removes from the corpus and how
+ * that affects bmath_exec() throughput.
+ */
+static uint64_t run(struct parser_context *pctx, struct bmath_program **progs,
+		    size_t count, size_t rounds, uint64_t *sink)
+{
+	uint64_t start = bench_now_ns();
+	uint64_t result;
+
+	for (size_t r = 0; r < rounds; r++) {
+		for (size_t i = 0; i < count; i++) {
+			if (!progs[i])
+				continue;
+			bmath_exec(pctx, progs[i], &result);
+			*sink += result;
+		}
+	}
+
+	return bench_now_ns() - start;
+}
+
+int main(int argc, char *argv[])
+{
+	struct bench_corpus corpus;
+	struct parser_context *pctx;
+	struct bmath_program **progs;
+	struct bmath_optimize_stats stats;
+	struct parser_settings settings = { .max_parse_len = 512, NULL };
+	size_t rounds = 20, evals = 0;
+	size_t ops_before = 0, ops_after = 0;
+	uint64_t sink = 0, before_ns, after_ns;
+
+	if (argc < 2) {
+		fprintf(stderr, "usage: %s CORPUS [ROUNDS]\n", argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	if (argc > 2)
+		rounds = strtoul(argv[2], NULL, 10);
+
+	if (bench_corpus_load(argv[1], &corpus))
+		return EXIT_FAILURE;
+
+	settings.err_stream = fopen("/dev/null", "w");
+	pctx = parser_new(&settings);
+	progs = calloc(corpus.count, sizeof(*progs));
+	if (!pctx || !progs)
+		return EXIT_FAILURE;
+
+	for (size_t i = 0; i < corpus.count; i++) {
+		bmath_compile(pctx, corpus.lines[i], corpus.lens[i], &progs[i]);
+		evals += progs[i] != NULL;
+	}
+
+	before_ns = run(pctx, progs, corpus.count, rounds, &sink);
+
+	for (size_t i = 0; i < corpus.count; i++) {
+		if (!progs[i])
+			continue;
+		bmath_optimize(progs[i], &stats);
+		ops_before += stats.ops_before;
+		ops_after += stats.ops_after;
+	}
+
+	after_ns = run(pctx, progs, corpus.count, rounds, &sink);
+
+	printf("ops before: %zu, ops after: %zu (%.1f%% removed)\n",
+	       ops_before, ops_after,
+	       ops_before ? 100.0 * (ops_before - ops_after) / ops_before : 0);
+	bench_report("unoptimized exec", before_ns, evals * rounds);
+	bench_report("optimized exec", after_ns, evals * rounds);
+	printf("checksum: %llu\n", (unsigned long long)sink);
+
+	for (size_t i = 0; i < corpus.count; i++)
+		bmath_program_free(progs[i]);
+	free(progs);
+	parser_free(pctx);
+	fclose(settings.err_stream);
+	bench_corpus_free(&corpus);
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,123 @@
+#include "bench.h"
+#include "../src/parser.h"
+
+/*
+ * Evaluates a generated file of dependent lines over and over, like -w does
+ * as the file is edited. Each block of lines reads the base and size of its
+ * block, and each base is the one of the block before plus a stride, so the
+ * first base is read by every line. Compares evaluating every line of the
+ * file against evaluating it incrementally when nothing changed, when one
+ * size changed, and when the first base did.
+ */
+
+#define RECALC_LINES 100000
+#define RECALC_MAX_LEN 64
+#define RECALC_BLOCK 100
+// the block whose size is edited
+#define RECALC_EDITED (RECALC_LINES / RECALC_BLOCK / 2)
+
+static size_t build_line(char *buf, size_t i, bool edit_size, bool edit_base)
+{
+	size_t k = i / RECALC_BLOCK, j = i % RECALC_BLOCK;
+
+	if (j == 0 && k == 0)
+		return sprintf(buf, "base0 = 0x%lx",
+			       edit_base ? 0x7f1000000000ul : 0x7f0000000000ul);
+	if (j == 0)
+		return sprintf(buf, "base%zu = base%zu + 0x10000", k, k - 1);
+	if (j == 1)
+		return sprintf(buf, "size%zu = 0x%x", k,
+			       edit_size && k == RECALC_EDITED ? 0x80 : 0x40);
+	if (j % 2)
+		return sprintf(buf, "_ - base%zu", k);
+	return sprintf(buf, "v%zu_%zu = align(base%zu + %zu * size%zu, 4096)", k,
+		       j, k, j, k);
+}
+
+// every line, from the top, as -w does on each change
+static uint64_t run_pass(struct parser_context *pctx, const char *lines,
+			 const size_t *lens, uint64_t *sink)
+{
+	uint64_t start = bench_now_ns(), result;
+
+	parser_reset_symbols(pctx);
+	for (size_t i = 0; i < RECALC_LINES; i++) {
+		if (parse(pctx, lines + i * RECALC_MAX_LEN, lens[i], &result))
+			exit(EXIT_FAILURE);
+		*sink += result;
+	}
+
+	return bench_now_ns() - start;
+}
+
+int main(int argc, char *argv[])
+{
+	const struct {
+		const char *label;
+		bool incremental;
+		bool edit_size;
+		bool edit_base;
+	} configs[] = {
+		{ "full evaluation", false, false, false },
+		{ "incremental, no change", true, false, false },
+		{ "incremental, one size", true, true, false },
+		{ "incremental, first base", true, false, true },
+	};
+	struct parser_settings settings = { .max_parse_len = 0, NULL };
+	struct bmath_recalc_stats stats = { 0 };
+	struct parser_context *pctx;
+	size_t rounds = 10, *lens[2];
+	uint64_t ns, best, sink = 0;
+	char *lines[2];
+
+	if (argc > 1)
+		rounds = strtoul(argv[1], NULL, 10);
+
+	for (int v = 0; v < 2; v++) {
+		lines[v] = malloc(RECALC_LINES * RECALC_MAX_LEN);
+		lens[v] = malloc(RECALC_LINES * sizeof(*lens[v]));
+		if (!lines[v] || !lens[v])
+			return EXIT_FAILURE;
+	}
+
+	settings.err_stream = fopen("/dev/null", "w");
+
+	for (size_t c = 0; c < sizeof(configs) / sizeof(configs[0]); c++) {
+		for (size_t i = 0; i < RECALC_LINES; i++) {
+			lens[0][i] = build_line(lines[0] + i * RECALC_MAX_LEN,
+						i, false, false);
+			lens[1][i] = build_line(lines[1] + i * RECALC_MAX_LEN,
+						i, configs[c].edit_size,
+						configs[c].edit_base);
+		}
+
+		settings.incremental = configs[c].incremental;
+		pctx = parser_new(&settings);
+		if (!pctx)
+			return EXIT_FAILURE;
+
+		// the file as it was, then each pass edits or reverts it
+		run_pass(pctx, lines[0], lens[0], &sink);
+		best = UINT64_MAX;
+		for (size_t r = 0; r < rounds; r++) {
+			ns = run_pass(pctx, lines[(r + 1) % 2], lens[(r + 1) % 2],
+				      &sink);
+			best = ns < best ? ns : best;
+		}
+
+		bench_report(configs[c].label, best, RECALC_LINES);
+		if (parser_recalc_stats(pctx, &stats))
+			printf("%-24s %zu lines evaluated, %zu unchanged\n", "",
+			       stats.evaluated, stats.reused);
+		printf("%-24s %.3f ms per pass\n", "", (double)best / 1e6);
+		parser_free(pctx);
+	}
+	printf("checksum: %llu\n", (unsigned long long)sink);
+
+	fclose(settings.err_stream);
+	for (int v = 0; v < 2; v++) {
+		free(lines[v]);
+		free(lens[v]);
+	}
+	return EXIT_SUCCESS;
+}
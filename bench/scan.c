@@ -0,0 +1,104 @@
+#include "bench.h"
+#include "../src/parser.h"
+#include "../src/scan.h"
+
+/*
+ * Times the line pre-scan on its own with each scanner, then parse() with
+ * the scalar scanner and with the widest one the CPU supports. parse() only
+ * pre-scans lines longer than 64 bytes, so on a corpus of short lines the
+ * two should be about the same.
+ */
+
+static const struct {
+	const char *label;
+	scan_line_t scan;
+} scanners[] = {
+	{ "scan scalar", scan_line_scalar },
+#ifdef __x86_64__
+	{ "scan sse2", scan_line_sse2 },
+	{ "scan avx2", scan_line_avx2 },
+#endif
+};
+
+static const struct {
+	const char *label;
+	enum bmath_simd level;
+} levels[] = {
+	{ "parse() scalar scan", BMATH_SIMD_SCALAR },
+	{ "parse() widest scan", BMATH_SIMD_AUTO },
+};
+
+int main(int argc, char *argv[])
+{
+	struct bench_corpus corpus;
+	struct parser_context *pctx;
+	struct parser_settings settings = { .max_parse_len = 0, NULL };
+	size_t rounds = 20, longest = 0, len;
+	uint64_t start, ns, result, *spaces, sink = 0;
+
+	if (argc < 2) {
+		fprintf(stderr, "usage: %s CORPUS [ROUNDS]\n", argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	if (argc > 2)
+		rounds = strtoul(argv[2], NULL, 10);
+
+	if (bench_corpus_load(argv[1], &corpus))
+		return EXIT_FAILURE;
+
+	for (size_t i = 0; i < corpus.count; i++) {
+		if (corpus.lens[i] > longest)
+			longest = corpus.lens[i];
+	}
+
+	settings.err_stream = fopen("/dev/null", "w");
+	pctx = parser_new(&settings);
+	spaces = calloc(SCAN_WORDS(longest + 1), sizeof(*spaces));
+	if (!pctx || !spaces)
+		return EXIT_FAILURE;
+
+	for (size_t s = 0; s < sizeof(scanners) / sizeof(scanners[0]); s++) {
+#ifdef __x86_64__
+		if (scanners[s].scan == scan_line_avx2 &&
+		    scan_select(BMATH_SIMD_AUTO) != scan_line_avx2) {
+			printf("%-24s unsupported\n", scanners[s].label);
+			continue;
+		}
+#endif
+
+		start = bench_now_ns();
+		for (size_t r = 0; r < rounds; r++) {
+			for (size_t i = 0; i < corpus.count; i++) {
+				sink += scanners[s].scan(corpus.lines[i],
+							 corpus.lens[i],
+							 spaces, &len);
+				sink += len + spaces[0];
+			}
+		}
+		ns = bench_now_ns() - start;
+		bench_report(scanners[s].label, ns, corpus.count * rounds);
+	}
+
+	for (size_t l = 0; l < sizeof(levels) / sizeof(levels[0]); l++) {
+		parser_set_simd(pctx, levels[l].level);
+
+		start = bench_now_ns();
+		for (size_t r = 0; r < rounds; r++) {
+			for (size_t i = 0; i < corpus.count; i++) {
+				parse(pctx, corpus.lines[i], corpus.lens[i],
+				      &result);
+				sink += result;
+			}
+		}
+		ns = bench_now_ns() - start;
+		bench_report(levels[l].label, ns, corpus.count * rounds);
+	}
+	printf("checksum: %llu\n", (unsigned long long)sink);
+
+	free(spaces);
+	parser_free(pctx);
+	fclose(settings.err_stream);
+	bench_corpus_free(&corpus);
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,72 @@
+#include "bench.h"
+#include "../src/parser.h"
+
+/*
+ * Compares parse()ing each line of a corpus against bmath_parse_batch(),
+ * which groups lines by shape and evaluates each group with SIMD lanes.
+ */
+int main(int argc, char *argv[])
+{
+	struct bench_corpus corpus;
+	struct parser_context *pctx;
+	struct parser_settings settings = { .max_parse_len = 512, NULL };
+	struct bmath_batch_stats stats = { 0 };
+	size_t rounds = 20;
+	uint64_t start, result, *results, sink = 0;
+	uint64_t parse_ns = 0, batch_ns = 0;
+	int *errs;
+
+	if (argc < 2) {
+		fprintf(stderr, "usage: %s CORPUS [ROUNDS]\n", argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	if (argc > 2)
+		rounds = strtoul(argv[2], NULL, 10);
+
+	if (bench_corpus_load(argv[1], &corpus))
+		return EXIT_FAILURE;
+
+	settings.err_stream = fopen("/dev/null", "w");
+	pctx = parser_new(&settings);
+	results = malloc(corpus.count * sizeof(*results));
+	errs = malloc(corpus.count * sizeof(*errs));
+	if (!pctx || !results || !errs)
+		return EXIT_FAILURE;
+
+	for (size_t r = 0; r < rounds; r++) {
+		start = bench_now_ns();
+		for (size_t i = 0; i < corpus.count; i++) {
+			parse(pctx, corpus.lines[i], corpus.lens[i], &result);
+			sink += result;
+		}
+		parse_ns += bench_now_ns() - start;
+
+		start = bench_now_ns();
+		if (bmath_parse_batch(pctx, (const char *const *)corpus.lines,
+				      corpus.lens, corpus.count, results, errs,
+				      &stats))
+			return EXIT_FAILURE;
+		batch_ns += bench_now_ns() - start;
+
+		for (size_t i = 0; i < corpus.count; i++)
+			sink -= results[i];
+	}
+
+	bench_report("parse()", parse_ns, corpus.count * rounds);
+	bench_report("bmath_parse_batch()", batch_ns, corpus.count * rounds);
+	printf("shapes: %zu, parsed one at a time: %zu, lanes per op: %.2f\n",
+	       stats.shapes, stats.parsed,
+	       stats.op_dispatches ?
+		       (double)stats.lane_ops / (double)stats.op_dispatches :
+		       0.0);
+	// parse() and bmath_parse_batch() agree when this is zero
+	printf("checksum: %llu\n", (unsigned long long)sink);
+
+	free(results);
+	free(errs);
+	parser_free(pctx);
+	fclose(settings.err_stream);
+	bench_corpus_free(&corpus);
+	return EXIT_SUCCESS;
+}
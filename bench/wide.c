@@ -0,0 +1,95 @@
+#include "bench.h"
+#include "../src/parser.h"
+
+/*
+ * What evaluating wider than 64 bits costs, tier by tier: lines that each
+ * finish in one tier, evaluated with bmath_parse_wide() at widths from 128
+ * bits up, against parse() where the line fits in 64. The tier a line
+ * finished in, and how often it had to start over in a wider one, come from
+ * parser_wide_stats().
+ */
+
+#define WIDE_EVALS 200000
+
+static const struct {
+	const char *label;
+	const char *expr;
+} lines[] = {
+	// fits in 64 bits, at any width
+	{ "64-bit values", "align(0x1234 + 56, 16) * 3 >> 2 | popcnt(0xff00)" },
+	// ~ and a carry out of 64 bits, which need 128 to run exactly
+	{ "128-bit values", "~0 ^ 0xffffffffffffffff * 0xffff + (1 << 100)" },
+	// and these need limbs past 128
+	{ "256-bit values", "(1 << 200) / 3 + 0xffffffffffffffff * 0xffff" },
+};
+
+static const unsigned int widths[] = { 64, 128, 256, 1024 };
+
+#define NLINES (sizeof(lines) / sizeof(lines[0]))
+#define NWIDTHS (sizeof(widths) / sizeof(widths[0]))
+
+static const char *tier_of(const struct bmath_wide_stats *s)
+{
+	if (s->tier_limbs)
+		return "limbs";
+	return s->tier_128 ? "128-bit" : "64-bit";
+}
+
+int main(int argc, char *argv[])
+{
+	struct parser_settings settings = { .max_parse_len = 0, NULL };
+	struct parser_context *pctx;
+	struct bmath_wide_stats stats;
+	size_t evals = WIDE_EVALS, len;
+	uint64_t start, ns, sink = 0, out[BMATH_WIDTH_MAX / 64];
+	char label[64];
+
+	if (argc > 1)
+		evals = strtoul(argv[1], NULL, 10);
+
+	settings.err_stream = fopen("/dev/null", "w");
+	for (size_t w = 0; w < NWIDTHS; w++) {
+		settings.width = widths[w];
+		pctx = parser_new(&settings);
+		if (!pctx)
+			return EXIT_FAILURE;
+
+		for (size_t i = 0; i < NLINES; i++) {
+			len = strlen(lines[i].expr);
+			// at 64 bits only the first line is what it says
+			if (widths[w] == 64 && i)
+				break;
+
+			start = bench_now_ns();
+			for (size_t k = 0; k < evals; k++) {
+				if (bmath_parse_wide(pctx, lines[i].expr, len,
+						     out))
+					return EXIT_FAILURE;
+				sink += out[0];
+			}
+			ns = bench_now_ns() - start;
+
+			snprintf(label, sizeof(label), "%s at %u", lines[i].label,
+				 widths[w]);
+			bench_report(label, ns, evals);
+			if (!parser_wide_stats(pctx, &stats)) {
+				printf("%-24s parse()\n", "");
+				continue;
+			}
+			printf("%-24s %s tier, %.2f escalations a line\n", "",
+			       tier_of(&stats),
+			       (double)stats.escalations / (double)evals);
+
+			// stats are per context, start the next line afresh
+			parser_free(pctx);
+			pctx = parser_new(&settings);
+			if (!pctx)
+				return EXIT_FAILURE;
+		}
+		parser_free(pctx);
+	}
+	printf("checksum: %llu\n", (unsigned long long)sink);
+
+	fclose(settings.err_stream);
+	return EXIT_SUCCESS;
+}
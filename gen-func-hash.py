@@ -0,0 +1,108 @@
+#!/usr/bin/env python3
+
+# Builtin function names and their enum func_id, see functions.h
+FUNCTIONS = {
+    "align": "FUNC_ALIGN",
+    "align_down": "FUNC_ALIGN_DOWN",
+    "bswap": "FUNC_BSWAP",
+    "clz": "FUNC_CLZ",
+    "ctz": "FUNC_CTZ",
+    "mask": "FUNC_MASK",
+    "popcnt": "FUNC_POPCNT",
+}
+
+# token_is_name_char() in token.h
+NAME_FIRST = ord("_")
+NAME_LAST = ord("z")
+
+
+def func_hash(name, a, b, c, mask):
+    key = name.encode()
+    return (key[0] * a + key[1] * b + key[-1] * c + len(key)) & mask
+
+
+def find_perfect_hash(names):
+    """
+    Smallest power of two table, then the smallest multipliers, such that
+    no two names share a slot.
+    """
+    size = 1
+    while size < len(names):
+        size *= 2
+
+    while True:
+        for a in range(1, 32):
+            for b in range(0, 32):
+                for c in range(0, 32):
+                    slots = {func_hash(n, a, b, c, size - 1) for n in names}
+                    if len(slots) == len(names):
+                        return size, a, b, c
+        size *= 2
+
+
+names = sorted(FUNCTIONS)
+for name in names:
+    assert len(name) >= 2, "the hash reads the first two characters"
+    assert all(NAME_FIRST <= ord(ch) <= NAME_LAST for ch in name)
+
+size, a, b, c = find_perfect_hash(names)
+first_chars = 0
+for name in names:
+    first_chars |= 1 << (ord(name[0]) - NAME_FIRST)
+
+print("// THIS FILE IS GENERATED by gen-func-hash.py!")
+print("#ifndef FUNC_HASH_H\n#define FUNC_HASH_H\n")
+print("#include <stddef.h>")
+print("#include <stdint.h>")
+print("#include <string.h>\n")
+print("// enum func_id is in functions.h, which has to come first\n")
+
+print(f"#define FUNC_HASH_MIN_LEN {min(len(n) for n in names)}")
+print(f"#define FUNC_HASH_MAX_LEN {max(len(n) for n in names)}")
+print("// bit c - '_' is set when a builtin starts with c")
+print(f"#define FUNC_HASH_FIRST_CHARS 0x{first_chars:08x}u\n")
+
+print("struct func_hash_entry {")
+print("\tconst char *name;")
+print("\tsize_t len;")
+print("\tenum func_id id;")
+print("};\n")
+
+print(f"static const struct func_hash_entry func_hash_table[{size}] = {{")
+for name in sorted(names, key=lambda n: func_hash(n, a, b, c, size - 1)):
+    slot = func_hash(name, a, b, c, size - 1)
+    print(f'\t[{slot}] = {{ "{name}", {len(name)}, {FUNCTIONS[name]} }},')
+print("};\n")
+
+print("// name must be at least FUNC_HASH_MIN_LEN long")
+print("static inline size_t func_hash(const char *name, size_t len)")
+print("{")
+print("\tconst unsigned char *key = (const unsigned char *)name;\n")
+terms = []
+for mult, key in ((a, "key[0]"), (b, "key[1]"), (c, "key[len - 1]")):
+    if mult == 1:
+        terms.append(key)
+    elif mult:
+        terms.append(f"{key} * {mult}u")
+print(f"\treturn ({' + '.join(terms)} + len) & {size - 1};")
+print("}\n")
+
+print("/*")
+print(" * The builtin named by exactly len bytes of name, or NULL. name must start")
+print(" * with a token_is_name_char(). Only candidates that pass the length and first")
+print(" * character checks are hashed.")
+print(" */")
+print("static inline const struct func_hash_entry *")
+print("func_hash_lookup(const char *name, size_t len)")
+print("{")
+print("\tconst struct func_hash_entry *entry;\n")
+print("\tif (len < FUNC_HASH_MIN_LEN || len > FUNC_HASH_MAX_LEN ||")
+print("\t    !((FUNC_HASH_FIRST_CHARS >> (name[0] - '_')) & 1))")
+print("\t\treturn NULL;\n")
+print("\tentry = &func_hash_table[func_hash(name, len)];")
+print("\tif (entry->len != len || memcmp(entry->name, name, len) != 0)")
+print("\t\treturn NULL;\n")
+print("\treturn entry;")
+print("}\n")
+
+print("#endif")
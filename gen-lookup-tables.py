@@ -1,145 +1,280 @@
 #!/usr/bin/env python3
 
+# Character classes of the lexer. Every operator that is a token on its own
+# gets a class, so the class alone says which token it is.
+OPERATORS = {
+    "%": ("TOK_FACTOR_OP", "ATTR_FACTOR_OP_MOD"),
+    "&": ("TOK_OP", "ATTR_OP_AND"),
+    "(": ("TOK_LPAREN", "ATTR_LPAREN"),
+    ")": ("TOK_RPAREN", "ATTR_RPAREN"),
+    "*": ("TOK_FACTOR_OP", "ATTR_FACTOR_OP_MUL"),
+    "+": ("TOK_SIGN", "ATTR_SIGN_PLUS"),
+    ",": ("TOK_COMMA", "0"),
+    "-": ("TOK_SIGN", "ATTR_SIGN_MINUS"),
+    "/": ("TOK_FACTOR_OP", "'/'"),
+    "=": ("TOK_ASSIGN", "0"),
+    "^": ("TOK_OP", "ATTR_OP_XOR"),
+    "|": ("TOK_OP", "ATTR_OP_OR"),
+    "~": ("TOK_BITWISE_NOT", "ATTR_BITWISE_NOT"),
+}
 
-def map_data(table, mapdata):
-    tbl = table.copy()
-    for i, v in mapdata.items():
-        tbl[i] = v
-    return tbl
+OPERATOR_NAMES = {
+    "%": "PERCENT",
+    "&": "AMPERSAND",
+    "(": "LPAREN",
+    ")": "RPAREN",
+    "*": "STAR",
+    "+": "PLUS",
+    ",": "COMMA",
+    "-": "MINUS",
+    "/": "SLASH",
+    "=": "EQUALS",
+    "^": "CARET",
+    "|": "PIPE",
+    "~": "TILDE",
+}
 
+CLASSES = [
+    "OTHER",
+    "END",
+    "SPACE",
+    "ZERO",
+    "DIGIT",
+    "X",
+    "UPPER_X",
+    "Y",
+    "NAME",
+    "LT",
+    "GT",
+] + [OPERATOR_NAMES[c] for c in OPERATORS]
 
-def gen_table(conditional):
-    arr = [0] * 128
-    for i in range(0, len(arr)):
-        if conditional(i):
-            arr[i] = 1
-    return arr
+# Tokens of classes that are a token on their own, or a token when they don't
+# start a function name
+CLASS_TOKENS = {
+    "X": ("TOK_VARIABLE", "VAR_X"),
+    "Y": ("TOK_VARIABLE", "VAR_Y"),
+    "LT": ("TOK_SHIFT_OP", "ATTR_LSHIFT"),
+    "GT": ("TOK_SHIFT_OP", "ATTR_RSHIFT"),
+}
+CLASS_TOKENS.update({OPERATOR_NAMES[c]: t for c, t in OPERATORS.items()})
 
+# Names start with these, see token_is_name_char()
+NAME_CHARS = [chr(i) for i in range(ord("_"), ord("z") + 1)]
 
-def gen_lookup_table(label, funclabel, table):
-    print(f"static int {label}[] = {{", end="")
+STATES = ["START", "LT", "GT", "ZERO"]
+ACCEPTS = ["END", "TOKEN", "SHIFT", "DECIMAL", "HEX", "NAME", "ILLEGAL"]
+
+FLAG_DIGIT = 0x20
+FLAG_HEX = 0x40
+FLAG_ALLOWED = 0x80
+
+assert len(CLASSES) <= 0x20
+assert len(STATES) + len(ACCEPTS) <= 0x100
+
+
+# Whitespace between tokens. Everything that looks for whitespace is
+# generated from this, so that no two of them can disagree.
+SPACES = " \t\n\r"
+
+
+def char_class(c):
+    if c == "\0":
+        return "END"
+    if c in SPACES:
+        return "SPACE"
+    if c == "0":
+        return "ZERO"
+    if "1" <= c <= "9":
+        return "DIGIT"
+    if c == "x":
+        return "X"
+    if c == "X":
+        return "UPPER_X"
+    if c == "y":
+        return "Y"
+    if c in NAME_CHARS:
+        return "NAME"
+    if c == "<":
+        return "LT"
+    if c == ">":
+        return "GT"
+    if c in OPERATORS:
+        return OPERATOR_NAMES[c]
+    return "OTHER"
+
+
+def is_hex(c):
+    return c in "0123456789abcdefABCDEF"
+
+
+# Can appear in some token. Everything else is rejected up front.
+def is_allowed(c):
+    return char_class(c) not in ("OTHER", "END") or is_hex(c)
+
+
+def char_entry(i):
+    c = chr(i)
+    entry = CLASSES.index(char_class(c))
+    if "0" <= c <= "9":
+        entry |= FLAG_DIGIT
+    if is_hex(c):
+        entry |= FLAG_HEX
+    if is_allowed(c):
+        entry |= FLAG_ALLOWED
+    return entry
+
+
+# Bit h of entry l is set if the character with high nibble h and low nibble
+# l is allowed. None of the allowed characters have the high bit set.
+def allowed_nibbles():
+    table = [0] * 16
+    for i in range(128):
+        if is_allowed(chr(i)):
+            table[i & 0xF] |= 1 << (i >> 4)
+    return table
+
+
+# The characters of the SPACE class
+def space_chars():
+    return [chr(i) for i in range(256) if char_class(chr(i)) == "SPACE"]
+
+
+# Entry l is the whitespace character with low nibble l, if there is one
+def space_nibbles():
+    table = [0xFF] * 16
+    for c in space_chars():
+        assert table[ord(c) & 0xF] == 0xFF
+        table[ord(c) & 0xF] = ord(c)
+    return table
+
+
+def transition(state, cls):
+    if state == "START":
+        if cls == "SPACE":
+            return "START"
+        if cls in ("LT", "GT", "ZERO"):
+            return cls
+        if cls == "END":
+            return "END"
+        if cls == "DIGIT":
+            return "DECIMAL"
+        if cls in ("X", "Y", "NAME"):
+            return "NAME"
+        if cls in OPERATOR_NAMES.values():
+            return "TOKEN"
+        return "ILLEGAL"
+    if state in ("LT", "GT"):
+        return "SHIFT" if cls == state else "ILLEGAL"
+    if state == "ZERO":
+        return "HEX" if cls in ("X", "UPPER_X") else "DECIMAL"
+
+
+# The lexer relies on the start state being the only one that loops, and on
+# every other state deciding its token on the next character
+for state in STATES[1:]:
+    for cls in CLASSES:
+        assert transition(state, cls) in ACCEPTS
+
+
+def gen_enum(name, prefix, labels, first=0):
+    print(f"enum {name} {{")
+    for i, label in enumerate(labels):
+        print(f"\t{prefix}{label} = {first + i},")
+    print("};\n")
+
+
+def gen_byte_table(decl, table, width=16):
+    print(f"{decl} = {{", end="")
     for i in range(0, len(table)):
-        if i % 16 == 0:
+        if i % width == 0:
             print("\n    ", end="")
-        print(f"{table[i]}", end=", ", flush=True)
-
+        print(f"{table[i]}", end=", ")
     print("\n};\n")
-    print(f"static inline int {funclabel}(char c)\n{{")
-    print(f"\treturn {label}[(int) c];")
-    print("}")
 
 
 print("// THIS FILE IS GENERATED!")
 print("#ifndef LOOKUP_TABLES_H\n#define LOOKUP_TABLES_H\n")
+print("#include <stdbool.h>")
+print("#include <stdint.h>\n")
+print("// refers to token.h and program.h, which have to come first\n")
 
-# a-fA-F0-9
-gen_lookup_table(
-    "lookup_is_allowed_hex",
-    "__is_allowed_hex",
-    gen_table(
-        lambda i: (i >= ord("a") and i <= ord("f"))
-        or (i >= ord("A") and i <= ord("F"))
-        or (i >= ord("0") and i <= ord("9"))
-    ),
-)
-print()
-
-
-gen_lookup_table(
-    "lookup_hex_to_value",
-    "__hex_to_value",
-    map_data(
-        gen_table(
-            lambda i: (i >= ord("a") and i <= ord("f"))
-            or (i >= ord("A") and i <= ord("F"))
-            or (i >= ord("0") and i <= ord("9"))
-        ),
-        {
-            ord("0"): 0,
-            ord("1"): 1,
-            ord("2"): 2,
-            ord("3"): 3,
-            ord("4"): 4,
-            ord("5"): 5,
-            ord("6"): 6,
-            ord("7"): 7,
-            ord("8"): 8,
-            ord("9"): 9,
-            ord("A"): 10,
-            ord("a"): 10,
-            ord("B"): 11,
-            ord("b"): 11,
-            ord("C"): 12,
-            ord("c"): 12,
-            ord("D"): 13,
-            ord("d"): 13,
-            ord("E"): 14,
-            ord("e"): 14,
-            ord("F"): 15,
-            ord("f"): 15,
-        },
-    ),
+gen_enum("lex_class", "LEX_CLASS_", CLASSES)
+gen_enum("lex_state", "LEX_STATE_", STATES)
+print(f"#define LEX_STATES {len(STATES)}")
+print(f"#define LEX_CLASSES {len(CLASSES)}\n")
+print("// the DFA stops in one of these, see lookup_lex_dfa")
+gen_enum("lex_accept", "LEX_ACCEPT_", ACCEPTS, len(STATES))
+
+print("/*")
+print(" * One byte per character: its lexer class in the low bits, whether it is")
+print(" * a decimal or a hex digit, and whether it can appear in a token at all.")
+print(" * Indexed by unsigned char, so bytes with the high bit set are")
+print(" * LEX_CLASS_OTHER like any other illegal character.")
+print(" */")
+print(f"#define LEX_CLASS_MASK 0x1f")
+print(f"#define LEX_FLAG_DIGIT {FLAG_DIGIT:#x}")
+print(f"#define LEX_FLAG_HEX {FLAG_HEX:#x}")
+print(f"#define LEX_FLAG_ALLOWED {FLAG_ALLOWED:#x}\n")
+gen_byte_table(
+    "static const uint8_t lookup_char_class[256]",
+    [f"{char_entry(i):#04x}" for i in range(256)],
+    width=8,
 )
-print()
 
+print("/*")
+print(" * lookup_lex_dfa[state][class] is the next state, consuming the character,")
+print(" * or an accept code at or past LEX_STATES, leaving it for the token.")
+print(" * Only whitespace loops back to LEX_STATE_START, and every other state is")
+print(" * one character into its token and accepts on the next one.")
+print(" */")
+# rows are padded to a power of two so indexing them is a shift
+print("static const uint8_t lookup_lex_dfa[LEX_STATES][LEX_CLASS_MASK + 1] = {")
+for state in STATES:
+    print(f"\t[LEX_STATE_{state}] = {{", end="")
+    for i, cls in enumerate(CLASSES):
+        nxt = transition(state, cls)
+        label = f"LEX_STATE_{nxt}" if nxt in STATES else f"LEX_ACCEPT_{nxt}"
+        print(f"\n\t\t[LEX_CLASS_{cls}] = {label},", end="")
+    print("\n\t},")
+print("};\n")
 
-# 0-9
-gen_lookup_table(
-    "lookup_is_digit",
-    "__is_digit",
-    gen_table(lambda i: i >= ord("0") and i <= ord("9")),
-)
-print()
+print("// the token a class stands for, TOK_NULL if none")
+print("struct lex_class_token {\n\tuint8_t type;\n\tuint8_t attr;\n};\n")
+print("static const struct lex_class_token lookup_class_token[LEX_CLASSES] = {")
+for cls in CLASSES:
+    if cls in CLASS_TOKENS:
+        tok, attr = CLASS_TOKENS[cls]
+        print(f"\t[LEX_CLASS_{cls}] = {{ {tok}, {attr} }},")
+print("};\n")
 
-# A-F
-gen_lookup_table(
-    "lookup_is_capital_hex",
-    "__is_capital_hex",
-    gen_table(lambda i: i >= ord("A") and i <= ord("F")),
+print("/*")
+print(" * The same sets for byte shuffles, indexed by low nibble, see scan.h.")
+print(" * Bit h of lookup_allowed_nibbles[l] is set if the character 0xhl is")
+print(" * allowed, and lookup_space_nibbles[l] is the whitespace character with")
+print(" * low nibble l, or 0xff if there is none.")
+print(" */")
+gen_byte_table(
+    "static const uint8_t lookup_allowed_nibbles[16]",
+    [f"{v:#04x}" for v in allowed_nibbles()],
+    width=8,
 )
-print()
-
-# ()<> \t\n\rA-Za-z0-9
-gen_lookup_table(
-    "lookup_is_allowed_character",
-    "__is_allowed_character",
-    gen_table(
-        lambda i: i == ord("~")
-        or i == ord("(")
-        or i == ord(")")
-        or i == ord(">")
-        or i == ord("<")
-        or i == ord(" ")
-        or i == ord("\t")
-        or i == ord("\n")
-        or i == ord("\r")
-        or i == ord("|")
-        or i == ord("&")
-        or i == ord("~")
-        or i == ord("^")
-        or i == ord("+")
-        or i == ord("-")
-        or i == ord("%")
-        or i == ord("_")
-        or (i >= ord("A") and i <= ord("Z"))
-        or (i >= ord("a") and i <= ord("z"))
-        or (i >= ord("0") and i <= ord("9"))
-    ),
+gen_byte_table(
+    "static const uint8_t lookup_space_nibbles[16]",
+    [f"{v:#04x}" for v in space_nibbles()],
+    width=8,
 )
-print()
-
-# hex terminator
-gen_lookup_table(
-    "lookup_is_hex_terminator",
-    "__is_hex_terminator",
-    gen_table(
-        lambda i: i == ord(" ")
-        or i == ord("\t")
-        or i == ord("\n")
-        or i == ord("\r")
-        or i == 0
-    ),
+
+print("// the characters of LEX_CLASS_SPACE, to compare a vector with each")
+print(f"#define LEX_SPACE_CHARS {len(space_chars())}")
+gen_byte_table(
+    "static const uint8_t lookup_space_chars[LEX_SPACE_CHARS]",
+    [f"{ord(c):#04x}" for c in space_chars()],
+    width=8,
 )
-print()
+
+print("static inline unsigned int __char_class(char c)")
+print("{")
+print("\treturn lookup_char_class[(unsigned char)c] & LEX_CLASS_MASK;")
+print("}\n")
 
 print("#endif")
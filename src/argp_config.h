@@ -1,17 +1,21 @@
 #pragma once
 
+#include <errno.h>
 #include <stdbool.h>
+#include <stdlib.h>
 #include <strings.h>
 #include <argp.h>
 
 const char *argp_program_bug_address = "Frederick Lawler <me@fred.software>";
 
-static char args_doc[] = "[EXPR]\n-w FILE";
+static char args_doc[] = "[EXPR]\n-w FILE\n--emit-c FILE\n--batch";
 
 static char doc[] = "\nUsage examples:"
 		    "\n\t./bmath \"0x001\""
 		    "\n\t./bmath < input-file"
 		    "\n\t./bmath -w input-file"
+		    "\n\t./bmath --emit-c input-file > exprs.h"
+		    "\n\t./bmath --batch < input-file"
 		    "\n\t./bmath"
 		    "\n\nSee bmath(1) for detailed examples and explinations.";
 
@@ -19,6 +23,15 @@ struct arguments {
 	char *alignment_expr;
 	char *detached_expr;
 	char *watch_path;
+	char *emit_c_path;
+	char *cache_file;
+	char *defs_path;
+	size_t cache_size;
+	size_t cse_window;
+	unsigned int width;
+	bool cse;
+	bool batch;
+	bool error_summary;
 	bool print_binary;
 	bool should_show_unicode;
 	bool should_uppercase_hex;
@@ -29,6 +42,14 @@ enum argument_opts {
 	OPT_UPPERCASE = 'u',
 	OPT_BINARY = 'b',
 	OPT_UNICODE = 128,
+	OPT_EMIT_C = 129,
+	OPT_BATCH = 130,
+	OPT_ERROR_SUMMARY = 131,
+	OPT_CACHE = 132,
+	OPT_CACHE_FILE = 133,
+	OPT_CSE = 134,
+	OPT_DEFS = 135,
+	OPT_WIDTH = 136,
 	OPT_ALIGN = 'a',
 	OPT_WATCH = 'w'
 };
@@ -37,18 +58,44 @@ static struct argp_option options[] = {
 	{ "align", OPT_ALIGN, "EXPR", 0,
 	  "Print input expression's alignment according to alignment expression. Alignment expression should be power of 2, but it's not enforced",
 	  0 },
+	{ "batch", OPT_BATCH, 0, 0,
+	  "Evaluate all of stdin at once, grouping lines that only differ in their numbers, and summarize the grouping on stderr",
+	  0 },
 	{ "binary", OPT_BINARY, 0, 0, "Print the result in binary", 0 },
+	{ "cache", OPT_CACHE, "ENTRIES", 0,
+	  "Remember the results and errors of up to ENTRIES distinct expressions and answer repeats from memory. With stdin, --watch or --batch, the hit and miss counts are printed on stderr once the input has been read",
+	  0 },
+	{ "cache-file", OPT_CACHE_FILE, "FILE", 0,
+	  "Keep results in FILE, created if it doesn't exist, and reuse them in later runs. Any number of bmath processes can share the file",
+	  0 },
+	{ "cse", OPT_CSE, "LINES", OPTION_ARG_OPTIONAL,
+	  "Diagnostic, slows evaluation down: compute each distinct subexpression of a line once, and with LINES, reuse the ones of that many lines before, to measure how repetitive the input is. With stdin, --watch or --batch, how many operations were shared is printed on stderr once the input has been read",
+	  0 },
+	{ "defs", OPT_DEFS, "FILE", 0,
+	  "Define the functions in FILE, one `def name(a, b) = expr` per line, before evaluating anything",
+	  0 },
+	{ "error-summary", OPT_ERROR_SUMMARY, 0, 0,
+	  "With stdin, --watch or --batch, count failing lines by error instead of reporting each one, and print the counts on stderr once the input has been read",
+	  0 },
+	{ "emit-c", OPT_EMIT_C, "FILE", 0,
+	  "Compile every line of FILE into a C header of static inline functions and print it",
+	  0 },
 	{ "unicode", OPT_UNICODE, 0, 0, "Print unicode characters", 0 },
 	{ "uppercase", OPT_UPPERCASE, 0, 0, "Uppercase hex output", 0 },
 	{ "watch", OPT_WATCH, 0, OPTION_NO_USAGE,
 	  "Watches file for changes. ie. Live reloading. When enabled, stdin capabilities are disabled, and requires a file path to input file as first program argument",
 	  0 },
+	{ "width", OPT_WIDTH, "BITS", 0,
+	  "Evaluate at BITS bits, a power of two from 64 to 4096, with literals and results as wide. Past 64 bits, lines can't read or bind names, and --batch and --emit-c aren't available",
+	  0 },
 	{ 0 }
 };
 
 static error_t parse_opt(int key, char *arg, struct argp_state *state)
 {
 	struct arguments *arguments = (struct arguments *)state->input;
+	unsigned long width;
+	char *end;
 
 	switch (key) {
 	case OPT_UPPERCASE:
@@ -66,6 +113,48 @@ static error_t parse_opt(int key, char *arg, struct argp_state *state)
 	case OPT_WATCH:
 		arguments->watch = true;
 		break;
+	case OPT_EMIT_C:
+		arguments->emit_c_path = arg;
+		break;
+	case OPT_BATCH:
+		arguments->batch = true;
+		break;
+	case OPT_ERROR_SUMMARY:
+		arguments->error_summary = true;
+		break;
+	case OPT_CACHE:
+		arguments->cache_size = strtoul(arg, &end, 0);
+		if (*arg == '-' || *end || end == arg) {
+			argp_error(state, "invalid cache size \"%s\"", arg);
+		}
+		break;
+	case OPT_CACHE_FILE:
+		arguments->cache_file = arg;
+		break;
+	case OPT_DEFS:
+		arguments->defs_path = arg;
+		break;
+	case OPT_WIDTH:
+		errno = 0;
+		width = strtoul(arg, &end, 0);
+		// checked before it is narrowed, 2^32 + 128 isn't 128
+		if (*arg == '-' || *end || end == arg || errno == ERANGE ||
+		    width < 64 || width > 4096 || (width & (width - 1))) {
+			argp_error(state, "invalid width \"%s\"", arg);
+		}
+		arguments->width = width;
+		break;
+	case OPT_CSE:
+		arguments->cse = true;
+		if (!arg) {
+			break;
+		}
+		arguments->cse_window = strtoul(arg, &end, 0);
+		if (*arg == '-' || *end || end == arg) {
+			argp_error(state, "invalid number of lines \"%s\"",
+				   arg);
+		}
+		break;
 	case ARGP_KEY_ARG:
 		if (arguments->watch && state->arg_num == 0) {
 			arguments->watch_path = arg;
@@ -0,0 +1,442 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef __x86_64__
+#include <cpuid.h>
+#include <stdatomic.h>
+#endif
+
+#include "batch.h"
+#include "functions.h"
+#include "program.h"
+#include "util.h"
+
+/*
+ * Portable kernels. These are plain loops over a column; the compiler is free
+ * to vectorize them for the baseline ISA.
+ */
+
+#define BATCH_SCALAR_BINARY(name, expr)                                      \
+	static bool name(const struct program_op *op, uint64_t *dst,         \
+			 const uint64_t *const *args, size_t lanes)          \
+	{                                                                    \
+		const uint64_t *a = args[0], *b = args[1];                   \
+		for (size_t i = 0; i < lanes; i++)                           \
+			dst[i] = (expr);                                     \
+		return false;                                                \
+	}
+
+BATCH_SCALAR_BINARY(__scalar_mul, a[i] * b[i])
+BATCH_SCALAR_BINARY(__scalar_add, a[i] + b[i])
+BATCH_SCALAR_BINARY(__scalar_sub, a[i] - b[i])
+BATCH_SCALAR_BINARY(__scalar_shl, a[i] << (b[i] & 63))
+BATCH_SCALAR_BINARY(__scalar_shr, a[i] >> (b[i] & 63))
+BATCH_SCALAR_BINARY(__scalar_and, a[i] & b[i])
+BATCH_SCALAR_BINARY(__scalar_xor, a[i] ^ b[i])
+BATCH_SCALAR_BINARY(__scalar_or, a[i] | b[i])
+
+static bool __scalar_neg(const struct program_op *op, uint64_t *dst,
+			 const uint64_t *const *args, size_t lanes)
+{
+	for (size_t i = 0; i < lanes; i++)
+		dst[i] = -args[0][i];
+	return false;
+}
+
+static bool __scalar_not(const struct program_op *op, uint64_t *dst,
+			 const uint64_t *const *args, size_t lanes)
+{
+	for (size_t i = 0; i < lanes; i++)
+		dst[i] = ~args[0][i];
+	return false;
+}
+
+// No ISA bmath targets can divide 64-bit integer vectors, so every level
+// shares these.
+bool batch_div(const struct program_op *op, uint64_t *dst,
+	       const uint64_t *const *args, size_t lanes)
+{
+	const uint64_t *a = args[0], *b = args[1];
+	bool fault = false;
+
+	for (size_t i = 0; i < lanes; i++) {
+		fault |= b[i] == 0;
+		dst[i] = b[i] ? a[i] / b[i] : 0;
+	}
+
+	return fault;
+}
+
+bool batch_mod(const struct program_op *op, uint64_t *dst,
+	       const uint64_t *const *args, size_t lanes)
+{
+	const uint64_t *a = args[0], *b = args[1];
+	bool fault = false;
+
+	for (size_t i = 0; i < lanes; i++) {
+		fault |= b[i] == 0;
+		dst[i] = b[i] ? a[i] % b[i] : 0;
+	}
+
+	return fault;
+}
+
+bool batch_call(const struct program_op *op, uint64_t *dst,
+		const uint64_t *const *args, size_t lanes)
+{
+	uint64_t argv[FUNC_MAX_ARGC];
+	bool fault = false;
+
+	for (size_t i = 0; i < lanes; i++) {
+		for (uint8_t k = 0; k < op->argc; k++) {
+			argv[k] = args[k][i];
+		}
+
+		// builtins zero their result when they fail
+		fault |= func_call(&dst[i], op->imm, argv) != FUNC_ESUCCESS;
+	}
+
+	return fault;
+}
+
+static const struct batch_kernels batch_kernels_scalar = {
+	.level = BMATH_SIMD_SCALAR,
+	.ops = {
+		[OP_NEG] = __scalar_neg,
+		[OP_NOT] = __scalar_not,
+		[OP_MUL] = __scalar_mul,
+		[OP_DIV] = batch_div,
+		[OP_MOD] = batch_mod,
+		[OP_ADD] = __scalar_add,
+		[OP_SUB] = __scalar_sub,
+		[OP_SHL] = __scalar_shl,
+		[OP_SHR] = __scalar_shr,
+		[OP_AND] = __scalar_and,
+		[OP_XOR] = __scalar_xor,
+		[OP_OR] = __scalar_or,
+	},
+};
+
+#ifdef __x86_64__
+
+struct batch_features {
+	bool avx2;
+	bool avx512;
+	bool vpopcntdq;
+};
+
+static struct batch_features __detect_features()
+{
+	struct batch_features f = { 0 };
+	unsigned int eax, ebx, ecx, edx;
+	unsigned int xcr0_lo, xcr0_hi;
+	bool ymm, zmm;
+
+	if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx) || !(ecx & bit_OSXSAVE)) {
+		return f;
+	}
+
+	// the OS has to save the wider registers across context switches
+	__asm__("xgetbv" : "=a"(xcr0_lo), "=d"(xcr0_hi) : "c"(0));
+	ymm = (xcr0_lo & 0x06) == 0x06;
+	zmm = (xcr0_lo & 0xe6) == 0xe6;
+
+	if (!__get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx)) {
+		return f;
+	}
+
+	f.avx2 = ymm && (ebx & bit_AVX2);
+	f.avx512 = zmm && (ebx & bit_AVX512F) && (ebx & bit_AVX512DQ) &&
+		   (ebx & bit_AVX512CD) && (ebx & bit_AVX512BW);
+	f.vpopcntdq = f.avx512 && (ecx & bit_AVX512VPOPCNTDQ);
+	return f;
+}
+
+/*
+ * cpuid traps under virtualization and every parser_new() selects kernels,
+ * so the CPU is only asked once per process. Threads racing to ask first all
+ * store the same answer.
+ */
+#define FEATURES_KNOWN 0x8
+#define FEATURES_AVX2 0x1
+#define FEATURES_AVX512 0x2
+#define FEATURES_VPOPCNTDQ 0x4
+
+static struct batch_features __features()
+{
+	static _Atomic unsigned int known;
+	unsigned int bits = atomic_load_explicit(&known, memory_order_relaxed);
+	struct batch_features f;
+
+	if (!bits) {
+		f = __detect_features();
+		bits = FEATURES_KNOWN | (f.avx2 ? FEATURES_AVX2 : 0) |
+		       (f.avx512 ? FEATURES_AVX512 : 0) |
+		       (f.vpopcntdq ? FEATURES_VPOPCNTDQ : 0);
+		atomic_store_explicit(&known, bits, memory_order_relaxed);
+		return f;
+	}
+
+	f.avx2 = bits & FEATURES_AVX2;
+	f.avx512 = bits & FEATURES_AVX512;
+	f.vpopcntdq = bits & FEATURES_VPOPCNTDQ;
+	return f;
+}
+
+const struct batch_kernels *batch_select(enum bmath_simd cap)
+{
+	struct batch_features f = __features();
+
+	if (cap == BMATH_SIMD_AUTO) {
+		cap = BMATH_SIMD_AVX512;
+	}
+
+	if (cap >= BMATH_SIMD_AVX512 && f.vpopcntdq) {
+		return &batch_kernels_avx512_vpopcntdq;
+	}
+
+	if (cap >= BMATH_SIMD_AVX512 && f.avx512) {
+		return &batch_kernels_avx512;
+	}
+
+	if (cap >= BMATH_SIMD_AVX2 && f.avx2) {
+		return &batch_kernels_avx2;
+	}
+
+	return &batch_kernels_scalar;
+}
+
+#else
+
+const struct batch_kernels *batch_select(enum bmath_simd cap)
+{
+	return &batch_kernels_scalar;
+}
+
+#endif
+
+static batch_kernel_t __call_kernel(const struct batch_kernels *kernels,
+				    const struct program_op *op)
+{
+	batch_kernel_t kernel = NULL;
+
+	switch (op->imm) {
+	case FUNC_ALIGN:
+		kernel = kernels->align;
+		break;
+	case FUNC_ALIGN_DOWN:
+		kernel = kernels->align_down;
+		break;
+	case FUNC_BSWAP:
+		kernel = kernels->bswap;
+		break;
+	case FUNC_CLZ:
+		kernel = kernels->clz;
+		break;
+	case FUNC_CTZ:
+		kernel = kernels->ctz;
+		break;
+	case FUNC_MASK:
+		kernel = kernels->mask;
+		break;
+	case FUNC_POPCNT:
+		kernel = kernels->popcnt;
+		break;
+	}
+
+	return kernel ? kernel : batch_call;
+}
+
+/*
+ * Re-runs a block that faulted one input at a time. Padding lanes may have
+ * faulted on their own, so the block only fails if a real input does.
+ */
+static enum program_err __find_fault(const struct bmath_program *prog,
+				     const uint64_t *const *vars, size_t nvars,
+				     size_t base, size_t n, size_t *fault)
+{
+	uint64_t *stack, *bound, result;
+	enum func_err func_err;
+	enum program_err err = PROG_ESUCCESS;
+	size_t op;
+
+	stack = malloc(prog->max_depth * sizeof(*stack));
+	bound = malloc((nvars ? nvars : 1) * sizeof(*bound));
+	if (!stack || !bound) {
+		err = PROG_ENOMEM;
+		goto out;
+	}
+
+	for (size_t i = base; i < base + n; i++) {
+		for (size_t v = 0; v < nvars; v++) {
+			bound[v] = vars[v] ? vars[v][i] : 0;
+		}
+
+		err = program_run(prog, stack, bound, &result, &op, &func_err);
+		if (err) {
+			*fault = i;
+			break;
+		}
+	}
+
+out:
+	free(stack);
+	free(bound);
+	return err;
+}
+
+/*
+ * Literals never change between blocks, so each one gets a column that is
+ * filled once up front.
+ */
+static uint64_t *__broadcast_literals(const struct bmath_program *prog,
+				      const uint64_t **literals)
+{
+	uint64_t *cols, *col;
+	size_t n = 0;
+
+	for (size_t i = 0; i < prog->len; i++) {
+		n += prog->ops[i].code == OP_PUSH;
+	}
+
+	cols = aligned_alloc(64, (n ? n : 1) * BATCH_LANES * sizeof(*cols));
+	if (!cols) {
+		return NULL;
+	}
+
+	col = cols;
+	for (size_t i = 0; i < prog->len; i++) {
+		if (prog->ops[i].code != OP_PUSH)
+			continue;
+
+		for (size_t l = 0; l < BATCH_LANES; l++)
+			col[l] = prog->ops[i].imm;
+		literals[i] = col;
+		col += BATCH_LANES;
+	}
+
+	return cols;
+}
+
+enum program_err batch_run(const struct batch_kernels *kernels,
+			   const struct bmath_program *prog,
+			   const uint64_t *const *vars, size_t nvars,
+			   uint64_t *out, size_t count, size_t *fault,
+			   struct batch_stats *stats)
+{
+	static const uint64_t zeros[BATCH_LANES] = { 0 };
+	const struct program_op *op;
+	batch_kernel_t *plan;
+	const uint64_t **slots, **literals, **inputs;
+	enum program_err err = PROG_ESUCCESS;
+	uint64_t *stack, *consts = NULL, *padded, *dst;
+	size_t n, lanes, depth;
+	bool faulted;
+
+	plan = malloc(prog->len * sizeof(*plan));
+	literals = malloc(prog->len * sizeof(*literals));
+	slots = malloc(prog->max_depth * sizeof(*slots));
+	inputs = malloc((nvars ? nvars : 1) * sizeof(*inputs));
+	// one column per stack slot, plus one per variable for the tail block
+	stack = aligned_alloc(64, (prog->max_depth + nvars) * BATCH_LANES *
+					  sizeof(*stack));
+	if (plan && literals && slots && inputs && stack) {
+		consts = __broadcast_literals(prog, literals);
+	}
+
+	if (!consts) {
+		err = PROG_ENOMEM;
+		goto out;
+	}
+
+	padded = stack + prog->max_depth * BATCH_LANES;
+
+	// resolve kernels once instead of once per block
+	for (size_t i = 0; i < prog->len; i++) {
+		op = &prog->ops[i];
+		if (op->code == OP_CALL) {
+			plan[i] = __call_kernel(kernels, op);
+		} else if (op->code < OP_CALL) {
+			plan[i] = kernels->ops[op->code];
+		}
+	}
+
+	for (size_t base = 0; base < count; base += BATCH_LANES) {
+		n = count - base < BATCH_LANES ? count - base : BATCH_LANES;
+		// Vector kernels always work on whole registers. The padding
+		// lanes are zeroed inputs, so they are well-defined but ignored.
+		lanes = (n + BATCH_VECTOR_LANES - 1) & ~(BATCH_VECTOR_LANES - 1);
+		depth = 0;
+		faulted = false;
+
+		for (size_t v = 0; v < nvars; v++) {
+			inputs[v] = vars[v] ? vars[v] + base : zeros;
+			if (vars[v] && n < BATCH_LANES) {
+				memset(padded + v * BATCH_LANES, 0,
+				       BATCH_LANES * sizeof(*padded));
+				memcpy(padded + v * BATCH_LANES, inputs[v],
+				       n * sizeof(*padded));
+				inputs[v] = padded + v * BATCH_LANES;
+			}
+		}
+
+		for (size_t i = 0; i < prog->len; i++) {
+			op = &prog->ops[i];
+			switch (op->code) {
+			case OP_PUSH:
+				slots[depth++] = literals[i];
+				continue;
+			case OP_VAR:
+				slots[depth++] = inputs[op->imm];
+				continue;
+			case OP_NEG:
+			case OP_NOT:
+				depth -= 1;
+				break;
+			case OP_CALL:
+				depth -= op->argc;
+				break;
+			default:
+				depth -= 2;
+				break;
+			}
+
+			// full blocks write the last op straight to the output
+			dst = stack + depth * BATCH_LANES;
+			if (i == prog->len - 1 && n == BATCH_LANES)
+				dst = out + base;
+
+			faulted |= plan[i](op, dst, slots + depth, lanes);
+			slots[depth++] = dst;
+
+			if (stats) {
+				stats->dispatches++;
+				stats->lane_ops += n;
+			}
+		}
+
+		if (unlikely(faulted)) {
+			err = __find_fault(prog, vars, nvars, base, n, fault);
+			// inputs before the fault still get their results
+			if (err == PROG_ENOMEM)
+				break;
+			if (err)
+				n = *fault - base;
+		}
+
+		if (slots[0] != out + base)
+			memcpy(out + base, slots[0], n * sizeof(*out));
+		if (err)
+			break;
+	}
+
+out:
+	free(plan);
+	free(literals);
+	free(slots);
+	free(inputs);
+	free(stack);
+	free(consts);
+	return err;
+}
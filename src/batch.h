@@ -0,0 +1,87 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "parser.h"
+#include "program.h"
+
+/*
+ * Batch evaluation runs one program over many inputs a block at a time. Each
+ * value on the stack is a column of BATCH_LANES values, so each op is
+ * dispatched once per block and its kernel works on whole columns. Literals
+ * are broadcast into their own columns once per batch and variables are read
+ * straight from the caller's arrays.
+ */
+#define BATCH_LANES 256
+// kernels may round the lane count up to this many, see batch_run()
+#define BATCH_VECTOR_LANES 8
+
+/*
+ * Applies an op to a block. dst may be the same column as args[0], so
+ * kernels must read a lane before writing it. Lanes that would fault are set
+ * to 0.
+ * @return true if any lane faulted
+ */
+typedef bool (*batch_kernel_t)(const struct program_op *op, uint64_t *dst,
+			       const uint64_t *const *args, size_t lanes);
+
+/*
+ * A kernel for every operator, indexed by opcode, and for the builtins that
+ * have a vector version. Missing builtins fall back to calling the scalar
+ * function lane by lane.
+ */
+struct batch_kernels {
+	enum bmath_simd level;
+	batch_kernel_t ops[OP_CALL];
+	batch_kernel_t align;
+	batch_kernel_t align_down;
+	batch_kernel_t bswap;
+	batch_kernel_t clz;
+	batch_kernel_t ctz;
+	batch_kernel_t mask;
+	batch_kernel_t popcnt;
+};
+
+/**
+ * Pick the widest kernels the CPU supports, but no wider than the cap.
+ * BMATH_SIMD_AUTO means no cap.
+ */
+const struct batch_kernels *batch_select(enum bmath_simd cap);
+
+struct batch_stats {
+	// kernel calls, one per op per block
+	size_t dispatches;
+	// inputs those calls were applied to, not counting padding
+	size_t lane_ops;
+};
+
+/**
+ * Evaluate a program for count inputs.
+ * @param const uint64_t *const *vars One input array per variable index an
+ *        OP_VAR may refer to. A NULL array reads as zero
+ * @param size_t nvars Length of vars
+ * @param size_t *fault Index of the first input that faulted
+ * @param struct batch_stats *stats Optional, accumulated into
+ * @return PROG_ESUCCESS, PROG_ENOMEM, or the program_err of the faulting
+ *         input
+ */
+enum program_err batch_run(const struct batch_kernels *kernels,
+			   const struct bmath_program *prog,
+			   const uint64_t *const *vars, size_t nvars,
+			   uint64_t *out, size_t count, size_t *fault,
+			   struct batch_stats *stats);
+
+bool batch_call(const struct program_op *op, uint64_t *dst,
+		const uint64_t *const *args, size_t lanes);
+bool batch_div(const struct program_op *op, uint64_t *dst,
+	       const uint64_t *const *args, size_t lanes);
+bool batch_mod(const struct program_op *op, uint64_t *dst,
+	       const uint64_t *const *args, size_t lanes);
+
+#ifdef __x86_64__
+extern const struct batch_kernels batch_kernels_avx2;
+extern const struct batch_kernels batch_kernels_avx512;
+extern const struct batch_kernels batch_kernels_avx512_vpopcntdq;
+#endif
@@ -0,0 +1,274 @@
+#ifdef __x86_64__
+
+#include <immintrin.h>
+#include <stdint.h>
+
+#include "batch.h"
+#include "program.h"
+
+/*
+ * AVX2 kernels, four lanes per register. AVX2 has no 64-bit multiply,
+ * leading zero count or popcount, so those are built out of narrower
+ * operations.
+ */
+
+#define AVX2 __attribute__((target("avx2")))
+#define AVX2_LANES 4
+
+static inline AVX2 __m256i __load(const uint64_t *p)
+{
+	return _mm256_loadu_si256((const __m256i *)p);
+}
+
+static inline AVX2 void __store(uint64_t *p, __m256i v)
+{
+	_mm256_storeu_si256((__m256i *)p, v);
+}
+
+static inline AVX2 __m256i __mullo(__m256i a, __m256i b)
+{
+	__m256i lo = _mm256_mul_epu32(a, b);
+	__m256i cross = _mm256_add_epi64(
+		_mm256_mul_epu32(_mm256_srli_epi64(a, 32), b),
+		_mm256_mul_epu32(a, _mm256_srli_epi64(b, 32)));
+
+	return _mm256_add_epi64(lo, _mm256_slli_epi64(cross, 32));
+}
+
+// nibble lookup, summed per 64-bit lane by vpsadbw
+static inline AVX2 __m256i __popcnt(__m256i v)
+{
+	const __m256i lut = _mm256_setr_epi8(0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2,
+					     3, 2, 3, 3, 4, 0, 1, 1, 2, 1, 2,
+					     2, 3, 1, 2, 2, 3, 2, 3, 3, 4);
+	const __m256i nibble = _mm256_set1_epi8(0x0f);
+	__m256i lo = _mm256_and_si256(v, nibble);
+	__m256i hi = _mm256_and_si256(_mm256_srli_epi16(v, 4), nibble);
+	__m256i cnt = _mm256_add_epi8(_mm256_shuffle_epi8(lut, lo),
+				      _mm256_shuffle_epi8(lut, hi));
+
+	return _mm256_sad_epu8(cnt, _mm256_setzero_si256());
+}
+
+// smear the highest set bit down, then count what is left
+static inline AVX2 __m256i __lzcnt(__m256i v)
+{
+	v = _mm256_or_si256(v, _mm256_srli_epi64(v, 1));
+	v = _mm256_or_si256(v, _mm256_srli_epi64(v, 2));
+	v = _mm256_or_si256(v, _mm256_srli_epi64(v, 4));
+	v = _mm256_or_si256(v, _mm256_srli_epi64(v, 8));
+	v = _mm256_or_si256(v, _mm256_srli_epi64(v, 16));
+	v = _mm256_or_si256(v, _mm256_srli_epi64(v, 32));
+
+	return _mm256_sub_epi64(_mm256_set1_epi64x(64), __popcnt(v));
+}
+
+// AVX2 only compares signed 64-bit lanes
+static inline AVX2 __m256i __cmpgt_epu64(__m256i a, __m256i b)
+{
+	const __m256i sign = _mm256_set1_epi64x(INT64_MIN);
+
+	return _mm256_cmpgt_epi64(_mm256_xor_si256(a, sign),
+				  _mm256_xor_si256(b, sign));
+}
+
+#define AVX2_BINARY(name, expr)                                              \
+	static AVX2 bool name(const struct program_op *op, uint64_t *dst,    \
+			      const uint64_t *const *args, size_t lanes)     \
+	{                                                                    \
+		for (size_t i = 0; i < lanes; i += AVX2_LANES) {             \
+			__m256i a = __load(args[0] + i);                     \
+			__m256i b = __load(args[1] + i);                     \
+			__store(dst + i, (expr));                            \
+		}                                                            \
+		return false;                                                \
+	}
+
+AVX2_BINARY(__avx2_mul, __mullo(a, b))
+AVX2_BINARY(__avx2_add, _mm256_add_epi64(a, b))
+AVX2_BINARY(__avx2_sub, _mm256_sub_epi64(a, b))
+AVX2_BINARY(__avx2_shl,
+	    _mm256_sllv_epi64(a, _mm256_and_si256(b, _mm256_set1_epi64x(63))))
+AVX2_BINARY(__avx2_shr,
+	    _mm256_srlv_epi64(a, _mm256_and_si256(b, _mm256_set1_epi64x(63))))
+AVX2_BINARY(__avx2_and, _mm256_and_si256(a, b))
+AVX2_BINARY(__avx2_xor, _mm256_xor_si256(a, b))
+AVX2_BINARY(__avx2_or, _mm256_or_si256(a, b))
+// (x + a - 1) & ~(a - 1)
+AVX2_BINARY(__avx2_align,
+	    _mm256_andnot_si256(
+		    _mm256_sub_epi64(b, _mm256_set1_epi64x(1)),
+		    _mm256_add_epi64(a, _mm256_sub_epi64(
+						b, _mm256_set1_epi64x(1)))))
+AVX2_BINARY(__avx2_align_down,
+	    _mm256_andnot_si256(_mm256_sub_epi64(b, _mm256_set1_epi64x(1)),
+				a))
+
+static AVX2 bool __avx2_neg(const struct program_op *op, uint64_t *dst,
+			    const uint64_t *const *args, size_t lanes)
+{
+	for (size_t i = 0; i < lanes; i += AVX2_LANES) {
+		__store(dst + i, _mm256_sub_epi64(_mm256_setzero_si256(),
+						   __load(args[0] + i)));
+	}
+	return false;
+}
+
+static AVX2 bool __avx2_not(const struct program_op *op, uint64_t *dst,
+			    const uint64_t *const *args, size_t lanes)
+{
+	for (size_t i = 0; i < lanes; i += AVX2_LANES) {
+		__store(dst + i, _mm256_xor_si256(__load(args[0] + i),
+						   _mm256_set1_epi64x(-1)));
+	}
+	return false;
+}
+
+static AVX2 bool __avx2_popcnt(const struct program_op *op, uint64_t *dst,
+			       const uint64_t *const *args, size_t lanes)
+{
+	for (size_t i = 0; i < lanes; i += AVX2_LANES) {
+		__store(dst + i, __popcnt(__load(args[0] + i)));
+	}
+	return false;
+}
+
+// ctz(x) == popcnt((x & -x) - 1), and bmath defines ctz(0) as 0
+static AVX2 bool __avx2_ctz(const struct program_op *op, uint64_t *dst,
+			    const uint64_t *const *args, size_t lanes)
+{
+	const __m256i zero = _mm256_setzero_si256();
+	__m256i x, low;
+
+	for (size_t i = 0; i < lanes; i += AVX2_LANES) {
+		x = __load(args[0] + i);
+		low = _mm256_and_si256(x, _mm256_sub_epi64(zero, x));
+		low = __popcnt(_mm256_sub_epi64(low, _mm256_set1_epi64x(1)));
+		__store(dst + i,
+			_mm256_andnot_si256(_mm256_cmpeq_epi64(x, zero), low));
+	}
+	return false;
+}
+
+/*
+ * The leading zeros counted within the low `bytes` bytes. Out of range
+ * widths and values that don't fit in the width fault.
+ */
+static AVX2 bool __avx2_clz(const struct program_op *op, uint64_t *dst,
+			    const uint64_t *const *args, size_t lanes)
+{
+	const __m256i zero = _mm256_setzero_si256();
+	const __m256i one = _mm256_set1_epi64x(1);
+	__m256i x, bytes, bad_width, is_zero, unused, zeros, fault;
+	__m256i faults = zero;
+
+	for (size_t i = 0; i < lanes; i += AVX2_LANES) {
+		x = __load(args[0] + i);
+		bytes = __load(args[1] + i);
+
+		bad_width = __cmpgt_epu64(_mm256_sub_epi64(bytes, one),
+					  _mm256_set1_epi64x(7));
+		is_zero = _mm256_cmpeq_epi64(x, zero);
+		// bits above the width, 64 - bytes * 8
+		unused = _mm256_sub_epi64(_mm256_set1_epi64x(64),
+					  _mm256_slli_epi64(bytes, 3));
+		zeros = __lzcnt(x);
+
+		fault = _mm256_andnot_si256(is_zero,
+					    _mm256_cmpgt_epi64(unused, zeros));
+		fault = _mm256_or_si256(fault, bad_width);
+		faults = _mm256_or_si256(faults, fault);
+
+		__store(dst + i,
+			_mm256_andnot_si256(_mm256_or_si256(fault, is_zero),
+					    _mm256_sub_epi64(zeros, unused)));
+	}
+
+	return !_mm256_testz_si256(faults, faults);
+}
+
+static AVX2 bool __avx2_mask(const struct program_op *op, uint64_t *dst,
+			     const uint64_t *const *args, size_t lanes)
+{
+	const __m256i ones = _mm256_set1_epi64x(-1);
+	__m256i bytes, fault, faults = _mm256_setzero_si256();
+
+	for (size_t i = 0; i < lanes; i += AVX2_LANES) {
+		bytes = __load(args[0] + i);
+		fault = __cmpgt_epu64(bytes, _mm256_set1_epi64x(8));
+		faults = _mm256_or_si256(faults, fault);
+
+		// shift counts of 64 produce 0, which makes mask(8) all ones
+		__store(dst + i,
+			_mm256_andnot_si256(
+				fault,
+				_mm256_xor_si256(
+					_mm256_sllv_epi64(
+						ones, _mm256_slli_epi64(bytes, 3)),
+					ones)));
+	}
+
+	return !_mm256_testz_si256(faults, faults);
+}
+
+/*
+ * Swaps 8, 4 or 2 bytes depending on how wide the value is. A full 64-bit
+ * swap shifted back down gives the narrower swaps.
+ */
+static AVX2 bool __avx2_bswap(const struct program_op *op, uint64_t *dst,
+			      const uint64_t *const *args, size_t lanes)
+{
+	const __m256i reverse =
+		_mm256_setr_epi8(7, 6, 5, 4, 3, 2, 1, 0, 15, 14, 13, 12, 11, 10,
+				 9, 8, 7, 6, 5, 4, 3, 2, 1, 0, 15, 14, 13, 12,
+				 11, 10, 9, 8);
+	const __m256i zero = _mm256_setzero_si256();
+	__m256i x, wide32, wide16, wide8, shift;
+
+	for (size_t i = 0; i < lanes; i += AVX2_LANES) {
+		x = __load(args[0] + i);
+		wide32 = _mm256_cmpeq_epi64(_mm256_srli_epi64(x, 32), zero);
+		wide16 = _mm256_cmpeq_epi64(_mm256_srli_epi64(x, 16), zero);
+		wide8 = _mm256_cmpeq_epi64(_mm256_srli_epi64(x, 8), zero);
+
+		// 0 for 64-bit values, 32 for 32-bit, 48 for 16-bit
+		shift = _mm256_and_si256(wide32, _mm256_set1_epi64x(32));
+		shift = _mm256_add_epi64(
+			shift,
+			_mm256_and_si256(wide16, _mm256_set1_epi64x(16)));
+
+		__store(dst + i,
+			_mm256_blendv_epi8(
+				_mm256_srlv_epi64(
+					_mm256_shuffle_epi8(x, reverse), shift),
+				x, wide8));
+	}
+	return false;
+}
+
+const struct batch_kernels batch_kernels_avx2 = {
+	.level = BMATH_SIMD_AVX2,
+	.ops = {
+		[OP_NEG] = __avx2_neg,
+		[OP_NOT] = __avx2_not,
+		[OP_MUL] = __avx2_mul,
+		[OP_DIV] = batch_div,
+		[OP_MOD] = batch_mod,
+		[OP_ADD] = __avx2_add,
+		[OP_SUB] = __avx2_sub,
+		[OP_SHL] = __avx2_shl,
+		[OP_SHR] = __avx2_shr,
+		[OP_AND] = __avx2_and,
+		[OP_XOR] = __avx2_xor,
+		[OP_OR] = __avx2_or,
+	},
+	.align = __avx2_align,
+	.align_down = __avx2_align_down,
+	.bswap = __avx2_bswap,
+	.clz = __avx2_clz,
+	.ctz = __avx2_ctz,
+	.mask = __avx2_mask,
+	.popcnt = __avx2_popcnt,
+};
+
+#endif
@@ -0,0 +1,262 @@
+#ifdef __x86_64__
+
+#include <immintrin.h>
+#include <stdint.h>
+
+#include "batch.h"
+#include "program.h"
+
+/*
+ * AVX-512 kernels, eight lanes per register. F, DQ, CD and BW provide a
+ * native 64-bit multiply, leading zero count and unsigned compares. Popcount
+ * uses VPOPCNTDQ when the CPU has it and a nibble lookup otherwise, so there
+ * are two kernel tables.
+ */
+
+#define AVX512 __attribute__((target("avx512f,avx512dq,avx512cd,avx512bw")))
+#define AVX512_POPCNT                                                        \
+	__attribute__((target(                                               \
+		"avx512f,avx512dq,avx512cd,avx512bw,avx512vpopcntdq")))
+#define AVX512_LANES 8
+
+static inline AVX512 __m512i __load(const uint64_t *p)
+{
+	return _mm512_loadu_si512(p);
+}
+
+static inline AVX512 void __store(uint64_t *p, __m512i v)
+{
+	_mm512_storeu_si512(p, v);
+}
+
+static inline AVX512 __m512i __popcnt(__m512i v)
+{
+	const __m512i lut = _mm512_broadcast_i32x4(
+		_mm_setr_epi8(0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4));
+	const __m512i nibble = _mm512_set1_epi8(0x0f);
+	__m512i lo = _mm512_and_si512(v, nibble);
+	__m512i hi = _mm512_and_si512(_mm512_srli_epi16(v, 4), nibble);
+	__m512i cnt = _mm512_add_epi8(_mm512_shuffle_epi8(lut, lo),
+				      _mm512_shuffle_epi8(lut, hi));
+
+	return _mm512_sad_epu8(cnt, _mm512_setzero_si512());
+}
+
+#define AVX512_BINARY(name, expr)                                            \
+	static AVX512 bool name(const struct program_op *op, uint64_t *dst,  \
+				const uint64_t *const *args, size_t lanes)   \
+	{                                                                    \
+		for (size_t i = 0; i < lanes; i += AVX512_LANES) {           \
+			__m512i a = __load(args[0] + i);                     \
+			__m512i b = __load(args[1] + i);                     \
+			__store(dst + i, (expr));                            \
+		}                                                            \
+		return false;                                                \
+	}
+
+AVX512_BINARY(__avx512_mul, _mm512_mullo_epi64(a, b))
+AVX512_BINARY(__avx512_add, _mm512_add_epi64(a, b))
+AVX512_BINARY(__avx512_sub, _mm512_sub_epi64(a, b))
+AVX512_BINARY(__avx512_shl,
+	      _mm512_sllv_epi64(a, _mm512_and_si512(b, _mm512_set1_epi64(63))))
+AVX512_BINARY(__avx512_shr,
+	      _mm512_srlv_epi64(a, _mm512_and_si512(b, _mm512_set1_epi64(63))))
+AVX512_BINARY(__avx512_and, _mm512_and_si512(a, b))
+AVX512_BINARY(__avx512_xor, _mm512_xor_si512(a, b))
+AVX512_BINARY(__avx512_or, _mm512_or_si512(a, b))
+// (x + a - 1) & ~(a - 1)
+AVX512_BINARY(__avx512_align,
+	      _mm512_andnot_si512(
+		      _mm512_sub_epi64(b, _mm512_set1_epi64(1)),
+		      _mm512_add_epi64(a, _mm512_sub_epi64(
+						  b, _mm512_set1_epi64(1)))))
+AVX512_BINARY(__avx512_align_down,
+	      _mm512_andnot_si512(_mm512_sub_epi64(b, _mm512_set1_epi64(1)),
+				  a))
+
+static AVX512 bool __avx512_neg(const struct program_op *op, uint64_t *dst,
+				const uint64_t *const *args, size_t lanes)
+{
+	for (size_t i = 0; i < lanes; i += AVX512_LANES) {
+		__store(dst + i, _mm512_sub_epi64(_mm512_setzero_si512(),
+						   __load(args[0] + i)));
+	}
+	return false;
+}
+
+static AVX512 bool __avx512_not(const struct program_op *op, uint64_t *dst,
+				const uint64_t *const *args, size_t lanes)
+{
+	for (size_t i = 0; i < lanes; i += AVX512_LANES) {
+		// 0x55 is the truth table for ~a
+		__store(dst + i,
+			_mm512_ternarylogic_epi64(__load(args[0] + i),
+						  __load(args[0] + i),
+						  __load(args[0] + i), 0x55));
+	}
+	return false;
+}
+
+static AVX512 bool __avx512_popcnt(const struct program_op *op, uint64_t *dst,
+				   const uint64_t *const *args, size_t lanes)
+{
+	for (size_t i = 0; i < lanes; i += AVX512_LANES) {
+		__store(dst + i, __popcnt(__load(args[0] + i)));
+	}
+	return false;
+}
+
+static AVX512_POPCNT bool __avx512_vpopcnt(const struct program_op *op,
+					   uint64_t *dst,
+					   const uint64_t *const *args,
+					   size_t lanes)
+{
+	for (size_t i = 0; i < lanes; i += AVX512_LANES) {
+		__store(dst + i, _mm512_popcnt_epi64(__load(args[0] + i)));
+	}
+	return false;
+}
+
+// ctz(x) == 63 - lzcnt(x & -x), and bmath defines ctz(0) as 0
+static AVX512 bool __avx512_ctz(const struct program_op *op, uint64_t *dst,
+				const uint64_t *const *args, size_t lanes)
+{
+	const __m512i zero = _mm512_setzero_si512();
+	__m512i x, low;
+	__mmask8 nonzero;
+
+	for (size_t i = 0; i < lanes; i += AVX512_LANES) {
+		x = __load(args[0] + i);
+		nonzero = _mm512_test_epi64_mask(x, x);
+		low = _mm512_and_si512(x, _mm512_sub_epi64(zero, x));
+		__store(dst + i,
+			_mm512_maskz_sub_epi64(nonzero, _mm512_set1_epi64(63),
+					       _mm512_lzcnt_epi64(low)));
+	}
+	return false;
+}
+
+/*
+ * The leading zeros counted within the low `bytes` bytes. Out of range
+ * widths and values that don't fit in the width fault.
+ */
+static AVX512 bool __avx512_clz(const struct program_op *op, uint64_t *dst,
+				const uint64_t *const *args, size_t lanes)
+{
+	__m512i x, bytes, unused, zeros;
+	__mmask8 ok, fault, faults = 0;
+
+	for (size_t i = 0; i < lanes; i += AVX512_LANES) {
+		x = __load(args[0] + i);
+		bytes = __load(args[1] + i);
+
+		// 1 <= bytes <= 8
+		ok = _mm512_cmple_epu64_mask(
+			_mm512_sub_epi64(bytes, _mm512_set1_epi64(1)),
+			_mm512_set1_epi64(7));
+		// bits above the width, 64 - bytes * 8
+		unused = _mm512_sub_epi64(_mm512_set1_epi64(64),
+					  _mm512_slli_epi64(bytes, 3));
+		zeros = _mm512_lzcnt_epi64(x);
+
+		fault = ~ok | (_mm512_test_epi64_mask(x, x) &
+			       _mm512_cmplt_epi64_mask(zeros, unused));
+		faults |= fault;
+
+		__store(dst + i,
+			_mm512_maskz_sub_epi64(
+				~fault & _mm512_test_epi64_mask(x, x), zeros,
+				unused));
+	}
+
+	return faults;
+}
+
+static AVX512 bool __avx512_mask(const struct program_op *op, uint64_t *dst,
+				 const uint64_t *const *args, size_t lanes)
+{
+	const __m512i ones = _mm512_set1_epi64(-1);
+	__m512i bytes;
+	__mmask8 fault, faults = 0;
+
+	for (size_t i = 0; i < lanes; i += AVX512_LANES) {
+		bytes = __load(args[0] + i);
+		fault = _mm512_cmpgt_epu64_mask(bytes, _mm512_set1_epi64(8));
+		faults |= fault;
+
+		// shift counts of 64 produce 0, which makes mask(8) all ones
+		__store(dst + i,
+			_mm512_maskz_xor_epi64(
+				~fault,
+				_mm512_sllv_epi64(ones,
+						  _mm512_slli_epi64(bytes, 3)),
+				ones));
+	}
+
+	return faults;
+}
+
+/*
+ * Swaps 8, 4 or 2 bytes depending on how wide the value is. A full 64-bit
+ * swap shifted back down gives the narrower swaps.
+ */
+static AVX512 bool __avx512_bswap(const struct program_op *op, uint64_t *dst,
+				  const uint64_t *const *args, size_t lanes)
+{
+	const __m512i reverse = _mm512_broadcast_i32x4(_mm_setr_epi8(
+		7, 6, 5, 4, 3, 2, 1, 0, 15, 14, 13, 12, 11, 10, 9, 8));
+	__m512i x, shift;
+	__mmask8 wide32, wide16, wide8;
+
+	for (size_t i = 0; i < lanes; i += AVX512_LANES) {
+		x = __load(args[0] + i);
+		wide32 = _mm512_cmple_epu64_mask(x, _mm512_set1_epi64(UINT32_MAX));
+		wide16 = _mm512_cmple_epu64_mask(x, _mm512_set1_epi64(UINT16_MAX));
+		wide8 = _mm512_cmple_epu64_mask(x, _mm512_set1_epi64(UINT8_MAX));
+
+		// 0 for 64-bit values, 32 for 32-bit, 48 for 16-bit
+		shift = _mm512_maskz_mov_epi64(wide32, _mm512_set1_epi64(32));
+		shift = _mm512_mask_mov_epi64(shift, wide16,
+					      _mm512_set1_epi64(48));
+
+		__store(dst + i,
+			_mm512_mask_mov_epi64(
+				_mm512_srlv_epi64(
+					_mm512_shuffle_epi8(x, reverse), shift),
+				wide8, x));
+	}
+	return false;
+}
+
+#define AVX512_KERNELS(popcnt_kernel)                                        \
+	{                                                                    \
+		.level = BMATH_SIMD_AVX512,                                  \
+		.ops = {                                                     \
+			[OP_NEG] = __avx512_neg,                             \
+			[OP_NOT] = __avx512_not,                             \
+			[OP_MUL] = __avx512_mul,                             \
+			[OP_DIV] = batch_div,                                \
+			[OP_MOD] = batch_mod,                                \
+			[OP_ADD] = __avx512_add,                             \
+			[OP_SUB] = __avx512_sub,                             \
+			[OP_SHL] = __avx512_shl,                             \
+			[OP_SHR] = __avx512_shr,                             \
+			[OP_AND] = __avx512_and,                             \
+			[OP_XOR] = __avx512_xor,                             \
+			[OP_OR] = __avx512_or,                               \
+		},                                                           \
+		.align = __avx512_align,                                     \
+		.align_down = __avx512_align_down,                           \
+		.bswap = __avx512_bswap,                                     \
+		.clz = __avx512_clz,                                         \
+		.ctz = __avx512_ctz,                                         \
+		.mask = __avx512_mask,                                       \
+		.popcnt = popcnt_kernel,                                     \
+	}
+
+const struct batch_kernels batch_kernels_avx512 =
+	AVX512_KERNELS(__avx512_popcnt);
+const struct batch_kernels batch_kernels_avx512_vpopcntdq =
+	AVX512_KERNELS(__avx512_vpopcnt);
+
+#endif
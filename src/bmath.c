@@ -1,3 +1,8 @@
+// getline(), O_CLOEXEC. The readline flags from pkg-config may set it too.
+#ifndef _DEFAULT_SOURCE
+#define _DEFAULT_SOURCE
+#endif
+
 #include <argp.h>
 #include <fcntl.h>
 #include <locale.h>
@@ -32,17 +37,36 @@ static char *watch_file = NULL;
 static FILE *err_stream;
 static FILE *out_stream;
 
-#define P_MAX_EXP_LEN 512
-
 struct parse_expression {
 	const char *expr;
 	size_t len;
 };
 
+/*
+ * Failing lines counted by what went wrong, for --error-summary. Parse errors
+ * are told apart by their bmath_error_code, everything else by its PE_* code.
+ */
+struct error_summary {
+	size_t lines;
+	size_t failed;
+	size_t parse[BMATH_EEVAL + 1];
+	size_t other[PE_NO_MEMORY + 1];
+	// line of the first of each
+	size_t parse_first[BMATH_EEVAL + 1];
+	size_t other_first[PE_NO_MEMORY + 1];
+};
+
 struct execution_ctx {
 	struct parser_context *pctx;
+	struct print_context *print;
 	uint64_t alignment;
+	// limbs of a result, more than one with --width
+	size_t limbs;
+	uint64_t result[BMATH_WIDTH_MAX / 64];
 	bool print_expr;
+	// the context is quiet and errors are counted in errors
+	bool summarize;
+	struct error_summary errors;
 };
 
 static void _perror(FILE *stream, const char *fmt, ...)
@@ -50,7 +74,7 @@ static void _perror(FILE *stream, const char *fmt, ...)
 	int err = errno;
 	va_list args;
 	va_start(args, fmt);
-	fprintf(stream, fmt, args);
+	vfprintf(stream, fmt, args);
 	va_end(args);
 	fprintf(stream, ": %s\n", strerror(err));
 	// incase fprintf overwrites this, put it back
@@ -69,6 +93,114 @@ void execution_free(struct execution_ctx *ectx)
 		parser_free(ectx->pctx);
 		ectx->pctx = NULL;
 	}
+
+	print_free(ectx->print);
+	ectx->print = NULL;
+}
+
+static void print_eval_err(int err)
+{
+	switch (err) {
+	case PE_NOTHING_TO_PARSE:
+		// TODO: Add a means that when in watch or stream mode, this message
+		// only shows if there's litterally nothing to display
+		fputs("Nothing to parse.\n", err_stream);
+		break;
+	case PE_EXPRESSION_TOO_LONG:
+		fputs("Expression too long.\n", err_stream);
+		break;
+	case PE_PARSE_ERROR:
+		fputs("Parse error ocurred.\n", err_stream);
+		break;
+	default:
+		fputs("Unknown error ocurred.\n", err_stream);
+	}
+}
+
+static void count_error(struct execution_ctx *ectx, int err)
+{
+	struct error_summary *s = &ectx->errors;
+	enum bmath_error_code code;
+
+	s->failed++;
+	if (err == PE_PARSE_ERROR) {
+		code = parser_last_error(ectx->pctx)->code;
+		if (!s->parse[code]++)
+			s->parse_first[code] = s->lines;
+		return;
+	}
+
+	if (err < 0 || err > PE_NO_MEMORY)
+		err = 0;
+	if (!s->other[err]++)
+		s->other_first[err] = s->lines;
+}
+
+static const char *str_other_err(int err)
+{
+	switch (err) {
+	case PE_NOTHING_TO_PARSE:
+		return "Nothing to parse";
+	case PE_EXPRESSION_TOO_LONG:
+		return "Expression too long";
+	case PE_EVAL_ERROR:
+		return "Evaluation error";
+	case PE_NO_MEMORY:
+		return "Out of memory";
+	default:
+		return "Unknown error";
+	}
+}
+
+static void print_error_summary(struct execution_ctx *ectx)
+{
+	struct error_summary *s = &ectx->errors;
+	char msg[128];
+
+	fprintf(err_stream, "Errors: %zu of %zu lines failed\n", s->failed,
+		s->lines);
+
+	for (int code = 0; code <= BMATH_EEVAL; code++) {
+		if (!s->parse[code])
+			continue;
+		bmath_error_message(&(struct bmath_error){ .code = code }, msg,
+				    sizeof(msg));
+		fprintf(err_stream, "%10zu  %s, first on line %zu\n",
+			s->parse[code], msg, s->parse_first[code]);
+	}
+
+	for (int err = 0; err <= PE_NO_MEMORY; err++) {
+		if (!s->other[err])
+			continue;
+		fprintf(err_stream, "%10zu  %s, first on line %zu\n",
+			s->other[err], str_other_err(err), s->other_first[err]);
+	}
+}
+
+static void print_cache_stats(const struct bmath_cache_stats *s)
+{
+	if (s->capacity)
+		fprintf(err_stream,
+			"Cache: %zu hits, %zu misses, %zu evictions, %zu of %zu entries used\n",
+			s->hits, s->misses, s->evictions, s->entries,
+			s->capacity);
+	if (s->file_hits || s->file_misses)
+		fprintf(err_stream, "Cache file: %zu hits, %zu misses\n",
+			s->file_hits, s->file_misses);
+}
+
+static void print_cse_stats(const struct bmath_cse_stats *s)
+{
+	fprintf(err_stream,
+		"CSE: %zu ops, %zu computed, %zu shared with earlier lines, %.2fx dedup\n",
+		s->ops, s->computed, s->earlier_lines,
+		s->computed ? (double)s->ops / (double)s->computed : 1.0);
+}
+
+static void print_recalc_stats(const struct bmath_recalc_stats *s)
+{
+	fprintf(err_stream, "Recalc: %zu lines evaluated, %zu unchanged\n",
+		s->evaluated, s->reused);
 }
 
 static int _eval(struct parser_context *ctx,
@@ -78,56 +210,69 @@ static int _eval(struct parser_context *ctx,
 
 	err = parse(ctx, expr->expr, expr->len, out);
 	if (err) {
-		switch (err) {
-		case PE_NOTHING_TO_PARSE:
-			// TODO: Add a means that when in watch or stream mode, this message
-			// only shows if there's litterally nothing to display
-			fputs("Nothing to parse.\n", err_stream);
-			break;
-		case PE_EXPRESSION_TOO_LONG:
-			fputs("Expression too long.\n", err_stream);
-			break;
-		case PE_PARSE_ERROR:
-			fputs("Parse error ocurred.\n", err_stream);
-			break;
-		default:
-			fputs("Unknown error ocurred.\n", err_stream);
-		}
+		print_eval_err(err);
 	}
 
 	return err;
 }
 
-static int evaluate(struct execution_ctx *ectx, const char *expr, size_t len)
+/*
+ * Results wider than 64 bits are only printed in full, --align and --binary
+ * only apply to the ones that fit in 64.
+ */
+static void print_result(struct execution_ctx *ectx, const char *expr,
+			 size_t len, const uint64_t *output)
 {
-	int err;
-	uint64_t output = 0;
-
-	err = _eval(ectx->pctx, &(struct parse_expression){ expr, len },
-		    &output);
-	if (err) {
-		fputc('\n', err_stream);
-		flush_streams();
-		return err;
-	}
+	size_t wide = ectx->limbs;
 
 	if (ectx->print_expr) {
-		fprintf(out_stream, "%s\n", expr);
+		fwrite(expr, 1, len, out_stream);
+		fputc('\n', out_stream);
 	}
 
-	print_set_stream(out_stream);
-	print_number(output, uppercase_hex,
-		     (show_unicode) ? ENC_ALL : ENC_ASCII);
+	if (wide > 1) {
+		print_wide(ectx->print, output, wide, uppercase_hex);
+		while (wide > 1 && !output[wide - 1])
+			wide--;
+	} else {
+		print_number(ectx->print, output[0], uppercase_hex,
+			     (show_unicode) ? ENC_ALL : ENC_ASCII);
+	}
 
-	if (ectx->alignment) {
-		print_alignment(ectx->alignment, output, uppercase_hex);
+	if (ectx->alignment && wide == 1) {
+		print_alignment(ectx->print, ectx->alignment, output[0],
+				uppercase_hex);
 	}
 
-	if (show_binary) {
-		print_binary(output);
+	if (show_binary && wide == 1) {
+		print_binary(ectx->print, output[0]);
 	}
 
 	fputc('\n', out_stream);
+}
+
+static int evaluate(struct execution_ctx *ectx, const char *expr, size_t len)
+{
+	int err;
+
+	if (ectx->summarize)
+		ectx->errors.lines++;
+
+	// at 64 bits this is parse()
+	err = bmath_parse_wide(ectx->pctx, expr, len, ectx->result);
+	if (err && ectx->summarize) {
+		count_error(ectx, err);
+		return err;
+	}
+
+	if (err) {
+		print_eval_err(err);
+		fputc('\n', err_stream);
+		flush_streams();
+		return err;
+	}
+
+	print_result(ectx, expr, len, ectx->result);
 	flush_streams();
 	return err;
 }
@@ -159,57 +304,83 @@ static int do_readline(struct execution_ctx *ectx)
 	return EXIT_SUCCESS;
 }
 
+/*
+ * Lines are parsed straight out of the read buffer. Only a line that spans
+ * two reads is copied, into a buffer that grows to fit the longest one.
+ */
 static int read_file(struct execution_ctx *ectx, int fd)
 {
 #define BUF_SIZE 4096
+	char read_buff[BUF_SIZE];
+	struct bmath_cache_stats cache;
+	struct bmath_cse_stats sharing;
+	struct bmath_recalc_stats recalc;
 	ssize_t bytes_read = 0;
-	ssize_t expr_index = 0;
-	char expr[P_MAX_EXP_LEN] = { 0 };
+	size_t expr_index = 0, expr_cap = 0, n;
+	char *expr = NULL, *tmp, *line, *nl, *end;
+	int err = 0;
 
-	do {
-		char read_buff[BUF_SIZE] = { 0 };
-		ssize_t buff_index = 0;
+	ectx->print_expr = true;
+	ectx->errors = (struct error_summary){ 0 };
+	// names bound by the last read of the file don't carry over
+	parser_reset_symbols(ectx->pctx);
 
+	do {
 		bytes_read = read(fd, read_buff, sizeof(read_buff));
 		if (bytes_read < 0) {
 			_perror(err_stream, "Unable to read input line");
-			return EINVAL;
-		}
-
-		if (bytes_read == 0)
+			err = EINVAL;
 			break;
+		}
 
-		while (buff_index < bytes_read) {
-			if (unlikely(expr_index > P_MAX_EXP_LEN)) {
-				fputs("Attempted input buffer overflow. Skipping.\n",
-				      err_stream);
-				memset(expr, '\0', P_MAX_EXP_LEN);
-				expr_index = 0;
-				while (buff_index++ < bytes_read &&
-				       read_buff[buff_index] != '\n')
-					;
-				buff_index++;
+		line = read_buff;
+		end = read_buff + bytes_read;
+		while (line < end) {
+			nl = memchr(line, '\n', end - line);
+			if (nl && !expr_index) {
+				// ignore error handling for evaluate to keep program running
+				evaluate(ectx, line, nl - line);
+				line = nl + 1;
 				continue;
 			}
 
-			if (read_buff[buff_index] == '\n') {
-				ectx->print_expr = true;
-				// ignore error handling for evaluate to keep program running
-				evaluate(ectx, expr, expr_index);
-				memset(expr, '\0', expr_index);
-				expr_index = 0;
-				buff_index++;
-				continue;
+			// a line spanning reads is assembled in expr
+			n = (nl ? nl : end) - line;
+			if (unlikely(expr_index + n > expr_cap)) {
+				expr_cap = expr_cap ? expr_cap : BUF_SIZE;
+				while (expr_cap < expr_index + n)
+					expr_cap *= 2;
+				tmp = realloc(expr, expr_cap);
+				if (!tmp) {
+					fputs("Out of memory.\n", err_stream);
+					free(expr);
+					return ENOMEM;
+				}
+				expr = tmp;
 			}
 
-			expr[expr_index] = read_buff[buff_index];
-			expr_index++;
-			buff_index++;
-		}
+			memcpy(expr + expr_index, line, n);
+			expr_index += n;
+			if (!nl)
+				break;
 
+			evaluate(ectx, expr, expr_index);
+			expr_index = 0;
+			line = nl + 1;
+		}
 	} while (bytes_read > 0);
 
-	return 0;
+	if (ectx->summarize)
+		print_error_summary(ectx);
+	if (parser_cache_stats(ectx->pctx, &cache))
+		print_cache_stats(&cache);
+	if (parser_cse_stats(ectx->pctx, &sharing))
+		print_cse_stats(&sharing);
+	if (parser_recalc_stats(ectx->pctx, &recalc))
+		print_recalc_stats(&recalc);
+
+	free(expr);
+	return err;
 }
 
 static int do_stdin(struct execution_ctx *ectx)
@@ -225,6 +396,311 @@ static int do_stdin(struct execution_ctx *ectx)
 	return EXIT_SUCCESS;
 }
 
+/*
+ * Reads all of stdin and evaluates it with bmath_parse_batch(), which groups
+ * lines that only differ in their numbers and evaluates each group with SIMD.
+ * Like stdin mode, only newline terminated lines are evaluated and the output
+ * is the same, followed by a summary of the grouping on stderr.
+ */
+static int do_batch(struct execution_ctx *ectx)
+{
+	struct bmath_batch_stats stats;
+	struct bmath_cache_stats cache;
+	struct bmath_cse_stats sharing;
+	bool cached, shared;
+	char *buf = NULL, *tmp, *line, *nl;
+	char **lines = NULL;
+	size_t *lens = NULL;
+	uint64_t *results = NULL;
+	int *errs = NULL;
+	size_t len = 0, cap = 0, count = 0;
+	ssize_t bytes_read;
+	int exit = EXIT_FAILURE;
+
+	do {
+		if (cap - len < BUF_SIZE) {
+			cap = cap ? cap * 2 : BUF_SIZE * 16;
+			tmp = realloc(buf, cap);
+			if (!tmp) {
+				fputs("Out of memory.\n", err_stream);
+				goto out;
+			}
+			buf = tmp;
+		}
+
+		bytes_read = read(STDIN_FILENO, buf + len, cap - len);
+		if (bytes_read < 0) {
+			_perror(err_stream, "Unable to read input line");
+			goto out;
+		}
+		len += bytes_read;
+	} while (bytes_read > 0);
+
+	for (size_t i = 0; i < len; i++) {
+		count += buf[i] == '\n';
+	}
+
+	lines = malloc((count ? count : 1) * sizeof(*lines));
+	lens = malloc((count ? count : 1) * sizeof(*lens));
+	results = malloc((count ? count : 1) * sizeof(*results));
+	errs = malloc((count ? count : 1) * sizeof(*errs));
+	if (!lines || !lens || !results || !errs) {
+		fputs("Out of memory.\n", err_stream);
+		goto out;
+	}
+
+	line = buf;
+	for (size_t i = 0; i < count; i++) {
+		nl = memchr(line, '\n', buf + len - line);
+		lines[i] = line;
+		lens[i] = nl - line;
+		line = nl + 1;
+	}
+
+	if (bmath_parse_batch(ectx->pctx, (const char *const *)lines, lens,
+			      count, results, errs, &stats)) {
+		fputs("Out of memory.\n", err_stream);
+		goto out;
+	}
+	// before the lines counted for --error-summary are parsed again
+	cached = parser_cache_stats(ectx->pctx, &cache);
+	shared = parser_cse_stats(ectx->pctx, &sharing);
+
+	ectx->print_expr = true;
+	for (size_t i = 0; i < count; i++) {
+		ectx->errors.lines++;
+		if (errs[i] && ectx->summarize) {
+			// the error is only known for the line parsed last
+			if (errs[i] == PE_PARSE_ERROR)
+				parse(ectx->pctx, lines[i], lens[i], &results[i]);
+			count_error(ectx, errs[i]);
+			continue;
+		}
+
+		if (errs[i]) {
+			print_eval_err(errs[i]);
+			fputc('\n', err_stream);
+			continue;
+		}
+
+		print_result(ectx, lines[i], lens[i], &results[i]);
+	}
+
+	fprintf(err_stream,
+		"Batch: %zu lines, %zu shapes, %zu parsed one at a time, %.2f lanes per op\n",
+		count, stats.shapes, stats.parsed,
+		stats.op_dispatches ? (double)stats.lane_ops /
+					      (double)stats.op_dispatches :
+				      0.0);
+	if (ectx->summarize)
+		print_error_summary(ectx);
+	if (cached)
+		print_cache_stats(&cache);
+	if (shared)
+		print_cse_stats(&sharing);
+	exit = EXIT_SUCCESS;
+out:
+	flush_streams();
+	free(buf);
+	free(lines);
+	free(lens);
+	free(results);
+	free(errs);
+	execution_free(ectx);
+	return exit;
+}
+
+static const char *str_emit_err(int err)
+{
+	switch (err) {
+	case PE_NOTHING_TO_PARSE:
+		return "nothing to parse";
+	case PE_EXPRESSION_TOO_LONG:
+		return "expression too long";
+	case PE_PARSE_ERROR:
+		return "parse error";
+	case PE_EVAL_ERROR:
+		return "evaluation error";
+	case PE_NO_MEMORY:
+		return "out of memory";
+	default:
+		return "unknown error";
+	}
+}
+
+static void emit_c_string(FILE *out, const char *str, size_t len)
+{
+	fputc('"', out);
+	for (size_t i = 0; i < len; i++) {
+		if (str[i] == '"' || str[i] == '\\')
+			fputc('\\', out);
+		fputc(str[i], out);
+	}
+	fputc('"', out);
+}
+
+static int emit_c_line(struct execution_ctx *ectx, const char *expr,
+		       size_t len, size_t lineno, bool *has_vars)
+{
+	struct bmath_program *program;
+	char name[32];
+	uint64_t output;
+	int err;
+
+	err = bmath_compile(ectx->pctx, expr, len, &program);
+	if (err)
+		return err;
+
+	// Constant expressions that fault have no value to inline, leave them
+	// out. Whether an expression with variables faults depends on its
+	// inputs.
+	*has_vars = bmath_program_has_vars(program);
+	if (!*has_vars)
+		err = bmath_exec(ectx->pctx, program, &output);
+
+	if (!err) {
+		snprintf(name, sizeof(name), "bmath_expr_%zu", lineno);
+		err = bmath_emit_c(out_stream, program, name);
+	}
+
+	bmath_program_free(program);
+	return err;
+}
+
+/*
+ * Defines the function on each line of the file, skipping empty lines. The
+ * first definition that fails is reported and stops the program, since
+ * expressions that call it can't be evaluated.
+ */
+static int load_defs(struct execution_ctx *ectx, const char *path)
+{
+	FILE *in;
+	char *line = NULL;
+	size_t cap = 0, lineno = 0;
+	ssize_t len;
+	int err = 0;
+
+	in = fopen(path, "r");
+	if (!in) {
+		_perror(err_stream, "Unable to open definitions \"%s\"", path);
+		return EINVAL;
+	}
+
+	while ((len = getline(&line, &cap, in)) > 0) {
+		lineno++;
+		if (line[len - 1] == '\n')
+			line[--len] = '\0';
+
+		err = bmath_define(ectx->pctx, line, len);
+		if (err == PE_NOTHING_TO_PARSE) {
+			err = 0;
+			continue;
+		}
+
+		if (err) {
+			fprintf(err_stream, "Unable to define line %zu.\n",
+				lineno);
+			break;
+		}
+	}
+
+	free(line);
+	fclose(in);
+	return err;
+}
+
+/*
+ * Compiles each line of the file into a C function named after its line
+ * number. Lines that can't be compiled are reported and skipped. A table of
+ * the emitted functions without variables and their source expressions is
+ * appended, guarded by BMATH_EMIT_TABLE.
+ */
+static int do_emit_c(struct execution_ctx *ectx, const char *path)
+{
+	FILE *in;
+	char *line = NULL;
+	size_t cap = 0, lineno = 0, count = 0, next = 0;
+	size_t *emitted = NULL, *tmp;
+	ssize_t len;
+	bool has_vars;
+	int err, exit = EXIT_FAILURE;
+
+	in = fopen(path, "r");
+	if (!in) {
+		_perror(err_stream, "Unable to open file \"%s\"", path);
+		execution_free(ectx);
+		return EXIT_FAILURE;
+	}
+
+	bmath_emit_c_begin(out_stream);
+
+	while ((len = getline(&line, &cap, in)) > 0) {
+		lineno++;
+		if (line[len - 1] == '\n')
+			line[--len] = '\0';
+
+		err = emit_c_line(ectx, line, len, lineno, &has_vars);
+		if (err == PE_NOTHING_TO_PARSE)
+			continue;
+
+		if (err) {
+			fprintf(out_stream, "\n/* line %zu skipped: %s */\n",
+				lineno, str_emit_err(err));
+			fprintf(err_stream, "Skipping line %zu: %s.\n", lineno,
+				str_emit_err(err));
+			continue;
+		}
+
+		// the table only holds functions without parameters
+		if (has_vars)
+			continue;
+
+		if (count % 1024 == 0) {
+			tmp = realloc(emitted, (count + 1024) * sizeof(*emitted));
+			if (!tmp) {
+				fputs("Out of memory.\n", err_stream);
+				goto out;
+			}
+			emitted = tmp;
+		}
+		emitted[count++] = lineno;
+	}
+
+	// second pass pairs each emitted function with its source expression
+	fputs("\n#ifdef BMATH_EMIT_TABLE\n"
+	      "struct bmath_emit_entry {\n"
+	      "\tconst char *expr;\n"
+	      "\tuint64_t (*func)(void);\n"
+	      "};\n\n"
+	      "static const struct bmath_emit_entry bmath_emit_table[] = {\n",
+	      out_stream);
+
+	rewind(in);
+	lineno = 0;
+	while (next < count && (len = getline(&line, &cap, in)) > 0) {
+		if (++lineno != emitted[next])
+			continue;
+
+		if (line[len - 1] == '\n')
+			line[--len] = '\0';
+
+		fputs("\t{ ", out_stream);
+		emit_c_string(out_stream, line, len);
+		fprintf(out_stream, ", bmath_expr_%zu },\n", lineno);
+		next++;
+	}
+
+	fputs("\t{ 0, 0 },\n};\n#endif\n", out_stream);
+	exit = EXIT_SUCCESS;
+out:
+	free(emitted);
+	free(line);
+	fclose(in);
+	flush_streams();
+	execution_free(ectx);
+	return exit;
+}
+
 static void clear_screen(const char *msg)
 {
 	int err;
@@ -392,6 +868,15 @@ int main(int argc, char *argv[])
 	arguments.alignment_expr = NULL;
 	arguments.watch = false;
 	arguments.watch_path = NULL;
+	arguments.emit_c_path = NULL;
+	arguments.batch = false;
+	arguments.error_summary = false;
+	arguments.cache_size = 0;
+	arguments.cache_file = NULL;
+	arguments.defs_path = NULL;
+	arguments.cse = false;
+	arguments.cse_window = 0;
+	arguments.width = 64;
 
 	argp_parse(&argp, argc, argv, 0, 0, &arguments);
 
@@ -400,16 +885,51 @@ int main(int argc, char *argv[])
 	show_binary = arguments.print_binary;
 	watch_file = arguments.watch_path;
 
-	settings = (struct parser_settings){ .max_parse_len = P_MAX_EXP_LEN,
-					     .err_stream = err_stream };
+	// expressions of any length, see read_file()
+	settings = (struct parser_settings){ .max_parse_len = 0,
+					     .err_stream = err_stream,
+					     .cache_size = arguments.cache_size,
+					     .cache_file = arguments.cache_file,
+					     .cse = arguments.cse,
+					     .cse_window = arguments.cse_window,
+					     // -w evaluates the file on every change
+					     .incremental = arguments.watch &&
+							    arguments.width == 64,
+					     .width = arguments.width };
 
 	ectx.pctx = parser_new(&settings);
+	if (!ectx.pctx && arguments.cache_file) {
+		_perror(err_stream, "Unable to open cache file \"%s\"",
+			arguments.cache_file);
+		return EXIT_FAILURE;
+	}
 	if (!ectx.pctx) {
 		fprintf(err_stream, "Failed to create parser context");
 		return EXIT_FAILURE;
 	}
 
+	ectx.print = print_new(out_stream);
+	if (!ectx.print) {
+		fprintf(err_stream, "Failed to create print context");
+		execution_free(&ectx);
+		return EXIT_FAILURE;
+	}
+
 	ectx.print_expr = false;
+	ectx.limbs = arguments.width / 64;
+
+	if (arguments.width > 64 && (arguments.batch || arguments.emit_c_path)) {
+		fprintf(err_stream,
+			"--batch and --emit-c only evaluate at 64 bits.\n");
+		execution_free(&ectx);
+		return EXIT_FAILURE;
+	}
+
+	if (arguments.defs_path && load_defs(&ectx, arguments.defs_path)) {
+		flush_streams();
+		execution_free(&ectx);
+		return EXIT_FAILURE;
+	}
 
 	if (arguments.alignment_expr) {
 		err = _eval(ectx.pctx,
@@ -426,6 +946,21 @@ int main(int argc, char *argv[])
 		}
 	}
 
+	if (arguments.emit_c_path) {
+		return do_emit_c(&ectx, arguments.emit_c_path);
+	}
+
+	// only modes that read a whole input have something to summarize
+	if (arguments.error_summary && !arguments.detached_expr &&
+	    (arguments.batch || arguments.watch || !isatty(0))) {
+		ectx.summarize = true;
+		parser_set_quiet(ectx.pctx, true);
+	}
+
+	if (arguments.batch) {
+		return do_batch(&ectx);
+	}
+
 	if (arguments.watch) {
 		if (!arguments.watch_path) {
 			fprintf(err_stream,
@@ -0,0 +1,411 @@
+// getrandom(), CLOCK_MONOTONIC
+#define _DEFAULT_SOURCE
+
+#include <stdlib.h>
+#include <string.h>
+#include <sys/random.h>
+#include <time.h>
+
+#include "cache.h"
+#include "token.h"
+#include "program.h"
+#include "lookup_tables.h"
+
+/*
+ * Sets of CACHE_WAYS entries, picked by the hash. A line can only land in
+ * its own set, so a lookup compares at most CACHE_WAYS keys and eviction is
+ * LRU within the set. What a lookup compares first is packed into a cache
+ * line per set, and an entry is only touched once its hash matches.
+ */
+#define CACHE_WAYS 4
+
+struct cache_set {
+	uint64_t hash[CACHE_WAYS];
+	// tick of the last lookup that found the way, zero while it is empty
+	uint64_t used[CACHE_WAYS];
+};
+
+struct cache_entry {
+	char *key;
+	uint32_t key_len;
+	uint32_t key_cap;
+	int err;
+	uint64_t result;
+	// pos is an offset into key
+	struct bmath_error error;
+};
+
+struct result_cache {
+	struct cache_set *sets;
+	struct cache_entry *entries;
+	size_t nsets;
+	size_t ways;
+	uint64_t sip_key[2];
+	uint64_t tick;
+	struct bmath_cache_stats stats;
+	// the line of the last miss, for cache_store()
+	bool pending;
+	uint64_t hash;
+	size_t canon_len;
+	char canon[CACHE_MAX_KEY];
+};
+
+#define ROTL(x, b) (((x) << (b)) | ((x) >> (64 - (b))))
+
+static inline void __sip_round(uint64_t v[4])
+{
+	v[0] += v[1];
+	v[1] = ROTL(v[1], 13);
+	v[1] ^= v[0];
+	v[0] = ROTL(v[0], 32);
+	v[2] += v[3];
+	v[3] = ROTL(v[3], 16);
+	v[3] ^= v[2];
+	v[0] += v[3];
+	v[3] = ROTL(v[3], 21);
+	v[3] ^= v[0];
+	v[2] += v[1];
+	v[1] = ROTL(v[1], 17);
+	v[1] ^= v[2];
+	v[2] = ROTL(v[2], 32);
+}
+
+// SipHash-1-3: one round per word, three to finish
+uint64_t cache_hash(const uint64_t key[2], const char *data, size_t len)
+{
+	uint64_t v[4] = {
+		key[0] ^ 0x736f6d6570736575,
+		key[1] ^ 0x646f72616e646f6d,
+		key[0] ^ 0x6c7967656e657261,
+		key[1] ^ 0x7465646279746573,
+	};
+	uint64_t m, last = (uint64_t)len << 56;
+	size_t i;
+
+	for (i = 0; i + 8 <= len; i += 8) {
+		memcpy(&m, data + i, sizeof(m));
+		v[3] ^= m;
+		__sip_round(v);
+		v[0] ^= m;
+	}
+
+	for (size_t j = 0; i + j < len; j++) {
+		last |= (uint64_t)(unsigned char)data[i + j] << (8 * j);
+	}
+
+	v[3] ^= last;
+	__sip_round(v);
+	v[0] ^= last;
+
+	v[2] ^= 0xff;
+	__sip_round(v);
+	__sip_round(v);
+	__sip_round(v);
+	return v[0] ^ v[1] ^ v[2] ^ v[3];
+}
+
+void cache_seed(uint64_t key[2])
+{
+	struct timespec ts;
+
+	if (getrandom(key, 2 * sizeof(*key), GRND_NONBLOCK) ==
+	    2 * sizeof(*key)) {
+		return;
+	}
+
+	// without entropy, at least don't use the same key in every process
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	key[0] = (uint64_t)ts.tv_nsec * 0x9e3779b97f4a7c15 ^ (uintptr_t)key;
+	key[1] = (uint64_t)ts.tv_sec * 0xc2b2ae3d27d4eb4f ^ (uintptr_t)&ts;
+}
+
+struct result_cache *cache_new(size_t entries)
+{
+	struct result_cache *cache;
+	size_t ways = entries < CACHE_WAYS ? entries : CACHE_WAYS;
+
+	if (!entries) {
+		return NULL;
+	}
+
+	cache = calloc(1, sizeof(*cache));
+	if (!cache) {
+		return NULL;
+	}
+
+	cache->ways = ways;
+	cache->nsets = entries / ways;
+	cache->sets = aligned_alloc(sizeof(*cache->sets),
+				    cache->nsets * sizeof(*cache->sets));
+	cache->entries = calloc(cache->nsets * ways, sizeof(*cache->entries));
+	if (!cache->sets || !cache->entries) {
+		free(cache->sets);
+		free(cache->entries);
+		free(cache);
+		return NULL;
+	}
+	memset(cache->sets, 0, cache->nsets * sizeof(*cache->sets));
+
+	cache->stats.capacity = cache->nsets * ways;
+	cache_seed(cache->sip_key);
+	return cache;
+}
+
+void cache_free(struct result_cache *cache)
+{
+	if (!cache) {
+		return;
+	}
+
+	for (size_t i = 0; i < cache->nsets * cache->ways; i++) {
+		free(cache->entries[i].key);
+	}
+
+	free(cache->sets);
+	free(cache->entries);
+	free(cache);
+}
+
+static inline bool __space(char c)
+{
+	return __char_class(c) == LEX_CLASS_SPACE;
+}
+
+// where the line ends for the lexer, at len or at a NUL before it
+static inline size_t __line_end(const char *expr, size_t len)
+{
+	const char *nul = memchr(expr, '\0', len);
+
+	return nul ? (size_t)(nul - expr) : len;
+}
+
+// branch free, whitespace is too frequent in a line to predict
+static inline size_t __canonicalize_bytes(const char *expr, size_t len,
+					  char *out, size_t n, bool *prev)
+{
+	bool space;
+
+	for (size_t i = 0; i < len; i++) {
+		space = __space(expr[i]);
+		out[n] = space ? ' ' : expr[i];
+		n += !(space && *prev);
+		*prev = space;
+	}
+
+	return n;
+}
+
+#ifdef __x86_64__
+
+#include <immintrin.h>
+
+// the bytes of v in LEX_CLASS_SPACE, the same set __space() tests for
+static inline __m128i __spaces(__m128i v)
+{
+	__m128i ws = _mm_setzero_si128(), c;
+
+	for (size_t k = 0; k < LEX_SPACE_CHARS; k++) {
+		c = _mm_set1_epi8((char)lookup_space_chars[k]);
+		ws = _mm_or_si128(ws, _mm_cmpeq_epi8(v, c));
+	}
+
+	return ws;
+}
+
+/*
+ * Most lines have single spaces between their tokens, so a chunk without a
+ * longer run only needs its other whitespace turned into spaces.
+ */
+static size_t __canonicalize(const char *expr, size_t len, char *out)
+{
+	size_t n = 0, i;
+	bool prev = false;
+	unsigned int runs;
+	__m128i v, ws;
+
+	for (i = 0; i + 16 <= len; i += 16) {
+		v = _mm_loadu_si128((const __m128i *)(expr + i));
+		ws = __spaces(v);
+		runs = _mm_movemask_epi8(ws);
+		if (runs & (runs << 1 | prev)) {
+			n = __canonicalize_bytes(expr + i, 16, out, n, &prev);
+			continue;
+		}
+
+		v = _mm_or_si128(_mm_andnot_si128(ws, v),
+				 _mm_and_si128(ws, _mm_set1_epi8(' ')));
+		_mm_storeu_si128((__m128i *)(out + n), v);
+		n += 16;
+		prev = runs >> 15;
+	}
+
+	return __canonicalize_bytes(expr + i, len - i, out, n, &prev);
+}
+
+#else
+
+static size_t __canonicalize(const char *expr, size_t len, char *out)
+{
+	bool prev = false;
+
+	return __canonicalize_bytes(expr, len, out, 0, &prev);
+}
+
+#endif
+
+size_t cache_canonicalize(const char *expr, size_t len, char *out)
+{
+	return __canonicalize(expr, __line_end(expr, len), out);
+}
+
+// offset in the canonical line of an offset in expr
+static size_t __canon_pos(const char *expr, size_t len, size_t pos)
+{
+	size_t n = 0;
+
+	for (size_t i = 0; i < pos && i < len; i++) {
+		n += !__space(expr[i]) || !i || !__space(expr[i - 1]);
+	}
+
+	return n;
+}
+
+// offset in expr of an offset in the canonical line, the reverse of the above
+static size_t __expr_pos(const char *expr, size_t len, size_t pos)
+{
+	size_t n = 0, i;
+
+	for (i = 0; i < len; i++) {
+		if (__space(expr[i]) && i && __space(expr[i - 1])) {
+			continue;
+		}
+		if (n++ == pos) {
+			break;
+		}
+	}
+
+	return i;
+}
+
+static inline size_t __set(const struct result_cache *cache, uint64_t hash)
+{
+	return ((unsigned __int128)hash * cache->nsets) >> 64;
+}
+
+bool cache_lookup(struct result_cache *cache, const char *expr, size_t len,
+		  int *out_err, uint64_t *out_result,
+		  struct bmath_error *out_error)
+{
+	struct cache_set *set;
+	struct cache_entry *e;
+	size_t idx;
+
+	cache->pending = false;
+	if (len > CACHE_MAX_KEY) {
+		return false;
+	}
+
+	len = __line_end(expr, len);
+	cache->canon_len = __canonicalize(expr, len, cache->canon);
+	cache->hash = cache_hash(cache->sip_key, cache->canon, cache->canon_len);
+
+	idx = __set(cache, cache->hash);
+	set = &cache->sets[idx];
+	for (size_t w = 0; w < cache->ways; w++) {
+		if (!set->used[w] || set->hash[w] != cache->hash) {
+			continue;
+		}
+
+		e = &cache->entries[idx * cache->ways + w];
+		if (e->key_len != cache->canon_len ||
+		    memcmp(e->key, cache->canon, cache->canon_len)) {
+			continue;
+		}
+
+		set->used[w] = ++cache->tick;
+		cache->stats.hits++;
+		*out_err = e->err;
+		*out_result = e->result;
+		*out_error = e->error;
+		if (e->err) {
+			out_error->pos = __expr_pos(expr, len, e->error.pos);
+		}
+		return true;
+	}
+
+	cache->stats.misses++;
+	cache->pending = true;
+	return false;
+}
+
+void cache_store(struct result_cache *cache, const char *expr, size_t len,
+		 int err, uint64_t result, const struct bmath_error *error)
+{
+	struct cache_set *set;
+	struct cache_entry *e;
+	struct bmath_error stored = *error;
+	size_t idx, way = 0, cap;
+	char *key;
+
+	if (!cache->pending) {
+		return;
+	}
+	cache->pending = false;
+
+	// running out of memory may not happen again
+	if (err && (err != PE_PARSE_ERROR || error->code == BMATH_ENOMEM)) {
+		return;
+	}
+
+	if (err) {
+		len = __line_end(expr, len);
+		stored.pos = __canon_pos(expr, len, error->pos);
+		// only offsets that mean the same in every line of the key
+		if (__expr_pos(expr, len, stored.pos) != error->pos) {
+			return;
+		}
+	}
+
+	idx = __set(cache, cache->hash);
+	set = &cache->sets[idx];
+	for (size_t w = 1; w < cache->ways && set->used[way]; w++) {
+		if (set->used[w] < set->used[way]) {
+			way = w;
+		}
+	}
+
+	if (set->used[way]) {
+		cache->stats.evictions++;
+	} else {
+		cache->stats.entries++;
+	}
+
+	e = &cache->entries[idx * cache->ways + way];
+	// in steps, so evicting one line for another rarely reallocates. Even
+	// a line of only whitespace, whose key is empty, gets a buffer.
+	if (!e->key || e->key_cap < cache->canon_len) {
+		cap = (cache->canon_len + 64) & ~(size_t)63;
+		key = realloc(e->key, cap);
+		if (!key) {
+			cache->stats.entries--;
+			set->used[way] = 0;
+			return;
+		}
+		e->key = key;
+		e->key_cap = cap;
+	}
+
+	memcpy(e->key, cache->canon, cache->canon_len);
+	e->key_len = cache->canon_len;
+	e->err = err;
+	e->result = result;
+	e->error = stored;
+	set->hash[way] = cache->hash;
+	set->used[way] = ++cache->tick;
+}
+
+void cache_stats(const struct result_cache *cache,
+		 struct bmath_cache_stats *out)
+{
+	*out = cache->stats;
+}
@@ -0,0 +1,65 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "parser.h"
+
+/*
+ * Outcomes of parse() by expression, see parser_settings.cache_size. Lines
+ * that only differ in their whitespace runs share an entry: every run is
+ * collapsed into one space before the line is hashed and compared, which
+ * never changes how it lexes. Keys are hashed with SipHash under a key drawn
+ * for each cache, so which lines collide can't be worked out from outside.
+ */
+
+// longer lines bypass the cache, so no entry holds more than this
+#define CACHE_MAX_KEY 1024
+
+struct result_cache;
+
+/**
+ * @param size_t entries Rounded down to a whole number of sets
+ * @return NULL if entries is zero or out of memory
+ */
+struct result_cache *cache_new(size_t entries);
+void cache_free(struct result_cache *cache);
+
+/**
+ * Look up an expression and count a hit or a miss. The error of a hit points
+ * into expr, wherever its whitespace is. After a miss, cache_store() records
+ * the outcome of the same expression.
+ * @param int *out_err What parse() returned
+ * @return Whether the expression was found
+ */
+bool cache_lookup(struct result_cache *cache, const char *expr, size_t len,
+		  int *out_err, uint64_t *out_result,
+		  struct bmath_error *out_error);
+
+/**
+ * Remember the outcome of the expression of the last cache_lookup() miss,
+ * evicting the least recently used entry of its set if the set is full.
+ * Failing to make room only means the outcome isn't remembered.
+ */
+void cache_store(struct result_cache *cache, const char *expr, size_t len,
+		 int err, uint64_t result, const struct bmath_error *error);
+
+void cache_stats(const struct result_cache *cache,
+		 struct bmath_cache_stats *out);
+
+/*
+ * The key and hash every cache uses, for the one in cache_file.h.
+ */
+
+/**
+ * Write the key of an expression, which is never longer than the expression.
+ * @param char *out Room for len bytes
+ * @return Length of the key
+ */
+size_t cache_canonicalize(const char *expr, size_t len, char *out);
+
+// a fresh random key for cache_hash()
+void cache_seed(uint64_t key[2]);
+
+uint64_t cache_hash(const uint64_t key[2], const char *data, size_t len);
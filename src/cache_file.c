@@ -0,0 +1,315 @@
+// MAP_SHARED, flock()
+#define _DEFAULT_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "cache.h"
+#include "cache_file.h"
+
+#ifndef VERSION
+#include "version.h"
+#endif
+
+/*
+ * The file is a page of header followed by fixed size slots, and is created
+ * at its full size, sparse, so it never grows or shrinks under a mapping.
+ * A line may be in any of CACHE_FILE_PROBE slots from the one its hash picks.
+ *
+ * Each slot is a seqlock: its sequence is odd while a writer fills it in,
+ * and readers check it didn't change while they looked. Writers take a slot
+ * by bumping the sequence with a compare and swap and give up if they lose,
+ * so nobody ever waits. A writer that dies halfway leaves its slot odd,
+ * which only loses that slot.
+ */
+
+// "bmathrc1", written last when the file is created
+#define CACHE_FILE_MAGIC 0x31637268746d6162ull
+#define CACHE_FILE_HEADER 4096
+#define CACHE_FILE_SLOTS (1 << 16)
+#define CACHE_FILE_PROBE 8
+#define CACHE_FILE_KEY 96
+#define CACHE_FILE_SIZE \
+	(CACHE_FILE_HEADER + CACHE_FILE_SLOTS * sizeof(struct cache_file_slot))
+
+struct cache_file_header {
+	_Atomic uint64_t magic;
+	uint64_t sip_key[2];
+};
+
+struct cache_file_slot {
+	// zero while the slot has never been written
+	_Atomic uint32_t seq;
+	uint16_t key_len;
+	uint64_t hash;
+	uint64_t version;
+	uint64_t result;
+	char key[CACHE_FILE_KEY];
+};
+
+_Static_assert(sizeof(struct cache_file_slot) == 128,
+	       "slots are two cache lines");
+
+struct cache_file {
+	struct cache_file_header *header;
+	struct cache_file_slot *slots;
+	uint64_t version;
+	size_t hits;
+	size_t misses;
+	// the key of the last lookup that missed, for cache_file_store()
+	bool pending;
+	size_t canon_len;
+	uint64_t hash;
+	char canon[CACHE_MAX_KEY];
+};
+
+static void *__map(int fd)
+{
+	void *map = mmap(NULL, CACHE_FILE_SIZE, PROT_READ | PROT_WRITE,
+			 MAP_SHARED, fd, 0);
+
+	return map == MAP_FAILED ? NULL : map;
+}
+
+// with the file locked, so only one process sets it up
+static void *__create(int fd)
+{
+	struct cache_file_header *header;
+
+	if (ftruncate(fd, CACHE_FILE_SIZE)) {
+		return NULL;
+	}
+
+	header = __map(fd);
+	if (!header) {
+		return NULL;
+	}
+
+	cache_seed(header->sip_key);
+	atomic_store_explicit(&header->magic, CACHE_FILE_MAGIC,
+			      memory_order_release);
+	return header;
+}
+
+static inline bool __valid(struct cache_file_header *header)
+{
+	return atomic_load_explicit(&header->magic, memory_order_acquire) ==
+	       CACHE_FILE_MAGIC;
+}
+
+static void *__open(int fd)
+{
+	struct cache_file_header *header = NULL;
+	struct stat st;
+
+	if (fstat(fd, &st)) {
+		return NULL;
+	}
+
+	if (st.st_size == CACHE_FILE_SIZE) {
+		header = __map(fd);
+		if (!header || __valid(header)) {
+			return header;
+		}
+	}
+
+	// new, or still being set up by whoever holds the lock
+	if (flock(fd, LOCK_EX)) {
+		goto fail;
+	}
+
+	if (fstat(fd, &st)) {
+		goto fail_unlock;
+	}
+
+	if (st.st_size == 0) {
+		if (header) {
+			munmap(header, CACHE_FILE_SIZE);
+		}
+		header = __create(fd);
+	} else if (st.st_size == CACHE_FILE_SIZE) {
+		if (!header) {
+			header = __map(fd);
+		}
+		if (header && !__valid(header)) {
+			errno = EINVAL;
+			goto fail_unlock;
+		}
+	} else {
+		errno = EINVAL;
+		goto fail_unlock;
+	}
+
+	flock(fd, LOCK_UN);
+	return header;
+
+fail_unlock:
+	flock(fd, LOCK_UN);
+fail:
+	if (header) {
+		munmap(header, CACHE_FILE_SIZE);
+	}
+	return NULL;
+}
+
+struct cache_file *cache_file_open(const char *path)
+{
+	struct cache_file *cf;
+	int fd, err;
+
+	cf = malloc(sizeof(*cf));
+	if (!cf) {
+		return NULL;
+	}
+
+	fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+	if (fd < 0) {
+		free(cf);
+		return NULL;
+	}
+
+	// the mapping keeps the file open
+	cf->header = __open(fd);
+	err = errno;
+	close(fd);
+	if (!cf->header) {
+		free(cf);
+		errno = err;
+		return NULL;
+	}
+
+	cf->slots = (struct cache_file_slot *)((char *)cf->header +
+					       CACHE_FILE_HEADER);
+	cf->version = cache_hash(cf->header->sip_key, VERSION, strlen(VERSION));
+	cf->hits = 0;
+	cf->misses = 0;
+	cf->pending = false;
+	return cf;
+}
+
+void cache_file_close(struct cache_file *cf)
+{
+	if (!cf) {
+		return;
+	}
+
+	munmap(cf->header, CACHE_FILE_SIZE);
+	free(cf);
+}
+
+static bool __key(struct cache_file *cf, const char *expr, size_t len)
+{
+	if (len > CACHE_MAX_KEY) {
+		return false;
+	}
+
+	cf->canon_len = cache_canonicalize(expr, len, cf->canon);
+	if (cf->canon_len > CACHE_FILE_KEY) {
+		return false;
+	}
+
+	cf->hash = cache_hash(cf->header->sip_key, cf->canon, cf->canon_len);
+	return true;
+}
+
+static inline struct cache_file_slot *__slot(struct cache_file *cf, size_t i)
+{
+	return &cf->slots[(cf->hash + i) & (CACHE_FILE_SLOTS - 1)];
+}
+
+static inline bool __matches(const struct cache_file *cf,
+			     const struct cache_file_slot *slot)
+{
+	return slot->hash == cf->hash && slot->version == cf->version &&
+	       slot->key_len == cf->canon_len &&
+	       !memcmp(slot->key, cf->canon, cf->canon_len);
+}
+
+bool cache_file_lookup(struct cache_file *cf, const char *expr, size_t len,
+		       uint64_t *out_result)
+{
+	struct cache_file_slot *slot;
+	uint32_t seq;
+	uint64_t result;
+
+	cf->pending = false;
+	if (!__key(cf, expr, len)) {
+		return false;
+	}
+
+	for (size_t i = 0; i < CACHE_FILE_PROBE; i++) {
+		slot = __slot(cf, i);
+		seq = atomic_load_explicit(&slot->seq, memory_order_acquire);
+		if (!seq || seq & 1 || !__matches(cf, slot)) {
+			continue;
+		}
+
+		result = slot->result;
+		atomic_thread_fence(memory_order_acquire);
+		if (atomic_load_explicit(&slot->seq, memory_order_relaxed) !=
+		    seq) {
+			continue;
+		}
+
+		cf->hits++;
+		*out_result = result;
+		return true;
+	}
+
+	cf->misses++;
+	cf->pending = true;
+	return false;
+}
+
+void cache_file_store(struct cache_file *cf, uint64_t result)
+{
+	struct cache_file_slot *slot = NULL;
+	uint32_t seq;
+
+	if (!cf->pending) {
+		return;
+	}
+	cf->pending = false;
+
+	// an empty slot, or one of an older build, before evicting
+	for (size_t i = 0; i < CACHE_FILE_PROBE && !slot; i++) {
+		seq = atomic_load_explicit(&__slot(cf, i)->seq,
+					   memory_order_relaxed);
+		if (!seq || __slot(cf, i)->version != cf->version) {
+			slot = __slot(cf, i);
+		}
+	}
+	if (!slot) {
+		slot = __slot(cf, (cf->hash >> 32) % CACHE_FILE_PROBE);
+	}
+
+	seq = atomic_load_explicit(&slot->seq, memory_order_relaxed);
+	if (seq & 1 ||
+	    !atomic_compare_exchange_strong_explicit(&slot->seq, &seq, seq + 1,
+						     memory_order_acquire,
+						     memory_order_relaxed)) {
+		return;
+	}
+	atomic_thread_fence(memory_order_release);
+
+	slot->key_len = cf->canon_len;
+	slot->hash = cf->hash;
+	slot->version = cf->version;
+	slot->result = result;
+	memcpy(slot->key, cf->canon, cf->canon_len);
+	atomic_store_explicit(&slot->seq, seq + 2, memory_order_release);
+}
+
+void cache_file_stats(const struct cache_file *cf, size_t *out_hits,
+		      size_t *out_misses)
+{
+	*out_hits = cf->hits;
+	*out_misses = cf->misses;
+}
@@ -0,0 +1,40 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Results of parse() kept in a file, so they outlive the process and are
+ * shared by every process that maps the same file, see
+ * parser_settings.cache_file. Keys are those of cache.h, tagged with the
+ * bmath version so an upgrade never reads what an older build stored.
+ * Only results are kept: an expression that failed is parsed again to
+ * report its error.
+ */
+
+struct cache_file;
+
+/**
+ * Map a cache file, creating it if it doesn't exist or is empty.
+ * @return NULL with errno set, EINVAL if the file isn't a cache file
+ */
+struct cache_file *cache_file_open(const char *path);
+void cache_file_close(struct cache_file *cf);
+
+/**
+ * Look up an expression and count a hit or a miss. Never waits on other
+ * processes: an entry that is being written reads as a miss. After a miss,
+ * cache_file_store() records the result of the same expression.
+ */
+bool cache_file_lookup(struct cache_file *cf, const char *expr, size_t len,
+		       uint64_t *out_result);
+
+/**
+ * Remember the result of the expression of the last cache_file_lookup()
+ * miss. Skipped if another process is writing the same slot.
+ */
+void cache_file_store(struct cache_file *cf, uint64_t result);
+
+void cache_file_stats(const struct cache_file *cf, size_t *out_hits,
+		      size_t *out_misses);
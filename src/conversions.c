@@ -0,0 +1,330 @@
+#include <errno.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "conversions.h"
+#include "util.h"
+
+/*
+ * Numbers are parsed 8 bytes at a time as one uint64_t, with the first byte
+ * in the low byte whatever the host byte order. Digits are found and
+ * converted with plain integer ops, so there's no loop over the bytes.
+ */
+
+#define SWAR_ONES 0x0101010101010101ull
+#define SWAR_HIGH (0x80 * SWAR_ONES)
+
+typedef uint64_t __attribute__((may_alias, aligned(1))) unaligned_u64;
+
+static inline uint64_t __le64(uint64_t word)
+{
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+	return __builtin_bswap64(word);
+#else
+	return word;
+#endif
+}
+
+/*
+ * The 8 bytes at p, of which only n can be read. Bytes past n are 0, which
+ * is never a digit. A short tail is read as the aligned words it lies in,
+ * those never cross a page.
+ */
+static inline OVERREAD uint64_t __load(const char *p, size_t n)
+{
+	const unaligned_u64 *aligned;
+	size_t off;
+	uint64_t word;
+
+	if (likely(n >= 8)) {
+		return __le64(*(const unaligned_u64 *)p);
+	}
+
+	if (!n) {
+		return 0;
+	}
+
+	aligned = (const unaligned_u64 *)((uintptr_t)p & ~(uintptr_t)7);
+	off = (uintptr_t)p & 7;
+	word = __le64(aligned[0]) >> (off * 8);
+
+	// off isn't 0 if the tail runs into the next word
+	if (off + n > 8) {
+		word |= __le64(aligned[1]) << (64 - off * 8);
+	}
+
+	return word & ((1ull << (n * 8)) - 1);
+}
+
+// high bit set in the bytes that aren't within [lo, hi], both below 0x80
+static inline uint64_t __outside(uint64_t word, uint8_t lo, uint8_t hi)
+{
+	uint64_t low = word & ~SWAR_HIGH;
+	uint64_t above = low + (0x7f - hi) * SWAR_ONES;
+	uint64_t below = (low | SWAR_HIGH) - lo * SWAR_ONES;
+
+	return (word | above | ~below) & SWAR_HIGH;
+}
+
+/*
+ * Number of leading bytes that aren't flagged in mask. Their flags are summed
+ * with a multiply rather than found with ctz, as that needs a branch for 0.
+ */
+static inline unsigned int __leading(uint64_t mask)
+{
+	return ((((mask - 1) & ~mask & SWAR_HIGH) >> 7) * SWAR_ONES) >> 56;
+}
+
+/*
+ * Only the lowest flagged byte counts, so borrows and carries out of the
+ * bytes past it don't matter.
+ */
+static inline unsigned int __dec_digits(uint64_t word)
+{
+	uint64_t t = word - 0x30 * SWAR_ONES;
+
+	return __leading((t | (t + 0x76 * SWAR_ONES)) & SWAR_HIGH);
+}
+
+static inline uint64_t __non_hex(uint64_t word)
+{
+	// setting 0x20 folds A-F onto a-f and nothing else onto them
+	return __outside(word, '0', '9') &
+	       __outside(word | 0x20 * SWAR_ONES, 'a', 'f');
+}
+
+static inline unsigned int __hex_digits(uint64_t word)
+{
+	return __leading(__non_hex(word));
+}
+
+/*
+ * The digits are moved to the top, so the bytes below them are leading zeros.
+ * There are no digits to keep for n = 0, but the shift can't be 64.
+ */
+static inline uint64_t __align_digits(uint64_t word, unsigned int n)
+{
+	return (word << ((64 - n * 8) & 63)) & -(uint64_t)(n != 0);
+}
+
+/*
+ * The first n digits of word, n <= 8. Pairs, quads and octets of digits are
+ * combined with one multiply each.
+ */
+static inline uint64_t __dec_value(uint64_t word, unsigned int n)
+{
+	word = __align_digits(word & 0x0f0f0f0f0f0f0f0full, n);
+	word = (word * (10 * 0x100 + 1)) >> 8;
+	word = ((word & 0x00ff00ff00ff00ffull) * (100 * 0x10000 + 1)) >> 16;
+	return ((word & 0x0000ffff0000ffffull) * (10000 * 0x100000000ull + 1)) >>
+	       32;
+}
+
+// same as __dec_value, letters have bit 6 set and are 9 below their value
+static inline uint64_t __hex_value(uint64_t word, unsigned int n)
+{
+	word = (word & 0x0f0f0f0f0f0f0f0full) + 9 * ((word >> 6) & SWAR_ONES);
+	word = __align_digits(word, n);
+	word = (word * (16 * 0x100 + 1)) >> 8;
+	word = ((word & 0x00ff00ff00ff00ffull) * (0x100 * 0x10000 + 1)) >> 16;
+	return ((word & 0x0000ffff0000ffffull) *
+		(0x10000 * 0x100000000ull + 1)) >>
+	       32;
+}
+
+static const uint64_t powers_of_ten[9] = {
+	1, 10, 100, 1000, 10000, 100000, 1000000, 10000000, 100000000,
+};
+
+/*
+ * Digits in the two words at p. The second word only counts if the first is
+ * all digits. Nothing here branches on the digits, so numbers up to 16 digits
+ * don't depend on the CPU guessing their length.
+ */
+struct two_words {
+	unsigned int n;
+	uint64_t first, second;
+	unsigned int n_first, n_second;
+};
+
+static inline struct two_words __two_words(const char *p, size_t len,
+					   unsigned int (*digits)(uint64_t))
+{
+	struct two_words w;
+
+	w.first = __load(p, len);
+	w.second = len > 8 ? __load(p + 8, len - 8) : 0;
+	w.n_first = digits(w.first);
+	w.n_second = digits(w.second) & -(unsigned int)(w.n_first == 8);
+	w.n = w.n_first + w.n_second;
+	return w;
+}
+
+ssize_t str_dec_to_uint64(const char *input, size_t input_length,
+			  uint64_t *result)
+{
+	const char *p = input;
+	const char *end = input + input_length;
+	struct two_words w = __two_words(p, input_length, __dec_digits);
+	uint64_t word, value;
+	unsigned int n = 8;
+	bool overflow = false;
+
+	// 16 digits always fit
+	value = __dec_value(w.first, w.n_first) * powers_of_ten[w.n_second] +
+		__dec_value(w.second, w.n_second);
+	p += w.n;
+
+	while (unlikely(n == 8 && w.n == 16)) {
+		word = __load(p, end - p);
+		n = __dec_digits(word);
+		overflow |= __builtin_mul_overflow(value, powers_of_ten[n], &value);
+		overflow |= __builtin_add_overflow(value, __dec_value(word, n),
+						   &value);
+		p += n;
+	}
+	*result = value;
+
+	if (p == input) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	if (overflow) {
+		errno = ERANGE;
+		return -(p - input);
+	}
+
+	return p - input;
+}
+
+ssize_t str_hex_to_uint64(const char *input, size_t input_length,
+			  uint64_t *result)
+{
+	const char *end = input + input_length;
+	const char *digits = input + 2;
+	const char *p = digits;
+	struct two_words w;
+	uint64_t value, non_hex;
+
+	if (input_length < 1 || input[0] != '0') {
+		errno = EINVAL;
+		return -1;
+	}
+
+	if (input_length < 2 || (input[1] | 0x20) != 'x') {
+		errno = EINVAL;
+		return -2;
+	}
+
+	w = __two_words(p, input_length - 2, __hex_digits);
+	value = __hex_value(w.first, w.n_first) << (w.n_second * 4) |
+		__hex_value(w.second, w.n_second);
+	p += w.n;
+
+	// past 16 digits it only counts them, a word at a time while they last
+	if (unlikely(w.n == 16)) {
+		while (!(non_hex = __non_hex(__load(p, end - p)))) {
+			p += 8;
+		}
+		p += __leading(non_hex);
+	}
+	*result = value;
+
+	if (p - digits > MAX_HEX_DIGITS) {
+		errno = E2BIG;
+		return -(p - input);
+	}
+
+	return p - input;
+}
+
+// limbs = limbs * mul + add, returns what carries out of the top limb
+static inline uint64_t __limbs_madd(uint64_t *limbs, size_t nlimbs,
+				    uint64_t mul, uint64_t add)
+{
+	unsigned __int128 t;
+
+	for (size_t i = 0; i < nlimbs; i++) {
+		t = (unsigned __int128)limbs[i] * mul + add;
+		limbs[i] = (uint64_t)t;
+		add = (uint64_t)(t >> 64);
+	}
+
+	return add;
+}
+
+ssize_t str_dec_to_limbs(const char *input, size_t input_length,
+			 uint64_t *limbs, size_t nlimbs)
+{
+	const char *p = input;
+	const char *end = input + input_length;
+	uint64_t word, carry = 0;
+	unsigned int n;
+
+	memset(limbs, 0, nlimbs * sizeof(*limbs));
+	do {
+		word = __load(p, end - p);
+		n = __dec_digits(word);
+		carry |= __limbs_madd(limbs, nlimbs, powers_of_ten[n],
+				      __dec_value(word, n));
+		p += n;
+	} while (n == 8);
+
+	if (p == input) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	if (carry) {
+		errno = ERANGE;
+		return -(p - input);
+	}
+
+	return p - input;
+}
+
+ssize_t str_hex_to_limbs(const char *input, size_t input_length,
+			 uint64_t *limbs, size_t nlimbs)
+{
+	const char *end = input + input_length;
+	const char *digits = input + 2;
+	const char *p = digits;
+	struct two_words w;
+	uint64_t non_hex;
+	size_t ndigits, n;
+
+	memset(limbs, 0, nlimbs * sizeof(*limbs));
+	if (input_length < 1 || input[0] != '0') {
+		errno = EINVAL;
+		return -1;
+	}
+
+	if (input_length < 2 || (input[1] | 0x20) != 'x') {
+		errno = EINVAL;
+		return -2;
+	}
+
+	while (!(non_hex = __non_hex(__load(p, end - p)))) {
+		p += 8;
+	}
+	p += __leading(non_hex);
+
+	ndigits = p - digits;
+	if (ndigits > nlimbs * MAX_HEX_DIGITS) {
+		errno = E2BIG;
+		return -(p - input);
+	}
+
+	// a limb for every 16 digits, from the last one back
+	for (size_t i = 0; ndigits > 16 * i; i++) {
+		n = ndigits - 16 * i;
+		n = n < 16 ? n : 16;
+		w = __two_words(p - 16 * i - n, n, __hex_digits);
+		limbs[i] = __hex_value(w.first, w.n_first) << (w.n_second * 4) |
+			   __hex_value(w.second, w.n_second);
+	}
+
+	return p - input;
+}
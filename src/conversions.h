@@ -3,4 +3,40 @@
 #include <stdint.h>
 #include <unistd.h>
 
-ssize_t str_hex_to_uint64(char *input, ssize_t input_length, uint64_t *result);
+/*
+ * Both parsers work 8 bytes at a time and read at most input_length bytes,
+ * though a short tail is read as the aligned 8-byte words it lies in.
+ */
+
+// at most 16 hex digits fit
+#define MAX_HEX_DIGITS 16
+
+/**
+ * Parse a 0x prefixed hex number. Only the first input_length bytes are read,
+ * so input doesn't need to be terminated.
+ * @return Bytes parsed. A negative value on error, with errno set to EINVAL if
+ *         there's no prefix, or to E2BIG if there are more digits than fit
+ *         in 64 bits, in which case its magnitude is the length of the number
+ */
+ssize_t str_hex_to_uint64(const char *input, size_t input_length,
+			  uint64_t *result);
+
+/**
+ * Parse a decimal number, stopping at the first byte that isn't a digit.
+ * @return Bytes parsed. A negative value on error, with errno set to EINVAL if
+ *         input doesn't start with a digit, or to ERANGE if the number doesn't
+ *         fit in 64 bits, in which case its magnitude is the length of the
+ *         number
+ */
+ssize_t str_dec_to_uint64(const char *input, size_t input_length,
+			  uint64_t *result);
+
+/*
+ * The same for numbers of up to nlimbs 64-bit limbs, stored least significant
+ * first, which is what a number that is too big for the two above is parsed
+ * again with. Errors are theirs, with the limbs standing in for 64 bits.
+ */
+ssize_t str_hex_to_limbs(const char *input, size_t input_length,
+			 uint64_t *limbs, size_t nlimbs);
+ssize_t str_dec_to_limbs(const char *input, size_t input_length,
+			 uint64_t *limbs, size_t nlimbs);
@@ -0,0 +1,207 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "cse.h"
+
+/*
+ * A fixed number of slots, open addressed. A subterm may be in any of
+ * CSE_PROBE slots from the one its hash picks; when they're all taken the
+ * least recently used one is forgotten, which only loses sharing. A node is
+ * a cache line: no builtin takes more than CSE_MAX_ARGS arguments, so calls
+ * with more are never shared, they fail anyway.
+ */
+#define CSE_SLOTS (1 << 10)
+#define CSE_PROBE 8
+#define CSE_MAX_ARGS 2
+
+struct cse_node {
+	uint64_t hash;
+	uint64_t id;
+	// line the subterm was last used on, zero while the slot is empty
+	uint64_t line;
+	uint64_t value;
+	// builtin of a call
+	uint64_t imm;
+	uint64_t args[CSE_MAX_ARGS];
+	// bit i is set when args[i] is a literal
+	uint8_t literals;
+	uint8_t code;
+	uint8_t argc;
+};
+
+_Static_assert(sizeof(struct cse_node) == 64, "nodes are a cache line");
+
+struct cse_table {
+	struct cse_node *nodes;
+	size_t window;
+	uint64_t line;
+	uint64_t next_id;
+	struct bmath_cse_stats stats;
+	// the subterm of the last miss, for cse_store()
+	bool pending;
+	struct cse_node key;
+};
+
+struct cse_table *cse_new(size_t window)
+{
+	struct cse_table *cse = calloc(1, sizeof(*cse));
+
+	if (!cse) {
+		return NULL;
+	}
+
+	cse->nodes = aligned_alloc(sizeof(*cse->nodes),
+				   CSE_SLOTS * sizeof(*cse->nodes));
+	if (!cse->nodes) {
+		free(cse);
+		return NULL;
+	}
+	memset(cse->nodes, 0, CSE_SLOTS * sizeof(*cse->nodes));
+
+	cse->window = window;
+	return cse;
+}
+
+void cse_free(struct cse_table *cse)
+{
+	if (!cse) {
+		return;
+	}
+
+	free(cse->nodes);
+	free(cse);
+}
+
+void cse_next_line(struct cse_table *cse)
+{
+	cse->line++;
+	cse->pending = false;
+}
+
+static inline size_t __operands(const struct program_op *op)
+{
+	switch (op->code) {
+	case OP_NEG:
+	case OP_NOT:
+		return 1;
+	case OP_CALL:
+		return op->argc;
+	default:
+		return 2;
+	}
+}
+
+static inline uint64_t __mix(uint64_t h, uint64_t v)
+{
+	h = (h ^ v) * 0x9e3779b97f4a7c15;
+	return h ^ (h >> 29);
+}
+
+static void __key(struct cse_node *key, const struct program_op *op,
+		  const struct cse_ref *args)
+{
+	size_t n = __operands(op);
+	uint64_t h;
+
+	key->code = op->code;
+	key->argc = n;
+	key->imm = op->code == OP_CALL ? op->imm : 0;
+	key->literals = 0;
+
+	h = __mix(key->code | (uint64_t)key->argc << 8, key->imm);
+	for (size_t i = 0; i < n; i++) {
+		key->args[i] = args[i].ref;
+		key->literals |= args[i].literal << i;
+		h = __mix(h, args[i].ref);
+	}
+
+	key->hash = __mix(h, key->literals);
+}
+
+static inline struct cse_node *__slot(struct cse_table *cse, size_t i)
+{
+	return &cse->nodes[(cse->key.hash + i) & (CSE_SLOTS - 1)];
+}
+
+static inline bool __live(const struct cse_table *cse,
+			  const struct cse_node *node)
+{
+	return node->line && cse->line - node->line <= cse->window;
+}
+
+static inline bool __same(const struct cse_node *node,
+			  const struct cse_node *key)
+{
+	return node->hash == key->hash && node->code == key->code &&
+	       node->argc == key->argc && node->imm == key->imm &&
+	       node->literals == key->literals &&
+	       !memcmp(node->args, key->args, key->argc * sizeof(*key->args));
+}
+
+bool cse_lookup(struct cse_table *cse, const struct program_op *op,
+		const struct cse_ref *args, uint64_t *out_value,
+		struct cse_ref *out_ref)
+{
+	struct cse_node *node;
+
+	cse->stats.ops++;
+	if (op->code == OP_CALL && op->argc > CSE_MAX_ARGS) {
+		cse->stats.computed++;
+		cse->pending = false;
+		return false;
+	}
+
+	__key(&cse->key, op, args);
+
+	for (size_t i = 0; i < CSE_PROBE; i++) {
+		node = __slot(cse, i);
+		if (!__same(node, &cse->key) || !__live(cse, node)) {
+			continue;
+		}
+
+		if (node->line != cse->line) {
+			cse->stats.earlier_lines++;
+		}
+		node->line = cse->line;
+		cse->pending = false;
+		*out_value = node->value;
+		*out_ref = (struct cse_ref){ .ref = node->id };
+		return true;
+	}
+
+	cse->stats.computed++;
+	cse->pending = true;
+	return false;
+}
+
+void cse_store(struct cse_table *cse, uint64_t value, struct cse_ref *out_ref)
+{
+	struct cse_node *node = NULL, *slot;
+
+	*out_ref = (struct cse_ref){ .ref = cse->next_id++ };
+	if (!cse->pending) {
+		return;
+	}
+	cse->pending = false;
+
+	for (size_t i = 0; i < CSE_PROBE; i++) {
+		slot = __slot(cse, i);
+		if (!__live(cse, slot)) {
+			node = slot;
+			break;
+		}
+		if (!node || slot->line < node->line) {
+			node = slot;
+		}
+	}
+
+	*node = cse->key;
+	node->id = out_ref->ref;
+	node->line = cse->line;
+	node->value = value;
+}
+
+void cse_stats(const struct cse_table *cse, struct bmath_cse_stats *out)
+{
+	*out = cse->stats;
+}
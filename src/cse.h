@@ -0,0 +1,57 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "parser.h"
+#include "program.h"
+
+/*
+ * The subterms parse() evaluates, hash-consed, see parser_settings.cse. A
+ * subterm is an op on its operands, each of which is a literal or another
+ * subterm. Subterms get ids that are never reused, so two with the same op
+ * and operands are the same expression and have the same value, even once
+ * one of their operands has been forgotten.
+ */
+
+// an operand: a literal, or the id of a subterm
+struct cse_ref {
+	uint64_t ref;
+	bool literal;
+};
+
+struct cse_table;
+
+/**
+ * @param size_t window Lines a subterm is remembered for after the one it
+ *        was last used on, zero to only share subterms within a line
+ * @return NULL if out of memory
+ */
+struct cse_table *cse_new(size_t window);
+void cse_free(struct cse_table *cse);
+
+// subterms are shared from here on as part of the next line
+void cse_next_line(struct cse_table *cse);
+
+/**
+ * Look up an op on its operands and count it. After a miss, cse_store()
+ * records what the op evaluated to.
+ * @param const struct cse_ref *args The op's operands, op->argc of them for
+ *        a call
+ * @param struct cse_ref *out_ref The subterm, when it was found. May alias
+ *        args
+ * @return Whether the subterm was found
+ */
+bool cse_lookup(struct cse_table *cse, const struct program_op *op,
+		const struct cse_ref *args, uint64_t *out_value,
+		struct cse_ref *out_ref);
+
+/**
+ * Remember the value of the op of the last cse_lookup() miss, replacing the
+ * least recently used subterm its slot could go in if there's no room.
+ * @param struct cse_ref *out_ref A new subterm, even if it isn't remembered
+ */
+void cse_store(struct cse_table *cse, uint64_t value, struct cse_ref *out_ref);
+
+void cse_stats(const struct cse_table *cse, struct bmath_cse_stats *out);
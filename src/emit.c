@@ -0,0 +1,232 @@
+#include <inttypes.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "functions.h"
+#include "parser.h"
+#include "program.h"
+
+/*
+ * Translates compiled programs back into C. The postfix ops are rebuilt into
+ * a tree so each function body is a single expression the C compiler is free
+ * to fold, inline and vectorize.
+ */
+
+static const char *emit_builtins[FUNCTIONS] = {
+	[FUNC_ALIGN] = "bmath_align", [FUNC_ALIGN_DOWN] = "bmath_align_down",
+	[FUNC_BSWAP] = "bmath_bswap", [FUNC_CLZ] = "bmath_clz",
+	[FUNC_CTZ] = "bmath_ctz",     [FUNC_MASK] = "bmath_mask",
+	[FUNC_POPCNT] = "bmath_popcnt",
+};
+
+static const char *emit_binary_ops[] = {
+	[OP_MUL] = "*", [OP_ADD] = "+", [OP_SUB] = "-",
+	[OP_AND] = "&", [OP_XOR] = "^", [OP_OR] = "|",
+};
+
+static const char *emit_vars[] = {
+	[VAR_X] = "x",
+	[VAR_Y] = "y",
+};
+
+static const char *emit_helper_ops[] = {
+	[OP_DIV] = "bmath_div",
+	[OP_MOD] = "bmath_mod",
+	[OP_SHL] = "bmath_shl",
+	[OP_SHR] = "bmath_shr",
+};
+
+/*
+ * Helpers mirror src/functions.h and program_step(). The header has to stand
+ * on its own, so the semantics are restated here rather than shared. Errors
+ * that bmath would report evaluate to 0, which is also what the builtins
+ * leave in their result.
+ */
+static const char emit_prologue[] =
+	"#include <stdint.h>\n"
+	"\n"
+	"#ifndef BMATH_EMIT_HELPERS\n"
+	"#define BMATH_EMIT_HELPERS\n"
+	"\n"
+	"static inline uint64_t bmath_div(uint64_t a, uint64_t b)\n"
+	"{\n"
+	"\treturn b ? a / b : 0;\n"
+	"}\n"
+	"\n"
+	"static inline uint64_t bmath_mod(uint64_t a, uint64_t b)\n"
+	"{\n"
+	"\treturn b ? a % b : 0;\n"
+	"}\n"
+	"\n"
+	"static inline uint64_t bmath_shl(uint64_t a, uint64_t b)\n"
+	"{\n"
+	"\treturn a << (b & 63);\n"
+	"}\n"
+	"\n"
+	"static inline uint64_t bmath_shr(uint64_t a, uint64_t b)\n"
+	"{\n"
+	"\treturn a >> (b & 63);\n"
+	"}\n"
+	"\n"
+	"static inline uint64_t bmath_align(uint64_t x, uint64_t a)\n"
+	"{\n"
+	"\treturn (x + a - 1) & ~(a - 1);\n"
+	"}\n"
+	"\n"
+	"static inline uint64_t bmath_align_down(uint64_t x, uint64_t a)\n"
+	"{\n"
+	"\treturn x & ~(a - 1);\n"
+	"}\n"
+	"\n"
+	"static inline uint64_t bmath_bswap(uint64_t x)\n"
+	"{\n"
+	"\tif (x > UINT32_MAX)\n"
+	"\t\treturn __builtin_bswap64(x);\n"
+	"\tif (x > UINT16_MAX)\n"
+	"\t\treturn __builtin_bswap32((uint32_t)x);\n"
+	"\tif (x > UINT8_MAX)\n"
+	"\t\treturn __builtin_bswap16((uint16_t)x);\n"
+	"\treturn x;\n"
+	"}\n"
+	"\n"
+	"static inline uint64_t bmath_clz(uint64_t x, uint64_t bytes)\n"
+	"{\n"
+	"\tif (bytes == 0 || bytes > 8 || x == 0)\n"
+	"\t\treturn 0;\n"
+	"\tif (bytes < 8 && x >> (bytes * 8))\n"
+	"\t\treturn 0;\n"
+	"\treturn __builtin_clzll(x) - (8 - bytes) * 8;\n"
+	"}\n"
+	"\n"
+	"static inline uint64_t bmath_ctz(uint64_t x)\n"
+	"{\n"
+	"\treturn x ? (uint64_t)__builtin_ctzll(x) : 0;\n"
+	"}\n"
+	"\n"
+	"static inline uint64_t bmath_mask(uint64_t bytes)\n"
+	"{\n"
+	"\tif (bytes >= 8)\n"
+	"\t\treturn bytes == 8 ? UINT64_MAX : 0;\n"
+	"\treturn ~(UINT64_MAX << (bytes * 8));\n"
+	"}\n"
+	"\n"
+	"static inline uint64_t bmath_popcnt(uint64_t x)\n"
+	"{\n"
+	"\treturn (uint64_t)__builtin_popcountll(x);\n"
+	"}\n"
+	"\n"
+	"#endif\n";
+
+struct emit_node {
+	const struct program_op *op;
+	// children are stored as indices into the node array
+	size_t args[FUNCTIONS_MAX_OPS];
+};
+
+static void __emit_node(FILE *out, const struct emit_node *nodes, size_t n)
+{
+	const struct emit_node *node = &nodes[n];
+	const struct program_op *op = node->op;
+
+	switch (op->code) {
+	case OP_PUSH:
+		fprintf(out, "UINT64_C(%" PRIu64 ")", op->imm);
+		return;
+	case OP_VAR:
+		fputs(emit_vars[op->imm], out);
+		return;
+	case OP_NEG:
+	case OP_NOT:
+		fputs(op->code == OP_NEG ? "(-" : "(~", out);
+		__emit_node(out, nodes, node->args[0]);
+		fputc(')', out);
+		return;
+	case OP_CALL:
+		fprintf(out, "%s(", emit_builtins[op->imm]);
+		for (uint8_t i = 0; i < op->argc; i++) {
+			if (i)
+				fputs(", ", out);
+			__emit_node(out, nodes, node->args[i]);
+		}
+		fputc(')', out);
+		return;
+	case OP_DIV:
+	case OP_MOD:
+	case OP_SHL:
+	case OP_SHR:
+		fprintf(out, "%s(", emit_helper_ops[op->code]);
+		__emit_node(out, nodes, node->args[0]);
+		fputs(", ", out);
+		__emit_node(out, nodes, node->args[1]);
+		fputc(')', out);
+		return;
+	default:
+		fputc('(', out);
+		__emit_node(out, nodes, node->args[0]);
+		fprintf(out, " %s ", emit_binary_ops[op->code]);
+		__emit_node(out, nodes, node->args[1]);
+		fputc(')', out);
+		return;
+	}
+}
+
+int bmath_emit_c_begin(FILE *out)
+{
+	fputs("// THIS FILE IS GENERATED!\n", out);
+	fputs(emit_prologue, out);
+	return 0;
+}
+
+int bmath_emit_c(FILE *out, const struct bmath_program *program,
+		 const char *func_name)
+{
+	struct emit_node *nodes;
+	size_t *stack, depth = 0;
+	const struct program_op *op;
+	uint8_t argc;
+
+	nodes = malloc(program->len * sizeof(*nodes));
+	stack = malloc(program->max_depth * sizeof(*stack));
+	if (!nodes || !stack) {
+		free(nodes);
+		free(stack);
+		return PE_NO_MEMORY;
+	}
+
+	for (size_t i = 0; i < program->len; i++) {
+		op = &program->ops[i];
+		nodes[i].op = op;
+
+		switch (op->code) {
+		case OP_PUSH:
+		case OP_VAR:
+			argc = 0;
+			break;
+		case OP_NEG:
+		case OP_NOT:
+			argc = 1;
+			break;
+		case OP_CALL:
+			argc = op->argc;
+			break;
+		default:
+			argc = 2;
+			break;
+		}
+
+		depth -= argc;
+		for (uint8_t j = 0; j < argc; j++)
+			nodes[i].args[j] = stack[depth + j];
+		stack[depth++] = i;
+	}
+
+	fprintf(out, "\nstatic inline uint64_t %s(%s)\n{\n\treturn ", func_name,
+		program->vars ? "uint64_t x, uint64_t y" : "void");
+	__emit_node(out, nodes, stack[0]);
+	fputs(";\n}\n", out);
+
+	free(nodes);
+	free(stack);
+	return 0;
+}
@@ -0,0 +1,120 @@
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "parser.h"
+#include "functions.h"
+#include "token.h"
+
+/*
+ * Text for the errors recorded in struct bmath_error. Nothing here runs
+ * unless an error is rendered, so formatting stays out of the parser.
+ */
+
+// the caret line is written in runs of these rather than a byte at a time
+static const char tildes[64] = "~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~"
+			       "~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~";
+
+static const char *error_msgs[] = {
+	[BMATH_ENONE] = "No error",
+	[BMATH_EEMPTY] = "Nothing to parse",
+	[BMATH_ETOO_LONG] = "Expression too long",
+	[BMATH_EILLEGAL] = "Illegal character",
+	[BMATH_ENUMBER_RANGE] = "Number exceeds 8 bytes",
+	[BMATH_EHEX_RANGE] = "Hex exceeds 8 bytes",
+	[BMATH_EHEX_INVALID] = "Invalid hex",
+	[BMATH_EWIDTH] = "Number exceeds the width",
+	[BMATH_EUNEXPECTED] = "Unexpected token",
+	[BMATH_EVARIABLE] = "Variables are only allowed in compiled expressions",
+	[BMATH_EUNDEFINED] = "Undefined name",
+	[BMATH_EDEFINED] = "Already defined",
+	[BMATH_EDIVZERO] = "Division by zero",
+	[BMATH_EFUNC] = "Function returned error code",
+	[BMATH_EEXPANSION] = "Calls expand to too many operations",
+	[BMATH_EBUDGET] = "Over budget",
+	[BMATH_ENOMEM] = "Out of memory",
+	[BMATH_EEVAL] = "Something went wrong evaluating.",
+};
+
+static const char *limit_msgs[] = {
+	[BMATH_LIMIT_NONE] = "",
+	[BMATH_LIMIT_TOKENS] = "too many tokens",
+	[BMATH_LIMIT_DEPTH] = "nested too deeply",
+	[BMATH_LIMIT_CALLS] = "too many calls",
+	[BMATH_LIMIT_STEPS] = "too many operations",
+	[BMATH_LIMIT_DEADLINE] = "out of time",
+};
+
+// errors that aren't about a place in the expression
+static inline bool __general(enum bmath_error_code code)
+{
+	return code == BMATH_EEMPTY || code == BMATH_ETOO_LONG ||
+	       code == BMATH_ENOMEM || code == BMATH_EEVAL;
+}
+
+size_t bmath_error_message(const struct bmath_error *error, char *buf,
+			   size_t size)
+{
+	int n;
+
+	// without its details an error is described by its code alone
+	if (error->code == BMATH_EUNEXPECTED && error->expected &&
+	    error->actual) {
+		n = snprintf(buf, size, "Expecting a %s, but got %s instead.",
+			     error->expected, error->actual);
+	} else if (error->code == BMATH_EFUNC && error->func_err) {
+		n = snprintf(buf, size, "%s: %d %s", error_msgs[BMATH_EFUNC],
+			     error->func_err, str_func_err(error->func_err));
+	} else if (error->code == BMATH_EBUDGET && error->limit) {
+		n = snprintf(buf, size, "%s, %s", error_msgs[BMATH_EBUDGET],
+			     limit_msgs[error->limit]);
+	} else {
+		n = snprintf(buf, size, "%s", error_msgs[error->code]);
+	}
+
+	return n < 0 ? 0 : (size_t)n;
+}
+
+void bmath_error_render(FILE *out, const struct bmath_error *error,
+			const char *expr, size_t len)
+{
+	char msg[128];
+	const char *nul;
+
+	if (error->code == BMATH_ENONE) {
+		return;
+	}
+
+	bmath_error_message(error, msg, sizeof(msg));
+
+	if (error->batch) {
+		fprintf(out, "[ERROR]: Input %zu faulted\n", error->input);
+	}
+
+	if (__general(error->code)) {
+		fprintf(out, "[ERROR]: %s\n", msg);
+		return;
+	}
+
+	if (!expr) {
+		fprintf(out, "[ERROR]: %s at column %" PRIu32 "\n", msg,
+			error->pos);
+		return;
+	}
+
+	// lines end at len, or at a NUL before it
+	nul = memchr(expr, '\0', len);
+	if (nul) {
+		len = nul - expr;
+	}
+
+	fputs("[PARSE ERROR]: There was an error parsing the expression:\n",
+	      out);
+	fwrite(expr, 1, len, out);
+	fputc('\n', out);
+	for (size_t n = error->pos; n; n -= n < 64 ? n : 64) {
+		fwrite(tildes, 1, n < 64 ? n : 64, out);
+	}
+	fprintf(out, "^ %s\n", msg);
+}
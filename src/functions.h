@@ -1,5 +1,6 @@
 #pragma once
 
+#include <stdbool.h>
 #include <stdint.h>
 
 enum func_err { FUNC_ESUCCESS = 0, FUNC_EINVAL = 1, FUNC_ERANGE };
@@ -14,19 +15,176 @@ static inline const char *str_func_err(enum func_err err)
 	return str_func_err_tbl[err];
 }
 
+// most arguments a call can be parsed with, builtin or defined
 #define FUNCTIONS_MAX_OPS 7
-typedef enum func_err (*bmath_func_t)(uint64_t *, int,
-				      uint64_t argv[FUNCTIONS_MAX_OPS]);
-
-enum func_err align(uint64_t *retval, int argc,
-		    uint64_t argv[FUNCTIONS_MAX_OPS]);
-enum func_err align_down(uint64_t *retval, int argc,
-			 uint64_t argv[FUNCTIONS_MAX_OPS]);
-enum func_err bswap(uint64_t *retval, int argc,
-		    uint64_t argv[FUNCTIONS_MAX_OPS]);
-enum func_err clz(uint64_t *retval, int argc, uint64_t argv[FUNCTIONS_MAX_OPS]);
-enum func_err ctz(uint64_t *retval, int argc, uint64_t argv[FUNCTIONS_MAX_OPS]);
-enum func_err mask(uint64_t *retval, int argc,
-		   uint64_t argv[FUNCTIONS_MAX_OPS]);
-enum func_err popcnt(uint64_t *retval, int argc,
-		     uint64_t argv[FUNCTIONS_MAX_OPS]);
+// most arguments a builtin takes
+#define FUNC_MAX_ARGC 2
+
+/*
+ * The builtins, which OP_CALL carries in imm. Each takes a fixed number of
+ * arguments, which the parser checks once for every call, so running one
+ * never has to.
+ */
+enum func_id {
+	FUNC_ALIGN = 0,
+	FUNC_ALIGN_DOWN,
+	FUNC_BSWAP,
+	FUNC_CLZ,
+	FUNC_CTZ,
+	FUNC_MASK,
+	FUNC_POPCNT,
+	FUNCTIONS,
+};
+
+struct func_range {
+	uint64_t min;
+	uint64_t max;
+};
+
+#define FUNC_ANY { 0, UINT64_MAX }
+
+struct func_info {
+	const char *name;
+	uint8_t argc;
+	// a call without arguments is zero, as mask() is
+	bool nullary;
+	// what each argument may be, calls fail with FUNC_ERANGE otherwise
+	struct func_range ranges[FUNC_MAX_ARGC];
+	// calls may also fail with arguments in range, as clz() does with a
+	// value wider than its bytes
+	bool partial;
+};
+
+static const struct func_info func_info[FUNCTIONS] = {
+	[FUNC_ALIGN] = { "align", 2, false, { FUNC_ANY, FUNC_ANY }, false },
+	[FUNC_ALIGN_DOWN] = { "align_down", 2, false, { FUNC_ANY, FUNC_ANY },
+			      false },
+	[FUNC_BSWAP] = { "bswap", 1, false, { FUNC_ANY, FUNC_ANY }, false },
+	[FUNC_CLZ] = { "clz", 2, false, { FUNC_ANY, { 1, 8 } }, true },
+	[FUNC_CTZ] = { "ctz", 1, false, { FUNC_ANY, FUNC_ANY }, false },
+	[FUNC_MASK] = { "mask", 1, true, { { 0, 8 }, FUNC_ANY }, false },
+	[FUNC_POPCNT] = { "popcnt", 1, false, { FUNC_ANY, FUNC_ANY }, false },
+};
+
+/**
+ * Whether a builtin can be called with argc arguments.
+ * @return FUNC_ESUCCESS or FUNC_EINVAL
+ */
+static inline enum func_err func_arity(enum func_id id, int argc)
+{
+	if (argc == func_info[id].argc || (argc == 0 && func_info[id].nullary))
+		return FUNC_ESUCCESS;
+	return FUNC_EINVAL;
+}
+
+static inline bool func_in_range(enum func_id id, int arg, uint64_t value)
+{
+	return value >= func_info[id].ranges[arg].min &&
+	       value <= func_info[id].ranges[arg].max;
+}
+
+/*
+ * The builtins themselves. Each zeroes its result when it fails.
+ */
+
+static inline enum func_err func_align(uint64_t *ret, uint64_t x, uint64_t a)
+{
+	*ret = (x + a - 1) & ~(a - 1);
+	return FUNC_ESUCCESS;
+}
+
+static inline enum func_err func_align_down(uint64_t *ret, uint64_t x,
+					    uint64_t a)
+{
+	*ret = x & ~(a - 1);
+	return FUNC_ESUCCESS;
+}
+
+static inline enum func_err func_bswap(uint64_t *ret, uint64_t x)
+{
+	if (x > UINT32_MAX)
+		*ret = __builtin_bswap64(x);
+	else if (x > UINT16_MAX)
+		*ret = __builtin_bswap32((uint32_t)x);
+	else if (x > UINT8_MAX)
+		*ret = __builtin_bswap16((uint16_t)x);
+	else
+		*ret = x;
+	return FUNC_ESUCCESS;
+}
+
+static inline enum func_err func_clz(uint64_t *ret, uint64_t value,
+				     uint64_t bytes)
+{
+	uint64_t zeros;
+
+	*ret = 0;
+	if (!func_in_range(FUNC_CLZ, 1, bytes))
+		return FUNC_ERANGE;
+
+	if (value == 0)
+		return FUNC_ESUCCESS;
+
+	// zeros within the low bytes, which the value has to fit in
+	zeros = __builtin_clzll(value) - (8 - bytes) * 8;
+	if (zeros >= bytes * 8)
+		return FUNC_ERANGE;
+
+	*ret = zeros;
+	return FUNC_ESUCCESS;
+}
+
+static inline enum func_err func_ctz(uint64_t *ret, uint64_t x)
+{
+	*ret = x ? (uint64_t)__builtin_ctzll(x) : 0;
+	return FUNC_ESUCCESS;
+}
+
+static inline enum func_err func_mask(uint64_t *ret, uint64_t bytes)
+{
+	*ret = 0;
+	if (!func_in_range(FUNC_MASK, 0, bytes))
+		return FUNC_ERANGE;
+
+	*ret = bytes == 8 ? UINT64_MAX : ~(UINT64_MAX << (bytes * 8));
+	return FUNC_ESUCCESS;
+}
+
+static inline enum func_err func_popcnt(uint64_t *ret, uint64_t x)
+{
+	*ret = (uint64_t)__builtin_popcountll(x);
+	return FUNC_ESUCCESS;
+}
+
+/**
+ * Call a builtin with as many arguments as it takes, see func_arity().
+ * @param uint64_t id An enum func_id
+ */
+static inline enum func_err func_call(uint64_t *ret, uint64_t id,
+				      const uint64_t *argv)
+{
+	switch (id) {
+	case FUNC_ALIGN:
+		return func_align(ret, argv[0], argv[1]);
+	case FUNC_ALIGN_DOWN:
+		return func_align_down(ret, argv[0], argv[1]);
+	case FUNC_BSWAP:
+		return func_bswap(ret, argv[0]);
+	case FUNC_CLZ:
+		return func_clz(ret, argv[0], argv[1]);
+	case FUNC_CTZ:
+		return func_ctz(ret, argv[0]);
+	case FUNC_MASK:
+		return func_mask(ret, argv[0]);
+	case FUNC_POPCNT:
+		return func_popcnt(ret, argv[0]);
+	default:
+		*ret = 0;
+		return FUNC_EINVAL;
+	}
+}
+
+/**
+ * func_call() out of line, for native code to call.
+ */
+enum func_err func_dispatch(uint64_t *ret, uint64_t id, const uint64_t *argv);
@@ -0,0 +1,508 @@
+#ifdef BMATH_JIT
+
+// MAP_ANONYMOUS
+#define _DEFAULT_SOURCE
+
+#include <cpuid.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "functions.h"
+#include "jit.h"
+#include "program.h"
+#include "util.h"
+
+/*
+ * A straightforward template JIT for the stack programs in program.h.
+ *
+ * Register use:
+ *   rax  top of the value stack
+ *   rbx  base of the value stack; slot n lives at [rbx + 8 * n]
+ *   rcx, rdx  scratch
+ *   [rbp - 16]  saved out_result pointer
+ *   [rbp - 24]  saved vars pointer
+ *   [rsp]  return slot for generic builtin calls
+ *
+ * Every value below the top of the stack lives in its slot, so the depth at
+ * each op is known statically and no pushes or pops are generated.
+ */
+
+#define JIT_MIN_CAP 256
+
+struct jit_features {
+	bool popcnt;
+	bool lzcnt;
+	bool tzcnt;
+};
+
+struct jit_buf {
+	uint8_t *code;
+	size_t len;
+	size_t cap;
+	// rel32 displacements that need to point at the fault handler
+	size_t *faults;
+	size_t nfaults;
+	size_t faults_cap;
+	bool oom;
+};
+
+static struct jit_features __detect_features()
+{
+	struct jit_features f = { 0 };
+	unsigned int eax, ebx, ecx, edx;
+
+	if (__get_cpuid(1, &eax, &ebx, &ecx, &edx)) {
+		f.popcnt = ecx & bit_POPCNT;
+	}
+
+	if (__get_cpuid(0x80000001, &eax, &ebx, &ecx, &edx)) {
+		f.lzcnt = ecx & bit_LZCNT;
+	}
+
+	if (__get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx)) {
+		f.tzcnt = ebx & bit_BMI;
+	}
+
+	return f;
+}
+
+static void __emit_bytes(struct jit_buf *b, const void *bytes, size_t n)
+{
+	uint8_t *code;
+	size_t cap;
+
+	if (unlikely(b->len + n > b->cap)) {
+		cap = b->cap ? b->cap : JIT_MIN_CAP;
+		while (cap < b->len + n) {
+			cap *= 2;
+		}
+
+		code = realloc(b->code, cap);
+		if (!code) {
+			b->oom = true;
+			return;
+		}
+
+		b->code = code;
+		b->cap = cap;
+	}
+
+	memcpy(b->code + b->len, bytes, n);
+	b->len += n;
+}
+
+#define __emit(b, ...)                                                 \
+	do {                                                           \
+		const uint8_t _bytes[] = { __VA_ARGS__ };              \
+		__emit_bytes((b), _bytes, sizeof(_bytes));             \
+	} while (0)
+
+static inline void __emit_u32(struct jit_buf *b, uint32_t v)
+{
+	__emit_bytes(b, &v, sizeof(v));
+}
+
+static inline void __emit_u64(struct jit_buf *b, uint64_t v)
+{
+	__emit_bytes(b, &v, sizeof(v));
+}
+
+static inline uint32_t __slot(size_t n)
+{
+	return (uint32_t)(n * sizeof(uint64_t));
+}
+
+/*
+ * Emits a rel32 jump (jmp or jcc) and returns the offset of its
+ * displacement so it can be patched once the target is known.
+ */
+static size_t __emit_jump(struct jit_buf *b, uint8_t cc)
+{
+	if (cc) {
+		__emit(b, 0x0f, cc);
+	} else {
+		__emit(b, 0xe9);
+	}
+	__emit_u32(b, 0);
+	return b->len - sizeof(uint32_t);
+}
+
+static void __patch_jump(struct jit_buf *b, size_t at, size_t target)
+{
+	int32_t rel = (int32_t)(target - (at + sizeof(int32_t)));
+
+	if (!b->oom) {
+		memcpy(b->code + at, &rel, sizeof(rel));
+	}
+}
+
+#define JCC_JAE 0x83
+#define JCC_JZ 0x84
+#define JCC_JNZ 0x85
+#define JCC_JBE 0x86
+#define JCC_JA 0x87
+
+static void __emit_fault_jump(struct jit_buf *b, uint8_t cc)
+{
+	size_t at = __emit_jump(b, cc);
+	size_t *faults;
+
+	if (b->nfaults == b->faults_cap) {
+		b->faults_cap = b->faults_cap ? b->faults_cap * 2 : 16;
+		faults = realloc(b->faults, b->faults_cap * sizeof(*faults));
+		if (!faults) {
+			b->oom = true;
+			return;
+		}
+		b->faults = faults;
+	}
+
+	b->faults[b->nfaults++] = at;
+}
+
+// mov [rbx + slot], rax
+static inline void __store_top(struct jit_buf *b, size_t slot)
+{
+	__emit(b, 0x48, 0x89, 0x83);
+	__emit_u32(b, __slot(slot));
+}
+
+// <op> rax, [rbx + slot]
+static inline void __alu_slot(struct jit_buf *b, uint8_t opcode, size_t slot)
+{
+	__emit(b, 0x48, opcode, 0x83);
+	__emit_u32(b, __slot(slot));
+}
+
+// mov rcx, rax; mov rax, [rbx + slot]
+static inline void __swap_in_left(struct jit_buf *b, size_t slot)
+{
+	__emit(b, 0x48, 0x89, 0xc1);
+	__alu_slot(b, 0x8b, slot);
+}
+
+static void __emit_push(struct jit_buf *b, size_t depth, uint64_t imm)
+{
+	if (depth) {
+		__store_top(b, depth - 1);
+	}
+
+	if (imm == 0) {
+		__emit(b, 0x31, 0xc0); // xor eax, eax
+	} else if (imm <= UINT32_MAX) {
+		__emit(b, 0xb8); // mov eax, imm32
+		__emit_u32(b, (uint32_t)imm);
+	} else {
+		__emit(b, 0x48, 0xb8); // mov rax, imm64
+		__emit_u64(b, imm);
+	}
+}
+
+static void __emit_var(struct jit_buf *b, size_t depth, uint64_t var)
+{
+	if (depth) {
+		__store_top(b, depth - 1);
+	}
+
+	__emit(b, 0x48, 0x8b, 0x4d, 0xe8); // mov rcx, [rbp - 24]
+	__emit(b, 0x48, 0x8b, 0x81); // mov rax, [rcx + disp32]
+	__emit_u32(b, __slot(var));
+}
+
+static void __emit_binary(struct jit_buf *b, uint8_t code, size_t depth)
+{
+	size_t left = depth - 2;
+
+	switch (code) {
+	case OP_ADD:
+		__alu_slot(b, 0x03, left);
+		break;
+	case OP_AND:
+		__alu_slot(b, 0x23, left);
+		break;
+	case OP_OR:
+		__alu_slot(b, 0x0b, left);
+		break;
+	case OP_XOR:
+		__alu_slot(b, 0x33, left);
+		break;
+	case OP_MUL:
+		// imul rax, [rbx + slot]
+		__emit(b, 0x48, 0x0f, 0xaf, 0x83);
+		__emit_u32(b, __slot(left));
+		break;
+	case OP_SUB:
+		__swap_in_left(b, left);
+		__emit(b, 0x48, 0x29, 0xc8); // sub rax, rcx
+		break;
+	// the hardware masks the count to 6 bits, same as program_step()
+	case OP_SHL:
+		__swap_in_left(b, left);
+		__emit(b, 0x48, 0xd3, 0xe0); // shl rax, cl
+		break;
+	case OP_SHR:
+		__swap_in_left(b, left);
+		__emit(b, 0x48, 0xd3, 0xe8); // shr rax, cl
+		break;
+	case OP_DIV:
+	case OP_MOD:
+		__emit(b, 0x48, 0x85, 0xc0); // test rax, rax
+		__emit_fault_jump(b, JCC_JZ);
+		__swap_in_left(b, left);
+		__emit(b, 0x31, 0xd2); // xor edx, edx
+		__emit(b, 0x48, 0xf7, 0xf1); // div rcx
+		if (code == OP_MOD) {
+			__emit(b, 0x48, 0x89, 0xd0); // mov rax, rdx
+		}
+		break;
+	default:
+		break;
+	}
+}
+
+static void __emit_bswap(struct jit_buf *b)
+{
+	size_t to_64, to_32, done_8, done_16, done_32;
+
+	// bswap() picks the narrowest width that holds the value
+	__emit(b, 0x48, 0x89, 0xc1); // mov rcx, rax
+	__emit(b, 0x48, 0xc1, 0xe9, 0x20); // shr rcx, 32
+	to_64 = __emit_jump(b, JCC_JNZ);
+	__emit(b, 0x3d); // cmp eax, 0xffff
+	__emit_u32(b, UINT16_MAX);
+	to_32 = __emit_jump(b, JCC_JA);
+	__emit(b, 0x3d); // cmp eax, 0xff
+	__emit_u32(b, UINT8_MAX);
+	done_8 = __emit_jump(b, JCC_JBE);
+	__emit(b, 0x66, 0xc1, 0xc0, 0x08); // rol ax, 8
+	done_16 = __emit_jump(b, 0);
+	__patch_jump(b, to_32, b->len);
+	__emit(b, 0x0f, 0xc8); // bswap eax
+	done_32 = __emit_jump(b, 0);
+	__patch_jump(b, to_64, b->len);
+	__emit(b, 0x48, 0x0f, 0xc8); // bswap rax
+	__patch_jump(b, done_8, b->len);
+	__patch_jump(b, done_16, b->len);
+	__patch_jump(b, done_32, b->len);
+}
+
+/*
+ * clz(x, bytes) with `bytes` known at compile time and x in rax.
+ */
+static void __emit_clz(struct jit_buf *b, uint64_t bytes)
+{
+	size_t done;
+
+	__emit(b, 0x48, 0x85, 0xc0); // test rax, rax
+	done = __emit_jump(b, JCC_JZ);
+
+	// values wider than `bytes` are out of range
+	if (bytes < 8) {
+		__emit(b, 0x48, 0xb9); // mov rcx, imm64
+		__emit_u64(b, (uint64_t)1 << (bytes * 8));
+		__emit(b, 0x48, 0x39, 0xc8); // cmp rax, rcx
+		__emit_fault_jump(b, JCC_JAE);
+	}
+
+	__emit(b, 0xf3, 0x48, 0x0f, 0xbd, 0xc0); // lzcnt rax, rax
+	if (bytes < 8) {
+		__emit(b, 0x48, 0x83, 0xe8, (uint8_t)((8 - bytes) * 8));
+	}
+	__patch_jump(b, done, b->len);
+}
+
+/*
+ * Builtins with a native equivalent are lowered inline, everything else goes
+ * through func_dispatch().
+ */
+static bool __emit_builtin(struct jit_buf *b, const struct jit_features *f,
+			   const struct program_op *op, size_t depth)
+{
+	switch (op->imm) {
+	case FUNC_POPCNT:
+		if (!f->popcnt)
+			return false;
+		__emit(b, 0xf3, 0x48, 0x0f, 0xb8, 0xc0); // popcnt rax, rax
+		return true;
+	case FUNC_CTZ:
+		if (!f->tzcnt)
+			return false;
+		// tzcnt yields 64 for zero, ctz() wants 0
+		__emit(b, 0xf3, 0x48, 0x0f, 0xbc, 0xc0); // tzcnt rax, rax
+		__emit(b, 0x83, 0xe0, 0x3f); // and eax, 63
+		return true;
+	case FUNC_BSWAP:
+		__emit_bswap(b);
+		return true;
+	case FUNC_ALIGN:
+	case FUNC_ALIGN_DOWN:
+		__emit(b, 0x48, 0x8d, 0x48, 0xff); // lea rcx, [rax - 1]
+		__emit(b, 0x48, 0xf7, 0xd1); // not rcx
+		__alu_slot(b, 0x8b, depth - 2); // mov rax, [rbx + slot]
+		if (op->imm == FUNC_ALIGN) {
+			// x + (a - 1) == x - ~(a - 1) - 1
+			__emit(b, 0x48, 0x29, 0xc8); // sub rax, rcx
+			__emit(b, 0x48, 0x83, 0xe8, 0x01); // sub rax, 1
+		}
+		__emit(b, 0x48, 0x21, 0xc8); // and rax, rcx
+		return true;
+	default:
+		return false;
+	}
+}
+
+static void __emit_call(struct jit_buf *b, const struct program_op *op,
+			size_t depth)
+{
+	if (depth) {
+		__store_top(b, depth - 1);
+	}
+
+	__emit(b, 0x48, 0x8d, 0x3c, 0x24); // lea rdi, [rsp]
+	__emit(b, 0xbe); // mov esi, id
+	__emit_u32(b, (uint32_t)op->imm);
+	__emit(b, 0x48, 0x8d, 0x93); // lea rdx, [rbx + slot]
+	__emit_u32(b, __slot(depth - op->argc));
+	__emit(b, 0x48, 0xb8); // mov rax, func_dispatch
+	__emit_u64(b, (uint64_t)(uintptr_t)func_dispatch);
+	__emit(b, 0xff, 0xd0); // call rax
+	__emit(b, 0x85, 0xc0); // test eax, eax
+	__emit_fault_jump(b, JCC_JNZ);
+	__emit(b, 0x48, 0x8b, 0x04, 0x24); // mov rax, [rsp]
+}
+
+static void __emit_program(struct jit_buf *b, const struct jit_features *f,
+			   const struct bmath_program *prog)
+{
+	const struct program_op *op, *next;
+	size_t depth = 0;
+	size_t done;
+
+	// push rbp; mov rbp, rsp; push rbx; push rdx; push rsi; sub rsp, 8;
+	// mov rbx, rdi
+	__emit(b, 0x55, 0x48, 0x89, 0xe5, 0x53, 0x52, 0x56, 0x48, 0x83, 0xec,
+	       0x08, 0x48, 0x89, 0xfb);
+
+	for (size_t i = 0; i < prog->len; i++) {
+		op = &prog->ops[i];
+		next = i + 1 < prog->len ? &prog->ops[i + 1] : NULL;
+
+		switch (op->code) {
+		case OP_PUSH:
+			// clz() with a literal width folds the range check
+			// into the generated code
+			if (next && next->code == OP_CALL &&
+			    next->imm == FUNC_CLZ &&
+			    func_in_range(FUNC_CLZ, 1, op->imm) && f->lzcnt) {
+				__emit_clz(b, op->imm);
+				i++;
+				break;
+			}
+			__emit_push(b, depth, op->imm);
+			depth++;
+			break;
+		case OP_VAR:
+			__emit_var(b, depth, op->imm);
+			depth++;
+			break;
+		case OP_NEG:
+			__emit(b, 0x48, 0xf7, 0xd8); // neg rax
+			break;
+		case OP_NOT:
+			__emit(b, 0x48, 0xf7, 0xd0); // not rax
+			break;
+		case OP_CALL:
+			if (!__emit_builtin(b, f, op, depth)) {
+				__emit_call(b, op, depth);
+			}
+			depth = depth - op->argc + 1;
+			break;
+		default:
+			__emit_binary(b, op->code, depth);
+			depth--;
+			break;
+		}
+	}
+
+	// mov rcx, [rbp - 16]; mov [rcx], rax; xor eax, eax
+	__emit(b, 0x48, 0x8b, 0x4d, 0xf0, 0x48, 0x89, 0x01, 0x31, 0xc0);
+	done = __emit_jump(b, 0);
+
+	for (size_t i = 0; i < b->nfaults; i++) {
+		__patch_jump(b, b->faults[i], b->len);
+	}
+	__emit(b, 0xb8, 0x01, 0x00, 0x00, 0x00); // mov eax, 1
+
+	__patch_jump(b, done, b->len);
+	// mov rbx, [rbp - 8]; leave; ret
+	__emit(b, 0x48, 0x8b, 0x5d, 0xf8, 0xc9, 0xc3);
+}
+
+int jit_compile(struct bmath_program *prog)
+{
+	struct jit_features features = __detect_features();
+	struct jit_buf b = { 0 };
+	size_t page = sysconf(_SC_PAGESIZE);
+	size_t size, color;
+	uint8_t *mem;
+
+	__emit_program(&b, &features, prog);
+	free(b.faults);
+	if (b.oom) {
+		free(b.code);
+		return PROG_ENOMEM;
+	}
+
+	/*
+	 * Every program gets its own mapping. Starting each one on a different
+	 * cache line within the page keeps hot programs from all landing in
+	 * the same L1i sets.
+	 */
+	color = ((((uintptr_t)prog >> 4) * 2654435761u) % (page / 64)) * 64;
+	size = (color + b.len + page - 1) & ~(page - 1);
+	mem = mmap(NULL, size, PROT_READ | PROT_WRITE,
+		   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (mem == MAP_FAILED) {
+		free(b.code);
+		return PROG_ENOMEM;
+	}
+
+	memcpy(mem + color, b.code, b.len);
+	free(b.code);
+
+	if (mprotect(mem, size, PROT_READ | PROT_EXEC)) {
+		munmap(mem, size);
+		return PROG_ENOMEM;
+	}
+
+	// another thread may have promoted the program in the meantime. Only
+	// the one whose code was published records its mapping, the others
+	// would overwrite it with one they are about to unmap.
+	if (!__atomic_compare_exchange_n(&prog->jit, &(void *){ NULL },
+					 mem + color, false, __ATOMIC_ACQ_REL,
+					 __ATOMIC_ACQUIRE)) {
+		munmap(mem, size);
+		return PROG_ESUCCESS;
+	}
+
+	prog->jit_map = mem;
+	prog->jit_size = size;
+	return PROG_ESUCCESS;
+}
+
+void jit_release(struct bmath_program *prog)
+{
+	if (!prog->jit) {
+		return;
+	}
+
+	munmap(prog->jit_map, prog->jit_size);
+	prog->jit = NULL;
+	prog->jit_map = NULL;
+	prog->jit_size = 0;
+}
+
+#endif
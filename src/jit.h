@@ -0,0 +1,47 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "program.h"
+
+/*
+ * Native code for a compiled program. Returns zero and writes the result on
+ * success. A nonzero return means the program faulted; callers re-run the
+ * interpreter to recover the exact error.
+ */
+typedef int (*jit_func_t)(uint64_t *stack, const uint64_t *vars,
+			  uint64_t *out_result);
+
+#ifdef BMATH_JIT
+
+/**
+ * Translate a program into x86-64 machine code. The code is written into an
+ * anonymous RW mapping which is then flipped to RX before it is published.
+ * @return PROG_ESUCCESS or PROG_ENOMEM
+ */
+int jit_compile(struct bmath_program *prog);
+void jit_release(struct bmath_program *prog);
+
+static inline bool jit_available()
+{
+	return true;
+}
+
+#else
+
+static inline int jit_compile(struct bmath_program *prog)
+{
+	return PROG_ENOMEM;
+}
+
+static inline void jit_release(struct bmath_program *prog)
+{
+}
+
+static inline bool jit_available()
+{
+	return false;
+}
+
+#endif
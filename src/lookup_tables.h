@@ -2,100 +2,269 @@
 #ifndef LOOKUP_TABLES_H
 #define LOOKUP_TABLES_H
 
-static int lookup_is_allowed_hex[] = {
-    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 
-    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 
-    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 
-    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 0, 0, 
-    0, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 0, 0, 0, 0, 0, 
-    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 
-    0, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 0, 0, 0, 0, 0, 
-    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 
+#include <stdbool.h>
+#include <stdint.h>
+
+// refers to token.h and program.h, which have to come first
+
+enum lex_class {
+	LEX_CLASS_OTHER = 0,
+	LEX_CLASS_END = 1,
+	LEX_CLASS_SPACE = 2,
+	LEX_CLASS_ZERO = 3,
+	LEX_CLASS_DIGIT = 4,
+	LEX_CLASS_X = 5,
+	LEX_CLASS_UPPER_X = 6,
+	LEX_CLASS_Y = 7,
+	LEX_CLASS_NAME = 8,
+	LEX_CLASS_LT = 9,
+	LEX_CLASS_GT = 10,
+	LEX_CLASS_PERCENT = 11,
+	LEX_CLASS_AMPERSAND = 12,
+	LEX_CLASS_LPAREN = 13,
+	LEX_CLASS_RPAREN = 14,
+	LEX_CLASS_STAR = 15,
+	LEX_CLASS_PLUS = 16,
+	LEX_CLASS_COMMA = 17,
+	LEX_CLASS_MINUS = 18,
+	LEX_CLASS_SLASH = 19,
+	LEX_CLASS_EQUALS = 20,
+	LEX_CLASS_CARET = 21,
+	LEX_CLASS_PIPE = 22,
+	LEX_CLASS_TILDE = 23,
 };
 
-static inline int __is_allowed_hex(char c)
-{
-	return lookup_is_allowed_hex[(int) c];
-}
+enum lex_state {
+	LEX_STATE_START = 0,
+	LEX_STATE_LT = 1,
+	LEX_STATE_GT = 2,
+	LEX_STATE_ZERO = 3,
+};
 
-static int lookup_hex_to_value[] = {
-    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 
-    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 
-    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 
-    0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 0, 0, 0, 0, 0, 0, 
-    0, 10, 11, 12, 13, 14, 15, 0, 0, 0, 0, 0, 0, 0, 0, 0, 
-    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 
-    0, 10, 11, 12, 13, 14, 15, 0, 0, 0, 0, 0, 0, 0, 0, 0, 
-    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 
+#define LEX_STATES 4
+#define LEX_CLASSES 24
+
+// the DFA stops in one of these, see lookup_lex_dfa
+enum lex_accept {
+	LEX_ACCEPT_END = 4,
+	LEX_ACCEPT_TOKEN = 5,
+	LEX_ACCEPT_SHIFT = 6,
+	LEX_ACCEPT_DECIMAL = 7,
+	LEX_ACCEPT_HEX = 8,
+	LEX_ACCEPT_NAME = 9,
+	LEX_ACCEPT_ILLEGAL = 10,
 };
 
-static inline int __hex_to_value(char c)
-{
-	return lookup_hex_to_value[(int) c];
-}
+/*
+ * One byte per character: its lexer class in the low bits, whether it is
+ * a decimal or a hex digit, and whether it can appear in a token at all.
+ * Indexed by unsigned char, so bytes with the high bit set are
+ * LEX_CLASS_OTHER like any other illegal character.
+ */
+#define LEX_CLASS_MASK 0x1f
+#define LEX_FLAG_DIGIT 0x20
+#define LEX_FLAG_HEX 0x40
+#define LEX_FLAG_ALLOWED 0x80
 
-static int lookup_is_digit[] = {
-    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 
-    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 
-    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 
-    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 0, 0, 
-    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 
-    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 
-    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 
-    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 
+static const uint8_t lookup_char_class[256] = {
+    0x01, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 
+    0x00, 0x82, 0x82, 0x00, 0x00, 0x82, 0x00, 0x00, 
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 
+    0x82, 0x00, 0x00, 0x00, 0x00, 0x8b, 0x8c, 0x00, 
+    0x8d, 0x8e, 0x8f, 0x90, 0x91, 0x92, 0x00, 0x93, 
+    0xe3, 0xe4, 0xe4, 0xe4, 0xe4, 0xe4, 0xe4, 0xe4, 
+    0xe4, 0xe4, 0x00, 0x00, 0x89, 0x94, 0x8a, 0x00, 
+    0x00, 0xc0, 0xc0, 0xc0, 0xc0, 0xc0, 0xc0, 0x00, 
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 
+    0x86, 0x00, 0x00, 0x00, 0x00, 0x00, 0x95, 0x88, 
+    0x88, 0xc8, 0xc8, 0xc8, 0xc8, 0xc8, 0xc8, 0x88, 
+    0x88, 0x88, 0x88, 0x88, 0x88, 0x88, 0x88, 0x88, 
+    0x88, 0x88, 0x88, 0x88, 0x88, 0x88, 0x88, 0x88, 
+    0x85, 0x87, 0x88, 0x00, 0x96, 0x00, 0x97, 0x00, 
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 
 };
 
-static inline int __is_digit(char c)
-{
-	return lookup_is_digit[(int) c];
-}
+/*
+ * lookup_lex_dfa[state][class] is the next state, consuming the character,
+ * or an accept code at or past LEX_STATES, leaving it for the token.
+ * Only whitespace loops back to LEX_STATE_START, and every other state is
+ * one character into its token and accepts on the next one.
+ */
+static const uint8_t lookup_lex_dfa[LEX_STATES][LEX_CLASS_MASK + 1] = {
+	[LEX_STATE_START] = {
+		[LEX_CLASS_OTHER] = LEX_ACCEPT_ILLEGAL,
+		[LEX_CLASS_END] = LEX_ACCEPT_END,
+		[LEX_CLASS_SPACE] = LEX_STATE_START,
+		[LEX_CLASS_ZERO] = LEX_STATE_ZERO,
+		[LEX_CLASS_DIGIT] = LEX_ACCEPT_DECIMAL,
+		[LEX_CLASS_X] = LEX_ACCEPT_NAME,
+		[LEX_CLASS_UPPER_X] = LEX_ACCEPT_ILLEGAL,
+		[LEX_CLASS_Y] = LEX_ACCEPT_NAME,
+		[LEX_CLASS_NAME] = LEX_ACCEPT_NAME,
+		[LEX_CLASS_LT] = LEX_STATE_LT,
+		[LEX_CLASS_GT] = LEX_STATE_GT,
+		[LEX_CLASS_PERCENT] = LEX_ACCEPT_TOKEN,
+		[LEX_CLASS_AMPERSAND] = LEX_ACCEPT_TOKEN,
+		[LEX_CLASS_LPAREN] = LEX_ACCEPT_TOKEN,
+		[LEX_CLASS_RPAREN] = LEX_ACCEPT_TOKEN,
+		[LEX_CLASS_STAR] = LEX_ACCEPT_TOKEN,
+		[LEX_CLASS_PLUS] = LEX_ACCEPT_TOKEN,
+		[LEX_CLASS_COMMA] = LEX_ACCEPT_TOKEN,
+		[LEX_CLASS_MINUS] = LEX_ACCEPT_TOKEN,
+		[LEX_CLASS_SLASH] = LEX_ACCEPT_TOKEN,
+		[LEX_CLASS_EQUALS] = LEX_ACCEPT_TOKEN,
+		[LEX_CLASS_CARET] = LEX_ACCEPT_TOKEN,
+		[LEX_CLASS_PIPE] = LEX_ACCEPT_TOKEN,
+		[LEX_CLASS_TILDE] = LEX_ACCEPT_TOKEN,
+	},
+	[LEX_STATE_LT] = {
+		[LEX_CLASS_OTHER] = LEX_ACCEPT_ILLEGAL,
+		[LEX_CLASS_END] = LEX_ACCEPT_ILLEGAL,
+		[LEX_CLASS_SPACE] = LEX_ACCEPT_ILLEGAL,
+		[LEX_CLASS_ZERO] = LEX_ACCEPT_ILLEGAL,
+		[LEX_CLASS_DIGIT] = LEX_ACCEPT_ILLEGAL,
+		[LEX_CLASS_X] = LEX_ACCEPT_ILLEGAL,
+		[LEX_CLASS_UPPER_X] = LEX_ACCEPT_ILLEGAL,
+		[LEX_CLASS_Y] = LEX_ACCEPT_ILLEGAL,
+		[LEX_CLASS_NAME] = LEX_ACCEPT_ILLEGAL,
+		[LEX_CLASS_LT] = LEX_ACCEPT_SHIFT,
+		[LEX_CLASS_GT] = LEX_ACCEPT_ILLEGAL,
+		[LEX_CLASS_PERCENT] = LEX_ACCEPT_ILLEGAL,
+		[LEX_CLASS_AMPERSAND] = LEX_ACCEPT_ILLEGAL,
+		[LEX_CLASS_LPAREN] = LEX_ACCEPT_ILLEGAL,
+		[LEX_CLASS_RPAREN] = LEX_ACCEPT_ILLEGAL,
+		[LEX_CLASS_STAR] = LEX_ACCEPT_ILLEGAL,
+		[LEX_CLASS_PLUS] = LEX_ACCEPT_ILLEGAL,
+		[LEX_CLASS_COMMA] = LEX_ACCEPT_ILLEGAL,
+		[LEX_CLASS_MINUS] = LEX_ACCEPT_ILLEGAL,
+		[LEX_CLASS_SLASH] = LEX_ACCEPT_ILLEGAL,
+		[LEX_CLASS_EQUALS] = LEX_ACCEPT_ILLEGAL,
+		[LEX_CLASS_CARET] = LEX_ACCEPT_ILLEGAL,
+		[LEX_CLASS_PIPE] = LEX_ACCEPT_ILLEGAL,
+		[LEX_CLASS_TILDE] = LEX_ACCEPT_ILLEGAL,
+	},
+	[LEX_STATE_GT] = {
+		[LEX_CLASS_OTHER] = LEX_ACCEPT_ILLEGAL,
+		[LEX_CLASS_END] = LEX_ACCEPT_ILLEGAL,
+		[LEX_CLASS_SPACE] = LEX_ACCEPT_ILLEGAL,
+		[LEX_CLASS_ZERO] = LEX_ACCEPT_ILLEGAL,
+		[LEX_CLASS_DIGIT] = LEX_ACCEPT_ILLEGAL,
+		[LEX_CLASS_X] = LEX_ACCEPT_ILLEGAL,
+		[LEX_CLASS_UPPER_X] = LEX_ACCEPT_ILLEGAL,
+		[LEX_CLASS_Y] = LEX_ACCEPT_ILLEGAL,
+		[LEX_CLASS_NAME] = LEX_ACCEPT_ILLEGAL,
+		[LEX_CLASS_LT] = LEX_ACCEPT_ILLEGAL,
+		[LEX_CLASS_GT] = LEX_ACCEPT_SHIFT,
+		[LEX_CLASS_PERCENT] = LEX_ACCEPT_ILLEGAL,
+		[LEX_CLASS_AMPERSAND] = LEX_ACCEPT_ILLEGAL,
+		[LEX_CLASS_LPAREN] = LEX_ACCEPT_ILLEGAL,
+		[LEX_CLASS_RPAREN] = LEX_ACCEPT_ILLEGAL,
+		[LEX_CLASS_STAR] = LEX_ACCEPT_ILLEGAL,
+		[LEX_CLASS_PLUS] = LEX_ACCEPT_ILLEGAL,
+		[LEX_CLASS_COMMA] = LEX_ACCEPT_ILLEGAL,
+		[LEX_CLASS_MINUS] = LEX_ACCEPT_ILLEGAL,
+		[LEX_CLASS_SLASH] = LEX_ACCEPT_ILLEGAL,
+		[LEX_CLASS_EQUALS] = LEX_ACCEPT_ILLEGAL,
+		[LEX_CLASS_CARET] = LEX_ACCEPT_ILLEGAL,
+		[LEX_CLASS_PIPE] = LEX_ACCEPT_ILLEGAL,
+		[LEX_CLASS_TILDE] = LEX_ACCEPT_ILLEGAL,
+	},
+	[LEX_STATE_ZERO] = {
+		[LEX_CLASS_OTHER] = LEX_ACCEPT_DECIMAL,
+		[LEX_CLASS_END] = LEX_ACCEPT_DECIMAL,
+		[LEX_CLASS_SPACE] = LEX_ACCEPT_DECIMAL,
+		[LEX_CLASS_ZERO] = LEX_ACCEPT_DECIMAL,
+		[LEX_CLASS_DIGIT] = LEX_ACCEPT_DECIMAL,
+		[LEX_CLASS_X] = LEX_ACCEPT_HEX,
+		[LEX_CLASS_UPPER_X] = LEX_ACCEPT_HEX,
+		[LEX_CLASS_Y] = LEX_ACCEPT_DECIMAL,
+		[LEX_CLASS_NAME] = LEX_ACCEPT_DECIMAL,
+		[LEX_CLASS_LT] = LEX_ACCEPT_DECIMAL,
+		[LEX_CLASS_GT] = LEX_ACCEPT_DECIMAL,
+		[LEX_CLASS_PERCENT] = LEX_ACCEPT_DECIMAL,
+		[LEX_CLASS_AMPERSAND] = LEX_ACCEPT_DECIMAL,
+		[LEX_CLASS_LPAREN] = LEX_ACCEPT_DECIMAL,
+		[LEX_CLASS_RPAREN] = LEX_ACCEPT_DECIMAL,
+		[LEX_CLASS_STAR] = LEX_ACCEPT_DECIMAL,
+		[LEX_CLASS_PLUS] = LEX_ACCEPT_DECIMAL,
+		[LEX_CLASS_COMMA] = LEX_ACCEPT_DECIMAL,
+		[LEX_CLASS_MINUS] = LEX_ACCEPT_DECIMAL,
+		[LEX_CLASS_SLASH] = LEX_ACCEPT_DECIMAL,
+		[LEX_CLASS_EQUALS] = LEX_ACCEPT_DECIMAL,
+		[LEX_CLASS_CARET] = LEX_ACCEPT_DECIMAL,
+		[LEX_CLASS_PIPE] = LEX_ACCEPT_DECIMAL,
+		[LEX_CLASS_TILDE] = LEX_ACCEPT_DECIMAL,
+	},
+};
 
-static int lookup_is_capital_hex[] = {
-    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 
-    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 
-    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 
-    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 
-    0, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 0, 0, 0, 0, 0, 
-    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 
-    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 
-    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 
+// the token a class stands for, TOK_NULL if none
+struct lex_class_token {
+	uint8_t type;
+	uint8_t attr;
 };
 
-static inline int __is_capital_hex(char c)
-{
-	return lookup_is_capital_hex[(int) c];
-}
+static const struct lex_class_token lookup_class_token[LEX_CLASSES] = {
+	[LEX_CLASS_X] = { TOK_VARIABLE, VAR_X },
+	[LEX_CLASS_Y] = { TOK_VARIABLE, VAR_Y },
+	[LEX_CLASS_LT] = { TOK_SHIFT_OP, ATTR_LSHIFT },
+	[LEX_CLASS_GT] = { TOK_SHIFT_OP, ATTR_RSHIFT },
+	[LEX_CLASS_PERCENT] = { TOK_FACTOR_OP, ATTR_FACTOR_OP_MOD },
+	[LEX_CLASS_AMPERSAND] = { TOK_OP, ATTR_OP_AND },
+	[LEX_CLASS_LPAREN] = { TOK_LPAREN, ATTR_LPAREN },
+	[LEX_CLASS_RPAREN] = { TOK_RPAREN, ATTR_RPAREN },
+	[LEX_CLASS_STAR] = { TOK_FACTOR_OP, ATTR_FACTOR_OP_MUL },
+	[LEX_CLASS_PLUS] = { TOK_SIGN, ATTR_SIGN_PLUS },
+	[LEX_CLASS_COMMA] = { TOK_COMMA, 0 },
+	[LEX_CLASS_MINUS] = { TOK_SIGN, ATTR_SIGN_MINUS },
+	[LEX_CLASS_SLASH] = { TOK_FACTOR_OP, '/' },
+	[LEX_CLASS_EQUALS] = { TOK_ASSIGN, 0 },
+	[LEX_CLASS_CARET] = { TOK_OP, ATTR_OP_XOR },
+	[LEX_CLASS_PIPE] = { TOK_OP, ATTR_OP_OR },
+	[LEX_CLASS_TILDE] = { TOK_BITWISE_NOT, ATTR_BITWISE_NOT },
+};
 
-static int lookup_is_allowed_character[] = {
-    0, 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 0, 0, 1, 0, 0, 
-    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 
-    1, 0, 0, 0, 0, 1, 1, 0, 1, 1, 0, 1, 0, 1, 0, 0, 
-    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 0, 0, 1, 0, 1, 0, 
-    0, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 
-    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 0, 0, 0, 1, 1, 
-    0, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 
-    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 0, 1, 0, 1, 0, 
+/*
+ * The same sets for byte shuffles, indexed by low nibble, see scan.h.
+ * Bit h of lookup_allowed_nibbles[l] is set if the character 0xhl is
+ * allowed, and lookup_space_nibbles[l] is the whitespace character with
+ * low nibble l, or 0xff if there is none.
+ */
+static const uint8_t lookup_allowed_nibbles[16] = {
+    0xcc, 0xd8, 0xd8, 0xd8, 0xd8, 0xdc, 0xdc, 0xc8, 
+    0xec, 0xcd, 0xc5, 0x44, 0xcc, 0x4d, 0xe8, 0x64, 
 };
 
-static inline int __is_allowed_character(char c)
-{
-	return lookup_is_allowed_character[(int) c];
-}
+static const uint8_t lookup_space_nibbles[16] = {
+    0x20, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 
+    0xff, 0x09, 0x0a, 0xff, 0xff, 0x0d, 0xff, 0xff, 
+};
 
-static int lookup_is_hex_terminator[] = {
-    1, 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 0, 0, 1, 0, 0, 
-    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 
-    1, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 
-    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 
-    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 
-    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 
-    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 
-    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 
+// the characters of LEX_CLASS_SPACE, to compare a vector with each
+#define LEX_SPACE_CHARS 4
+static const uint8_t lookup_space_chars[LEX_SPACE_CHARS] = {
+    0x09, 0x0a, 0x0d, 0x20, 
 };
 
-static inline int __is_hex_terminator(char c)
+static inline unsigned int __char_class(char c)
 {
-	return lookup_is_hex_terminator[(int) c];
+	return lookup_char_class[(unsigned char)c] & LEX_CLASS_MASK;
 }
 
 #endif
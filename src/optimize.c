@@ -0,0 +1,333 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "jit.h"
+#include "program.h"
+#include "util.h"
+
+/*
+ * Tracks one value on the symbolic stack. Every value owns a contiguous run
+ * of ops in the output that starts at `start` and ends where the next value
+ * starts (or at the end of the output for the top of the stack).
+ */
+struct opt_value {
+	size_t start;
+	uint64_t value;
+	bool is_const;
+	// evaluating this value may raise an error, so it must not be dropped
+	bool may_fault;
+};
+
+struct optimizer {
+	struct program_op *ops;
+	size_t len;
+	struct opt_value *stack;
+	size_t depth;
+};
+
+static inline bool __is_commutative(uint8_t code)
+{
+	switch (code) {
+	case OP_MUL:
+	case OP_ADD:
+	case OP_AND:
+	case OP_XOR:
+	case OP_OR:
+		return true;
+	default:
+		return false;
+	}
+}
+
+/*
+ * Returns true when `x code rhs` is always x.
+ */
+static inline bool __is_right_identity(uint8_t code, uint64_t rhs)
+{
+	switch (code) {
+	case OP_ADD:
+	case OP_SUB:
+	case OP_XOR:
+	case OP_OR:
+		return rhs == 0;
+	case OP_SHL:
+	case OP_SHR:
+		return (rhs & 63) == 0;
+	case OP_MUL:
+	case OP_DIV:
+		return rhs == 1;
+	case OP_AND:
+		return rhs == UINT64_MAX;
+	default:
+		return false;
+	}
+}
+
+/*
+ * Returns true when `x code rhs` is always zero.
+ */
+static inline bool __is_right_absorbing(uint8_t code, uint64_t rhs)
+{
+	switch (code) {
+	case OP_MUL:
+	case OP_AND:
+		return rhs == 0;
+	case OP_MOD:
+		return rhs == 1;
+	default:
+		return false;
+	}
+}
+
+/*
+ * Returns true when `lhs code x` is always zero.
+ */
+static inline bool __is_left_absorbing(uint8_t code, uint64_t lhs)
+{
+	switch (code) {
+	case OP_MUL:
+	case OP_AND:
+	case OP_SHL:
+	case OP_SHR:
+		return lhs == 0;
+	default:
+		return false;
+	}
+}
+
+static inline void __push_const(struct optimizer *o, size_t start,
+				uint64_t value, uint32_t pos)
+{
+	o->len = start;
+	o->ops[o->len++] = (struct program_op){ .imm = value,
+						 .pos = pos,
+						 .code = OP_PUSH };
+	o->stack[o->depth++] =
+		(struct opt_value){ .start = start, .value = value,
+				    .is_const = true };
+}
+
+static void __remove_op(struct optimizer *o, size_t idx)
+{
+	memmove(&o->ops[idx], &o->ops[idx + 1],
+		(o->len - idx - 1) * sizeof(*o->ops));
+	o->len--;
+}
+
+static void __fold_unary(struct optimizer *o, const struct program_op *op)
+{
+	struct opt_value *top = &o->stack[o->depth - 1];
+	struct program_op *last = &o->ops[o->len - 1];
+
+	if (top->is_const) {
+		top->value = op->code == OP_NEG ? -top->value : ~top->value;
+		last->imm = top->value;
+		return;
+	}
+
+	// ~~x and --x cancel out
+	if (last->code == op->code) {
+		o->len--;
+		return;
+	}
+
+	o->ops[o->len++] = *op;
+}
+
+static void __fold_binary(struct optimizer *o, const struct program_op *op)
+{
+	struct opt_value *lhs = &o->stack[o->depth - 2];
+	struct opt_value *rhs = &o->stack[o->depth - 1];
+	struct program_op *prev;
+	enum func_err func_err;
+	uint64_t args[2], *sp = args + 2;
+	size_t start = lhs->start;
+
+	if (lhs->is_const && rhs->is_const) {
+		args[0] = lhs->value;
+		args[1] = rhs->value;
+		if (program_step(op, &sp, NULL, &func_err) == PROG_ESUCCESS) {
+			o->depth -= 2;
+			__push_const(o, start, args[0], op->pos);
+			return;
+		}
+		goto emit;
+	}
+
+	if (rhs->is_const) {
+		if (__is_right_identity(op->code, rhs->value)) {
+			o->len = rhs->start;
+			o->depth--;
+			return;
+		}
+
+		if (!lhs->may_fault &&
+		    __is_right_absorbing(op->code, rhs->value)) {
+			o->depth -= 2;
+			__push_const(o, start, 0, op->pos);
+			return;
+		}
+
+		// (x op c1) op c2 => x op (c1 op c2)
+		prev = &o->ops[rhs->start - 1];
+		if (__is_commutative(op->code) && prev->code == op->code &&
+		    rhs->start >= 2 && o->ops[rhs->start - 2].code == OP_PUSH &&
+		    rhs->start - 2 > lhs->start) {
+			args[0] = o->ops[rhs->start - 2].imm;
+			args[1] = rhs->value;
+			sp = args + 2;
+			program_step(op, &sp, NULL, &func_err);
+			o->ops[rhs->start - 2].imm = args[0];
+			o->len = rhs->start;
+			o->depth--;
+			return;
+		}
+	}
+
+	if (lhs->is_const) {
+		if (__is_commutative(op->code) &&
+		    __is_right_identity(op->code, lhs->value)) {
+			__remove_op(o, lhs->start);
+			rhs->start--;
+			*lhs = *rhs;
+			o->depth--;
+			return;
+		}
+
+		if (!rhs->may_fault &&
+		    __is_left_absorbing(op->code, lhs->value)) {
+			o->depth -= 2;
+			__push_const(o, start, 0, op->pos);
+			return;
+		}
+	}
+
+emit:
+	o->ops[o->len++] = *op;
+	o->depth--;
+	lhs->may_fault = lhs->may_fault || rhs->may_fault;
+	if (op->code == OP_DIV || op->code == OP_MOD) {
+		lhs->may_fault |= !rhs->is_const || rhs->value == 0;
+	}
+	lhs->is_const = false;
+}
+
+static void __fold_call(struct optimizer *o, const struct program_op *op)
+{
+	struct opt_value *args = &o->stack[o->depth - op->argc];
+	const struct func_info *info = &func_info[op->imm];
+	uint64_t argv[FUNC_MAX_ARGC] = { 0 };
+	uint64_t *sp = argv + op->argc;
+	enum func_err func_err;
+	size_t start = o->len;
+	bool all_const = true, may_fault = info->partial;
+
+	for (uint8_t i = 0; i < op->argc; i++) {
+		all_const = all_const && args[i].is_const;
+		argv[i] = args[i].value;
+		may_fault = may_fault || args[i].may_fault;
+
+		// only arguments that may be out of range make the call fail
+		if (args[i].is_const ?
+			    !func_in_range(op->imm, i, args[i].value) :
+			    info->ranges[i].min ||
+				    info->ranges[i].max != UINT64_MAX)
+			may_fault = true;
+	}
+
+	if (op->argc) {
+		start = args[0].start;
+	}
+
+	// The builtins are pure, so a call on literals can be evaluated once
+	// here. Calls that fail are kept so the error surfaces at exec time.
+	if (all_const &&
+	    program_step(op, &sp, NULL, &func_err) == PROG_ESUCCESS) {
+		o->depth -= op->argc;
+		__push_const(o, start, argv[0], op->pos);
+		return;
+	}
+
+	o->depth -= op->argc;
+	o->ops[o->len++] = *op;
+	o->stack[o->depth++] =
+		(struct opt_value){ .start = start, .may_fault = may_fault };
+}
+
+static size_t __program_depth(const struct bmath_program *prog)
+{
+	size_t depth = 0, max_depth = 0;
+
+	for (size_t i = 0; i < prog->len; i++) {
+		switch (prog->ops[i].code) {
+		case OP_PUSH:
+		case OP_VAR:
+			depth++;
+			break;
+		case OP_NEG:
+		case OP_NOT:
+			break;
+		case OP_CALL:
+			depth = depth - prog->ops[i].argc + 1;
+			break;
+		default:
+			depth--;
+			break;
+		}
+
+		if (depth > max_depth)
+			max_depth = depth;
+	}
+
+	return max_depth;
+}
+
+int program_optimize(struct bmath_program *prog)
+{
+	struct optimizer o = { .ops = prog->ops, .len = 0, .depth = 0 };
+	struct program_op op;
+
+	if (!prog->len) {
+		return PROG_ESUCCESS;
+	}
+
+	// native code no longer matches the ops, let it be promoted again
+	jit_release(prog);
+	prog->runs = 0;
+
+	o.stack = malloc(prog->max_depth * sizeof(*o.stack));
+	if (!o.stack) {
+		return PROG_ENOMEM;
+	}
+
+	// The output never outgrows the input, so rewrite the ops in place.
+	for (size_t i = 0; i < prog->len; i++) {
+		op = prog->ops[i];
+		switch (op.code) {
+		case OP_PUSH:
+			__push_const(&o, o.len, op.imm, op.pos);
+			break;
+		case OP_VAR:
+			o.stack[o.depth++] =
+				(struct opt_value){ .start = o.len };
+			o.ops[o.len++] = op;
+			break;
+		case OP_NEG:
+		case OP_NOT:
+			__fold_unary(&o, &op);
+			break;
+		case OP_CALL:
+			__fold_call(&o, &op);
+			break;
+		default:
+			__fold_binary(&o, &op);
+			break;
+		}
+	}
+
+	free(o.stack);
+	prog->len = o.len;
+	prog->max_depth = __program_depth(prog);
+	return PROG_ESUCCESS;
+}
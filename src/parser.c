@@ -1,669 +1,2583 @@
+// clock_gettime()
+#define _DEFAULT_SOURCE
+
 #include <errno.h>
 #include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 
+#include "batch.h"
+#include "cache.h"
+#include "cache_file.h"
 #include "conversions.h"
+#include "cse.h"
 #include "parser.h"
+#include "recalc.h"
+#include "symbols.h"
 #include "util.h"
-#include "lookup_tables.h"
 #include "token.h"
 #include "functions.h"
+#include "jit.h"
+#include "program.h"
+#include "scan.h"
+#include "shape.h"
+#include "wide.h"
+#include "lookup_tables.h"
 
-struct token_func token_functions[] = {
-	{ "align", align },
-	{
-		"align_down",
-		align_down,
-	},
-	{
-		"bswap",
-		bswap,
-	},
-	{
-		"clz",
-		clz,
-	},
-	{
-		"ctz",
-		ctz,
-	},
-	{
-		"mask",
-		mask,
-	},
-	{
-		"popcnt",
-		popcnt,
-	},
-};
-
-struct token *NULL_TOKEN =
-	&(struct token){ .type = TOK_NULL, .namelen = 0, .attr = ATTR_NULL };
+static const struct token NULL_TOKEN = { .type = TOK_NULL,
+					 .namelen = 0,
+					 .attr = ATTR_NULL };
 
 struct parser_context {
-	int max_parse_len;
+	// zero means unbounded
+	size_t max_parse_len;
 	bool liberror;
+	// first error of the current call, see parser_last_error()
+	struct bmath_error error;
+	bool quiet;
 	FILE *err_stream;
-	struct token_tbl *functions;
+	// value stack shared by on-the-fly evaluation and bmath_exec()
+	uint64_t *stack;
+	size_t stack_cap;
+	// operator stack of the parser, see expr()
+	struct parse_frame *frames;
+	size_t frames_cap;
+	unsigned int jit_threshold;
+	const struct batch_kernels *batch;
+	// whitespace bits of the line being parsed, see scan.h
+	scan_line_t scan;
+	uint64_t *spaces;
+	size_t spaces_cap;
+	// the line being parsed, lexed, see __tokenize()
+	struct lexed_token *tokens;
+	size_t tokens_cap;
+	// set by parser_init(), the buffers above are the caller's and can't grow
+	bool scratch;
+	// NULL unless parser_settings.cache_size is set
+	struct result_cache *cache;
+	// NULL unless parser_settings.cache_file is set
+	struct cache_file *cache_file;
+	// NULL unless parser_settings.cse is set, and then what each value
+	// on the stack is, see __share()
+	struct cse_table *cse;
+	struct cse_ref *refs;
+	size_t refs_cap;
+	// NULL for parser_init() contexts
+	struct symbol_table *symbols;
+	// NULL unless parser_settings.incremental is set
+	struct recalc *recalc;
+	// what the line being parsed binds, and whether it reads or binds
+	// anything, which keeps it out of the caches
+	uint32_t binds;
+	bool symbolic;
+	// parser_settings.budget, with the limits that are off at SIZE_MAX
+	size_t max_tokens;
+	size_t max_depth;
+	size_t max_calls;
+	size_t max_steps;
+	uint64_t deadline_ns;
+	// NULL unless parser_settings.width is over 64, and then the line
+	// being evaluated, compiled, and the limbs of its literals that are
+	// too wide for an op, the widest of them literal_tier wide
+	struct wide_eval *wide;
+	size_t limbs;
+	struct bmath_program wide_prog;
+	uint64_t *literals;
+	size_t literals_len;
+	size_t literals_cap;
+	enum wide_tier literal_tier;
+};
+
+// bmath_exec() binds every variable to zero
+static const uint64_t zero_vars[PROGRAM_MAX_VARS] = { 0 };
+
+// ops a single call of a definition may inline, which keeps nested calls
+// that read their parameters more than once from growing without bound
+#define INLINE_MAX_OPS (1 << 16)
+
+static inline uint32_t __clamp_pos(size_t pos)
+{
+	return pos < UINT32_MAX ? pos : UINT32_MAX;
+}
+
+/*
+ * Errors are only recorded here. They are rendered once the call is over, if
+ * at all, see bmath_error_render(). Only the first error of a call is kept,
+ * anything after it is a consequence.
+ */
+static void __set_error(struct parser_context *ctx, struct bmath_error error)
+{
+	if (!ctx->liberror) {
+		ctx->error = error;
+	}
+	ctx->liberror = true;
+}
+
+#define __general_error(l, c) \
+	__set_error((l)->ctx, (struct bmath_error){ .code = (c) })
+
+// points at where the lexer is
+#define __lexical_error(l, c)                                     \
+	__set_error((l)->ctx,                                     \
+		    (struct bmath_error){                         \
+			    .code = (c),                          \
+			    .pos = __clamp_pos((l)->current_column), \
+		    })
+
+static inline uint64_t __now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+static void __set_budget(struct parser_context *ctx,
+			 const struct bmath_budget *budget)
+{
+	ctx->max_tokens = budget->max_tokens ? budget->max_tokens : SIZE_MAX;
+	ctx->max_depth = budget->max_depth ? budget->max_depth : SIZE_MAX;
+	ctx->max_calls = budget->max_calls ? budget->max_calls : SIZE_MAX;
+	ctx->max_steps = budget->max_steps ? budget->max_steps : SIZE_MAX;
+	ctx->deadline_ns = budget->deadline_ns;
+}
+
+#define __budget_error(l, lim, p)                                    \
+	__set_error((l)->ctx, (struct bmath_error){ .code = BMATH_EBUDGET, \
+						    .pos = (p),            \
+						    .limit = (lim) })
+
+// what a call that failed on a line returns
+static inline int __line_error(const struct parser_context *ctx)
+{
+	return ctx->error.code == BMATH_EBUDGET ? PE_BUDGET_EXCEEDED :
+						  PE_PARSE_ERROR;
+}
+
+/*
+ * Lines are lexed in one pass into an array of these before they're parsed,
+ * and the array is reused from line to line. A lexical error ends the array
+ * with a TOK_ERROR, which is only reported if the parser gets that far.
+ */
+struct lexed_token {
+	uint64_t attr;
+	// where the token starts, clamped like program_op.pos
+	uint32_t pos;
+	uint8_t type;
+};
+
+/*
+ * Operators waiting for their right operand, and the parentheses and calls
+ * they are nested in. The parser keeps these on an explicit stack instead of
+ * recursing, so nesting depth and unary chains are only bounded by memory.
+ */
+enum frame_kind {
+	FRAME_UNARY,
+	FRAME_BINARY,
+	FRAME_PAREN,
+	FRAME_CALL,
+	// a call of a definition, see __inline_call()
+	FRAME_INLINE,
 };
 
-#define __general_error(l, fmt, arg...)                           \
-	do {                                                      \
-		fprintf((l)->err_stream, "[ERROR]: " fmt, ##arg); \
-		(l)->ctx->liberror = true;                        \
-	} while (0)
-
-#define __lexical_error(l, fmt, arg...)                                                 \
-	do {                                                                            \
-		fprintf((l)->err_stream,                                                \
-			"[PARSE ERROR]: There was an error parsing the expression:\n"); \
-		fprintf((l)->err_stream, "%s\n", (l)->line);                            \
-		__repeat_character((l)->err_stream, (l)->current_column, '~');          \
-		fprintf((l)->err_stream, "%c " fmt "\n", '^', ##arg);                   \
-		(l)->ctx->liberror = true;                                              \
-	} while (0)
+struct parse_frame {
+	// function attr of a call, or the symbol_def it inlines
+	uint64_t imm;
+	// where the operator or function name starts
+	uint32_t pos;
+	uint8_t kind;
+	uint8_t code;
+	// binary operators bind tighter the higher this is
+	uint8_t prec;
+	// arguments of a call parsed so far
+	uint8_t argc;
+};
 
 struct lexer {
 	const char *line;
 	struct parser_context *ctx;
-	uint16_t current_column;
-	int16_t line_length;
-	FILE *err_stream;
-	struct token lookahead_token;
+	// where the lexer is, and once the line is lexed, where errors point
+	size_t current_column;
+	size_t line_length;
+	struct lexed_token *lookahead;
+	// when set, ops are compiled into prog instead of being evaluated
+	struct bmath_program *prog;
+	size_t depth;
+	// pre-scan of the line, nothing past scanned is looked at. Short
+	// lines aren't pre-scanned, see __lex_line()
+	const uint64_t *spaces;
+	size_t scanned;
+	// tokens the line was lexed into
+	size_t ntokens;
+	// parameters of the definition whose body is being compiled, every
+	// other token from the first, see __definition()
+	const struct lexed_token *params;
+	uint8_t nparams;
+	// limbs a literal may have, more than one for bmath_parse_wide()
+	size_t limbs;
+	// work done on the line so far, see __over_budget()
+	size_t steps;
+	size_t calls;
+	// tokens while the line is lexed, steps after, at which the budget
+	// is looked at next, and when the line's deadline passes, zero until
+	// the clock is first read
+	size_t next_check;
+	uint64_t deadline;
 };
 
-static inline bool __is_x(char character);
-static inline bool __is_start_of_hex(char current_character, char peek);
-static inline bool __is_illegal_character(char character);
+/*
+ * The count of tokens or steps at which the budget has to be looked at next:
+ * once it is over max, or sooner to read the clock if there is a deadline.
+ */
+static inline size_t __next_check(const struct lexer *lexer, size_t count,
+				  size_t max)
+{
+	size_t next = max < SIZE_MAX ? max + 1 : SIZE_MAX;
+
+	if (lexer->ctx->deadline_ns && next - count > BMATH_BUDGET_CLOCK_EVERY)
+		next = count + BMATH_BUDGET_CLOCK_EVERY;
+	return next;
+}
+
+/*
+ * Slow path of the budget, once count reaches lexer->next_check. Keeping a
+ * single threshold leaves one compare on the common path, limits or not.
+ * The deadline starts at the first check, lines that never get there are
+ * done before it matters and don't read the clock at all.
+ * @return Whether the line went over, which raises BMATH_EBUDGET at pos
+ */
+static bool __over_budget(struct lexer *lexer, size_t count, size_t max,
+			  enum bmath_limit limit, uint32_t pos)
+{
+	uint64_t deadline_ns = lexer->ctx->deadline_ns, now;
+
+	if (count > max) {
+		__budget_error(lexer, limit, pos);
+		return true;
+	}
+
+	if (deadline_ns) {
+		now = __now_ns();
+		if (!lexer->deadline) {
+			// a deadline too far out to add up is no deadline
+			lexer->deadline = now + deadline_ns < now ?
+						  UINT64_MAX :
+						  now + deadline_ns;
+		} else if (now >= lexer->deadline) {
+			__budget_error(lexer, BMATH_LIMIT_DEADLINE, pos);
+			return true;
+		}
+	}
+
+	lexer->next_check = __next_check(lexer, count, max);
+	return false;
+}
+
+static inline unsigned int __lex_next(const char **pos, const char *end,
+				      unsigned int *out_class);
 
 static struct lexer __init_lexer(struct parser_context *ctx, const char *line,
-				 int16_t line_length);
+				 size_t line_length);
 static struct token __lexer_parse_number(struct lexer *lexer);
 static struct token __lexer_parse_hex(struct lexer *lexer);
-static struct token __lexer_get_next_token(struct lexer *lexer);
+static struct token __lexer_parse_wide(struct lexer *lexer, bool hex);
+static struct token __lexer_get_next_token(struct lexer *lexer,
+					   size_t *out_pos);
 
+static void __lookahead(struct lexer *lexer, struct lexed_token *tok);
 static void __expect(struct lexer *lexer, enum token_type expected);
+static void __emit(struct lexer *lexer, enum program_opcode code,
+		   uint8_t argc, uint64_t imm, uint32_t pos);
 
-static uint64_t expr_number(struct lexer *lexer);
-static uint64_t expr_function(struct lexer *lexer);
-static uint64_t expr_signed(struct lexer *lexer);
-static uint64_t expr_factor(struct lexer *lexer);
-static uint64_t expr_add(struct lexer *lexer);
-static uint64_t expr_shift(struct lexer *lexer);
-static uint64_t expr_and(struct lexer *lexer);
-static uint64_t expr_xor(struct lexer *lexer);
-static uint64_t expr_or(struct lexer *lexer);
-static uint64_t expr(struct lexer *lexer);
+static void expr(struct lexer *lexer);
 
-ssize_t str_hex_to_uint64(char *input, ssize_t input_length, uint64_t *result)
+static int __ensure_spaces(struct parser_context *ctx, size_t words)
 {
-	ssize_t bytes_parsed = 0;
-	const char *input_start = input;
+	uint64_t *spaces;
+	size_t cap;
 
-	if (*input++ != '0') {
-		errno = EINVAL;
-		return -1;
+	if (likely(words <= ctx->spaces_cap)) {
+		return 0;
 	}
 
-	if (!__is_x(*input++)) {
-		errno = EINVAL;
-		return -2;
+	if (ctx->scratch) {
+		return ENOMEM;
 	}
 
-	*result = 0;
-	while (__is_allowed_hex(*input)) {
-		*result = (*result << 4) + __hex_to_value(*input++);
+	cap = ctx->spaces_cap ? ctx->spaces_cap : 4;
+	while (cap < words) {
+		cap *= 2;
 	}
 
-	bytes_parsed += input - input_start;
-	if (bytes_parsed > input_length) {
-		errno = E2BIG;
-		return -bytes_parsed;
+	spaces = realloc(ctx->spaces, cap * sizeof(*spaces));
+	if (!spaces) {
+		return ENOMEM;
 	}
 
-	return bytes_parsed;
+	ctx->spaces = spaces;
+	ctx->spaces_cap = cap;
+	return 0;
 }
 
-static uint64_t __perform_parse(struct lexer *lexer)
+/*
+ * A line with a byte that can't be part of any token is rejected as a whole,
+ * before anything is evaluated, at its first such byte.
+ */
+static bool __prescan(struct lexer *lexer)
 {
-	lexer->lookahead_token = __lexer_get_next_token(lexer);
-	return expr(lexer);
+	struct parser_context *ctx = lexer->ctx;
+	size_t len;
+
+	if (__ensure_spaces(ctx, SCAN_WORDS(lexer->line_length))) {
+		__general_error(lexer, BMATH_ENOMEM);
+		return false;
+	}
+
+	if (ctx->scan(lexer->line, lexer->line_length, ctx->spaces, &len)) {
+		lexer->current_column = len;
+		__lexical_error(lexer, BMATH_EILLEGAL);
+		return false;
+	}
+
+	lexer->spaces = ctx->spaces;
+	lexer->scanned = len;
+	return true;
 }
 
-struct parser_context *parser_new(struct parser_settings *settings)
+static int __ensure_tokens(struct parser_context *ctx, size_t ntokens)
 {
-	int err;
-	struct parser_context *ctx = malloc(sizeof(*ctx));
-	if (!ctx) {
-		return NULL;
-	}
+	struct lexed_token *tokens;
+	size_t cap;
 
-	ctx->functions = token_tbl_new();
-	if (!ctx->functions) {
-		free(ctx);
-		return NULL;
+	if (likely(ntokens <= ctx->tokens_cap)) {
+		return 0;
 	}
 
-	ctx->liberror = false;
-	ctx->max_parse_len = settings->max_parse_len;
-	ctx->err_stream = stderr;
-	if (settings->err_stream) {
-		ctx->err_stream = settings->err_stream;
+	if (ctx->scratch) {
+		return ENOMEM;
 	}
 
-	for (size_t i = 0;
-	     i < sizeof(token_functions) / sizeof(token_functions[0]); i++) {
-		err = token_tbl_register_func(ctx->functions,
-					      &token_functions[i]);
-		if (err) {
-			parser_free(ctx);
-			return NULL;
-		}
+	cap = ctx->tokens_cap ? ctx->tokens_cap * 2 : 64;
+	tokens = realloc(ctx->tokens, cap * sizeof(*tokens));
+	if (!tokens) {
+		return ENOMEM;
 	}
 
-	return ctx;
+	ctx->tokens = tokens;
+	ctx->tokens_cap = cap;
+	return 0;
 }
 
-int parser_free(struct parser_context *ctx)
+// lexes the whole line, up to its end or its first lexical error
+static bool __tokenize(struct lexer *lexer)
 {
-	token_tbl_free(ctx->functions);
-	free(ctx);
-	return 0;
+	struct parser_context *ctx = lexer->ctx;
+	struct token tok;
+	size_t n = 0, pos;
+
+	do {
+		if (__ensure_tokens(ctx, n + 1)) {
+			__general_error(lexer, BMATH_ENOMEM);
+			return false;
+		}
+
+		tok = __lexer_get_next_token(lexer, &pos);
+		ctx->tokens[n++] = (struct lexed_token){
+			.attr = tok.attr,
+			.pos = __clamp_pos(pos),
+			.type = tok.type,
+		};
+
+		if (unlikely(n >= lexer->next_check) &&
+		    __over_budget(lexer, n, ctx->max_tokens, BMATH_LIMIT_TOKENS,
+				  __clamp_pos(pos)))
+			return false;
+	} while (tok.type != TOK_NULL && tok.type != TOK_ERROR);
+
+	lexer->ntokens = n;
+	lexer->next_check = __next_check(lexer, 0, ctx->max_steps);
+	return true;
 }
 
-int parse(struct parser_context *ctx, const char *infix_expression, size_t len,
-	  uint64_t *out_result)
+/*
+ * Lines up to a block long are lexed without the pre-scan. The DFA skips
+ * their whitespace by itself and stops at a NUL, and on lines this short a
+ * separate pass over the line costs more than the jumps over whitespace
+ * save. The pre-scan only runs when lexing stopped short of the end, so that
+ * a line with an illegal byte is still rejected at it before anything else.
+ */
+#define SHORT_LINE 64
+
+static bool __lex_line(struct lexer *lexer)
 {
-	struct lexer lexer;
-	uint64_t result;
+	struct parser_context *ctx = lexer->ctx;
+	struct bmath_error error;
+	bool lexed, liberror;
 
-	*out_result = 0;
+	if (lexer->line_length > SHORT_LINE)
+		return __prescan(lexer) && __tokenize(lexer);
 
-	if (len == 0)
-		return PE_NOTHING_TO_PARSE;
+	lexer->scanned = lexer->line_length;
+	lexed = __tokenize(lexer);
+	if (likely(lexed &&
+		   ctx->tokens[lexer->ntokens - 1].type == TOK_NULL))
+		return true;
 
-	if (len > (size_t)ctx->max_parse_len)
-		return PE_EXPRESSION_TOO_LONG;
+	// the pre-scan would have come first, so its error wins
+	error = ctx->error;
+	liberror = ctx->liberror;
+	ctx->liberror = false;
+	if (!__prescan(lexer))
+		return false;
 
-	lexer = __init_lexer(ctx, infix_expression, (int16_t)len);
-	lexer.err_stream = ctx->err_stream;
+	ctx->error = error;
+	ctx->liberror = liberror;
+	return lexed;
+}
 
-	result = __perform_parse(&lexer);
+static inline size_t __name_len(const struct lexed_token *tok)
+{
+	return tok->type == TOK_NAME ? tok->attr : 1;
+}
 
-	if (ctx->liberror) {
-		ctx->liberror = false;
-		return PE_PARSE_ERROR;
+// the parameter tok names, lexer->nparams if it isn't one
+static uint8_t __param(const struct lexer *lexer, const struct lexed_token *tok)
+{
+	const struct lexed_token *param;
+	uint8_t k;
+
+	for (k = 0; k < lexer->nparams; k++) {
+		param = &lexer->params[2 * k];
+		if (__name_len(param) == __name_len(tok) &&
+		    !memcmp(lexer->line + param->pos, lexer->line + tok->pos,
+			    __name_len(tok))) {
+			break;
+		}
 	}
 
-	*out_result = result;
-
-	return 0;
+	return k;
 }
 
-static inline bool __is_x(char character)
+/*
+ * A line that starts with `name =` binds the name to the value of the rest,
+ * see parse(). Compiled expressions don't bind anything.
+ * @return false if the name can't be bound
+ */
+static bool __binding(struct lexer *lexer, struct lexed_token **tokens)
 {
-	switch (character) {
-	case 'x':
-	case 'X':
+	struct parser_context *ctx = lexer->ctx;
+	struct lexed_token *name = *tokens;
+
+	if (lexer->prog ||
+	    (name->type != TOK_NAME && name->type != TOK_VARIABLE) ||
+	    name[1].type != TOK_ASSIGN) {
 		return true;
-	default:
+	}
+
+	ctx->symbolic = true;
+	if (ctx->symbols) {
+		ctx->binds = symbols_intern(ctx->symbols,
+					    lexer->line + name->pos,
+					    __name_len(name));
+	}
+	if (ctx->binds == SYMBOL_NONE) {
+		__general_error(lexer, BMATH_ENOMEM);
 		return false;
 	}
-}
 
-static inline bool __is_start_of_hex(char current_character, char peek)
-{
-	return current_character == '0' && __is_x(peek);
+	*tokens += 2;
+	return true;
 }
 
-static inline bool __is_illegal_character(char character)
+static void __perform_parse(struct lexer *lexer)
 {
-	return !__is_allowed_character(character);
-}
+	struct lexed_token *tokens;
 
-static struct lexer __init_lexer(struct parser_context *ctx, const char *line,
-				 int16_t line_length)
-{
-	struct lexer lexer;
+	if (!__lex_line(lexer)) {
+		return;
+	}
 
-	lexer.line = line;
-	lexer.current_column = 0;
-	lexer.line_length = line_length;
-	lexer.ctx = ctx;
+	tokens = lexer->ctx->tokens;
+	if (!__binding(lexer, &tokens)) {
+		return;
+	}
 
-	return lexer;
+	__lookahead(lexer, tokens);
+	expr(lexer);
 }
 
-static struct token __lexer_parse_number(struct lexer *lexer)
+static inline bool __too_long(const struct parser_context *ctx, size_t len)
 {
-	uint64_t result = 0;
-	char *line_reader = (char *)lexer->line + lexer->current_column;
-	struct token tok = *NULL_TOKEN;
+	return ctx->max_parse_len && len > ctx->max_parse_len;
+}
+
+/*
+ * Every call starts with a clean error, nothing of an earlier one may leak
+ * into it, and lines it won't look at still get a code.
+ * @return PE_NOTHING_TO_PARSE, PE_EXPRESSION_TOO_LONG or zero
+ */
+static int __begin_line(struct parser_context *ctx, size_t len)
+{
+	ctx->error = (struct bmath_error){ .code = BMATH_ENONE };
 
-	while (__is_digit(*line_reader)) {
-		result = result * 10 + (*line_reader++ - '0');
+	if (len == 0) {
+		ctx->error.code = BMATH_EEMPTY;
+		return PE_NOTHING_TO_PARSE;
 	}
 
-	lexer->current_column = line_reader - lexer->line;
+	if (__too_long(ctx, len)) {
+		ctx->error.code = BMATH_ETOO_LONG;
+		return PE_EXPRESSION_TOO_LONG;
+	}
 
-	tok.attr = result;
-	tok.type = TOK_NUMBER;
-	return tok;
+	return 0;
 }
 
-static struct token __lexer_parse_hex(struct lexer *lexer)
+static int __ensure_stack(struct parser_context *ctx, size_t depth)
 {
-	// 8 bytes for 64bit number + 0x
-#define MAX_HEX_STR 16 + 2
-	uint64_t result = 0;
-	char *start = (char *)lexer->line + lexer->current_column;
-	struct token tok = *NULL_TOKEN;
+	uint64_t *stack;
+	size_t cap;
 
-	ssize_t bytes_parsed = str_hex_to_uint64(start, MAX_HEX_STR, &result);
-	if (bytes_parsed < 0) {
-		if (errno == E2BIG) {
-			__lexical_error(lexer, "Hex exceeds 8 bytes");
-			return tok;
-		}
+	if (likely(depth <= ctx->stack_cap)) {
+		return 0;
+	}
 
-		__lexical_error(lexer, "Invalid hex");
-		return tok;
+	if (ctx->scratch) {
+		return ENOMEM;
 	}
 
-	lexer->current_column += bytes_parsed;
+	cap = ctx->stack_cap ? ctx->stack_cap : 16;
+	while (cap < depth) {
+		cap *= 2;
+	}
 
-	tok.type = TOK_NUMBER;
-	tok.attr = result;
-	return tok;
+	stack = realloc(ctx->stack, cap * sizeof(*stack));
+	if (!stack) {
+		return ENOMEM;
+	}
+
+	ctx->stack = stack;
+	ctx->stack_cap = cap;
+	return 0;
 }
 
-static struct token __lexer_get_next_token(struct lexer *lexer)
+static void __init_context(struct parser_context *ctx,
+			   struct parser_settings *settings)
 {
-	char *line_reader = (char *)lexer->line + lexer->current_column;
-	struct token token = *NULL_TOKEN;
-	char current_character;
-	char peek_character;
+	ctx->liberror = false;
+	ctx->error = (struct bmath_error){ .code = BMATH_ENONE };
+	ctx->quiet = settings->quiet;
+	ctx->stack = NULL;
+	ctx->stack_cap = 0;
+	ctx->frames = NULL;
+	ctx->frames_cap = 0;
+	ctx->max_parse_len = settings->max_parse_len;
+	ctx->jit_threshold = jit_available() ? settings->jit_threshold : 0;
+	ctx->batch = batch_select(settings->simd);
+	ctx->scan = scan_select(settings->simd);
+	ctx->spaces = NULL;
+	ctx->spaces_cap = 0;
+	ctx->tokens = NULL;
+	ctx->tokens_cap = 0;
+	ctx->scratch = false;
+	ctx->cache = NULL;
+	ctx->cache_file = NULL;
+	ctx->cse = NULL;
+	ctx->refs = NULL;
+	ctx->refs_cap = 0;
+	ctx->symbols = NULL;
+	ctx->recalc = NULL;
+	ctx->binds = SYMBOL_NONE;
+	ctx->symbolic = false;
+	__set_budget(ctx, &settings->budget);
+	ctx->wide = NULL;
+	ctx->limbs = 1;
+	ctx->wide_prog = (struct bmath_program){ 0 };
+	ctx->literals = NULL;
+	ctx->literals_len = 0;
+	ctx->literals_cap = 0;
+	ctx->literal_tier = WIDE_TIER_64;
+	ctx->err_stream = stderr;
+	if (settings->err_stream) {
+		ctx->err_stream = settings->err_stream;
+	}
+}
 
-	// this is to avoid having to specify namelen = 1 in multiple places
-	token.namelen = 1;
+struct parser_context *parser_new(struct parser_settings *settings)
+{
+	struct parser_context *ctx;
+	unsigned int width = settings->width;
+	int err;
 
-	// We're already at or past the null character. Perform early return
-	// to prevent snooping at memory past the bounds of the array.
-	if (lexer->current_column > lexer->line_length - 1) {
-		return token;
+	if (width && (width < 64 || width > BMATH_WIDTH_MAX ||
+		      (width & (width - 1)))) {
+		errno = EINVAL;
+		return NULL;
 	}
 
-	while ((current_character = *line_reader++)) {
-		peek_character = *line_reader;
+	ctx = malloc(sizeof(*ctx));
+	if (!ctx) {
+		return NULL;
+	}
 
-		struct token *t =
-			token_tbl_lookup(lexer->ctx->functions, --line_reader);
-		if (t && t->type != TOK_NULL) {
-			token = *t;
-			goto out;
-		} else {
-			line_reader++;
-		}
+	__init_context(ctx, settings);
+	ctx->symbols = symbols_new();
+	if (!ctx->symbols) {
+		goto fail;
+	}
 
-		if (__is_digit(current_character)) {
-			if (__is_start_of_hex(current_character,
-					      peek_character)) {
-				return __lexer_parse_hex(lexer);
-			}
-			return __lexer_parse_number(lexer);
+	if (settings->cache_size) {
+		ctx->cache = cache_new(settings->cache_size);
+		if (!ctx->cache) {
+			goto fail;
 		}
+	}
 
-		switch (current_character) {
-		case '\t':
-		case '\n':
-		case '\r':
-		case ' ':
-			lexer->current_column++;
-			continue;
-		case '%':
-			token.type = TOK_FACTOR_OP;
-			token.attr = ATTR_FACTOR_OP_MOD;
-			goto out;
-		case '/':
-			token.type = TOK_FACTOR_OP;
-			token.attr = '/';
-			goto out;
-		case '&':
-			token.type = TOK_OP;
-			token.attr = ATTR_OP_AND;
-			goto out;
-		case '(':
-			token.type = TOK_LPAREN;
-			token.attr = ATTR_LPAREN;
-			goto out;
-		case ')':
-			token.type = TOK_RPAREN;
-			token.attr = ATTR_RPAREN;
-			goto out;
-		case '*':
-			token.type = TOK_FACTOR_OP;
-			token.attr = ATTR_FACTOR_OP_MUL;
-			goto out;
-		case '+':
-			token.type = TOK_SIGN;
-			token.attr = ATTR_SIGN_PLUS;
-			goto out;
-		case ',':
-			token.type = TOK_COMMA;
-			goto out;
-		case '-':
-			token.type = TOK_SIGN;
-			token.attr = ATTR_SIGN_MINUS;
-			goto out;
-		case '<':
-			if (peek_character == '<') {
-				token.type = TOK_SHIFT_OP;
-				token.attr = ATTR_LSHIFT;
-				token.namelen = 2;
-				goto out;
-			}
-			break;
-		case '>':
-			if (peek_character == '>') {
-				token.type = TOK_SHIFT_OP;
-				token.attr = ATTR_RSHIFT;
-				token.namelen = 2;
-				goto out;
-			}
-			break;
-		case '^':
-			token.type = TOK_OP;
-			token.attr = ATTR_OP_XOR;
-			goto out;
-		case '|':
-			token.type = TOK_OP;
-			token.attr = ATTR_OP_OR;
-			goto out;
-		case '~':
-			token.type = TOK_BITWISE_NOT;
-			token.attr = ATTR_BITWISE_NOT;
-			goto out;
-		default:
-			break;
+	if (settings->cache_file) {
+		ctx->cache_file = cache_file_open(settings->cache_file);
+		if (!ctx->cache_file) {
+			goto fail;
 		}
-
-		__lexical_error(lexer, "Illegal character");
-		break;
 	}
 
-out:
-	lexer->current_column += token.namelen;
-	return token;
-}
+	if (settings->cse) {
+		ctx->cse = cse_new(settings->cse_window);
+		if (!ctx->cse) {
+			goto fail;
+		}
+	}
 
-static void __expect(struct lexer *lex, enum token_type expected)
-{
-	if (lex->lookahead_token.type == expected) {
-		lex->lookahead_token = __lexer_get_next_token(lex);
-		return;
+	if (settings->incremental) {
+		ctx->recalc = recalc_new();
+		if (!ctx->recalc) {
+			goto fail;
+		}
 	}
 
-	if (!lex->ctx->liberror) {
-		__lexical_error(lex, "Expecting a %s, but got %s instead.",
-				token_name(expected),
-				token_name(lex->lookahead_token.type));
+	if (width > 64) {
+		ctx->wide = wide_new(width);
+		if (!ctx->wide) {
+			goto fail;
+		}
+		ctx->limbs = width / 64;
 	}
+
+	return ctx;
+
+fail:
+	// keep what went wrong opening the cache file
+	err = errno;
+	parser_free(ctx);
+	errno = err;
+	return NULL;
 }
 
-static uint64_t expr_number(struct lexer *lexer)
+/*
+ * Every token takes at least a byte, and the line ends with one more. Each
+ * frame and each stacked value takes a token of its own, so a line of len
+ * bytes never needs more than len + 1 of any of them.
+ */
+#define SCRATCH_ALIGN _Alignof(max_align_t)
+
+size_t parser_scratch_size(size_t max_parse_len)
 {
-	uint64_t ret;
+	size_t n = max_parse_len + 1;
 
-	if (lexer->lookahead_token.type == TOK_LPAREN) {
-		__expect(lexer, TOK_LPAREN);
-		ret = expr(lexer);
-		__expect(lexer, TOK_RPAREN);
-		return ret;
+	if (!max_parse_len) {
+		return 0;
 	}
 
-	ret = lexer->lookahead_token.attr;
-	__expect(lexer, TOK_NUMBER);
-	return ret;
+	return SCRATCH_ALIGN - 1 + sizeof(struct parser_context) +
+	       SCAN_WORDS(max_parse_len) * sizeof(uint64_t) +
+	       n * (sizeof(uint64_t) + sizeof(struct lexed_token) +
+		    sizeof(struct parse_frame));
 }
 
-static uint64_t expr_function(struct lexer *lexer)
+struct parser_context *parser_init(void *scratch, size_t size,
+				   struct parser_settings *settings)
 {
-	int err = 0;
-	static uint64_t ops[FUNCTIONS_MAX_OPS] = { 0 };
-	uint64_t ret = 0;
-	size_t i;
-	bmath_func_t func;
-	struct token tok;
+	size_t len = settings->max_parse_len, n = len + 1;
+	struct parser_context *ctx;
+	char *p;
 
-	if (lexer->lookahead_token.type != TOK_FUNCTION) {
-		return expr_number(lexer);
+	if (!len || size < parser_scratch_size(len)) {
+		return NULL;
 	}
 
-	memset(ops, 0, sizeof(ops));
-
-	tok = lexer->lookahead_token;
-	__expect(lexer, TOK_FUNCTION);
-	func = (bmath_func_t)tok.attr;
+	p = (char *)(((uintptr_t)scratch + SCRATCH_ALIGN - 1) &
+		     ~(uintptr_t)(SCRATCH_ALIGN - 1));
+	ctx = (struct parser_context *)p;
+	__init_context(ctx, settings);
+	ctx->scratch = true;
+	p += sizeof(*ctx);
 
-	__expect(lexer, TOK_LPAREN);
-	for (i = 0; i < sizeof(ops) / sizeof(ops[0]); i++) {
-		if (lexer->lookahead_token.type == TOK_RPAREN) {
-			--i;
-			break;
-		}
+	// every size is a multiple of 8, which keeps each buffer aligned
+	ctx->stack = (uint64_t *)p;
+	ctx->stack_cap = n;
+	p += n * sizeof(*ctx->stack);
 
-		ops[i] = expr(lexer);
-		if (lexer->lookahead_token.type != TOK_COMMA) {
-			break;
-		}
-		__expect(lexer, TOK_COMMA);
-	}
-	__expect(lexer, TOK_RPAREN);
+	ctx->spaces = (uint64_t *)p;
+	ctx->spaces_cap = SCAN_WORDS(len);
+	p += SCAN_WORDS(len) * sizeof(*ctx->spaces);
 
-	err = func(&ret, i + 1, ops);
-	if (err) {
-		__lexical_error(lexer, "Function returned error code: %d %s",
-				err, str_func_err(err));
-		return ret;
-	}
+	ctx->tokens = (struct lexed_token *)p;
+	ctx->tokens_cap = n;
+	p += n * sizeof(*ctx->tokens);
 
-	return ret;
+	ctx->frames = (struct parse_frame *)p;
+	ctx->frames_cap = n;
+	return ctx;
 }
 
-static uint64_t expr_signed(struct lexer *lexer)
+int parser_free(struct parser_context *ctx)
 {
-#define MAX_STACK 10
-	static struct token stack[MAX_STACK] = { 0 };
-	struct token tok;
-
-	uint64_t ret;
-	int i = -1;
-	int in_loop = 0;
-
-	while (1) {
-		tok = lexer->lookahead_token;
-		switch (tok.type) {
-		case TOK_BITWISE_NOT:
-		case TOK_SIGN:
-			if (!in_loop) {
-				in_loop = 1;
-				memset(stack, 0, sizeof(stack));
-			}
-			i++;
-			if (i >= MAX_STACK) {
-				__lexical_error(
-					lexer, "Exceeded max stack depth of %d",
-					MAX_STACK);
-				return 0;
-			}
-			stack[i] = tok;
-			__expect(lexer, lexer->lookahead_token.type);
-			break;
-		default:
-			ret = expr_function(lexer);
-			goto next;
-		}
+	if (ctx->scratch) {
+		return 0;
 	}
 
-next:
-	for (int j = i; j >= 0; j--) {
-		switch (stack[j].type) {
-		case TOK_BITWISE_NOT:
-			ret = ~ret;
-			break;
-		case TOK_SIGN:
-			if (stack[j].attr == ATTR_SIGN_MINUS) {
-				ret = -ret;
-			}
-			break;
-		default:
-			break;
-		}
-	}
+	free(ctx->stack);
+	free(ctx->frames);
+	free(ctx->spaces);
+	free(ctx->tokens);
+	cache_free(ctx->cache);
+	cache_file_close(ctx->cache_file);
+	cse_free(ctx->cse);
+	free(ctx->refs);
+	symbols_free(ctx->symbols);
+	recalc_free(ctx->recalc);
+	wide_free(ctx->wide);
+	program_release(&ctx->wide_prog);
+	free(ctx->literals);
+	free(ctx);
+	return 0;
+}
 
-	return ret;
+void parser_set_jit_threshold(struct parser_context *ctx,
+			      unsigned int threshold)
+{
+	ctx->jit_threshold = jit_available() ? threshold : 0;
 }
 
-static uint64_t expr_factor(struct lexer *lexer)
+void parser_set_budget(struct parser_context *ctx,
+		       const struct bmath_budget *budget)
 {
-	uint64_t left, right;
-	struct token tok;
+	__set_budget(ctx, budget);
+}
 
-	left = expr_signed(lexer);
-	while (true) {
-		if (lexer->lookahead_token.type != TOK_FACTOR_OP) {
-			break;
-		}
+void parser_set_quiet(struct parser_context *ctx, bool quiet)
+{
+	ctx->quiet = quiet;
+}
 
-		tok = lexer->lookahead_token;
-		__expect(lexer, lexer->lookahead_token.type);
-		right = expr_signed(lexer);
-		switch (tok.attr) {
-		case ATTR_FACTOR_OP_MUL:
-			left *= right;
-			break;
-		case '/':
-			if (right == 0) {
-				__lexical_error(lexer, "Division by zero");
-				return left;
-			}
-			left /= right;
+enum bmath_simd parser_set_simd(struct parser_context *ctx,
+				enum bmath_simd cap)
+{
+	ctx->batch = batch_select(cap);
+	ctx->scan = scan_select(cap);
+	return ctx->batch->level;
+}
+
+bool parser_cache_stats(const struct parser_context *ctx,
+			struct bmath_cache_stats *out_stats)
+{
+	if (!ctx->cache && !ctx->cache_file) {
+		return false;
+	}
+
+	*out_stats = (struct bmath_cache_stats){ 0 };
+	if (ctx->cache) {
+		cache_stats(ctx->cache, out_stats);
+	}
+	if (ctx->cache_file) {
+		cache_file_stats(ctx->cache_file, &out_stats->file_hits,
+				 &out_stats->file_misses);
+	}
+	return true;
+}
+
+bool parser_cse_stats(const struct parser_context *ctx,
+		      struct bmath_cse_stats *out_stats)
+{
+	if (!ctx->cse) {
+		return false;
+	}
+
+	cse_stats(ctx->cse, out_stats);
+	return true;
+}
+
+void parser_reset_symbols(struct parser_context *ctx)
+{
+	if (ctx->symbols) {
+		symbols_next_pass(ctx->symbols);
+	}
+	if (ctx->recalc) {
+		recalc_next_pass(ctx->recalc);
+	}
+}
+
+bool parser_recalc_stats(const struct parser_context *ctx,
+			 struct bmath_recalc_stats *out_stats)
+{
+	if (!ctx->recalc) {
+		return false;
+	}
+
+	recalc_stats(ctx->recalc, out_stats);
+	return true;
+}
+
+bool parser_wide_stats(const struct parser_context *ctx,
+		       struct bmath_wide_stats *out_stats)
+{
+	if (!ctx->wide) {
+		return false;
+	}
+
+	wide_stats(ctx->wide, out_stats);
+	return true;
+}
+
+const struct bmath_error *parser_last_error(const struct parser_context *ctx)
+{
+	return &ctx->error;
+}
+
+// a NULL out only records the error
+static void __render_error(const struct parser_context *ctx, FILE *out,
+			   const char *expr, size_t len)
+{
+	if (out && !ctx->quiet) {
+		bmath_error_render(out, &ctx->error, expr, len);
+	}
+}
+
+/*
+ * parse() of a line that isn't remembered for parser_settings.incremental.
+ * Lines that read or bind a name aren't cached, their outcome depends on
+ * more than their text.
+ */
+static int __parse_line(struct parser_context *ctx,
+			const char *infix_expression, size_t len,
+			uint64_t *out_result)
+{
+	struct lexer lexer;
+	int err;
+
+	// a cached error is rendered like it was just found
+	if (ctx->cache && cache_lookup(ctx->cache, infix_expression, len, &err,
+				       out_result, &ctx->error)) {
+		if (err)
+			__render_error(ctx, ctx->err_stream, infix_expression,
+				       len);
+		return err;
+	}
+
+	// the file only has results, which the cache above can keep too
+	if (ctx->cache_file && cache_file_lookup(ctx->cache_file,
+						 infix_expression, len,
+						 out_result)) {
+		if (ctx->cache)
+			cache_store(ctx->cache, infix_expression, len, 0,
+				    *out_result, &ctx->error);
+		return 0;
+	}
+
+	if (ctx->cse)
+		cse_next_line(ctx->cse);
+
+	lexer = __init_lexer(ctx, infix_expression, len);
+
+	__perform_parse(&lexer);
+
+	// going over budget depends on more than the line, such as the clock
+	if (ctx->liberror) {
+		ctx->liberror = false;
+		err = __line_error(ctx);
+		if (ctx->cache && !ctx->symbolic && err == PE_PARSE_ERROR)
+			cache_store(ctx->cache, infix_expression, len, err, 0,
+				    &ctx->error);
+		__render_error(ctx, ctx->err_stream, infix_expression, len);
+		return err;
+	}
+
+	*out_result = ctx->stack[0];
+	if (ctx->symbolic)
+		return 0;
+
+	if (ctx->cache)
+		cache_store(ctx->cache, infix_expression, len, 0,
+			    *out_result, &ctx->error);
+	if (ctx->cache_file)
+		cache_file_store(ctx->cache_file, *out_result);
+
+	return 0;
+}
+
+int parse(struct parser_context *ctx, const char *infix_expression, size_t len,
+	  uint64_t *out_result)
+{
+	int err;
+
+	*out_result = 0;
+	ctx->binds = SYMBOL_NONE;
+	ctx->symbolic = false;
+
+	err = __begin_line(ctx, len);
+	if (err)
+		return err;
+
+	// a remembered error is rendered like it was just found
+	if (ctx->recalc &&
+	    recalc_lookup(ctx->recalc, ctx->symbols, infix_expression, len,
+			  &err, out_result, &ctx->error, &ctx->binds)) {
+		if (err)
+			__render_error(ctx, ctx->err_stream, infix_expression,
+				       len);
+	} else {
+		err = __parse_line(ctx, infix_expression, len, out_result);
+		if (ctx->recalc)
+			recalc_store(ctx->recalc, err, *out_result,
+				     &ctx->error, ctx->binds);
+	}
+
+	if (err || !ctx->symbols)
+		return err;
+
+	if (ctx->binds != SYMBOL_NONE)
+		symbols_set(ctx->symbols, ctx->binds, *out_result);
+	symbols_set(ctx->symbols, SYMBOL_LAST, *out_result);
+	return 0;
+}
+
+static int __compile(struct parser_context *ctx, const char *infix_expression,
+		     size_t len, FILE *err_stream,
+		     struct bmath_program **out_program)
+{
+	struct lexer lexer;
+	struct bmath_program *prog;
+	struct program_op *ops;
+	int err;
+
+	*out_program = NULL;
+	err = __begin_line(ctx, len);
+	if (err)
+		return err;
+
+	prog = calloc(1, sizeof(*prog));
+	if (!prog) {
+		ctx->error.code = BMATH_ENOMEM;
+		return PE_NO_MEMORY;
+	}
+
+	lexer = __init_lexer(ctx, infix_expression, len);
+	lexer.prog = prog;
+
+	__perform_parse(&lexer);
+
+	if (ctx->liberror) {
+		ctx->liberror = false;
+		__render_error(ctx, err_stream, infix_expression, len);
+		bmath_program_free(prog);
+		return __line_error(ctx);
+	}
+
+	// programs are immutable from here on out, so drop the slack
+	ops = realloc(prog->ops, prog->len * sizeof(*ops));
+	if (ops) {
+		prog->ops = ops;
+		prog->cap = prog->len;
+	}
+
+	*out_program = prog;
+	return 0;
+}
+
+int bmath_parse_wide(struct parser_context *ctx, const char *infix_expression,
+		     size_t len, uint64_t *out_limbs)
+{
+	struct lexer lexer;
+	enum program_err err;
+	enum func_err func_err = FUNC_ESUCCESS;
+	size_t fault = 0;
+	int ret;
+
+	if (!ctx->wide)
+		return parse(ctx, infix_expression, len, out_limbs);
+
+	memset(out_limbs, 0, ctx->limbs * sizeof(*out_limbs));
+	ret = __begin_line(ctx, len);
+	if (ret)
+		return ret;
+
+	// the program and the literals are reused from line to line
+	program_reset(&ctx->wide_prog);
+	ctx->literals_len = 0;
+	ctx->literal_tier = WIDE_TIER_64;
+
+	lexer = __init_lexer(ctx, infix_expression, len);
+	lexer.prog = &ctx->wide_prog;
+	lexer.limbs = ctx->limbs;
+
+	__perform_parse(&lexer);
+
+	if (!ctx->liberror) {
+		err = wide_run(ctx->wide, &ctx->wide_prog, ctx->literal_tier,
+			       out_limbs, &fault, &func_err);
+		if (err == PROG_ENOMEM) {
+			ctx->error.code = BMATH_ENOMEM;
+			return PE_NO_MEMORY;
+		}
+
+		// faults point at their op, as they do in parse()
+		if (err)
+			__set_error(ctx,
+				    (struct bmath_error){
+					    .code = err == PROG_EDIVZERO ?
+							    BMATH_EDIVZERO :
+							    BMATH_EFUNC,
+					    .pos = ctx->wide_prog.ops[fault].pos,
+					    .func_err = func_err });
+	}
+
+	if (ctx->liberror) {
+		ctx->liberror = false;
+		__render_error(ctx, ctx->err_stream, infix_expression, len);
+		return __line_error(ctx);
+	}
+
+	return 0;
+}
+
+int bmath_compile(struct parser_context *ctx, const char *infix_expression,
+		  size_t len, struct bmath_program **out_program)
+{
+	return __compile(ctx, infix_expression, len, ctx->err_stream,
+			 out_program);
+}
+
+/*
+ * `def name(a, b) = expr`, see bmath_define(). The body is compiled into
+ * lexer->prog, reading the parameters from lexer->params.
+ * @return The symbol of name, SYMBOL_NONE if the definition is invalid
+ */
+static uint32_t __definition(struct lexer *lexer)
+{
+	struct parser_context *ctx = lexer->ctx;
+	const struct lexed_token *tok, *name;
+	uint32_t sym;
+
+	tok = ctx->tokens;
+	__lookahead(lexer, ctx->tokens);
+	if (tok->type != TOK_NAME || __name_len(tok) != 3 ||
+	    memcmp(lexer->line + tok->pos, "def", 3)) {
+		__set_error(ctx, (struct bmath_error){
+					 .code = BMATH_EUNEXPECTED,
+					 .pos = tok->pos,
+					 .expected = "def",
+					 .actual = token_name(tok->type),
+				 });
+		return SYMBOL_NONE;
+	}
+	__expect(lexer, TOK_NAME);
+
+	name = lexer->lookahead;
+	if (name->type == TOK_FUNCTION) {
+		__lexical_error(lexer, BMATH_EDEFINED);
+		return SYMBOL_NONE;
+	}
+	__expect(lexer, TOK_NAME);
+	if (ctx->liberror)
+		return SYMBOL_NONE;
+
+	sym = ctx->symbols ? symbols_intern(ctx->symbols,
+					    lexer->line + name->pos,
+					    __name_len(name)) :
+			     SYMBOL_NONE;
+	if (sym == SYMBOL_NONE) {
+		__general_error(lexer, BMATH_ENOMEM);
+		return SYMBOL_NONE;
+	}
+	if (symbols_def(ctx->symbols, sym)) {
+		lexer->current_column = name->pos;
+		__lexical_error(lexer, BMATH_EDEFINED);
+		return SYMBOL_NONE;
+	}
+
+	__expect(lexer, TOK_LPAREN);
+	lexer->params = lexer->lookahead;
+	while (!ctx->liberror && lexer->lookahead->type != TOK_RPAREN) {
+		tok = lexer->lookahead;
+		__expect(lexer, tok->type == TOK_VARIABLE ? TOK_VARIABLE :
+							     TOK_NAME);
+		if (ctx->liberror)
+			return SYMBOL_NONE;
+
+		if (__param(lexer, tok) < lexer->nparams) {
+			lexer->current_column = tok->pos;
+			__lexical_error(lexer, BMATH_EDEFINED);
+			return SYMBOL_NONE;
+		}
+
+		lexer->nparams++;
+		if (lexer->lookahead->type != TOK_COMMA ||
+		    lexer->nparams == FUNCTIONS_MAX_OPS)
 			break;
-		case ATTR_FACTOR_OP_MOD:
-			if (right == 0) {
-				__lexical_error(lexer, "Division by zero");
-				return left;
-			}
-			left %= right;
+		__expect(lexer, TOK_COMMA);
+	}
+	__expect(lexer, TOK_RPAREN);
+	__expect(lexer, TOK_ASSIGN);
+	if (ctx->liberror)
+		return SYMBOL_NONE;
+
+	expr(lexer);
+
+	// the body has to be all of the rest of the line
+	if (!ctx->liberror && lexer->lookahead->type != TOK_NULL)
+		__expect(lexer, TOK_NULL);
+
+	return ctx->liberror ? SYMBOL_NONE : sym;
+}
+
+int bmath_define(struct parser_context *ctx, const char *definition,
+		 size_t len)
+{
+	struct bmath_program prog = { 0 };
+	struct symbol_def *def = NULL;
+	struct program_op *ops;
+	struct lexer lexer;
+	uint32_t sym = SYMBOL_NONE;
+	int err;
+
+	err = __begin_line(ctx, len);
+	if (err)
+		return err;
+
+	lexer = __init_lexer(ctx, definition, len);
+	lexer.prog = &prog;
+	if (__lex_line(&lexer))
+		sym = __definition(&lexer);
+
+	if (sym != SYMBOL_NONE) {
+		def = malloc(sizeof(*def));
+		if (!def)
+			__general_error(&lexer, BMATH_ENOMEM);
+	}
+
+	if (ctx->liberror) {
+		ctx->liberror = false;
+		__render_error(ctx, ctx->err_stream, definition, len);
+		program_release(&prog);
+		free(def);
+		return __line_error(ctx);
+	}
+
+	// like programs, bodies don't change from here on out
+	ops = realloc(prog.ops, prog.len * sizeof(*ops));
+	*def = (struct symbol_def){ .ops = ops ? ops : prog.ops,
+				    .len = prog.len,
+				    .argc = lexer.nparams };
+	symbols_define(ctx->symbols, sym, def);
+
+	// lines that called name failed, and may not anymore
+	if (ctx->recalc)
+		recalc_invalidate(ctx->recalc);
+	return 0;
+}
+
+static inline void __maybe_promote(struct parser_context *ctx,
+				   struct bmath_program *program)
+{
+	uint32_t runs;
+
+	if (__atomic_load_n(&program->jit, __ATOMIC_ACQUIRE))
+		return;
+
+	runs = __atomic_add_fetch(&program->runs, 1, __ATOMIC_RELAXED);
+	if (runs < ctx->jit_threshold)
+		return;
+
+	// A failed promotion leaves the program interpreted. Back off for
+	// another threshold's worth of runs before trying again.
+	if (jit_compile(program))
+		__atomic_store_n(&program->runs, 0, __ATOMIC_RELAXED);
+}
+
+static void __report_fault(struct parser_context *ctx,
+			   const struct bmath_program *program,
+			   enum program_err err, size_t fault,
+			   enum func_err func_err)
+{
+	ctx->error = (struct bmath_error){ .pos = program->ops[fault].pos,
+					   .func_err = func_err };
+
+	switch (err) {
+	case PROG_EDIVZERO:
+		ctx->error.code = BMATH_EDIVZERO;
+		break;
+	case PROG_EFUNC:
+		ctx->error.code = BMATH_EFUNC;
+		break;
+	default:
+		ctx->error.code = BMATH_EEVAL;
+		break;
+	}
+}
+
+int bmath_exec(struct parser_context *ctx, struct bmath_program *program,
+	       uint64_t *out_result)
+{
+	enum program_err err;
+	enum func_err func_err = FUNC_ESUCCESS;
+	size_t fault = 0;
+	jit_func_t jit;
+
+	*out_result = 0;
+	ctx->error = (struct bmath_error){ .code = BMATH_ENONE };
+
+	if (__ensure_stack(ctx, program->max_depth)) {
+		ctx->error.code = BMATH_ENOMEM;
+		return PE_NO_MEMORY;
+	}
+
+	if (ctx->jit_threshold) {
+		__maybe_promote(ctx, program);
+
+		jit = (jit_func_t)__atomic_load_n(&program->jit,
+						  __ATOMIC_ACQUIRE);
+		if (jit && jit(ctx->stack, zero_vars, out_result) == 0)
+			return 0;
+	}
+
+	err = program_run(program, ctx->stack, zero_vars, out_result, &fault,
+			  &func_err);
+	if (err == PROG_ESUCCESS)
+		return 0;
+
+	__report_fault(ctx, program, err, fault, func_err);
+	__render_error(ctx, ctx->err_stream, NULL, 0);
+	*out_result = 0;
+	return PE_EVAL_ERROR;
+}
+
+int bmath_exec_batch(struct parser_context *ctx,
+		     const struct bmath_program *program, const uint64_t *x,
+		     const uint64_t *y, uint64_t *out, size_t count)
+{
+	const uint64_t *vars[PROGRAM_MAX_VARS] = { [VAR_X] = x, [VAR_Y] = y };
+	uint64_t bound[PROGRAM_MAX_VARS], result;
+	enum func_err func_err = FUNC_ESUCCESS;
+	enum program_err err;
+	size_t fault = 0, op = 0;
+
+	ctx->error = (struct bmath_error){ .code = BMATH_ENONE };
+	if (count == 0)
+		return 0;
+
+	err = batch_run(ctx->batch, program, vars, PROGRAM_MAX_VARS, out, count,
+			&fault, NULL);
+	if (err == PROG_ESUCCESS)
+		return 0;
+
+	if (err == PROG_ENOMEM || __ensure_stack(ctx, program->max_depth)) {
+		ctx->error.code = BMATH_ENOMEM;
+		return PE_NO_MEMORY;
+	}
+
+	// run the faulting input once more to find out what went wrong
+	for (size_t v = 0; v < PROGRAM_MAX_VARS; v++) {
+		bound[v] = vars[v] ? vars[v][fault] : 0;
+	}
+	err = program_run(program, ctx->stack, bound, &result, &op, &func_err);
+
+	__report_fault(ctx, program, err, op, func_err);
+	ctx->error.batch = true;
+	ctx->error.input = fault;
+	__render_error(ctx, ctx->err_stream, NULL, 0);
+	return PE_EVAL_ERROR;
+}
+
+/*
+ * Lexes a whole line into its shape key without parsing it, see shape.h.
+ * This is a cut down __lexer_get_next_token() that produces the same tokens,
+ * but gives up on anything out of the ordinary: lexical errors, variables,
+ * and a number right after a complete operand, where the parser stops early.
+ * Those lines are left to parse().
+ * @return false if the line can't be grouped
+ */
+static bool __scan_shape(struct parser_context *ctx, const char *line,
+			 size_t len, struct shape_scan *scan)
+{
+	const char *c = line, *end = line + len;
+	struct token func;
+	uint64_t value;
+	ssize_t parsed;
+	unsigned int accept, class;
+	char prev = '\0';
+
+	shape_scan_reset(scan);
+
+	if (len == 0 || __too_long(ctx, len))
+		return false;
+
+	while (c < end) {
+		accept = __lex_next(&c, end, &class);
+		switch (accept) {
+		case LEX_ACCEPT_END:
+			return true;
+		case LEX_ACCEPT_SHIFT:
+		case LEX_ACCEPT_TOKEN:
+			if (shape_scan_token(scan, *c, 0))
+				return false;
+			prev = *c;
+			c += accept == LEX_ACCEPT_SHIFT ? 2 : 1;
+			continue;
+		case LEX_ACCEPT_NAME:
+			if (!token_lookup_func(c, end - c, &func) ||
+			    shape_scan_token(scan, 'f', func.attr))
+				return false;
+			prev = 'f';
+			c += func.namelen;
+			continue;
+		case LEX_ACCEPT_DECIMAL:
+		case LEX_ACCEPT_HEX:
 			break;
 		default:
-			__general_error(lexer,
-					"Something went wrong parsing term.\n");
+			return false;
+		}
+
+		if (prev == 'n' || prev == ')')
+			return false;
+
+		if (accept == LEX_ACCEPT_HEX)
+			parsed = str_hex_to_uint64(c, end - c, &value);
+		else
+			parsed = str_dec_to_uint64(c, end - c, &value);
+		if (parsed < 0)
+			return false;
+		c += parsed;
+
+		if (shape_scan_literal(scan, value) ||
+		    shape_scan_token(scan, 'n', 0))
+			return false;
+		prev = 'n';
+	}
+
+	return true;
+}
+
+/*
+ * Compiles one line of a shape and turns its literals into inputs, so the
+ * k-th OP_PUSH reads literal column k. The parser emits literals in source
+ * order, so they line up with the scanned ones unless it stopped short of the
+ * end of the line. prog->vars only tracks x and y and is left alone.
+ */
+static struct bmath_program *__compile_shape(struct parser_context *ctx,
+					     const struct shape *shape,
+					     const char *line, size_t len)
+{
+	struct bmath_program *prog;
+	size_t k = 0;
+
+	if (__compile(ctx, line, len, NULL, &prog))
+		return NULL;
+
+	for (size_t i = 0; i < prog->len; i++) {
+		if (prog->ops[i].code != OP_PUSH)
+			continue;
+
+		prog->ops[i].code = OP_VAR;
+		prog->ops[i].imm = k++;
+	}
+
+	if (k != shape->nlits) {
+		bmath_program_free(prog);
+		return NULL;
+	}
+
+	return prog;
+}
+
+/*
+ * Where a shape's lines go once they are grouped: their indexes and results
+ * start at first, and their literal columns at cols.
+ */
+struct shape_group {
+	size_t first;
+	size_t cols;
+	size_t filled;
+};
+
+/*
+ * Evaluates every line of a compiled shape. A line that faults is left
+ * pending for parse() to report, and evaluation resumes after it.
+ */
+static int __run_shape(struct parser_context *ctx, const struct shape *shape,
+		       const size_t *lines, const uint64_t *cols,
+		       uint64_t *results, uint64_t *out_results, int *out_errs,
+		       struct batch_stats *stats)
+{
+	const uint64_t **vars;
+	enum program_err err;
+	size_t start = 0, end, fault = 0;
+
+	vars = malloc((shape->nlits ? shape->nlits : 1) * sizeof(*vars));
+	if (!vars)
+		return PE_NO_MEMORY;
+
+	while (start < shape->count) {
+		for (size_t k = 0; k < shape->nlits; k++) {
+			vars[k] = cols + k * shape->count + start;
+		}
+
+		err = batch_run(ctx->batch, shape->prog, vars, shape->nlits,
+				results + start, shape->count - start, &fault,
+				stats);
+		if (err == PROG_ENOMEM) {
+			free(vars);
+			return PE_NO_MEMORY;
+		}
+
+		end = err ? start + fault : shape->count;
+		for (size_t i = start; i < end; i++) {
+			out_results[lines[i]] = results[i];
+			out_errs[lines[i]] = 0;
+		}
+		start = end + 1;
+	}
+
+	free(vars);
+	return 0;
+}
+
+// not evaluated yet
+#define BATCH_PENDING -1
+#define BATCH_NO_SHAPE SIZE_MAX
+
+int bmath_parse_batch(struct parser_context *ctx, const char *const *lines,
+		      const size_t *lens, size_t count, uint64_t *out_results,
+		      int *out_errs, struct bmath_batch_stats *out_stats)
+{
+	struct batch_stats stats = { 0 };
+	struct shape_scan scan = { 0 };
+	struct shape_tbl *tbl;
+	struct shape *shape;
+	struct shape_group *groups = NULL, *group;
+	size_t *line_shape, *order = NULL;
+	uint64_t *cols = NULL, *results = NULL;
+	const uint64_t *lits;
+	size_t nshapes, first = 0, ncols = 0, lit = 0, parsed = 0, j;
+	// one past the line that succeeded last
+	size_t last = 0;
+	int ret = PE_NO_MEMORY;
+
+	tbl = shape_tbl_new();
+	line_shape = malloc(count * sizeof(*line_shape));
+	if (!tbl || !line_shape)
+		goto out;
+
+	for (size_t i = 0; i < count; i++) {
+		out_results[i] = 0;
+		out_errs[i] = BATCH_PENDING;
+		line_shape[i] = BATCH_NO_SHAPE;
+
+		if (!__scan_shape(ctx, lines[i], lens[i], &scan)) {
+			shape_scan_drop(&scan);
+			continue;
+		}
+
+		if (shape_tbl_add(tbl, &scan, &line_shape[i]))
+			goto out;
+	}
+
+	nshapes = shape_tbl_len(tbl);
+	groups = malloc((nshapes ? nshapes : 1) * sizeof(*groups));
+	order = malloc((count ? count : 1) * sizeof(*order));
+	results = malloc((count ? count : 1) * sizeof(*results));
+	cols = malloc((scan.nlits ? scan.nlits : 1) * sizeof(*cols));
+	if (!groups || !order || !results || !cols)
+		goto out;
+
+	for (size_t s = 0; s < nshapes; s++) {
+		shape = shape_tbl_at(tbl, s);
+		groups[s] = (struct shape_group){ .first = first, .cols = ncols };
+		first += shape->count;
+		ncols += shape->count * shape->nlits;
+	}
+
+	// Group the lines in input order, compiling each shape when its first
+	// line comes up, and turn each line's literals into a lane of its
+	// shape's literal columns.
+	for (size_t i = 0; i < count; i++) {
+		if (line_shape[i] == BATCH_NO_SHAPE)
+			continue;
+
+		shape = shape_tbl_at(tbl, line_shape[i]);
+		group = &groups[line_shape[i]];
+		lits = scan.lits + lit;
+		lit += shape->nlits;
+
+		// a lone line is cheaper to parse() than to compile and run
+		if (shape->count < 2)
+			continue;
+
+		j = group->filled++;
+		if (j == 0)
+			shape->prog = __compile_shape(ctx, shape, lines[i],
+						      lens[i]);
+		if (!shape->prog)
+			continue;
+
+		order[group->first + j] = i;
+		for (size_t k = 0; k < shape->nlits; k++) {
+			cols[group->cols + k * shape->count + j] = lits[k];
+		}
+	}
+
+	for (size_t s = 0; s < nshapes; s++) {
+		shape = shape_tbl_at(tbl, s);
+		if (!shape->prog)
+			continue;
+
+		group = &groups[s];
+		if (__run_shape(ctx, shape, order + group->first,
+				cols + group->cols, results + group->first,
+				out_results, out_errs, &stats))
+			goto out;
+	}
+
+	// Whatever is left goes through parse() in order, so any errors are
+	// reported in input order. Each of those lines sees the result of the
+	// line that succeeded last before it as `_`, grouped or not.
+	for (size_t i = 0; i < count; i++) {
+		if (out_errs[i] == BATCH_PENDING) {
+			if (last && ctx->symbols)
+				symbols_set(ctx->symbols, SYMBOL_LAST,
+					    out_results[last - 1]);
+			out_errs[i] = parse(ctx, lines[i], lens[i],
+					    &out_results[i]);
+			parsed++;
+		}
+
+		if (!out_errs[i])
+			last = i + 1;
+	}
+
+	if (last && ctx->symbols)
+		symbols_set(ctx->symbols, SYMBOL_LAST, out_results[last - 1]);
+
+	if (out_stats) {
+		out_stats->shapes = nshapes;
+		out_stats->parsed = parsed;
+		out_stats->op_dispatches = stats.dispatches;
+		out_stats->lane_ops = stats.lane_ops;
+	}
+	ret = 0;
+
+out:
+	shape_tbl_free(tbl);
+	shape_scan_release(&scan);
+	free(line_shape);
+	free(groups);
+	free(order);
+	free(results);
+	free(cols);
+	return ret;
+}
+
+void bmath_program_free(struct bmath_program *program)
+{
+	if (!program)
+		return;
+
+	program_release(program);
+	free(program);
+}
+
+size_t bmath_program_len(const struct bmath_program *program)
+{
+	return program->len;
+}
+
+bool bmath_program_has_vars(const struct bmath_program *program)
+{
+	return program->vars != 0;
+}
+
+bool bmath_program_is_jitted(const struct bmath_program *program)
+{
+	return __atomic_load_n(&program->jit, __ATOMIC_ACQUIRE) != NULL;
+}
+
+int bmath_optimize(struct bmath_program *program,
+		   struct bmath_optimize_stats *stats)
+{
+	size_t before = program->len;
+
+	if (program_optimize(program))
+		return PE_NO_MEMORY;
+
+	if (stats) {
+		stats->ops_before = before;
+		stats->ops_after = program->len;
+	}
+
+	return 0;
+}
+
+static struct lexer __init_lexer(struct parser_context *ctx, const char *line,
+				 size_t line_length)
+{
+	struct lexer lexer;
+
+	lexer.line = line;
+	lexer.current_column = 0;
+	lexer.line_length = line_length;
+	lexer.ctx = ctx;
+	lexer.prog = NULL;
+	lexer.depth = 0;
+	lexer.spaces = NULL;
+	lexer.scanned = 0;
+	lexer.ntokens = 0;
+	lexer.params = NULL;
+	lexer.nparams = 0;
+	lexer.limbs = 1;
+	lexer.steps = 0;
+	lexer.calls = 0;
+	lexer.deadline = 0;
+	lexer.next_check = __next_check(&lexer, 0, ctx->max_tokens);
+
+	return lexer;
+}
+
+// reported once the parser gets to it, see struct lexed_token
+static inline struct token __error_token(enum bmath_error_code code)
+{
+	return (struct token){ .attr = code,
+			       .namelen = 0,
+			       .type = TOK_ERROR };
+}
+
+static struct token __lexer_parse_number(struct lexer *lexer)
+{
+	uint64_t result = 0;
+	const char *start = lexer->line + lexer->current_column;
+	struct token tok = NULL_TOKEN;
+
+	ssize_t bytes_parsed = str_dec_to_uint64(
+		start, lexer->line_length - lexer->current_column, &result);
+	if (bytes_parsed < 0) {
+		if (lexer->limbs > 1) {
+			return __lexer_parse_wide(lexer, false);
+		}
+
+		return __error_token(BMATH_ENUMBER_RANGE);
+	}
+
+	lexer->current_column += bytes_parsed;
+
+	tok.attr = result;
+	tok.type = TOK_NUMBER;
+	return tok;
+}
+
+static struct token __lexer_parse_hex(struct lexer *lexer)
+{
+	uint64_t result = 0;
+	const char *start = lexer->line + lexer->current_column;
+	struct token tok = NULL_TOKEN;
+
+	ssize_t bytes_parsed = str_hex_to_uint64(
+		start, lexer->line_length - lexer->current_column, &result);
+	if (bytes_parsed < 0) {
+		if (errno == E2BIG && lexer->limbs > 1) {
+			return __lexer_parse_wide(lexer, true);
+		}
+
+		if (errno == E2BIG) {
+			return __error_token(BMATH_EHEX_RANGE);
 		}
+
+		return __error_token(BMATH_EHEX_INVALID);
 	}
 
-	return left;
+	lexer->current_column += bytes_parsed;
+
+	tok.type = TOK_NUMBER;
+	tok.attr = result;
+	return tok;
 }
 
-static uint64_t expr_add(struct lexer *lexer)
+/*
+ * A literal too wide for 64 bits, for bmath_parse_wide(). Its limbs are kept
+ * with the other wide literals of the line, see __push_wide().
+ */
+static struct token __lexer_parse_wide(struct lexer *lexer, bool hex)
 {
-	uint64_t left, right;
-	struct token tok;
+	struct parser_context *ctx = lexer->ctx;
+	const char *start = lexer->line + lexer->current_column;
+	size_t len = lexer->line_length - lexer->current_column;
+	size_t base = ctx->literals_len, limbs = lexer->limbs, cap;
+	struct token tok = NULL_TOKEN;
+	ssize_t bytes_parsed;
+	uint64_t *literals;
+
+	if (base + limbs > ctx->literals_cap) {
+		cap = ctx->literals_cap ? ctx->literals_cap : 4 * limbs;
+		while (cap < base + limbs) {
+			cap *= 2;
+		}
 
-	left = expr_factor(lexer);
-	while (true) {
-		if (lexer->lookahead_token.type != TOK_SIGN) {
-			break;
+		literals = realloc(ctx->literals, cap * sizeof(*literals));
+		if (!literals) {
+			return __error_token(BMATH_ENOMEM);
 		}
 
-		tok = lexer->lookahead_token;
-		__expect(lexer, lexer->lookahead_token.type);
-		right = expr_factor(lexer);
-		switch (tok.attr) {
-		case ATTR_SIGN_PLUS:
-			left += right;
-			break;
-		case ATTR_SIGN_MINUS:
-			left -= right;
-			break;
-		default:
-			__general_error(lexer,
-					"Something went wrong parsing term.\n");
+		ctx->literals = literals;
+		ctx->literals_cap = cap;
+	}
+
+	literals = ctx->literals + base;
+	bytes_parsed = hex ? str_hex_to_limbs(start, len, literals, limbs) :
+			     str_dec_to_limbs(start, len, literals, limbs);
+	if (bytes_parsed < 0) {
+		return __error_token(BMATH_EWIDTH);
+	}
+
+	ctx->literals_len += limbs;
+	lexer->current_column += bytes_parsed;
+
+	// it is over 64 bits, so at least the 128-bit tier
+	for (size_t i = 2; i < limbs; i++) {
+		if (literals[i]) {
+			ctx->literal_tier = WIDE_TIER_LIMBS;
 		}
 	}
+	if (ctx->literal_tier == WIDE_TIER_64) {
+		ctx->literal_tier = WIDE_TIER_128;
+	}
 
-	return left;
+	tok.type = TOK_WIDE;
+	tok.attr = base;
+	return tok;
 }
 
-static uint64_t expr_shift(struct lexer *lexer)
+static inline unsigned int __lex_class(const char *c, const char *end)
 {
-	uint64_t left, right;
-	struct token tok;
+	return c < end ? __char_class(*c) : LEX_CLASS_END;
+}
 
-	left = expr_add(lexer);
-	while (true) {
-		if (lexer->lookahead_token.type != TOK_SHIFT_OP) {
-			break;
+/*
+ * Runs the DFA of lookup_tables.h from *pos to the end of the next token.
+ * Only whitespace loops back to the start state, and every other state is
+ * one character into its token, so no lookup waits on the one before it.
+ * @param const char **pos Set to the start of the token
+ * @return The LEX_ACCEPT_* the DFA stopped in
+ */
+static inline unsigned int __lex_next(const char **pos, const char *end,
+				      unsigned int *out_class)
+{
+	const char *p = *pos;
+	unsigned int class = __lex_class(p, end);
+	unsigned int next;
+
+	while ((next = lookup_lex_dfa[LEX_STATE_START][class]) ==
+	       LEX_STATE_START) {
+		class = __lex_class(++p, end);
+	}
+
+	if (next < LEX_STATES) {
+		next = lookup_lex_dfa[next][__lex_class(p + 1, end)];
+	}
+
+	*pos = p;
+	*out_class = class;
+	return next;
+}
+
+// the first byte at or after pos that isn't whitespace, len if there is none
+static inline size_t __skip_spaces(const uint64_t *spaces, size_t pos,
+				   size_t len)
+{
+	size_t word = pos / 64;
+	uint64_t tokens;
+
+	if (pos == len) {
+		return len;
+	}
+
+	// bits past len are clear, so the search stops there
+	tokens = ~spaces[word] >> (pos % 64);
+	while (!tokens) {
+		if (++word == SCAN_WORDS(len)) {
+			return len;
 		}
+		pos = word * 64;
+		tokens = ~spaces[word];
+	}
+
+	return pos + __builtin_ctzll(tokens);
+}
+
+/*
+ * Lexes the token at or after current_column and moves past it.
+ * @param size_t *out_pos Where the token starts
+ */
+static struct token __lexer_get_next_token(struct lexer *lexer,
+					   size_t *out_pos)
+{
+	const char *start;
+	const char *end = lexer->line + lexer->line_length;
+	const struct lex_class_token *class_token;
+	struct token token = NULL_TOKEN;
+	unsigned int class;
+
+	// this is to avoid having to specify namelen = 1 in multiple places
+	token.namelen = 1;
+
+	// Nothing at or past len is read, so the line doesn't need to be
+	// terminated. A NUL before len ends the line as well.
+	*out_pos = lexer->current_column;
+	if (lexer->current_column >= lexer->line_length ||
+	    lexer->current_column > lexer->scanned) {
+		return token;
+	}
 
-		tok = lexer->lookahead_token;
-		__expect(lexer, lexer->lookahead_token.type);
-		right = expr_add(lexer);
-		switch (tok.attr) {
-		case ATTR_LSHIFT:
-			left <<= right;
+	start = lexer->line + lexer->current_column;
+	if (lexer->spaces)
+		start = lexer->line + __skip_spaces(lexer->spaces,
+						    lexer->current_column,
+						    lexer->scanned);
+
+	switch (__lex_next(&start, end, &class)) {
+	case LEX_ACCEPT_END:
+		break;
+	case LEX_ACCEPT_DECIMAL:
+		lexer->current_column = *out_pos = start - lexer->line;
+		return __lexer_parse_number(lexer);
+	case LEX_ACCEPT_HEX:
+		lexer->current_column = *out_pos = start - lexer->line;
+		return __lexer_parse_hex(lexer);
+	case LEX_ACCEPT_SHIFT:
+		token.namelen = 2;
+		// fallthrough
+	case LEX_ACCEPT_TOKEN:
+		class_token = &lookup_class_token[class];
+		token.type = class_token->type;
+		token.attr = class_token->attr;
+		break;
+	case LEX_ACCEPT_NAME:
+		// builtins are functions, x and y on their own are variables,
+		// and anything else is a name
+		if (token_lookup_func(start, end - start, &token)) {
 			break;
-		case ATTR_RSHIFT:
-			left >>= right;
+		}
+
+		token.namelen = token_name_len(start, end - start);
+		class_token = &lookup_class_token[class];
+		if (token.namelen == 1 && class_token->type != TOK_NULL) {
+			token.type = class_token->type;
+			token.attr = class_token->attr;
 			break;
-		default:
-			__general_error(lexer,
-					"Something went wrong parsing term.\n");
+		}
+
+		token.type = TOK_NAME;
+		token.attr = token.namelen;
+		break;
+	default:
+		token = __error_token(BMATH_EILLEGAL);
+		break;
+	}
+
+	*out_pos = start - lexer->line;
+	lexer->current_column = *out_pos + token.namelen;
+	return token;
+}
+
+// errors point at the start of the lookahead from here on
+static void __lookahead(struct lexer *lexer, struct lexed_token *tok)
+{
+	lexer->lookahead = tok;
+	lexer->current_column = tok->pos;
+
+	if (unlikely(tok->type == TOK_ERROR)) {
+		__lexical_error(lexer, tok->attr);
+		tok->type = TOK_NULL;
+	}
+}
+
+static void __expect(struct lexer *lex, enum token_type expected)
+{
+	if (lex->lookahead->type == expected) {
+		__lookahead(lex, lex->lookahead + 1);
+		return;
+	}
+
+	__set_error(lex->ctx, (struct bmath_error){
+				      .code = BMATH_EUNEXPECTED,
+				      .pos = __clamp_pos(lex->current_column),
+				      .expected = token_name(expected),
+				      .actual = token_name(lex->lookahead->type),
+			      });
+}
+
+static int __ensure_refs(struct parser_context *ctx, size_t depth)
+{
+	struct cse_ref *refs;
+	size_t cap;
+
+	if (likely(depth <= ctx->refs_cap)) {
+		return 0;
+	}
+
+	cap = ctx->refs_cap ? ctx->refs_cap : 16;
+	while (cap < depth) {
+		cap *= 2;
+	}
+
+	refs = realloc(ctx->refs, cap * sizeof(*refs));
+	if (!refs) {
+		return ENOMEM;
+	}
+
+	ctx->refs = refs;
+	ctx->refs_cap = cap;
+	return 0;
+}
+
+/*
+ * With parser_settings.cse, each value on the stack has a reference next to
+ * it, to the literal it is or to the subterm that computed it. An op on
+ * operands it has seen before takes the value it had then instead of
+ * running again.
+ * @return Whether the op is done, with its value or an error
+ */
+static bool __share(struct lexer *lexer, const struct program_op *op)
+{
+	struct parser_context *ctx = lexer->ctx;
+	size_t top = lexer->depth - 1;
+
+	if (__ensure_refs(ctx, lexer->depth)) {
+		__general_error(lexer, BMATH_ENOMEM);
+		return true;
+	}
+
+	if (op->code == OP_PUSH) {
+		ctx->refs[top] = (struct cse_ref){ .ref = op->imm,
+						   .literal = true };
+		return false;
+	}
+
+	// the operands start where the value goes
+	return cse_lookup(ctx->cse, op, &ctx->refs[top], &ctx->stack[top],
+			  &ctx->refs[top]);
+}
+
+// values an op leaves on the stack, less the ones it takes
+static inline int __stack_effect(enum program_opcode code, uint8_t argc)
+{
+	switch (code) {
+	case OP_PUSH:
+	case OP_VAR:
+	case OP_ARG:
+		return 1;
+	case OP_NEG:
+	case OP_NOT:
+		return 0;
+	case OP_CALL:
+		return 1 - argc;
+	default:
+		return -1;
+	}
+}
+
+/*
+ * Evaluates or compiles an op. pos is where its token starts, which is where
+ * errors evaluating it point.
+ */
+static void __emit(struct lexer *lexer, enum program_opcode code,
+		   uint8_t argc, uint64_t imm, uint32_t pos)
+{
+	struct parser_context *ctx = lexer->ctx;
+	struct program_op op = {
+		.imm = imm, .pos = pos, .code = code, .argc = argc
+	};
+	enum program_err err;
+	enum func_err func_err = FUNC_ESUCCESS;
+	size_t base = lexer->depth;
+	uint64_t *sp;
+
+	lexer->depth += __stack_effect(code, argc);
+
+	// Once an error is raised the stack shape can no longer be trusted,
+	// so stop producing values and let the parser unwind.
+	if (ctx->liberror) {
+		return;
+	}
+
+	if (unlikely(++lexer->steps >= lexer->next_check) &&
+	    __over_budget(lexer, lexer->steps, ctx->max_steps,
+			  BMATH_LIMIT_STEPS, pos)) {
+		return;
+	}
+
+	if (code == OP_CALL && unlikely(++lexer->calls > ctx->max_calls)) {
+		__budget_error(lexer, BMATH_LIMIT_CALLS, pos);
+		return;
+	}
+
+	if (lexer->prog) {
+		if (program_emit(lexer->prog, op)) {
+			__general_error(lexer, BMATH_ENOMEM);
+			return;
+		}
+
+		if (lexer->depth > lexer->prog->max_depth) {
+			lexer->prog->max_depth = lexer->depth;
+		}
+
+		if (code == OP_VAR) {
+			lexer->prog->vars |= 1u << imm;
+		}
+		return;
+	}
+
+	if (__ensure_stack(ctx, lexer->depth)) {
+		__general_error(lexer, BMATH_ENOMEM);
+		return;
+	}
+
+	if (ctx->cse && __share(lexer, &op)) {
+		return;
+	}
+
+	sp = ctx->stack + base;
+	err = program_step(&op, &sp, NULL, &func_err);
+	if (err != PROG_ESUCCESS) {
+		lexer->current_column = pos;
+	}
+	switch (err) {
+	case PROG_ESUCCESS:
+		if (ctx->cse && code != OP_PUSH)
+			cse_store(ctx->cse, sp[-1], &ctx->refs[lexer->depth - 1]);
+		break;
+	case PROG_EDIVZERO:
+		__lexical_error(lexer, BMATH_EDIVZERO);
+		break;
+	case PROG_EFUNC:
+		__set_error(ctx, (struct bmath_error){ .code = BMATH_EFUNC,
+						       .pos = pos,
+						       .func_err = func_err });
+		break;
+	default:
+		__general_error(lexer, BMATH_EEVAL);
+		break;
+	}
+}
+
+/*
+ * Pushes the value a name is bound to, see parser_reset_symbols(). The name
+ * is looked up even when it isn't bound, so that with
+ * parser_settings.incremental the line is evaluated again once it is.
+ * @return false if it isn't bound
+ */
+static bool __read_name(struct lexer *lexer, const struct lexed_token *tok)
+{
+	struct parser_context *ctx = lexer->ctx;
+	const char *name = lexer->line + tok->pos;
+	uint32_t sym = SYMBOL_NONE;
+	uint64_t value;
+
+	if (!lexer->prog && ctx->symbols) {
+		ctx->symbolic = true;
+		sym = ctx->recalc ? symbols_intern(ctx->symbols, name,
+						   __name_len(tok)) :
+				    symbols_find(ctx->symbols, name,
+						 __name_len(tok));
+	}
+
+	if (sym == SYMBOL_NONE && ctx->recalc && !lexer->prog) {
+		__general_error(lexer, BMATH_ENOMEM);
+		return false;
+	}
+
+	if (sym != SYMBOL_NONE) {
+		if (ctx->recalc)
+			recalc_read(ctx->recalc, ctx->symbols, sym);
+		if (symbols_get(ctx->symbols, sym, &value)) {
+			__emit(lexer, OP_PUSH, 0, value, tok->pos);
+			return true;
+		}
+	}
+
+	__lexical_error(lexer, tok->type == TOK_VARIABLE ? BMATH_EVARIABLE :
+							  BMATH_EUNDEFINED);
+	return false;
+}
+
+/*
+ * Reads a parameter in the body of a definition. Bodies can't read anything
+ * else, x and y included.
+ * @return false if tok isn't a parameter
+ */
+static bool __read_param(struct lexer *lexer, const struct lexed_token *tok)
+{
+	uint8_t k = __param(lexer, tok);
+
+	if (k < lexer->nparams) {
+		__emit(lexer, OP_ARG, 0, k, tok->pos);
+		return true;
+	}
+
+	__lexical_error(lexer, BMATH_EUNDEFINED);
+	return false;
+}
+
+/*
+ * The definition a call is inlined from, see bmath_define(). Lines that
+ * call one aren't cached, like lines that read a name.
+ * @return NULL if the name isn't defined
+ */
+static const struct symbol_def *__find_def(struct lexer *lexer,
+					   const struct lexed_token *tok)
+{
+	struct parser_context *ctx = lexer->ctx;
+	const struct symbol_def *def = NULL;
+	uint32_t sym = SYMBOL_NONE;
+
+	if (!lexer->prog)
+		ctx->symbolic = true;
+
+	if (ctx->symbols)
+		sym = symbols_find(ctx->symbols, lexer->line + tok->pos,
+				   __name_len(tok));
+	if (sym != SYMBOL_NONE)
+		def = symbols_def(ctx->symbols, sym);
+
+	if (!def)
+		__lexical_error(lexer, BMATH_EUNDEFINED);
+	return def;
+}
+
+/*
+ * Pushes a literal of __lexer_parse_wide() a limb at a time, from the most
+ * significant one, as (hi << 64) | lo, so no op needs more than 64 bits.
+ */
+static void __push_wide(struct lexer *lexer, const struct lexed_token *tok)
+{
+	const uint64_t *limbs = lexer->ctx->literals + tok->attr;
+	size_t i = lexer->limbs;
+
+	while (i > 1 && !limbs[i - 1]) {
+		i--;
+	}
+
+	__emit(lexer, OP_PUSH, 0, limbs[--i], tok->pos);
+	while (i--) {
+		__emit(lexer, OP_PUSH, 0, 64, tok->pos);
+		__emit(lexer, OP_SHL, 0, 0, tok->pos);
+		if (limbs[i]) {
+			__emit(lexer, OP_PUSH, 0, limbs[i], tok->pos);
+			__emit(lexer, OP_OR, 0, 0, tok->pos);
+		}
+	}
+}
+
+/*
+ * Calls a builtin, checking its number of arguments here once so that
+ * running the call never has to. mask() is the literal zero.
+ */
+static void __call(struct lexer *lexer, enum func_id id, uint8_t argc,
+		   uint32_t pos)
+{
+	struct parser_context *ctx = lexer->ctx;
+
+	if (ctx->liberror)
+		return;
+
+	if (func_arity(id, argc)) {
+		__set_error(ctx, (struct bmath_error){
+					 .code = BMATH_EFUNC,
+					 .pos = pos,
+					 .func_err = FUNC_EINVAL,
+				 });
+		return;
+	}
+
+	if (argc != func_info[id].argc)
+		__emit(lexer, OP_PUSH, 0, 0, pos);
+	else
+		__emit(lexer, OP_CALL, argc, id, pos);
+}
+
+/*
+ * Replaces a call of a definition with its body, whose ops point at the
+ * call. parse() has evaluated the arguments already, and each parameter is
+ * a literal of its argument's value. Compiled expressions get a copy of the
+ * argument's ops wherever its parameter is read instead, which is what
+ * writing the body out by hand gives.
+ */
+static void __inline_call(struct lexer *lexer, const struct symbol_def *def,
+			  uint8_t argc, uint32_t pos)
+{
+	struct parser_context *ctx = lexer->ctx;
+	struct bmath_program *prog = lexer->prog;
+	size_t starts[FUNCTIONS_MAX_OPS + 1], tail, len = 0;
+	uint64_t args[FUNCTIONS_MAX_OPS];
+	const struct program_op *op;
+	struct program_op arg;
+	int values;
+
+	if (ctx->liberror)
+		return;
+
+	if (argc != def->argc) {
+		__set_error(ctx, (struct bmath_error){
+					 .code = BMATH_EFUNC,
+					 .pos = pos,
+					 .func_err = FUNC_EINVAL,
+				 });
+		return;
+	}
+
+	if (unlikely(++lexer->calls > ctx->max_calls)) {
+		__budget_error(lexer, BMATH_LIMIT_CALLS, pos);
+		return;
+	}
+
+	lexer->depth -= argc;
+	if (!prog) {
+		memcpy(args, ctx->stack + lexer->depth, argc * sizeof(*args));
+		for (size_t i = 0; i < def->len; i++) {
+			op = &def->ops[i];
+			if (op->code == OP_ARG)
+				__emit(lexer, OP_PUSH, 0, args[op->imm], pos);
+			else
+				__emit(lexer, op->code, op->argc, op->imm, pos);
+		}
+		return;
+	}
+
+	// each argument is the shortest run of ops before the next one that
+	// leaves a value
+	tail = starts[argc] = prog->len;
+	for (size_t k = argc; k--;) {
+		starts[k] = starts[k + 1];
+		values = 0;
+		do {
+			op = &prog->ops[--starts[k]];
+			values += __stack_effect(op->code, op->argc);
+		} while (values != 1);
+	}
+
+	for (size_t i = 0; i < def->len; i++) {
+		op = &def->ops[i];
+		len += op->code == OP_ARG ?
+			       starts[op->imm + 1] - starts[op->imm] :
+			       1;
+	}
+	if (len > INLINE_MAX_OPS) {
+		__set_error(ctx, (struct bmath_error){
+					 .code = BMATH_EEXPANSION,
+					 .pos = pos,
+				 });
+		return;
+	}
+
+	// the body goes after the arguments, and then over them
+	for (size_t i = 0; i < def->len; i++) {
+		op = &def->ops[i];
+		if (op->code != OP_ARG) {
+			__emit(lexer, op->code, op->argc, op->imm, pos);
+			continue;
+		}
+
+		for (size_t j = starts[op->imm]; j < starts[op->imm + 1]; j++) {
+			arg = prog->ops[j];
+			__emit(lexer, arg.code, arg.argc, arg.imm, arg.pos);
 		}
 	}
-	return left;
+
+	if (ctx->liberror)
+		return;
+
+	memmove(prog->ops + starts[0], prog->ops + tail,
+		(prog->len - tail) * sizeof(*prog->ops));
+	prog->len -= tail - starts[0];
 }
 
-static uint64_t expr_and(struct lexer *lexer)
+static int __ensure_frames(struct parser_context *ctx, size_t nframes)
 {
-	uint64_t left;
+	struct parse_frame *frames;
+	size_t cap;
 
-	left = expr_shift(lexer);
-	if (lexer->lookahead_token.attr != ATTR_OP_AND)
-		return left;
+	if (likely(nframes <= ctx->frames_cap)) {
+		return 0;
+	}
+
+	if (ctx->scratch) {
+		return ENOMEM;
+	}
+
+	cap = ctx->frames_cap ? ctx->frames_cap * 2 : 32;
+	frames = realloc(ctx->frames, cap * sizeof(*frames));
+	if (!frames) {
+		return ENOMEM;
+	}
 
-	__expect(lexer, TOK_OP);
-	return left & expr_and(lexer);
+	ctx->frames = frames;
+	ctx->frames_cap = cap;
+	return 0;
 }
 
-static uint64_t expr_xor(struct lexer *lexer)
+static bool __push_frame(struct lexer *lexer, size_t *nframes,
+			 struct parse_frame frame)
 {
-	uint64_t left;
+	struct parser_context *ctx = lexer->ctx;
+
+	if (unlikely(*nframes >= ctx->max_depth)) {
+		__budget_error(lexer, BMATH_LIMIT_DEPTH, frame.pos);
+		return false;
+	}
+
+	if (__ensure_frames(ctx, *nframes + 1)) {
+		__general_error(lexer, BMATH_ENOMEM);
+		return false;
+	}
 
-	left = expr_and(lexer);
-	if (lexer->lookahead_token.attr != ATTR_OP_XOR)
-		return left;
+	ctx->frames[(*nframes)++] = frame;
+	return true;
+}
 
-	__expect(lexer, TOK_OP);
-	return left ^ expr_xor(lexer);
+/*
+ * Precedence of a binary operator token, from | up to the factor operators.
+ * @return Zero if the token isn't a binary operator
+ */
+static uint8_t __binary_prec(const struct lexed_token *tok,
+			     enum program_opcode *code)
+{
+	switch (tok->type) {
+	case TOK_OP:
+		switch (tok->attr) {
+		case ATTR_OP_OR:
+			*code = OP_OR;
+			return 1;
+		case ATTR_OP_XOR:
+			*code = OP_XOR;
+			return 2;
+		case ATTR_OP_AND:
+			*code = OP_AND;
+			return 3;
+		default:
+			return 0;
+		}
+	case TOK_SHIFT_OP:
+		*code = tok->attr == ATTR_LSHIFT ? OP_SHL : OP_SHR;
+		return 4;
+	case TOK_SIGN:
+		*code = tok->attr == ATTR_SIGN_PLUS ? OP_ADD : OP_SUB;
+		return 5;
+	case TOK_FACTOR_OP:
+		switch (tok->attr) {
+		case ATTR_FACTOR_OP_MUL:
+			*code = OP_MUL;
+			return 6;
+		case '/':
+			*code = OP_DIV;
+			return 6;
+		case ATTR_FACTOR_OP_MOD:
+			*code = OP_MOD;
+			return 6;
+		default:
+			return 0;
+		}
+	default:
+		return 0;
+	}
 }
 
-static uint64_t expr_or(struct lexer *lexer)
+// emit the binary operators above the innermost parenthesis or call
+static size_t __reduce(struct lexer *lexer, size_t nframes, uint8_t prec)
 {
-	uint64_t left;
+	struct parse_frame *frames = lexer->ctx->frames;
 
-	left = expr_xor(lexer);
-	if (lexer->lookahead_token.attr != ATTR_OP_OR)
-		return left;
+	while (nframes && frames[nframes - 1].kind == FRAME_BINARY &&
+	       frames[nframes - 1].prec >= prec) {
+		nframes--;
+		__emit(lexer, frames[nframes].code, 0, 0, frames[nframes].pos);
+	}
 
-	__expect(lexer, TOK_OP);
-	return left | expr_or(lexer);
+	return nframes;
 }
 
-static uint64_t expr(struct lexer *lexer)
+/*
+ * Operator precedence parser. Alternates between reading an operand, with
+ * its unary prefixes and any parentheses or calls it opens, and reading the
+ * operator after it, which first emits the pending operators that bind at
+ * least as tightly. All binary operators are left associative. Parsing stops
+ * at the first error, or at the first token that can't continue the
+ * expression.
+ */
+static void expr(struct lexer *lexer)
 {
-	return expr_or(lexer);
+	struct parser_context *ctx = lexer->ctx;
+	const struct symbol_def *def;
+	struct parse_frame *top, frame;
+	struct lexed_token tok;
+	enum program_opcode code;
+	size_t nframes = 0;
+	uint8_t prec;
+
+operand:
+	while (!ctx->liberror) {
+		tok = *lexer->lookahead;
+		switch (tok.type) {
+		case TOK_SIGN:
+			// unary plus doesn't do anything
+			if (tok.attr == ATTR_SIGN_MINUS &&
+			    !__push_frame(lexer, &nframes,
+					  (struct parse_frame){
+						  .pos = tok.pos,
+						  .kind = FRAME_UNARY,
+						  .code = OP_NEG }))
+				return;
+			__expect(lexer, TOK_SIGN);
+			continue;
+		case TOK_BITWISE_NOT:
+			if (!__push_frame(lexer, &nframes,
+					  (struct parse_frame){
+						  .pos = tok.pos,
+						  .kind = FRAME_UNARY,
+						  .code = OP_NOT }))
+				return;
+			__expect(lexer, TOK_BITWISE_NOT);
+			continue;
+		case TOK_LPAREN:
+			if (!__push_frame(lexer, &nframes,
+					  (struct parse_frame){
+						  .pos = tok.pos,
+						  .kind = FRAME_PAREN }))
+				return;
+			__expect(lexer, TOK_LPAREN);
+			continue;
+		case TOK_FUNCTION:
+			__expect(lexer, TOK_FUNCTION);
+			__expect(lexer, TOK_LPAREN);
+			if (!__push_frame(lexer, &nframes,
+					  (struct parse_frame){
+						  .imm = tok.attr,
+						  .pos = tok.pos,
+						  .kind = FRAME_CALL }))
+				return;
+			if (lexer->lookahead->type == TOK_RPAREN)
+				goto call;
+			continue;
+		case TOK_VARIABLE:
+		case TOK_NAME:
+			// a name followed by a parenthesis calls a definition
+			if (tok.type == TOK_NAME &&
+			    lexer->lookahead[1].type == TOK_LPAREN) {
+				def = __find_def(lexer, &tok);
+				if (!def)
+					return;
+				__expect(lexer, TOK_NAME);
+				__expect(lexer, TOK_LPAREN);
+				frame = (struct parse_frame){
+					.imm = (uintptr_t)def,
+					.pos = tok.pos,
+					.kind = FRAME_INLINE,
+				};
+				if (!__push_frame(lexer, &nframes, frame))
+					return;
+				if (lexer->lookahead->type == TOK_RPAREN)
+					goto call;
+				continue;
+			}
+
+			// compiled expressions bind x and y when they run,
+			// everything else is bound by parse(), and lines of
+			// bmath_parse_wide() have neither
+			if (lexer->params) {
+				if (!__read_param(lexer, &tok))
+					return;
+			} else if (lexer->prog && lexer->limbs == 1 &&
+				   tok.type == TOK_VARIABLE) {
+				__emit(lexer, OP_VAR, 0, tok.attr, tok.pos);
+			} else if (!__read_name(lexer, &tok)) {
+				return;
+			}
+			__expect(lexer, tok.type);
+			break;
+		case TOK_WIDE:
+			__push_wide(lexer, &tok);
+			__expect(lexer, TOK_WIDE);
+			break;
+		default:
+			__emit(lexer, OP_PUSH, 0, tok.attr, tok.pos);
+			__expect(lexer, TOK_NUMBER);
+			break;
+		}
+		goto operator;
+	}
+	return;
+
+operator:
+	if (ctx->liberror)
+		return;
+
+	// prefixes bind tighter than anything that can follow an operand
+	while (nframes && ctx->frames[nframes - 1].kind == FRAME_UNARY) {
+		nframes--;
+		__emit(lexer, ctx->frames[nframes].code, 0, 0,
+		       ctx->frames[nframes].pos);
+	}
+
+	tok = *lexer->lookahead;
+	prec = __binary_prec(&tok, &code);
+	if (prec) {
+		nframes = __reduce(lexer, nframes, prec);
+		if (!__push_frame(lexer, &nframes,
+				  (struct parse_frame){ .pos = tok.pos,
+							.kind = FRAME_BINARY,
+							.code = code,
+							.prec = prec }))
+			return;
+		__expect(lexer, tok.type);
+		goto operand;
+	}
+
+	nframes = __reduce(lexer, nframes, 0);
+	if (!nframes || ctx->liberror)
+		return;
+
+	top = &ctx->frames[nframes - 1];
+	if (top->kind == FRAME_PAREN) {
+		__expect(lexer, TOK_RPAREN);
+		nframes--;
+		goto operator;
+	}
+
+	// the operand was an argument of the innermost call
+	top->argc++;
+	if (tok.type == TOK_COMMA) {
+		__expect(lexer, TOK_COMMA);
+		if (top->argc < FUNCTIONS_MAX_OPS &&
+		    lexer->lookahead->type != TOK_RPAREN)
+			goto operand;
+	}
+
+call:
+	top = &ctx->frames[nframes - 1];
+	__expect(lexer, TOK_RPAREN);
+	nframes--;
+	if (top->kind == FRAME_INLINE)
+		__inline_call(lexer, (const struct symbol_def *)top->imm,
+			      top->argc, top->pos);
+	else
+		__call(lexer, top->imm, top->argc, top->pos);
+	goto operator;
 }
@@ -1,5 +1,6 @@
 #pragma once
 
+#include <stdbool.h>
 #include <stdint.h>
 #include <stddef.h>
 #include <stdio.h>
@@ -10,21 +11,381 @@
 #define PE_EXPRESSION_TOO_LONG 1
 #define PE_PARSE_ERROR 2
 #define PE_NOTHING_TO_PARSE 3
+#define PE_EVAL_ERROR 4
+#define PE_NO_MEMORY 5
+#define PE_BUDGET_EXCEEDED 6
 
 struct parser_context;
+struct bmath_program;
+
+/*
+ * What went wrong in the last call on a context, see parser_last_error().
+ */
+enum bmath_error_code {
+	BMATH_ENONE = 0,
+	// an empty line, PE_NOTHING_TO_PARSE
+	BMATH_EEMPTY,
+	// a line longer than parser_settings.max_parse_len,
+	// PE_EXPRESSION_TOO_LONG
+	BMATH_ETOO_LONG,
+	// a byte that can't be part of any token
+	BMATH_EILLEGAL,
+	// a decimal literal that doesn't fit in 64 bits
+	BMATH_ENUMBER_RANGE,
+	// a hex literal with more than 16 digits
+	BMATH_EHEX_RANGE,
+	// 0x without digits
+	BMATH_EHEX_INVALID,
+	// a literal wider than parser_settings.width, for bmath_parse_wide()
+	BMATH_EWIDTH,
+	// a token the grammar doesn't allow there, see expected and actual
+	BMATH_EUNEXPECTED,
+	// `x` or `y` outside a compiled expression, unless it was bound
+	BMATH_EVARIABLE,
+	// a name that isn't bound, see parser_reset_symbols()
+	BMATH_EUNDEFINED,
+	// a definition of a builtin, of a name that is already defined, or
+	// with a parameter twice, see bmath_define()
+	BMATH_EDEFINED,
+	BMATH_EDIVZERO,
+	// a builtin rejected its arguments, see func_err. Calls with the
+	// wrong number of arguments are FUNC_EINVAL, which is found when the
+	// call is parsed, so bmath_compile() fails with it too.
+	BMATH_EFUNC,
+	// calls of definitions that would compile to too many ops
+	BMATH_EEXPANSION,
+	// a line took more than parser_settings.budget allows, see limit
+	BMATH_EBUDGET,
+	BMATH_ENOMEM,
+	BMATH_EEVAL,
+};
+
+/*
+ * Errors are recorded like this and only turned into text when they are
+ * rendered, see bmath_error_render().
+ */
+struct bmath_error {
+	enum bmath_error_code code;
+	// byte offset of the token the error points at. For bmath_exec()
+	// faults, where the op came from in the compiled expression.
+	uint32_t pos;
+	// token names, for BMATH_EUNEXPECTED
+	const char *expected;
+	const char *actual;
+	// enum func_err of the builtin, for BMATH_EFUNC
+	int func_err;
+	// enum bmath_limit that was reached, for BMATH_EBUDGET
+	int limit;
+	// for bmath_exec_batch() faults, the index of the input that faulted
+	bool batch;
+	size_t input;
+};
+
+struct bmath_optimize_stats {
+	size_t ops_before;
+	size_t ops_after;
+};
+
+struct bmath_batch_stats {
+	// distinct expression shapes among the lines
+	size_t shapes;
+	// lines that were parse()d one at a time
+	size_t parsed;
+	// kernel calls, and how many lines they applied an op to. Their ratio
+	// is the average number of SIMD lanes per op.
+	size_t op_dispatches;
+	size_t lane_ops;
+};
+
+struct bmath_cache_stats {
+	// parse() calls answered from the cache, and the ones that weren't.
+	// Lines too long to cache count as neither.
+	size_t hits;
+	size_t misses;
+	// entries replaced to make room
+	size_t evictions;
+	size_t entries;
+	size_t capacity;
+	// lookups in parser_settings.cache_file, after the ones above missed
+	size_t file_hits;
+	size_t file_misses;
+};
+
+struct bmath_cse_stats {
+	// operations parse() evaluated, literals aside, and how many of them
+	// had to be computed. Their ratio is how much sharing saved.
+	size_t ops;
+	size_t computed;
+	// operations shared with an earlier line, see parser_settings.cse
+	size_t earlier_lines;
+};
+
+struct bmath_recalc_stats {
+	// lines of the current pass that were evaluated, and the ones whose
+	// outcome from the pass before still held, see
+	// parser_settings.incremental
+	size_t evaluated;
+	size_t reused;
+};
+
+struct bmath_wide_stats {
+	// lines bmath_parse_wide() finished in each tier, see
+	// parser_settings.width
+	size_t tier_64;
+	size_t tier_128;
+	size_t tier_limbs;
+	// runs that had a value that didn't fit their tier, and started over
+	// in a wider one
+	size_t escalations;
+};
+
+/*
+ * Instruction sets bmath_exec_batch() can use. Each level includes the ones
+ * below it.
+ */
+enum bmath_simd {
+	// widest the CPU supports
+	BMATH_SIMD_AUTO = 0,
+	BMATH_SIMD_SCALAR,
+	BMATH_SIMD_AVX2,
+	BMATH_SIMD_AVX512,
+};
+
+enum bmath_limit {
+	BMATH_LIMIT_NONE = 0,
+	BMATH_LIMIT_TOKENS,
+	BMATH_LIMIT_DEPTH,
+	BMATH_LIMIT_CALLS,
+	BMATH_LIMIT_STEPS,
+	BMATH_LIMIT_DEADLINE,
+};
+
+/*
+ * Bounds on the work of a single line, so that no line can take long however
+ * it was written. A line that reaches one fails with PE_BUDGET_EXCEEDED and
+ * BMATH_EBUDGET, pointing at where it stopped. Zero leaves a limit off.
+ */
+struct bmath_budget {
+	// tokens the line lexes into, its end included
+	size_t max_tokens;
+	// parentheses, calls and operators waiting for their right operand,
+	// open at once
+	size_t max_depth;
+	// calls of builtins and definitions, including the ones in the
+	// bodies of definitions
+	size_t max_calls;
+	// operations evaluated or compiled, literals included
+	size_t max_steps;
+	// nanoseconds a line may take. The clock is read every
+	// BMATH_BUDGET_CLOCK_EVERY tokens and steps, from the first of them
+	// on, so a line may overrun by that much work at either end
+	uint64_t deadline_ns;
+};
+
+#define BMATH_BUDGET_CLOCK_EVERY 64
+
+// widest parser_settings.width, in bits
+#define BMATH_WIDTH_MAX 4096
 
 struct parser_settings {
-	int max_parse_len;
+	/*
+	 * Longest expression to accept, in bytes. Zero accepts expressions of
+	 * any length; lexing is linear and evaluation only needs memory for
+	 * the nesting depth.
+	 */
+	size_t max_parse_len;
 	FILE *err_stream;
+	/*
+	 * Only record errors, see parser_last_error(), instead of rendering
+	 * each one to err_stream.
+	 */
+	bool quiet;
+	/*
+	 * Promote a compiled program to native code after it has been run this
+	 * many times with bmath_exec(). Zero keeps everything interpreted.
+	 */
+	unsigned int jit_threshold;
+	/*
+	 * Widest instruction set bmath_exec_batch() may use. Levels the CPU
+	 * doesn't support are never selected.
+	 */
+	enum bmath_simd simd;
+	/*
+	 * Remember what parse() returned for up to this many distinct
+	 * expressions, results and errors alike, and answer repeats without
+	 * lexing them again. Expressions that only differ in their whitespace
+	 * are the same. Zero disables the cache, and parser_init() contexts
+	 * never have one.
+	 */
+	size_t cache_size;
+	/*
+	 * Path of a file that keeps the results of parse() across processes,
+	 * created if it doesn't exist. Every context and process that names
+	 * the same file shares it, lock free, and entries stored by another
+	 * bmath version are never used. Only results are kept, failing
+	 * expressions are parsed again. parser_new() fails, with errno set,
+	 * if the file can't be opened or isn't a cache file. NULL disables
+	 * it, and parser_init() contexts never have one.
+	 */
+	const char *cache_file;
+	/*
+	 * Have parse() compute each distinct subterm of a line once, such as
+	 * an align(base + off, 4096) that is repeated, and reuse its value
+	 * wherever it appears again. With cse_window, subterms are also
+	 * shared with that many lines before. parser_init() contexts never
+	 * share subterms. This is for measuring how repetitive lines are, see
+	 * parser_cse_stats(); parse() is slower with it.
+	 */
+	bool cse;
+	size_t cse_window;
+	/*
+	 * Remember what each line of a file evaluated to and which bindings
+	 * it read, so that evaluating the file again after
+	 * parser_reset_symbols() only evaluates the lines that changed and
+	 * the ones that read a binding whose value changed. Meant for
+	 * evaluating the same file over and over as it is edited.
+	 * parser_init() contexts never remember lines.
+	 */
+	bool incremental;
+	/*
+	 * Limits on the work parse(), bmath_compile() and bmath_define() do
+	 * for a line. Answers from the caches above and remembered lines
+	 * don't count against them, they take no more than a lookup, and
+	 * lines that went over aren't remembered.
+	 */
+	struct bmath_budget budget;
+	/*
+	 * Bits bmath_parse_wide() evaluates lines at: 64, also when zero, or
+	 * a power of two up to BMATH_WIDTH_MAX. Values wrap at the width the
+	 * way parse() wraps them at 64 bits, shift counts included.
+	 * parser_new() fails, with errno set to EINVAL, for any other width,
+	 * and parser_init() contexts only evaluate at 64 bits.
+	 */
+	unsigned int width;
 };
 
 struct parser_context *parser_new(struct parser_settings *settings);
+
+/**
+ * Bytes of scratch parser_init() needs for expressions of up to max_parse_len
+ * bytes, or zero when max_parse_len is zero.
+ */
+size_t parser_scratch_size(size_t max_parse_len);
+
+/**
+ * Create a context inside caller-provided memory instead of on the heap.
+ * Nothing is allocated: the context and every buffer parse() uses are laid
+ * out in the scratch, so parse() never allocates either. settings must set
+ * max_parse_len, which sizes the scratch. Expressions that need more than
+ * the scratch holds, such as a bmath_exec() of a program compiled elsewhere,
+ * fail with PE_NO_MEMORY. bmath_compile() and bmath_parse_batch() still
+ * allocate what they return and work with.
+ * @param void *scratch Any alignment, must outlive the context
+ * @param size_t size At least parser_scratch_size(settings->max_parse_len)
+ * @return NULL if max_parse_len is zero or the scratch is too small. The
+ *         context needs no parser_free(), but calling it is harmless
+ */
+struct parser_context *parser_init(void *scratch, size_t size,
+				   struct parser_settings *settings);
 int parser_free(struct parser_context *ctx);
 
+/**
+ * The first error of the last parse(), bmath_parse_wide(), bmath_compile(),
+ * bmath_define(), bmath_exec() or bmath_exec_batch() call on ctx, BMATH_ENONE
+ * if it succeeded. Each call starts from an empty record. Valid until the
+ * next of those calls.
+ */
+const struct bmath_error *parser_last_error(const struct parser_context *ctx);
+
+/**
+ * Describe an error in one line, without a trailing newline. Only code is
+ * needed, the details just make the message more precise.
+ * @return Length of the message, which is truncated like snprintf()
+ */
+size_t bmath_error_message(const struct bmath_error *error, char *buf,
+			   size_t size);
+
+/**
+ * Write an error the way a context that isn't quiet does. With the
+ * expression, it is shown with a caret under where the error points,
+ * otherwise the error is one line with its column.
+ * @param const char *expr May be NULL
+ */
+void bmath_error_render(FILE *out, const struct bmath_error *error,
+			const char *expr, size_t len);
+
+/**
+ * Change the JIT promotion threshold at runtime. Zero switches the JIT off;
+ * programs that were already promoted go back to being interpreted.
+ */
+void parser_set_jit_threshold(struct parser_context *ctx,
+			      unsigned int threshold);
+
+/**
+ * Change the limits at runtime, see parser_settings.budget.
+ */
+void parser_set_budget(struct parser_context *ctx,
+		       const struct bmath_budget *budget);
+
+/**
+ * Change whether errors are only recorded at runtime, see
+ * parser_settings.quiet.
+ */
+void parser_set_quiet(struct parser_context *ctx, bool quiet);
+
+/**
+ * Counters of the parse() caches, see parser_settings.cache_size and
+ * parser_settings.cache_file.
+ * @return false if ctx has neither
+ */
+bool parser_cache_stats(const struct parser_context *ctx,
+			struct bmath_cache_stats *out_stats);
+
+/**
+ * Counters of subterm sharing, see parser_settings.cse.
+ * @return false if ctx doesn't share subterms
+ */
+bool parser_cse_stats(const struct parser_context *ctx,
+		      struct bmath_cse_stats *out_stats);
+
+/**
+ * Unbind every name, including `_`, to evaluate a file from its first line
+ * again. parse() evaluates `name = expr` by binding name to the value of
+ * expr, which lines after it read as name, and `_` is the result of the
+ * last line that succeeded. `x` and `y` can be bound too, they are only
+ * variables in compiled expressions. parser_init() contexts have no
+ * bindings, and fail to make one with BMATH_ENOMEM.
+ */
+void parser_reset_symbols(struct parser_context *ctx);
+
+/**
+ * Counters of the current pass over a file, see
+ * parser_settings.incremental.
+ * @return false if ctx doesn't remember lines
+ */
+bool parser_recalc_stats(const struct parser_context *ctx,
+			 struct bmath_recalc_stats *out_stats);
+
+/**
+ * Counters of the tiers of bmath_parse_wide(), see parser_settings.width.
+ * @return false if ctx evaluates at 64 bits
+ */
+bool parser_wide_stats(const struct parser_context *ctx,
+		       struct bmath_wide_stats *out_stats);
+
+/**
+ * Change the instruction set cap for bmath_exec_batch() at runtime.
+ * @return The level that will actually be used on this CPU
+ */
+enum bmath_simd parser_set_simd(struct parser_context *ctx,
+				enum bmath_simd cap);
+
 /**
  * Convert infix notation to postfix notation. This takes care of parsing
  * operands and hex for operation.
- * @param const char *infix_expression
+ * @param const char *infix_expression Doesn't need to be NUL terminated,
+ *        nothing past len is read. This holds for every function taking an
+ *        expression and its length.
  * @param size_t len
  * @param uint64_t *out_result Result of the evaluation
  * @return Any positive integer means successful parse; a zero
@@ -32,3 +393,140 @@ int parser_free(struct parser_context *ctx);
  */
 int parse(struct parser_context *ctx, const char *infix_expression, size_t len,
 	  uint64_t *out_result);
+
+/**
+ * parse() at parser_settings.width bits. Literals may be as wide as the
+ * width, and builtins take and return values as wide, so mask() and clz()
+ * go up to width / 8 bytes. A line runs in the cheapest tier that holds
+ * every value it computes: 64-bit integers, 128-bit ones, then width / 64
+ * limbs updated in place, and a line that doesn't fit its tier starts over
+ * in the next one. Only the tier of the width itself wraps. Lines are
+ * compiled like bmath_compile() does, so they can call definitions but
+ * can't read or bind names, `_` and `x` included, and they aren't cached.
+ * At 64 bits this is parse().
+ * @param uint64_t *out_limbs width / 64 limbs of the result, least
+ *        significant first
+ * @return Like parse()
+ */
+int bmath_parse_wide(struct parser_context *ctx, const char *infix_expression,
+		     size_t len, uint64_t *out_limbs);
+
+/**
+ * Compile an expression once into a flat program that can be evaluated
+ * repeatedly with bmath_exec() without lexing or parsing it again. Compiled
+ * expressions may reference the free variables `x` and `y`.
+ * @param const char *infix_expression
+ * @param size_t len
+ * @param struct bmath_program **out_program Compiled program. Must be released
+ *        with bmath_program_free()
+ * @return Zero on success, otherwise a PE_* error code
+ */
+int bmath_compile(struct parser_context *ctx, const char *infix_expression,
+		  size_t len, struct bmath_program **out_program);
+
+/**
+ * Define a function, `def name(a, b) = expr`, that later expressions can
+ * call like a builtin. The body is parsed and checked once, here: it can
+ * only read its parameters, and call builtins and functions defined before
+ * it. Calls are inlined where they appear, so a compiled expression that
+ * calls name has the same ops as one with its body written out. parse()
+ * evaluates each argument once. Definitions last as long as the context,
+ * and can't be replaced. parser_init() contexts have no definitions, and
+ * fail to make one with BMATH_ENOMEM.
+ * @param const char *definition
+ * @param size_t len
+ * @return Zero on success, otherwise a PE_* error code
+ */
+int bmath_define(struct parser_context *ctx, const char *definition,
+		 size_t len);
+
+/**
+ * Evaluate a program produced by bmath_compile(). Programs that run often
+ * enough are promoted to native code, see parser_settings.jit_threshold.
+ * Variables read as zero; use bmath_exec_batch() to bind them.
+ * Faults in native code are re-run through the interpreter to report them.
+ * @param struct bmath_program *program
+ * @param uint64_t *out_result Result of the evaluation
+ * @return Zero on success, PE_EVAL_ERROR when the evaluation faults
+ *         (division by zero, function errors), or PE_NO_MEMORY
+ */
+int bmath_exec(struct parser_context *ctx, struct bmath_program *program,
+	       uint64_t *out_result);
+
+/**
+ * Evaluate a program once per input, binding `x` to x[i] and `y` to y[i].
+ * Inputs are processed in blocks with the SIMD kernels picked by
+ * parser_settings.simd.
+ * @param const uint64_t *x Inputs for `x`. May be NULL, which reads as zero
+ * @param const uint64_t *y Inputs for `y`. May be NULL, which reads as zero
+ * @param uint64_t *out count results
+ * @return Zero on success, PE_EVAL_ERROR when any input faults, or
+ *         PE_NO_MEMORY. Results before the faulting input are valid, its
+ *         index is in parser_last_error()->input.
+ */
+int bmath_exec_batch(struct parser_context *ctx,
+		     const struct bmath_program *program, const uint64_t *x,
+		     const uint64_t *y, uint64_t *out, size_t count);
+
+/**
+ * Evaluate many expressions, with the same results and errors as calling
+ * parse() on each one in order. Lines that only differ in their literals
+ * share a shape; each shape is compiled once and its lines are evaluated
+ * together with bmath_exec_batch()'s kernels, one line per SIMD lane with the
+ * literals as input columns. Shapes of a single line, and lines that can't
+ * be grouped, such as those that read or bind names, are parse()d in order
+ * after the groups have run.
+ * @param const char *const *lines
+ * @param const size_t *lens Length of each line
+ * @param uint64_t *out_results Result of each line, 0 when it failed
+ * @param int *out_errs What parse() returned for each line
+ * @param struct bmath_batch_stats *out_stats Optional
+ * @return Zero on success, otherwise PE_NO_MEMORY
+ */
+int bmath_parse_batch(struct parser_context *ctx, const char *const *lines,
+		      const size_t *lens, size_t count, uint64_t *out_results,
+		      int *out_errs, struct bmath_batch_stats *out_stats);
+
+void bmath_program_free(struct bmath_program *program);
+
+/**
+ * Number of ops in a compiled program.
+ */
+size_t bmath_program_len(const struct bmath_program *program);
+
+/**
+ * Whether the program references `x` or `y`.
+ */
+bool bmath_program_has_vars(const struct bmath_program *program);
+
+/**
+ * Whether the program has been promoted to native code.
+ */
+bool bmath_program_is_jitted(const struct bmath_program *program);
+
+/**
+ * Optimize a compiled program in place: folds literal-only subtrees
+ * (including builtin calls on literals), applies algebraic identities such
+ * as `x << 0` or `x & mask(8)`, and collapses `~~x` and `--x`.
+ * @param struct bmath_optimize_stats *stats Optional op counts before and
+ *        after optimizing
+ * @return Zero on success, otherwise PE_NO_MEMORY
+ */
+int bmath_optimize(struct bmath_program *program,
+		   struct bmath_optimize_stats *stats);
+
+/**
+ * Write the prologue of a self-contained C header: <stdint.h> plus the
+ * helpers emitted functions call into. Call once before bmath_emit_c().
+ */
+int bmath_emit_c_begin(FILE *out);
+
+/**
+ * Translate a compiled program into a `static inline uint64_t func_name(void)`
+ * C function with the same semantics as bmath_exec(). Programs that reference
+ * variables take them as `uint64_t x, uint64_t y` parameters. Operations that
+ * would fault in bmath evaluate to 0 in the emitted code.
+ * @return Zero on success, or PE_NO_MEMORY
+ */
+int bmath_emit_c(FILE *out, const struct bmath_program *program,
+		 const char *func_name);
@@ -9,9 +9,19 @@
 #include <string.h>
 #include <unistd.h>
 
+#include "parser.h"
 #include "print.h"
 
-FILE *stream = NULL;
+/*
+ * Everything print needs is kept here rather than in globals, so contexts
+ * used from different threads never share a stream or iconv's shift state.
+ */
+struct print_context {
+	FILE *stream;
+	// opened the first time a unicode encoding is printed
+	iconv_t iconv_descriptors[ENC_UTF32 + 1];
+	bool iconv_setup;
+};
 
 static const char *to_encoding_lookup[] = { [ENC_UTF8] = "UTF-8",
 					    [ENC_UTF16] = "UTF-16BE",
@@ -26,22 +36,13 @@ static const char *to_encoding_pretty_print_lookup[] = { [ENC_UTF8] = " UTF-8",
 							 [ENC_UTF32] =
 								 "UTF-32" };
 
-static iconv_t iconv_descriptors[ENC_UTF32 + 1] = { 0 };
-
-static bool iconv_setup = false;
+#define ICONV_ERR ((iconv_t) - 1)
 
-static void print_teardown()
+static void print_setup_unicode(struct print_context *pctx)
 {
-	iconv_close(iconv_descriptors[ENC_UTF8]);
-	iconv_close(iconv_descriptors[ENC_UTF16]);
-	iconv_close(iconv_descriptors[ENC_UTF32]);
-}
+	iconv_t *iconv_descriptors = pctx->iconv_descriptors;
 
-static void print_setup_unicode()
-{
-#define ICONV_ERR ((iconv_t) - 1)
-	int err;
-	iconv_setup = true;
+	pctx->iconv_setup = true;
 
 	iconv_descriptors[ENC_UTF8] = iconv_open(
 		to_encoding_lookup[ENC_UTF8], from_encoding_lookup[ENC_UTF32]);
@@ -55,18 +56,14 @@ static void print_setup_unicode()
 		to_encoding_lookup[ENC_UTF32], from_encoding_lookup[ENC_UTF32]);
 	assert(iconv_descriptors[ENC_UTF32] != ICONV_ERR);
 
-	// It's better to keep around these pointers than to constantly
-	// open/close. From a library implementation perspective the next
-	// few lines suck, but I want valgrind to be happy.
-	// I also don't want to implement a context for printing just
-	// for iconv handling.
-	err = atexit(print_teardown);
-	assert(err == 0);
+	// It's better to keep around these descriptors than to constantly
+	// open/close, they are closed with the context in print_free()
 }
 
-static void print_unicode(uint64_t num, bool uppercase_hex,
-			  enum encoding_t to_unicode)
+static void print_unicode(struct print_context *pctx, uint64_t num,
+			  bool uppercase_hex, enum encoding_t to_unicode)
 {
+	FILE *stream = pctx->stream;
 	iconv_t cd;
 	size_t conversion;
 
@@ -99,7 +96,7 @@ static void print_unicode(uint64_t num, bool uppercase_hex,
 	if (num < 31) {
 		fputs("<special> ", stream);
 	} else {
-		cd = iconv_descriptors[ENC_UTF8];
+		cd = pctx->iconv_descriptors[ENC_UTF8];
 		conversion =
 			iconv(cd, &utf8_input, &in_size, &utf8, &utf8_size);
 
@@ -111,7 +108,7 @@ static void print_unicode(uint64_t num, bool uppercase_hex,
 	}
 
 	// Convert from_unicode to to_unicode
-	cd = iconv_descriptors[to_unicode];
+	cd = pctx->iconv_descriptors[to_unicode];
 	conversion = iconv(cd, &to_unicode_input, &in_bytes_size,
 			   &to_unicode_bytes, &to_unicode_size);
 
@@ -130,35 +127,55 @@ static void print_unicode(uint64_t num, bool uppercase_hex,
 	 */
 	for (size_t i = 0; i < 8 - (to_unicode_size + offset[to_unicode]);
 	     i++) {
-		__print_hex((uint64_t)0xff & to_unicode_buf[i], 2,
+		__print_hex(pctx, (uint64_t)0xff & to_unicode_buf[i], 2,
 			    uppercase_hex);
 	}
 
 	fputs(")\n", stream);
 }
 
-static inline void ensure_stream()
+struct print_context *print_new(FILE *stream)
+{
+	struct print_context *pctx = calloc(1, sizeof(*pctx));
+
+	if (!pctx) {
+		return NULL;
+	}
+
+	pctx->stream = stream ? stream : stdout;
+	return pctx;
+}
+
+void print_free(struct print_context *pctx)
 {
-	if (!stream)
-		stream = stdout;
+	if (!pctx) {
+		return;
+	}
+
+	if (pctx->iconv_setup) {
+		iconv_close(pctx->iconv_descriptors[ENC_UTF8]);
+		iconv_close(pctx->iconv_descriptors[ENC_UTF16]);
+		iconv_close(pctx->iconv_descriptors[ENC_UTF32]);
+	}
+
+	free(pctx);
 }
 
-void print_set_stream(FILE *s)
+void print_set_stream(struct print_context *pctx, FILE *s)
 {
-	stream = s;
+	pctx->stream = s ? s : stdout;
 }
 
-void print_hex(bool u, int b, uint64_t n)
+void print_hex(struct print_context *pctx, bool u, int b, uint64_t n)
 {
-	ensure_stream();
 	if (u) {
-		fprintf(stream, "%0*" PRIX64, b, n);
+		fprintf(pctx->stream, "%0*" PRIX64, b, n);
 	} else {
-		fprintf(stream, "%0*" PRIx64, b, n);
+		fprintf(pctx->stream, "%0*" PRIx64, b, n);
 	}
 }
 
-void print_binary(uint64_t number)
+void print_binary(struct print_context *pctx, uint64_t number)
 {
 	// (bytes * bits per byte) + 2 newlines + 6 spaces + 1 null
 	char buff[(sizeof(number) * 8) + 8 + 1] = { 0 };
@@ -182,22 +199,23 @@ void print_binary(uint64_t number)
 		i++;
 	}
 
-	ensure_stream();
 	/*
    * The last null byte could be removed from the array, but incase
    * this ever gets changed to be more like sprintf() or something,
    * always include it. Just don't write it.
    */
-	fwrite(buff, sizeof(buff) - 1, 1, stream);
+	fwrite(buff, sizeof(buff) - 1, 1, pctx->stream);
 }
 
-void print_number(uint64_t num, bool uppercase_hex, int encoding_mask)
+void print_number(struct print_context *pctx, uint64_t num,
+		  bool uppercase_hex, int encoding_mask)
 {
+	FILE *stream = pctx->stream;
+
 	if (encoding_mask == ENC_NONE) {
 		return;
 	}
 
-	ensure_stream();
 	fprintf(stream, "   u64: %" PRIu64 "\n", num);
 
 	if (num <= 0xff) {
@@ -223,30 +241,30 @@ void print_number(uint64_t num, bool uppercase_hex, int encoding_mask)
 	}
 
 	if (encoding_mask & ENC_UTF) {
-		if (!iconv_setup) {
-			print_setup_unicode();
+		if (!pctx->iconv_setup) {
+			print_setup_unicode(pctx);
 		}
 
 		if ((encoding_mask & ENC_UTF8) == ENC_UTF8) {
-			print_unicode(num, uppercase_hex, ENC_UTF8);
+			print_unicode(pctx, num, uppercase_hex, ENC_UTF8);
 		}
 
 		if ((encoding_mask & ENC_UTF16) == ENC_UTF16) {
-			print_unicode(num, uppercase_hex, ENC_UTF16);
+			print_unicode(pctx, num, uppercase_hex, ENC_UTF16);
 		}
 
 		if ((encoding_mask & ENC_UTF32) == ENC_UTF32) {
-			print_unicode(num, uppercase_hex, ENC_UTF32);
+			print_unicode(pctx, num, uppercase_hex, ENC_UTF32);
 		}
 	}
 
 	fputs("   Hex: 0x", stream);
-	__print_hex(num, 0, uppercase_hex);
+	__print_hex(pctx, num, 0, uppercase_hex);
 	fputc('\n', stream);
 
 	if (num <= UINT16_MAX) {
 		fputs(" Hex16: 0x", stream);
-		__print_hex(num, 4, uppercase_hex);
+		__print_hex(pctx, num, 4, uppercase_hex);
 		fputc('\n', stream);
 	} else {
 		fputs(" Hex16: Exceeded\n", stream);
@@ -254,29 +272,111 @@ void print_number(uint64_t num, bool uppercase_hex, int encoding_mask)
 
 	if (num <= UINT32_MAX) {
 		fputs(" Hex32: 0x", stream);
-		__print_hex(num, 8, uppercase_hex);
+		__print_hex(pctx, num, 8, uppercase_hex);
 		fputc('\n', stream);
 	} else {
 		fputs(" Hex32: Exceeded\n", stream);
 	}
 
 	fputs(" Hex64: 0x", stream);
-	__print_hex(num, 16, uppercase_hex);
+	__print_hex(pctx, num, 16, uppercase_hex);
 	fputc('\n', stream);
 }
 
-void print_alignment(uint64_t alignment, uint64_t num, bool uppercase_hex)
+void print_alignment(struct print_context *pctx, uint64_t alignment,
+		     uint64_t num, bool uppercase_hex)
 {
+	FILE *stream = pctx->stream;
 	uint64_t mask = alignment - 1;
 	uint64_t up = (num + mask) & ~mask;
 	uint64_t down = num & ~mask;
-	ensure_stream();
 
 	fputs("algn d: 0x", stream);
-	__print_hex(down, 16, uppercase_hex);
+	__print_hex(pctx, down, 16, uppercase_hex);
 
 	fputs("\nalgn u: 0x", stream);
-	__print_hex(up, 16, uppercase_hex);
+	__print_hex(pctx, up, 16, uppercase_hex);
 
 	fprintf(stream, " (%lu blocks)\n", down / (alignment - 1) + 1);
 }
+
+// the largest power of ten in a limb, which decimals are cut into
+#define DEC_CHUNK 10000000000000000000ull
+#define DEC_CHUNK_DIGITS 19
+
+// n is consumed, and nlimbs is at least one
+static void __print_wide_dec(FILE *stream, uint64_t *n, size_t nlimbs)
+{
+	// 64 bits never take more than 20 digits, so a third of the bits do
+	char digits[BMATH_WIDTH_MAX / 3 + 1];
+	char *end = digits + sizeof(digits), *p = end;
+	unsigned __int128 rem;
+	uint64_t chunk;
+
+	do {
+		rem = 0;
+		for (size_t i = nlimbs; i--;) {
+			rem = rem << 64 | n[i];
+			n[i] = (uint64_t)(rem / DEC_CHUNK);
+			rem %= DEC_CHUNK;
+		}
+		while (nlimbs && !n[nlimbs - 1]) {
+			nlimbs--;
+		}
+
+		// chunks below the leading one keep their zeros
+		chunk = (uint64_t)rem;
+		for (int k = 0; k < DEC_CHUNK_DIGITS && (nlimbs || chunk); k++) {
+			*--p = '0' + chunk % 10;
+			chunk /= 10;
+		}
+	} while (nlimbs);
+
+	if (p == end) {
+		*--p = '0';
+	}
+	fwrite(p, 1, end - p, stream);
+}
+
+void print_wide(struct print_context *pctx, const uint64_t *limbs,
+		size_t nlimbs, bool uppercase_hex)
+{
+	FILE *stream = pctx->stream;
+	uint64_t n[BMATH_WIDTH_MAX / 64], carry = 1;
+	size_t top = nlimbs;
+	char label[16];
+
+	snprintf(label, sizeof(label), "u%zu", nlimbs * 64);
+	fprintf(stream, "%6s: ", label);
+	memcpy(n, limbs, nlimbs * sizeof(*n));
+	__print_wide_dec(stream, n, nlimbs);
+
+	label[0] = 'i';
+	fprintf(stream, "\n%6s: ", label);
+	memcpy(n, limbs, nlimbs * sizeof(*n));
+	if (limbs[nlimbs - 1] >> 63) {
+		fputc('-', stream);
+		for (size_t i = 0; i < nlimbs; i++) {
+			n[i] = ~n[i] + carry;
+			carry &= !n[i];
+		}
+	}
+	__print_wide_dec(stream, n, nlimbs);
+
+	while (top > 1 && !limbs[top - 1]) {
+		top--;
+	}
+
+	fputs("\n   Hex: 0x", stream);
+	__print_hex(pctx, limbs[top - 1], 0, uppercase_hex);
+	for (size_t i = top - 1; i--;) {
+		__print_hex(pctx, limbs[i], 16, uppercase_hex);
+	}
+
+	snprintf(label, sizeof(label), "Hex%zu", nlimbs * 64);
+	fprintf(stream, "\n%6s: 0x", label);
+	for (size_t i = nlimbs; i--;) {
+		__print_hex(pctx, limbs[i], 16, uppercase_hex);
+	}
+	fputc('\n', stream);
+}
@@ -16,13 +16,37 @@ enum encoding_t {
 #define ENC_UTF (ENC_UTF8 | ENC_UTF16 | ENC_UTF32)
 #define ENC_ALL (ENC_ASCII | ENC_UTF)
 
-#define __print_hex(n, b, u)        \
-	do {                        \
-		print_hex(u, b, n); \
+#define __print_hex(p, n, b, u)        \
+	do {                           \
+		print_hex(p, u, b, n); \
 	} while (0)
 
-void print_set_stream(FILE *);
-void print_hex(bool, int, uint64_t);
-void print_binary(uint64_t number);
-void print_number(uint64_t num, bool uppercase_hex, int encoding_mask);
-void print_alignment(uint64_t alignment, uint64_t num, bool uppercase_hex);
+/*
+ * Holds the stream and the unicode converters. A context must only be used
+ * by one thread at a time, separate contexts can print concurrently.
+ */
+struct print_context;
+
+/**
+ * @param FILE *stream Where to print, NULL prints to stdout
+ * @return NULL when out of memory
+ */
+struct print_context *print_new(FILE *stream);
+void print_free(struct print_context *pctx);
+
+void print_set_stream(struct print_context *pctx, FILE *);
+void print_hex(struct print_context *pctx, bool, int, uint64_t);
+void print_binary(struct print_context *pctx, uint64_t number);
+void print_number(struct print_context *pctx, uint64_t num,
+		  bool uppercase_hex, int encoding_mask);
+void print_alignment(struct print_context *pctx, uint64_t alignment,
+		     uint64_t num, bool uppercase_hex);
+
+/**
+ * print_number() for a value of nlimbs 64-bit limbs, least significant first,
+ * such as bmath_parse_wide() results: unsigned and two's complement decimal,
+ * and hex, both as short as it goes and padded to the width.
+ * @param size_t nlimbs Up to BMATH_WIDTH_MAX / 64
+ */
+void print_wide(struct print_context *pctx, const uint64_t *limbs,
+		size_t nlimbs, bool uppercase_hex);
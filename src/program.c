@@ -0,0 +1,65 @@
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "jit.h"
+#include "program.h"
+#include "util.h"
+
+#define PROGRAM_MIN_CAP 32
+
+int program_emit(struct bmath_program *prog, struct program_op op)
+{
+	struct program_op *ops;
+	size_t cap;
+
+	if (unlikely(prog->len == prog->cap)) {
+		cap = prog->cap ? prog->cap * 2 : PROGRAM_MIN_CAP;
+		ops = realloc(prog->ops, cap * sizeof(*ops));
+		if (!ops) {
+			return PROG_ENOMEM;
+		}
+
+		prog->ops = ops;
+		prog->cap = cap;
+	}
+
+	prog->ops[prog->len++] = op;
+	return PROG_ESUCCESS;
+}
+
+void program_reset(struct bmath_program *prog)
+{
+	prog->len = 0;
+	prog->max_depth = 0;
+	prog->vars = 0;
+}
+
+void program_release(struct bmath_program *prog)
+{
+	jit_release(prog);
+	free(prog->ops);
+	prog->ops = NULL;
+	prog->len = 0;
+	prog->cap = 0;
+	prog->max_depth = 0;
+}
+
+enum program_err program_run(const struct bmath_program *prog,
+			     uint64_t *stack, const uint64_t *vars,
+			     uint64_t *out_result, size_t *fault,
+			     enum func_err *func_err)
+{
+	enum program_err err;
+	uint64_t *sp = stack;
+
+	for (size_t i = 0; i < prog->len; i++) {
+		err = program_step(&prog->ops[i], &sp, vars, func_err);
+		if (unlikely(err)) {
+			*fault = i;
+			return err;
+		}
+	}
+
+	*out_result = stack[0];
+	return PROG_ESUCCESS;
+}
@@ -0,0 +1,192 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "functions.h"
+
+/*
+ * Compiled expressions are flat postfix programs for a small value stack
+ * machine. The parser emits the same op stream whether it is evaluating an
+ * expression on the fly or building a program for later execution, so both
+ * paths share one set of op semantics defined here.
+ */
+enum program_opcode {
+	OP_PUSH = 0,
+	OP_NEG,
+	OP_NOT,
+	OP_MUL,
+	OP_DIV,
+	OP_MOD,
+	OP_ADD,
+	OP_SUB,
+	OP_SHL,
+	OP_SHR,
+	OP_AND,
+	OP_XOR,
+	OP_OR,
+	OP_CALL,
+	OP_VAR,
+	// parameter imm of a definition, only found in its body, see
+	// symbol_def
+	OP_ARG,
+};
+
+/*
+ * Free variables an expression may reference. OP_VAR carries the index into
+ * the caller supplied vars array.
+ */
+enum program_var {
+	VAR_X = 0,
+	VAR_Y,
+	PROGRAM_MAX_VARS,
+};
+
+enum program_err {
+	PROG_ESUCCESS = 0,
+	PROG_EDIVZERO,
+	PROG_EFUNC,
+	PROG_ENOMEM,
+};
+
+struct program_op {
+	// literal for OP_PUSH, func_id for OP_CALL, program_var for OP_VAR
+	uint64_t imm;
+	// byte offset into the source expression, used for error reporting.
+	// Offsets past 4 GiB are clamped.
+	uint32_t pos;
+	uint8_t code;
+	uint8_t argc;
+};
+
+struct bmath_program {
+	struct program_op *ops;
+	size_t len;
+	size_t cap;
+	size_t max_depth;
+	// bitmask of the program_var entries referenced by OP_VAR
+	uint32_t vars;
+	// number of bmath_exec() calls, used to promote hot programs
+	uint32_t runs;
+	// native code once promoted, see jit.h. The mapping it lives in is
+	// written by whichever thread published jit.
+	void *jit;
+	void *jit_map;
+	size_t jit_size;
+};
+
+int program_emit(struct bmath_program *prog, struct program_op op);
+void program_reset(struct bmath_program *prog);
+void program_release(struct bmath_program *prog);
+
+/**
+ * Fold constant subtrees, drop identity operations and collapse redundant
+ * unary chains in place. Ops that fault are left alone so errors still
+ * surface when the program runs.
+ * @return PROG_ESUCCESS or PROG_ENOMEM
+ */
+int program_optimize(struct bmath_program *prog);
+
+/**
+ * Run a compiled program against a value stack of at least
+ * prog->max_depth entries.
+ * @param const uint64_t *vars PROGRAM_MAX_VARS values read by OP_VAR
+ * @param size_t *fault Index of the op that failed, if any
+ * @param enum func_err *func_err Error returned by a failing OP_CALL
+ * @return PROG_ESUCCESS or a program_err
+ */
+enum program_err program_run(const struct bmath_program *prog,
+			     uint64_t *stack, const uint64_t *vars,
+			     uint64_t *out_result, size_t *fault,
+			     enum func_err *func_err);
+
+/**
+ * Applies a single op to the top of the value stack.
+ * @param uint64_t **sp Points one past the top of the stack
+ * @param const uint64_t *vars Values for OP_VAR, may be NULL if the op
+ *        stream has none
+ * @return PROG_ESUCCESS or a program_err
+ */
+static inline enum program_err program_step(const struct program_op *op,
+					    uint64_t **sp,
+					    const uint64_t *vars,
+					    enum func_err *func_err)
+{
+	uint64_t *top = *sp;
+	uint64_t left, right;
+
+	switch (op->code) {
+	case OP_PUSH:
+		*top++ = op->imm;
+		goto out;
+	case OP_VAR:
+		*top++ = vars[op->imm];
+		goto out;
+	case OP_NEG:
+		top[-1] = -top[-1];
+		goto out;
+	case OP_NOT:
+		top[-1] = ~top[-1];
+		goto out;
+	// argc is always what the builtin takes, see func_arity()
+	case OP_CALL:
+		top -= op->argc;
+		*func_err = func_call(&left, op->imm, top);
+		if (*func_err)
+			return PROG_EFUNC;
+		*top++ = left;
+		goto out;
+	default:
+		break;
+	}
+
+	right = *--top;
+	left = top[-1];
+
+	switch (op->code) {
+	case OP_MUL:
+		left *= right;
+		break;
+	case OP_DIV:
+		if (right == 0)
+			return PROG_EDIVZERO;
+		left /= right;
+		break;
+	case OP_MOD:
+		if (right == 0)
+			return PROG_EDIVZERO;
+		left %= right;
+		break;
+	case OP_ADD:
+		left += right;
+		break;
+	case OP_SUB:
+		left -= right;
+		break;
+	// Shift counts wrap the same way the hardware does, which keeps
+	// oversized shifts well-defined.
+	case OP_SHL:
+		left <<= right & 63;
+		break;
+	case OP_SHR:
+		left >>= right & 63;
+		break;
+	case OP_AND:
+		left &= right;
+		break;
+	case OP_XOR:
+		left ^= right;
+		break;
+	case OP_OR:
+		left |= right;
+		break;
+	default:
+		break;
+	}
+
+	top[-1] = left;
+out:
+	*sp = top;
+	return PROG_ESUCCESS;
+}
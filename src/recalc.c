@@ -0,0 +1,446 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "cache.h"
+#include "recalc.h"
+
+/*
+ * Lines are found by their text through open addressed slots that hold
+ * index + 1, zero while empty, at most half of them taken. Each text has an
+ * outcome per occurrence in the pass. Lines that weren't seen in a pass are
+ * dropped at the start of the next one, which packs the lines in the order
+ * they were added and rebuilds the slots, so there are no tombstones either.
+ * A file mostly comes in the same order every pass, so each outcome also
+ * remembers the line that came after it, which is tried before hashing.
+ */
+
+// a symbol the line read, and what it was then
+struct recalc_dep {
+	uint64_t value;
+	uint32_t sym;
+	bool bound;
+};
+
+struct recalc_outcome {
+	struct recalc_dep *deps;
+	size_t ndeps;
+	uint64_t result;
+	struct bmath_error error;
+	int err;
+	uint32_t binds;
+	// index + 1 of the line after this one in the last pass, zero if none
+	uint32_t follows;
+	bool valid;
+};
+
+struct recalc_line {
+	char *text;
+	size_t len;
+	uint64_t hash;
+	// pass the line was last seen in, and lines with its text so far in it
+	uint64_t pass;
+	size_t seen;
+	struct recalc_outcome *outcomes;
+	size_t noutcomes;
+};
+
+struct recalc {
+	struct recalc_line *lines;
+	size_t count;
+	size_t cap;
+	uint32_t *slots;
+	size_t nslots;
+	uint64_t sip_key[2];
+	uint64_t pass;
+	// index + 1 of the line that likely comes next, and the line and
+	// occurrence of the one before it, zero at the start of a pass
+	uint32_t hint;
+	uint32_t prev;
+	size_t prev_occurrence;
+	struct bmath_recalc_stats stats;
+	// the outcome of the last miss, for recalc_store(), and what it read
+	struct recalc_outcome *pending;
+	struct recalc_dep *deps;
+	size_t ndeps;
+	size_t deps_cap;
+	// a read couldn't be recorded, so the outcome can't be kept
+	bool incomplete;
+};
+
+struct recalc *recalc_new(void)
+{
+	struct recalc *rc = calloc(1, sizeof(*rc));
+
+	if (!rc) {
+		return NULL;
+	}
+
+	rc->pass = 1;
+	cache_seed(rc->sip_key);
+	return rc;
+}
+
+static void __trim(struct recalc_line *line, size_t n)
+{
+	for (size_t i = n; i < line->noutcomes; i++) {
+		free(line->outcomes[i].deps);
+	}
+
+	if (n < line->noutcomes) {
+		line->noutcomes = n;
+	}
+}
+
+void recalc_free(struct recalc *rc)
+{
+	if (!rc) {
+		return;
+	}
+
+	for (size_t i = 0; i < rc->count; i++) {
+		__trim(&rc->lines[i], 0);
+		free(rc->lines[i].outcomes);
+		free(rc->lines[i].text);
+	}
+
+	free(rc->lines);
+	free(rc->slots);
+	free(rc->deps);
+	free(rc);
+}
+
+// the slot of the text, or the empty slot it would go in
+static uint32_t *__slot(const struct recalc *rc, const char *text, size_t len,
+			uint64_t hash)
+{
+	const struct recalc_line *line;
+	size_t mask = rc->nslots - 1;
+	uint32_t *slot;
+
+	for (size_t i = hash & mask;; i = (i + 1) & mask) {
+		slot = &rc->slots[i];
+		if (!*slot) {
+			return slot;
+		}
+
+		line = &rc->lines[*slot - 1];
+		if (line->hash == hash && line->len == len &&
+		    !memcmp(line->text, text, len)) {
+			return slot;
+		}
+	}
+}
+
+static void __index(struct recalc *rc)
+{
+	const struct recalc_line *line;
+
+	memset(rc->slots, 0, rc->nslots * sizeof(*rc->slots));
+	for (size_t i = 0; i < rc->count; i++) {
+		line = &rc->lines[i];
+		*__slot(rc, line->text, line->len, line->hash) = i + 1;
+	}
+}
+
+// the lines after each outcome, once the lines have been packed
+static void __remap(struct recalc *rc, const uint32_t *moved)
+{
+	struct recalc_outcome *o;
+
+	for (size_t i = 0; i < rc->count; i++) {
+		for (size_t j = 0; j < rc->lines[i].noutcomes; j++) {
+			o = &rc->lines[i].outcomes[j];
+			o->follows = moved && o->follows ? moved[o->follows - 1] :
+							   0;
+		}
+	}
+}
+
+void recalc_next_pass(struct recalc *rc)
+{
+	struct recalc_line *line;
+	uint32_t *moved = malloc((rc->count ? rc->count : 1) * sizeof(*moved));
+	size_t kept = 0;
+
+	for (size_t i = 0; i < rc->count; i++) {
+		line = &rc->lines[i];
+		if (line->pass != rc->pass) {
+			__trim(line, 0);
+			free(line->outcomes);
+			free(line->text);
+			if (moved) {
+				moved[i] = 0;
+			}
+			continue;
+		}
+
+		__trim(line, line->seen);
+		rc->lines[kept++] = *line;
+		if (moved) {
+			moved[i] = kept;
+		}
+	}
+
+	rc->count = kept;
+	if (rc->nslots) {
+		__index(rc);
+	}
+	__remap(rc, moved);
+	free(moved);
+
+	rc->pass++;
+	rc->hint = rc->count ? 1 : 0;
+	rc->prev = 0;
+	rc->pending = NULL;
+	rc->stats = (struct bmath_recalc_stats){ 0 };
+}
+
+void recalc_invalidate(struct recalc *rc)
+{
+	for (size_t i = 0; i < rc->count; i++) {
+		for (size_t j = 0; j < rc->lines[i].noutcomes; j++) {
+			rc->lines[i].outcomes[j].valid = false;
+		}
+	}
+}
+
+static bool __grow(struct recalc *rc)
+{
+	size_t nslots = rc->nslots ? rc->nslots * 2 : 64;
+	size_t cap = rc->cap ? rc->cap * 2 : 32;
+	struct recalc_line *lines;
+	uint32_t *slots;
+
+	lines = realloc(rc->lines, cap * sizeof(*lines));
+	if (!lines) {
+		return false;
+	}
+	rc->lines = lines;
+	rc->cap = cap;
+
+	slots = malloc(nslots * sizeof(*slots));
+	if (!slots) {
+		return false;
+	}
+
+	free(rc->slots);
+	rc->slots = slots;
+	rc->nslots = nslots;
+	__index(rc);
+	return true;
+}
+
+// the line with the text, added if it's new, NULL if out of memory
+static struct recalc_line *__line(struct recalc *rc, const char *text,
+				  size_t len)
+{
+	struct recalc_line *line;
+	uint64_t hash;
+	uint32_t *slot;
+
+	if (rc->hint) {
+		line = &rc->lines[rc->hint - 1];
+		if (line->len == len && !memcmp(line->text, text, len)) {
+			return line;
+		}
+	}
+
+	hash = cache_hash(rc->sip_key, text, len);
+	if (rc->nslots) {
+		slot = __slot(rc, text, len, hash);
+		if (*slot) {
+			return &rc->lines[*slot - 1];
+		}
+	}
+
+	if (rc->count == UINT32_MAX - 1) {
+		return NULL;
+	}
+
+	if ((rc->count + 1) * 2 > rc->nslots && !__grow(rc)) {
+		return NULL;
+	}
+
+	line = &rc->lines[rc->count];
+	*line = (struct recalc_line){ .text = malloc(len ? len : 1),
+				      .len = len,
+				      .hash = hash };
+	if (!line->text) {
+		return NULL;
+	}
+	memcpy(line->text, text, len);
+
+	*__slot(rc, text, len, hash) = ++rc->count;
+	return line;
+}
+
+static bool __grow_outcomes(struct recalc_line *line, size_t n)
+{
+	struct recalc_outcome *outcomes;
+
+	if (n < 2 * line->noutcomes) {
+		n = 2 * line->noutcomes;
+	}
+
+	outcomes = realloc(line->outcomes, n * sizeof(*outcomes));
+	if (!outcomes) {
+		return false;
+	}
+
+	memset(outcomes + line->noutcomes, 0,
+	       (n - line->noutcomes) * sizeof(*outcomes));
+	line->outcomes = outcomes;
+	line->noutcomes = n;
+	return true;
+}
+
+// whether every symbol the outcome read is still what it was
+static bool __current(const struct recalc_outcome *o,
+		      const struct symbol_table *symbols)
+{
+	uint64_t value;
+
+	for (size_t i = 0; i < o->ndeps; i++) {
+		if (symbols_get(symbols, o->deps[i].sym, &value) !=
+			    o->deps[i].bound ||
+		    value != o->deps[i].value) {
+			return false;
+		}
+	}
+
+	return true;
+}
+
+bool recalc_lookup(struct recalc *rc, const struct symbol_table *symbols,
+		   const char *expr, size_t len, int *out_err,
+		   uint64_t *out_result, struct bmath_error *out_error,
+		   uint32_t *out_binds)
+{
+	struct recalc_line *line;
+	struct recalc_outcome *o;
+	size_t occurrence;
+
+	rc->pending = NULL;
+	rc->ndeps = 0;
+	rc->incomplete = false;
+
+	line = __line(rc, expr, len);
+	if (!line) {
+		rc->stats.evaluated++;
+		rc->hint = rc->prev = 0;
+		return false;
+	}
+
+	if (line->pass != rc->pass) {
+		line->pass = rc->pass;
+		line->seen = 0;
+	}
+	occurrence = line->seen++;
+
+	// the line before now knows which one comes after it
+	if (rc->prev &&
+	    rc->prev_occurrence < rc->lines[rc->prev - 1].noutcomes) {
+		rc->lines[rc->prev - 1].outcomes[rc->prev_occurrence].follows =
+			line - rc->lines + 1;
+	}
+	rc->prev = line - rc->lines + 1;
+	rc->prev_occurrence = occurrence;
+	rc->hint = occurrence < line->noutcomes ?
+			   line->outcomes[occurrence].follows :
+			   0;
+
+	if (occurrence < line->noutcomes) {
+		o = &line->outcomes[occurrence];
+		if (o->valid && __current(o, symbols)) {
+			rc->stats.reused++;
+			*out_err = o->err;
+			*out_result = o->result;
+			*out_error = o->error;
+			*out_binds = o->binds;
+			return true;
+		}
+	}
+
+	rc->stats.evaluated++;
+	if (occurrence >= line->noutcomes &&
+	    !__grow_outcomes(line, occurrence + 1)) {
+		return false;
+	}
+
+	rc->pending = &line->outcomes[occurrence];
+	rc->pending->valid = false;
+	return false;
+}
+
+void recalc_read(struct recalc *rc, const struct symbol_table *symbols,
+		 uint32_t sym)
+{
+	struct recalc_dep *deps;
+	size_t cap;
+
+	if (!rc->pending) {
+		return;
+	}
+
+	// the same name twice in a row, as in `a * a`, is one edge
+	if (rc->ndeps && rc->deps[rc->ndeps - 1].sym == sym) {
+		return;
+	}
+
+	if (rc->ndeps == rc->deps_cap) {
+		cap = rc->deps_cap ? rc->deps_cap * 2 : 16;
+		deps = realloc(rc->deps, cap * sizeof(*deps));
+		if (!deps) {
+			rc->incomplete = true;
+			return;
+		}
+		rc->deps = deps;
+		rc->deps_cap = cap;
+	}
+
+	deps = &rc->deps[rc->ndeps++];
+	deps->sym = sym;
+	deps->bound = symbols_get(symbols, sym, &deps->value);
+}
+
+void recalc_store(struct recalc *rc, int err, uint64_t result,
+		  const struct bmath_error *error, uint32_t binds)
+{
+	struct recalc_outcome *o = rc->pending;
+	struct recalc_dep *deps = NULL;
+
+	if (!o) {
+		return;
+	}
+	rc->pending = NULL;
+
+	// running out of memory may not happen again
+	if (rc->incomplete ||
+	    (err && (err != PE_PARSE_ERROR || error->code == BMATH_ENOMEM))) {
+		return;
+	}
+
+	if (rc->ndeps) {
+		deps = realloc(o->deps, rc->ndeps * sizeof(*deps));
+		if (!deps) {
+			return;
+		}
+		memcpy(deps, rc->deps, rc->ndeps * sizeof(*deps));
+	} else {
+		free(o->deps);
+	}
+
+	*o = (struct recalc_outcome){ .deps = deps,
+				      .ndeps = rc->ndeps,
+				      .result = result,
+				      .error = *error,
+				      .err = err,
+				      .binds = binds,
+				      .follows = o->follows,
+				      .valid = true };
+}
+
+void recalc_stats(const struct recalc *rc, struct bmath_recalc_stats *out)
+{
+	*out = rc->stats;
+}
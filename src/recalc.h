@@ -0,0 +1,65 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "parser.h"
+#include "symbols.h"
+
+/*
+ * What each line of a file evaluated to in the last pass over it, and which
+ * bindings it read, see parser_settings.incremental. Lines are told apart by
+ * their text and by how many lines with the same text came before them in
+ * the pass, so a line keeps its entry when lines are added or removed
+ * elsewhere. A line whose bindings still have the values it read gives the
+ * same outcome again, and only lines that changed, or that read a binding
+ * that did, are evaluated. Those are the edges of the dependency graph:
+ * editing a definition re-evaluates what reads it, which re-evaluates what
+ * reads that if its value changed, and so on.
+ */
+
+struct recalc;
+
+/**
+ * @return NULL if out of memory
+ */
+struct recalc *recalc_new(void);
+void recalc_free(struct recalc *rc);
+
+/**
+ * Start a pass from the first line, forgetting the lines that weren't seen
+ * in the one before.
+ */
+void recalc_next_pass(struct recalc *rc);
+
+/**
+ * Forget every outcome, for when lines may evaluate differently even though
+ * what they read didn't change, such as once a function is defined.
+ */
+void recalc_invalidate(struct recalc *rc);
+
+/**
+ * Look up the next line of the pass and count it. After a miss, the bindings
+ * the line reads go to recalc_read() and its outcome to recalc_store().
+ * @param int *out_err What parse() returned
+ * @param uint32_t *out_binds The symbol the line binds, SYMBOL_NONE if it
+ *        doesn't bind one
+ * @return Whether the line's outcome is still valid
+ */
+bool recalc_lookup(struct recalc *rc, const struct symbol_table *symbols,
+		   const char *expr, size_t len, int *out_err,
+		   uint64_t *out_result, struct bmath_error *out_error,
+		   uint32_t *out_binds);
+
+// the line of the last miss read a symbol, bound or not
+void recalc_read(struct recalc *rc, const struct symbol_table *symbols,
+		 uint32_t sym);
+
+/**
+ * Remember the outcome of the line of the last recalc_lookup() miss.
+ */
+void recalc_store(struct recalc *rc, int err, uint64_t result,
+		  const struct bmath_error *error, uint32_t binds);
+
+void recalc_stats(const struct recalc *rc, struct bmath_recalc_stats *out);
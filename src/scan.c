@@ -0,0 +1,119 @@
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "batch.h"
+#include "scan.h"
+#include "token.h"
+#include "program.h"
+#include "lookup_tables.h"
+
+bool scan_line_scalar(const char *line, size_t len, uint64_t *spaces,
+		      size_t *out_len)
+{
+	uint64_t space = 0;
+	uint8_t entry;
+	size_t i;
+
+	for (i = 0; i < len; i++) {
+		entry = lookup_char_class[(unsigned char)line[i]];
+		if (!(entry & LEX_FLAG_ALLOWED)) {
+			break;
+		}
+
+		if ((entry & LEX_CLASS_MASK) == LEX_CLASS_SPACE) {
+			space |= 1ull << (i % 64);
+		}
+
+		if (i % 64 == 63) {
+			spaces[i / 64] = space;
+			space = 0;
+		}
+	}
+
+	if (i % 64) {
+		spaces[i / 64] = space;
+	}
+
+	*out_len = i;
+	return i < len && line[i] != '\0';
+}
+
+#ifdef __x86_64__
+
+#include <immintrin.h>
+
+// 0xff in the lanes of v that are within [lo, hi]
+static inline __m128i __in_range(__m128i v, char lo, char hi)
+{
+	__m128i off = _mm_sub_epi8(v, _mm_set1_epi8(lo));
+
+	return _mm_cmpeq_epi8(_mm_min_epu8(off, _mm_set1_epi8(hi - lo)), off);
+}
+
+static inline __m128i __is(__m128i v, char c)
+{
+	return _mm_cmpeq_epi8(v, _mm_set1_epi8(c));
+}
+
+/*
+ * SSE2 has no byte shuffle, so the allowed set is spelled out as ranges. It
+ * has to match LEX_FLAG_ALLOWED, which the tests check byte by byte.
+ */
+static inline OVERREAD uint64_t __sse2_block(const char *p,
+						  uint64_t *stop)
+{
+	uint64_t space = 0, bad = 0;
+	__m128i v, ws, ok;
+
+	for (int i = 0; i < 4; i++) {
+		v = _mm_loadu_si128((const __m128i *)(p + i * 16));
+
+		ws = _mm_or_si128(_mm_or_si128(__is(v, ' '), __is(v, '\t')),
+				  _mm_or_si128(__is(v, '\n'), __is(v, '\r')));
+		ok = _mm_or_si128(ws, __in_range(v, '%', '&'));
+		ok = _mm_or_si128(ok, __in_range(v, '(', '-'));
+		ok = _mm_or_si128(ok, __in_range(v, '/', '9'));
+		ok = _mm_or_si128(ok, __in_range(v, '<', '>'));
+		ok = _mm_or_si128(ok, __in_range(v, 'A', 'F'));
+		ok = _mm_or_si128(ok, __is(v, 'X'));
+		ok = _mm_or_si128(ok, __in_range(v, '^', 'z'));
+		ok = _mm_or_si128(ok, __is(v, '|'));
+		ok = _mm_or_si128(ok, __is(v, '~'));
+
+		space |= (uint64_t)(uint16_t)_mm_movemask_epi8(ws) << (i * 16);
+		bad |= (uint64_t)(uint16_t)~_mm_movemask_epi8(ok) << (i * 16);
+	}
+
+	*stop = bad;
+	return space;
+}
+
+bool scan_line_sse2(const char *line, size_t len, uint64_t *spaces,
+		    size_t *out_len)
+{
+	return scan_blocks(line, len, spaces, out_len, __sse2_block);
+}
+
+scan_line_t scan_select(enum bmath_simd cap)
+{
+	if (cap == BMATH_SIMD_SCALAR) {
+		return scan_line_scalar;
+	}
+
+	// batch_select() has already checked the CPU and the OS
+	if (batch_select(cap)->level >= BMATH_SIMD_AVX2) {
+		return scan_line_avx2;
+	}
+
+	// every x86-64 CPU has SSE2
+	return scan_line_sse2;
+}
+
+#else
+
+scan_line_t scan_select(enum bmath_simd cap)
+{
+	return scan_line_scalar;
+}
+
+#endif
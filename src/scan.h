@@ -0,0 +1,113 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "parser.h"
+#include "util.h"
+
+/*
+ * The pre-scan looks at a whole line before it is lexed, a vector at a time.
+ * It finds where the line ends, rejects it if it has a byte that can't appear
+ * in any token, and marks whitespace so the lexer can jump straight to the
+ * start of the next token. parse() leaves it out for short lines, where the
+ * lexer is faster on its own.
+ */
+
+// words of whitespace bits for a line of len bytes
+#define SCAN_WORDS(len) (((len) + 63) / 64)
+
+/**
+ * Scan a line up to len bytes, its first NUL, or its first illegal byte,
+ * whichever comes first.
+ * @param uint64_t *spaces One bit per byte, set for whitespace. Needs room for
+ *        SCAN_WORDS(len) words, of which SCAN_WORDS(*out_len) are written.
+ *        Bits at or past *out_len are clear
+ * @param size_t *out_len Where the scan stopped
+ * @return true if it stopped at an illegal byte
+ */
+typedef bool (*scan_line_t)(const char *line, size_t len, uint64_t *spaces,
+			    size_t *out_len);
+
+/**
+ * Pick the widest scanner the CPU supports, but no wider than the cap.
+ * BMATH_SIMD_SCALAR picks scan_line_scalar().
+ */
+scan_line_t scan_select(enum bmath_simd cap);
+
+bool scan_line_scalar(const char *line, size_t len, uint64_t *spaces,
+		      size_t *out_len);
+
+#ifdef __x86_64__
+bool scan_line_sse2(const char *line, size_t len, uint64_t *spaces,
+		    size_t *out_len);
+bool scan_line_avx2(const char *line, size_t len, uint64_t *spaces,
+		    size_t *out_len);
+#endif
+
+/*
+ * Vector scanners only supply a function that scans one 64-byte block. It
+ * returns the mask of its whitespace bytes, and sets stop to the mask of its
+ * bytes that would end the line: NULs and illegal bytes. They read past the
+ * line, so they are marked OVERREAD, see scan_blocks().
+ */
+typedef uint64_t (*scan_block_t)(const char *block, uint64_t *stop);
+
+static inline bool __scan_stop(uint64_t space, uint64_t stop, size_t base,
+			       uint64_t *spaces, size_t *out_len)
+{
+	size_t n;
+
+	if (!stop) {
+		spaces[base / 64] = space;
+		return false;
+	}
+
+	n = __builtin_ctzll(stop);
+	spaces[base / 64] = space & ((1ull << n) - 1);
+	*out_len = base + n;
+	return true;
+}
+
+/*
+ * Runs a block function over a line. Most lines are shorter than a block, so
+ * the tail isn't copied out: it is read as the aligned blocks it lies in. An
+ * aligned block never crosses a page, so the bytes around the tail can be
+ * read, but they are not trusted, everything past len stops the scan.
+ */
+static inline bool scan_blocks(const char *line, size_t len, uint64_t *spaces,
+			       size_t *out_len, scan_block_t block)
+{
+	const char *aligned;
+	uint64_t space, stop, next_space, next_stop;
+	size_t base, off;
+
+	*out_len = len;
+	for (base = 0; base + 64 <= len; base += 64) {
+		space = block(line + base, &stop);
+		if (__scan_stop(space, stop, base, spaces, out_len)) {
+			return line[*out_len] != '\0';
+		}
+	}
+
+	if (base == len) {
+		return false;
+	}
+
+	aligned = (const char *)((uintptr_t)(line + base) & ~(uintptr_t)63);
+	off = line + base - aligned;
+	space = block(aligned, &stop) >> off;
+	stop >>= off;
+
+	// off is not zero if the tail runs into the next block
+	if (off + len - base > 64) {
+		next_space = block(aligned + 64, &next_stop);
+		space |= next_space << (64 - off);
+		stop |= next_stop << (64 - off);
+	}
+
+	__scan_stop(space, stop | ~0ull << (len - base), base, spaces,
+		    out_len);
+	return *out_len < len && line[*out_len] != '\0';
+}
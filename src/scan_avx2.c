@@ -0,0 +1,64 @@
+#ifdef __x86_64__
+
+#include <immintrin.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "scan.h"
+#include "token.h"
+#include "program.h"
+#include "lookup_tables.h"
+
+/*
+ * AVX2 scanner, 32 bytes per register. Both sets are looked up by nibble
+ * with vpshufb, see lookup_allowed_nibbles and lookup_space_nibbles.
+ */
+
+#define AVX2 __attribute__((target("avx2")))
+
+static inline AVX2 __m256i __nibbles(const uint8_t *table)
+{
+	return _mm256_broadcastsi128_si256(
+		_mm_loadu_si128((const __m128i *)table));
+}
+
+static inline AVX2 OVERREAD uint64_t __avx2_block(const char *p,
+						       uint64_t *stop)
+{
+	const __m256i allowed = __nibbles(lookup_allowed_nibbles);
+	const __m256i spaces = __nibbles(lookup_space_nibbles);
+	// bit h for high nibble h, nothing for the high bit set
+	const __m256i high = _mm256_setr_epi8(
+		1, 2, 4, 8, 16, 32, 64, -128, 0, 0, 0, 0, 0, 0, 0, 0, 1, 2, 4, 8,
+		16, 32, 64, -128, 0, 0, 0, 0, 0, 0, 0, 0);
+	const __m256i low_nibble = _mm256_set1_epi8(0x0f);
+	uint64_t space = 0, bad = 0;
+	__m256i v, lo, hi, ok;
+
+	for (int i = 0; i < 2; i++) {
+		v = _mm256_loadu_si256((const __m256i *)(p + i * 32));
+		lo = _mm256_and_si256(v, low_nibble);
+		hi = _mm256_and_si256(_mm256_srli_epi16(v, 4), low_nibble);
+
+		ok = _mm256_and_si256(_mm256_shuffle_epi8(allowed, lo),
+				      _mm256_shuffle_epi8(high, hi));
+		ok = _mm256_cmpeq_epi8(ok, _mm256_setzero_si256());
+
+		space |= (uint64_t)(uint32_t)_mm256_movemask_epi8(
+				 _mm256_cmpeq_epi8(
+					 _mm256_shuffle_epi8(spaces, v), v))
+			 << (i * 32);
+		bad |= (uint64_t)(uint32_t)_mm256_movemask_epi8(ok) << (i * 32);
+	}
+
+	*stop = bad;
+	return space;
+}
+
+AVX2 bool scan_line_avx2(const char *line, size_t len, uint64_t *spaces,
+			 size_t *out_len)
+{
+	return scan_blocks(line, len, spaces, out_len, __avx2_block);
+}
+
+#endif
@@ -0,0 +1,232 @@
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "shape.h"
+
+#define SHAPE_TBL_MIN_SLOTS 64
+
+/*
+ * Open addressed index into shapes. The hash is kept next to the index so a
+ * probe only touches a shape on a likely match.
+ */
+struct shape_slot {
+	uint64_t hash;
+	// offset by one so 0 is empty
+	size_t idx;
+};
+
+struct shape_tbl {
+	struct shape *shapes;
+	size_t len;
+	size_t cap;
+	struct shape_slot *slots;
+	size_t nslots;
+};
+
+static int __grow(void **buf, size_t *cap, size_t need, size_t size)
+{
+	size_t n = *cap ? *cap : 16;
+	void *tmp;
+
+	if (need <= *cap) {
+		return 0;
+	}
+
+	while (n < need) {
+		n *= 2;
+	}
+
+	tmp = realloc(*buf, n * size);
+	if (!tmp) {
+		return ENOMEM;
+	}
+
+	*buf = tmp;
+	*cap = n;
+	return 0;
+}
+
+void shape_scan_reset(struct shape_scan *scan)
+{
+	scan->key_len = 0;
+	scan->hash = 0;
+	scan->line_lits = scan->nlits;
+}
+
+void shape_scan_drop(struct shape_scan *scan)
+{
+	scan->nlits = scan->line_lits;
+}
+
+void shape_scan_release(struct shape_scan *scan)
+{
+	free(scan->key);
+	free(scan->lits);
+	*scan = (struct shape_scan){ 0 };
+}
+
+int shape_scan_reserve(struct shape_scan *scan)
+{
+	if (__grow((void **)&scan->key, &scan->key_cap,
+		   scan->key_len + 1 + sizeof(uint64_t), 1) ||
+	    __grow((void **)&scan->lits, &scan->lits_cap, scan->nlits + 1,
+		   sizeof(*scan->lits))) {
+		return ENOMEM;
+	}
+
+	return 0;
+}
+
+struct shape_tbl *shape_tbl_new(void)
+{
+	struct shape_tbl *tbl = calloc(1, sizeof(*tbl));
+	if (!tbl) {
+		return NULL;
+	}
+
+	tbl->slots = calloc(SHAPE_TBL_MIN_SLOTS, sizeof(*tbl->slots));
+	if (!tbl->slots) {
+		free(tbl);
+		return NULL;
+	}
+
+	tbl->nslots = SHAPE_TBL_MIN_SLOTS;
+	return tbl;
+}
+
+void shape_tbl_free(struct shape_tbl *tbl)
+{
+	struct shape *shape;
+
+	if (!tbl) {
+		return;
+	}
+
+	for (size_t i = 0; i < tbl->len; i++) {
+		shape = &tbl->shapes[i];
+		free(shape->key);
+		if (shape->prog) {
+			program_release(shape->prog);
+			free(shape->prog);
+		}
+	}
+
+	free(tbl->shapes);
+	free(tbl->slots);
+	free(tbl);
+}
+
+static void __insert_slot(struct shape_slot *slots, size_t nslots,
+			  uint64_t hash, size_t idx)
+{
+	size_t i = hash & (nslots - 1);
+
+	while (slots[i].idx) {
+		i = (i + 1) & (nslots - 1);
+	}
+
+	slots[i] = (struct shape_slot){ .hash = hash, .idx = idx + 1 };
+}
+
+// keep the index at most half full
+static int __rehash(struct shape_tbl *tbl)
+{
+	size_t nslots = tbl->nslots * 2;
+	struct shape_slot *slots;
+
+	if (tbl->len * 2 < tbl->nslots) {
+		return 0;
+	}
+
+	slots = calloc(nslots, sizeof(*slots));
+	if (!slots) {
+		return ENOMEM;
+	}
+
+	for (size_t i = 0; i < tbl->len; i++) {
+		__insert_slot(slots, nslots, tbl->shapes[i].hash, i);
+	}
+
+	free(tbl->slots);
+	tbl->slots = slots;
+	tbl->nslots = nslots;
+	return 0;
+}
+
+static struct shape *__lookup(struct shape_tbl *tbl,
+			      const struct shape_scan *scan, uint64_t hash)
+{
+	struct shape *shape;
+	size_t i = hash & (tbl->nslots - 1);
+
+	while (tbl->slots[i].idx) {
+		if (tbl->slots[i].hash != hash) {
+			i = (i + 1) & (tbl->nslots - 1);
+			continue;
+		}
+
+		shape = &tbl->shapes[tbl->slots[i].idx - 1];
+		if (shape->key_len == scan->key_len &&
+		    memcmp(shape->key, scan->key, scan->key_len) == 0) {
+			return shape;
+		}
+		i = (i + 1) & (tbl->nslots - 1);
+	}
+
+	return NULL;
+}
+
+static struct shape *__add_shape(struct shape_tbl *tbl,
+				 const struct shape_scan *scan, uint64_t hash)
+{
+	struct shape *shape;
+
+	if (__rehash(tbl) || __grow((void **)&tbl->shapes, &tbl->cap,
+				    tbl->len + 1, sizeof(*tbl->shapes))) {
+		return NULL;
+	}
+
+	shape = &tbl->shapes[tbl->len];
+	*shape = (struct shape){ .key_len = scan->key_len,
+				 .hash = hash,
+				 .nlits = scan->nlits - scan->line_lits };
+
+	shape->key = malloc(scan->key_len ? scan->key_len : 1);
+	if (!shape->key) {
+		return NULL;
+	}
+	memcpy(shape->key, scan->key, scan->key_len);
+
+	__insert_slot(tbl->slots, tbl->nslots, hash, tbl->len);
+	tbl->len++;
+	return shape;
+}
+
+int shape_tbl_add(struct shape_tbl *tbl, const struct shape_scan *scan,
+		  size_t *out_idx)
+{
+	struct shape *shape;
+
+	shape = __lookup(tbl, scan, scan->hash);
+	if (!shape) {
+		shape = __add_shape(tbl, scan, scan->hash);
+		if (!shape) {
+			return ENOMEM;
+		}
+	}
+
+	shape->count++;
+	*out_idx = shape - tbl->shapes;
+	return 0;
+}
+
+size_t shape_tbl_len(const struct shape_tbl *tbl)
+{
+	return tbl->len;
+}
+
+struct shape *shape_tbl_at(struct shape_tbl *tbl, size_t i)
+{
+	return &tbl->shapes[i];
+}
@@ -0,0 +1,101 @@
+#pragma once
+
+#include <errno.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "program.h"
+
+/*
+ * Expressions that differ only in their literals share a shape. The shape of
+ * a line is its token stream with the values of number tokens left out, so
+ * every line of a shape compiles to the same program apart from the
+ * immediates of its OP_PUSH ops. bmath_parse_batch() compiles each shape once
+ * and evaluates all of its lines together, one SIMD lane per line.
+ */
+
+/*
+ * Lexer output for a run of lines: the shape key of the current line, and
+ * the literals of every line scanned so far in input order.
+ */
+struct shape_scan {
+	uint8_t *key;
+	size_t key_len;
+	size_t key_cap;
+	// built up token by token, so the key is never hashed as a whole
+	uint64_t hash;
+	uint64_t *lits;
+	size_t nlits;
+	size_t lits_cap;
+	// where the current line's literals start
+	size_t line_lits;
+};
+
+struct shape {
+	uint8_t *key;
+	size_t key_len;
+	uint64_t hash;
+	size_t nlits;
+	// lines seen with this shape
+	size_t count;
+	// NULL when the shape couldn't be compiled as a whole
+	struct bmath_program *prog;
+};
+
+struct shape_tbl;
+
+// start the next line
+void shape_scan_reset(struct shape_scan *scan);
+// forget the current line's literals
+void shape_scan_drop(struct shape_scan *scan);
+void shape_scan_release(struct shape_scan *scan);
+// make room for another token and literal, see below
+int shape_scan_reserve(struct shape_scan *scan);
+
+/*
+ * These run once per token, so they are inline and only call out when the
+ * buffers need to grow.
+ */
+static inline int shape_scan_token(struct shape_scan *scan, uint8_t type,
+				   uint64_t attr)
+{
+	if (scan->key_len + 1 + sizeof(attr) > scan->key_cap &&
+	    shape_scan_reserve(scan)) {
+		return ENOMEM;
+	}
+
+	scan->key[scan->key_len++] = type;
+	memcpy(scan->key + scan->key_len, &attr, sizeof(attr));
+	scan->key_len += sizeof(attr);
+
+	// multiply and fold, one round per token
+	scan->hash = (scan->hash ^ attr ^ ((uint64_t)type << 56)) *
+		     0x9e3779b97f4a7c15;
+	scan->hash ^= scan->hash >> 29;
+	return 0;
+}
+
+static inline int shape_scan_literal(struct shape_scan *scan, uint64_t value)
+{
+	if (scan->nlits == scan->lits_cap && shape_scan_reserve(scan)) {
+		return ENOMEM;
+	}
+
+	scan->lits[scan->nlits++] = value;
+	return 0;
+}
+
+struct shape_tbl *shape_tbl_new(void);
+void shape_tbl_free(struct shape_tbl *tbl);
+
+/**
+ * Count a scanned line towards its shape, adding the shape if it is new.
+ * @param size_t *out_idx Index of the shape, see shape_tbl_at()
+ * @return Zero on success, otherwise ENOMEM
+ */
+int shape_tbl_add(struct shape_tbl *tbl, const struct shape_scan *scan,
+		  size_t *out_idx);
+
+size_t shape_tbl_len(const struct shape_tbl *tbl);
+struct shape *shape_tbl_at(struct shape_tbl *tbl, size_t i);
@@ -0,0 +1,198 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "cache.h"
+#include "symbols.h"
+
+/*
+ * Names are kept in order of their index, and found through open addressed
+ * slots that hold index + 1, zero while empty, at most half of them taken.
+ * Nothing is ever removed, so there are no tombstones.
+ */
+
+struct symbol {
+	char *name;
+	size_t len;
+	uint64_t hash;
+	uint64_t value;
+	// pass the name was last bound in
+	uint64_t pass;
+	// NULL unless it was defined
+	struct symbol_def *def;
+};
+
+struct symbol_table {
+	struct symbol *symbols;
+	size_t count;
+	size_t cap;
+	uint32_t *slots;
+	size_t nslots;
+	uint64_t sip_key[2];
+	// starts at one, so names that were never bound aren't
+	uint64_t pass;
+};
+
+struct symbol_table *symbols_new(void)
+{
+	struct symbol_table *symbols = calloc(1, sizeof(*symbols));
+
+	if (!symbols) {
+		return NULL;
+	}
+
+	symbols->pass = 1;
+	cache_seed(symbols->sip_key);
+	if (symbols_intern(symbols, "_", 1) != SYMBOL_LAST) {
+		symbols_free(symbols);
+		return NULL;
+	}
+
+	return symbols;
+}
+
+void symbols_free(struct symbol_table *symbols)
+{
+	if (!symbols) {
+		return;
+	}
+
+	for (size_t i = 0; i < symbols->count; i++) {
+		free(symbols->symbols[i].name);
+		if (symbols->symbols[i].def) {
+			free(symbols->symbols[i].def->ops);
+			free(symbols->symbols[i].def);
+		}
+	}
+
+	free(symbols->symbols);
+	free(symbols->slots);
+	free(symbols);
+}
+
+void symbols_next_pass(struct symbol_table *symbols)
+{
+	symbols->pass++;
+}
+
+// the slot of the name, or the empty slot it would go in
+static uint32_t *__slot(const struct symbol_table *symbols, const char *name,
+			size_t len, uint64_t hash)
+{
+	const struct symbol *sym;
+	size_t mask = symbols->nslots - 1;
+	uint32_t *slot;
+
+	for (size_t i = hash & mask;; i = (i + 1) & mask) {
+		slot = &symbols->slots[i];
+		if (!*slot) {
+			return slot;
+		}
+
+		sym = &symbols->symbols[*slot - 1];
+		if (sym->hash == hash && sym->len == len &&
+		    !memcmp(sym->name, name, len)) {
+			return slot;
+		}
+	}
+}
+
+uint32_t symbols_find(const struct symbol_table *symbols, const char *name,
+		      size_t len)
+{
+	uint64_t hash = cache_hash(symbols->sip_key, name, len);
+
+	return *__slot(symbols, name, len, hash) - 1;
+}
+
+static bool __grow(struct symbol_table *symbols)
+{
+	size_t nslots = symbols->nslots ? symbols->nslots * 2 : 16;
+	size_t cap = symbols->cap ? symbols->cap * 2 : 8;
+	struct symbol *grown;
+	uint32_t *slots;
+
+	grown = realloc(symbols->symbols, cap * sizeof(*grown));
+	if (!grown) {
+		return false;
+	}
+	symbols->symbols = grown;
+	symbols->cap = cap;
+
+	slots = calloc(nslots, sizeof(*slots));
+	if (!slots) {
+		return false;
+	}
+
+	free(symbols->slots);
+	symbols->slots = slots;
+	symbols->nslots = nslots;
+	for (size_t i = 0; i < symbols->count; i++) {
+		const struct symbol *sym = &symbols->symbols[i];
+
+		*__slot(symbols, sym->name, sym->len, sym->hash) = i + 1;
+	}
+
+	return true;
+}
+
+uint32_t symbols_intern(struct symbol_table *symbols, const char *name,
+			size_t len)
+{
+	uint64_t hash = cache_hash(symbols->sip_key, name, len);
+	struct symbol *sym;
+	uint32_t *slot;
+
+	if (symbols->nslots) {
+		slot = __slot(symbols, name, len, hash);
+		if (*slot) {
+			return *slot - 1;
+		}
+	}
+
+	if (symbols->count == SYMBOL_NONE - 1) {
+		return SYMBOL_NONE;
+	}
+
+	if ((symbols->count + 1) * 2 > symbols->nslots && !__grow(symbols)) {
+		return SYMBOL_NONE;
+	}
+
+	sym = &symbols->symbols[symbols->count];
+	*sym = (struct symbol){ .name = malloc(len ? len : 1),
+				.len = len,
+				.hash = hash };
+	if (!sym->name) {
+		return SYMBOL_NONE;
+	}
+	memcpy(sym->name, name, len);
+
+	*__slot(symbols, name, len, hash) = ++symbols->count;
+	return symbols->count - 1;
+}
+
+bool symbols_get(const struct symbol_table *symbols, uint32_t sym,
+		 uint64_t *out_value)
+{
+	const struct symbol *s = &symbols->symbols[sym];
+
+	*out_value = s->pass == symbols->pass ? s->value : 0;
+	return s->pass == symbols->pass;
+}
+
+void symbols_set(struct symbol_table *symbols, uint32_t sym, uint64_t value)
+{
+	symbols->symbols[sym].value = value;
+	symbols->symbols[sym].pass = symbols->pass;
+}
+
+const struct symbol_def *symbols_def(const struct symbol_table *symbols,
+				     uint32_t sym)
+{
+	return symbols->symbols[sym].def;
+}
+
+void symbols_define(struct symbol_table *symbols, uint32_t sym,
+		    struct symbol_def *def)
+{
+	symbols->symbols[sym].def = def;
+}
@@ -0,0 +1,72 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "program.h"
+
+/*
+ * Names parse() binds with `name = expr`, see parser_reset_symbols(), and
+ * the ones bmath_define() defines. A name keeps its index for the life of
+ * the table, only its binding comes and goes: starting a new pass unbinds
+ * every name at once without touching them, a binding only counts when it
+ * was made in the current pass. Definitions stay.
+ */
+
+// `_`, the result of the last line that succeeded
+#define SYMBOL_LAST 0
+#define SYMBOL_NONE UINT32_MAX
+
+struct symbol_table;
+
+/*
+ * The body of a definition, compiled once, which calls are inlined from.
+ * OP_ARG reads the argument of parameter imm.
+ */
+struct symbol_def {
+	struct program_op *ops;
+	size_t len;
+	uint8_t argc;
+};
+
+/**
+ * @return NULL if out of memory. `_` is already in the table, unbound
+ */
+struct symbol_table *symbols_new(void);
+void symbols_free(struct symbol_table *symbols);
+
+// unbind every name
+void symbols_next_pass(struct symbol_table *symbols);
+
+/**
+ * @return The index of the name, SYMBOL_NONE if it isn't in the table
+ */
+uint32_t symbols_find(const struct symbol_table *symbols, const char *name,
+		      size_t len);
+
+/**
+ * Find a name, adding it unbound if it isn't in the table.
+ * @return SYMBOL_NONE if out of memory
+ */
+uint32_t symbols_intern(struct symbol_table *symbols, const char *name,
+			size_t len);
+
+/**
+ * @return Whether the name is bound, and then its value in out_value
+ */
+bool symbols_get(const struct symbol_table *symbols, uint32_t sym,
+		 uint64_t *out_value);
+void symbols_set(struct symbol_table *symbols, uint32_t sym, uint64_t value);
+
+/**
+ * @return The definition of the name, NULL if it isn't defined
+ */
+const struct symbol_def *symbols_def(const struct symbol_table *symbols,
+				     uint32_t sym);
+
+/**
+ * Define a name that isn't defined yet. The table owns def from here on.
+ */
+void symbols_define(struct symbol_table *symbols, uint32_t sym,
+		    struct symbol_def *def);
@@ -7,6 +7,8 @@
 #include <stdlib.h>
 
 #include "functions.h"
+// generated by gen-func-hash.py at build time
+#include "func_hash.h"
 
 #define ATTR_LPAREN 1
 #define ATTR_RPAREN ATTR_LPAREN + 1
@@ -32,8 +34,18 @@ enum token_type {
 	TOK_BITWISE_NOT,
 	TOK_SIGN,
 	TOK_FACTOR_OP,
+	// a builtin, attr is its enum func_id
 	TOK_FUNCTION,
 	TOK_COMMA,
+	TOK_VARIABLE,
+	// any other name, attr is its length
+	TOK_NAME,
+	TOK_ASSIGN,
+	// a lexical error, attr is its message
+	TOK_ERROR,
+	// a literal wider than 64 bits, for bmath_parse_wide(). attr is where
+	// its limbs start in the line's literals.
+	TOK_WIDE,
 };
 
 static const char *lookup_token_name[] = {
@@ -48,6 +60,11 @@ static const char *lookup_token_name[] = {
 	[TOK_FACTOR_OP] = "*, /, or %",
 	[TOK_FUNCTION] = "function",
 	[TOK_COMMA] = ",",
+	[TOK_VARIABLE] = "variable",
+	[TOK_NAME] = "name",
+	[TOK_ASSIGN] = "=",
+	[TOK_ERROR] = "error",
+	[TOK_WIDE] = "number",
 };
 
 struct token {
@@ -56,11 +73,6 @@ struct token {
 	enum token_type type;
 };
 
-struct token_func {
-	char *name;
-	bmath_func_t func;
-};
-
 static inline const char *token_name(enum token_type tok)
 {
 	return lookup_token_name[tok];
@@ -71,10 +83,42 @@ static inline enum token_type token_type(struct token *tok)
 	return tok->type;
 }
 
-struct token_tbl;
+// Names are made of these, and never start with a digit, which starts a number
+static inline bool token_is_name_char(char c)
+{
+	return (c >= '_' && c <= 'z') || (c >= '0' && c <= '9');
+}
+
+// the name at the start of name is its run of name characters within len
+static inline size_t token_name_len(const char *name, size_t len)
+{
+	size_t n = 0;
+
+	while (n < len && token_is_name_char(name[n])) {
+		n++;
+	}
 
-struct token_tbl *token_tbl_new();
-void token_tbl_free(struct token_tbl *root);
-int token_tbl_insert(struct token_tbl *tbl, const char *key, struct token);
-struct token *token_tbl_lookup(struct token_tbl *tbl, const char *key);
-int token_tbl_register_func(struct token_tbl *tbl, struct token_func *func);
+	return n;
+}
+
+/**
+ * Resolve the identifier at the start of name, see token_name_len().
+ * @param struct token *out A TOK_FUNCTION token if it names a builtin
+ * @return false if name doesn't start with a builtin
+ */
+static inline bool token_lookup_func(const char *name, size_t len,
+				     struct token *out)
+{
+	const struct func_hash_entry *entry;
+	size_t n = token_name_len(name, len);
+
+	entry = func_hash_lookup(name, n);
+	if (!entry) {
+		return false;
+	}
+
+	*out = (struct token){ .attr = entry->id,
+			       .namelen = n,
+			       .type = TOK_FUNCTION };
+	return true;
+}
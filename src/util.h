@@ -2,11 +2,14 @@
 
 #include <inttypes.h>
 
-#define __repeat_character(fp, n, c)           \
-	do {                                   \
-		for (int _i = 0; _i < n; _i++) \
-			fputc(c, fp);          \
-	} while (0)
-
 #define likely(x) __builtin_expect(!!(x), 1)
 #define unlikely(x) __builtin_expect(!!(x), 0)
+
+// for loads that read past a buffer, but never past the aligned block it is in
+#if defined(__SANITIZE_ADDRESS__)
+#define OVERREAD __attribute__((no_sanitize_address))
+#elif defined(__SANITIZE_THREAD__)
+#define OVERREAD __attribute__((no_sanitize_thread))
+#else
+#define OVERREAD
+#endif
@@ -0,0 +1,777 @@
+#include <errno.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "util.h"
+#include "wide.h"
+
+typedef unsigned __int128 u128;
+
+#define U128_MAX (~(u128)0)
+
+// what the exact tiers return for a value they can't hold
+#define WIDE_EFIT (-1)
+
+struct wide_eval {
+	unsigned int width;
+	size_t nlimbs;
+	// a value stack for each tier, depth_cap values deep
+	uint64_t *stack64;
+	u128 *stack128;
+	uint64_t *limbs;
+	size_t depth_cap;
+	// two values of limbs, where products, quotients and remainders are
+	// built before they replace their operand
+	uint64_t *scratch;
+	struct bmath_wide_stats stats;
+};
+
+struct wide_eval *wide_new(unsigned int width)
+{
+	struct wide_eval *w = calloc(1, sizeof(*w));
+
+	if (!w) {
+		return NULL;
+	}
+
+	w->width = width;
+	w->nlimbs = width / 64;
+	w->scratch = malloc(2 * w->nlimbs * sizeof(*w->scratch));
+	if (!w->scratch) {
+		free(w);
+		return NULL;
+	}
+
+	return w;
+}
+
+void wide_free(struct wide_eval *w)
+{
+	if (!w) {
+		return;
+	}
+
+	free(w->stack64);
+	free(w->stack128);
+	free(w->limbs);
+	free(w->scratch);
+	free(w);
+}
+
+void wide_stats(const struct wide_eval *w, struct bmath_wide_stats *out)
+{
+	*out = w->stats;
+}
+
+static int __reserve(struct wide_eval *w, size_t depth)
+{
+	size_t cap = w->depth_cap ? w->depth_cap : 16;
+	void *p;
+
+	if (likely(depth <= w->depth_cap)) {
+		return 0;
+	}
+
+	while (cap < depth) {
+		cap *= 2;
+	}
+
+	p = realloc(w->stack64, cap * sizeof(*w->stack64));
+	if (!p) {
+		return ENOMEM;
+	}
+	w->stack64 = p;
+
+	p = realloc(w->stack128, cap * sizeof(*w->stack128));
+	if (!p) {
+		return ENOMEM;
+	}
+	w->stack128 = p;
+
+	p = realloc(w->limbs, cap * w->nlimbs * sizeof(*w->limbs));
+	if (!p) {
+		return ENOMEM;
+	}
+	w->limbs = p;
+
+	w->depth_cap = cap;
+	return 0;
+}
+
+static inline void __limbs_set(uint64_t *a, size_t n, uint64_t v)
+{
+	a[0] = v;
+	memset(a + 1, 0, (n - 1) * sizeof(*a));
+}
+
+/*
+ * Builtins in the 64-bit tier agree with the width as long as they succeed,
+ * mask() and clz() only take fewer bytes, except for align() carrying out of
+ * the top.
+ */
+static bool __call_64(uint64_t *ret, uint64_t id, const uint64_t *argv)
+{
+	if (id == FUNC_ALIGN && argv[1] && argv[0] > UINT64_MAX - (argv[1] - 1))
+		return false;
+	return func_call(ret, id, argv) == FUNC_ESUCCESS;
+}
+
+/*
+ * The 64-bit tier, only ever exact: anything that would wrap, ~ always does
+ * at the width, and any fault, which the width may not have, gives up.
+ */
+static int __run_64(struct wide_eval *w, const struct bmath_program *prog,
+		    uint64_t *out)
+{
+	const struct program_op *op, *end = prog->ops + prog->len;
+	uint64_t *top = w->stack64, left, right;
+
+	for (op = prog->ops; op < end; op++) {
+		switch (op->code) {
+		case OP_PUSH:
+			*top++ = op->imm;
+			continue;
+		case OP_NEG:
+			if (top[-1])
+				return WIDE_EFIT;
+			continue;
+		case OP_NOT:
+			return WIDE_EFIT;
+		case OP_CALL:
+			top -= op->argc;
+			if (!__call_64(&left, op->imm, top))
+				return WIDE_EFIT;
+			*top++ = left;
+			continue;
+		default:
+			break;
+		}
+
+		right = *--top;
+		left = top[-1];
+
+		switch (op->code) {
+		case OP_MUL:
+			if (__builtin_mul_overflow(left, right, &left))
+				return WIDE_EFIT;
+			break;
+		case OP_DIV:
+			if (!right)
+				return WIDE_EFIT;
+			left /= right;
+			break;
+		case OP_MOD:
+			if (!right)
+				return WIDE_EFIT;
+			left %= right;
+			break;
+		case OP_ADD:
+			if (__builtin_add_overflow(left, right, &left))
+				return WIDE_EFIT;
+			break;
+		case OP_SUB:
+			if (__builtin_sub_overflow(left, right, &left))
+				return WIDE_EFIT;
+			break;
+		// counts wrap at the width, which is wider than the tier
+		case OP_SHL:
+			right &= w->width - 1;
+			if (!left)
+				break;
+			if (right >= 64 || (left >> (63 - right)) >> 1)
+				return WIDE_EFIT;
+			left <<= right;
+			break;
+		case OP_SHR:
+			right &= w->width - 1;
+			left = right < 64 ? left >> right : 0;
+			break;
+		case OP_AND:
+			left &= right;
+			break;
+		case OP_XOR:
+			left ^= right;
+			break;
+		case OP_OR:
+			left |= right;
+			break;
+		default:
+			break;
+		}
+
+		top[-1] = left;
+	}
+
+	__limbs_set(out, w->nlimbs, w->stack64[0]);
+	return PROG_ESUCCESS;
+}
+
+static inline unsigned int __popcnt128(u128 x)
+{
+	return __builtin_popcountll((uint64_t)x) +
+	       __builtin_popcountll((uint64_t)(x >> 64));
+}
+
+// x isn't zero
+static inline unsigned int __ctz128(u128 x)
+{
+	return (uint64_t)x ? __builtin_ctzll((uint64_t)x) :
+			     64 + __builtin_ctzll((uint64_t)(x >> 64));
+}
+
+// x isn't zero
+static inline unsigned int __clz128(u128 x)
+{
+	return (uint64_t)(x >> 64) ? __builtin_clzll((uint64_t)(x >> 64)) :
+				     64 + __builtin_clzll((uint64_t)x);
+}
+
+static inline u128 __bswap128(u128 x)
+{
+	uint64_t narrow;
+
+	if (x >> 64)
+		return (u128)__builtin_bswap64((uint64_t)x) << 64 |
+		       __builtin_bswap64((uint64_t)(x >> 64));
+
+	func_bswap(&narrow, (uint64_t)x);
+	return narrow;
+}
+
+/*
+ * The builtins at 128 bits, where mask() and clz() take up to 16 bytes. The
+ * exact tier also gives up on align() carrying out of the top.
+ */
+static enum func_err __call_128(u128 *ret, uint64_t id, const u128 *argv,
+				bool exact)
+{
+	u128 x = argv[0], a, zeros;
+
+	*ret = 0;
+	switch (id) {
+	case FUNC_ALIGN:
+		a = argv[1];
+		if (exact && a && x > U128_MAX - (a - 1))
+			return FUNC_ERANGE;
+		*ret = (x + a - 1) & ~(a - 1);
+		break;
+	case FUNC_ALIGN_DOWN:
+		*ret = x & ~(argv[1] - 1);
+		break;
+	case FUNC_BSWAP:
+		*ret = __bswap128(x);
+		break;
+	case FUNC_CLZ:
+		a = argv[1];
+		if (a < 1 || a > 16)
+			return FUNC_ERANGE;
+		if (!x)
+			break;
+		// zeros within the low bytes, which x has to fit in
+		zeros = __clz128(x) - (16 - a) * 8;
+		if (zeros >= a * 8)
+			return FUNC_ERANGE;
+		*ret = zeros;
+		break;
+	case FUNC_CTZ:
+		*ret = x ? __ctz128(x) : 0;
+		break;
+	case FUNC_MASK:
+		if (x > 16)
+			return FUNC_ERANGE;
+		*ret = x == 16 ? U128_MAX : ((u128)1 << (x * 8)) - 1;
+		break;
+	case FUNC_POPCNT:
+		*ret = __popcnt128(x);
+		break;
+	default:
+		return FUNC_EINVAL;
+	}
+
+	return FUNC_ESUCCESS;
+}
+
+/*
+ * The 128-bit tier, which wraps and reports faults at a width of 128, and is
+ * exact like the 64-bit one below wider ones.
+ */
+static int __run_128(struct wide_eval *w, const struct bmath_program *prog,
+		     uint64_t *out, size_t *fault, enum func_err *func_err)
+{
+	const struct program_op *op, *end = prog->ops + prog->len;
+	bool exact = w->width > 128, wrapped;
+	u128 *top = w->stack128, left, right;
+	enum func_err err;
+
+	for (op = prog->ops; op < end; op++) {
+		switch (op->code) {
+		case OP_PUSH:
+			*top++ = op->imm;
+			continue;
+		case OP_NEG:
+			if (exact && top[-1])
+				return WIDE_EFIT;
+			top[-1] = -top[-1];
+			continue;
+		case OP_NOT:
+			if (exact)
+				return WIDE_EFIT;
+			top[-1] = ~top[-1];
+			continue;
+		case OP_CALL:
+			top -= op->argc;
+			err = __call_128(&left, op->imm, top, exact);
+			if (err && exact)
+				return WIDE_EFIT;
+			if (err) {
+				*fault = op - prog->ops;
+				*func_err = err;
+				return PROG_EFUNC;
+			}
+			*top++ = left;
+			continue;
+		default:
+			break;
+		}
+
+		right = *--top;
+		left = top[-1];
+		wrapped = false;
+
+		switch (op->code) {
+		case OP_MUL:
+			wrapped = __builtin_mul_overflow(left, right, &left);
+			break;
+		case OP_DIV:
+		case OP_MOD:
+			if (!right && exact)
+				return WIDE_EFIT;
+			if (!right) {
+				*fault = op - prog->ops;
+				return PROG_EDIVZERO;
+			}
+			left = op->code == OP_DIV ? left / right : left % right;
+			break;
+		case OP_ADD:
+			wrapped = __builtin_add_overflow(left, right, &left);
+			break;
+		case OP_SUB:
+			wrapped = __builtin_sub_overflow(left, right, &left);
+			break;
+		case OP_SHL:
+			right &= w->width - 1;
+			wrapped = left && (right >= 128 ||
+					   (left >> (127 - right)) >> 1);
+			left = right < 128 ? left << right : 0;
+			break;
+		case OP_SHR:
+			right &= w->width - 1;
+			left = right < 128 ? left >> right : 0;
+			break;
+		case OP_AND:
+			left &= right;
+			break;
+		case OP_XOR:
+			left ^= right;
+			break;
+		case OP_OR:
+			left |= right;
+			break;
+		default:
+			break;
+		}
+
+		if (wrapped && exact)
+			return WIDE_EFIT;
+		top[-1] = left;
+	}
+
+	__limbs_set(out, w->nlimbs, (uint64_t)w->stack128[0]);
+	out[1] = (uint64_t)(w->stack128[0] >> 64);
+	return PROG_ESUCCESS;
+}
+
+/*
+ * Values of the limb tier are n limbs, least significant first, and every op
+ * replaces its left operand in place.
+ */
+
+// limbs up to the most significant one that isn't zero
+static inline size_t __limbs_len(const uint64_t *a, size_t n)
+{
+	while (n && !a[n - 1]) {
+		n--;
+	}
+	return n;
+}
+
+static inline size_t __limbs_bits(const uint64_t *a, size_t n)
+{
+	n = __limbs_len(a, n);
+	return n ? n * 64 - __builtin_clzll(a[n - 1]) : 0;
+}
+
+// a as a single limb, false if it doesn't fit in one
+static inline bool __limbs_small(const uint64_t *a, size_t n, uint64_t *v)
+{
+	*v = a[0];
+	return __limbs_len(a, n) <= 1;
+}
+
+static inline int __limbs_cmp(const uint64_t *a, const uint64_t *b, size_t n)
+{
+	for (size_t i = n; i--;) {
+		if (a[i] != b[i])
+			return a[i] < b[i] ? -1 : 1;
+	}
+	return 0;
+}
+
+static inline void __limbs_not(uint64_t *a, size_t n)
+{
+	for (size_t i = 0; i < n; i++) {
+		a[i] = ~a[i];
+	}
+}
+
+static inline void __limbs_neg(uint64_t *a, size_t n)
+{
+	uint64_t carry = 1;
+
+	for (size_t i = 0; i < n; i++) {
+		a[i] = ~a[i] + carry;
+		carry &= !a[i];
+	}
+}
+
+static inline void __limbs_dec(uint64_t *a, size_t n)
+{
+	for (size_t i = 0; i < n && !a[i]--; i++) {
+	}
+}
+
+static inline void __limbs_add(uint64_t *a, const uint64_t *b, size_t n)
+{
+	u128 sum = 0;
+
+	for (size_t i = 0; i < n; i++) {
+		sum = (u128)a[i] + b[i] + (uint64_t)(sum >> 64);
+		a[i] = (uint64_t)sum;
+	}
+}
+
+static inline void __limbs_sub(uint64_t *a, const uint64_t *b, size_t n)
+{
+	uint64_t borrow = 0, diff;
+	bool under;
+
+	for (size_t i = 0; i < n; i++) {
+		under = a[i] < b[i];
+		diff = a[i] - b[i];
+		a[i] = diff - borrow;
+		borrow = under | (diff < borrow);
+	}
+}
+
+// the product only goes as far as the width, which is where it wraps
+static void __limbs_mul(uint64_t *a, const uint64_t *b, size_t n,
+			uint64_t *product)
+{
+	size_t na = __limbs_len(a, n), nb = __limbs_len(b, n);
+	uint64_t carry;
+	u128 t;
+
+	memset(product, 0, n * sizeof(*product));
+	for (size_t i = 0; i < na; i++) {
+		carry = 0;
+		for (size_t j = 0; j < nb && i + j < n; j++) {
+			t = (u128)a[i] * b[j] + product[i + j] + carry;
+			product[i + j] = (uint64_t)t;
+			carry = (uint64_t)(t >> 64);
+		}
+		if (i + nb < n)
+			product[i + nb] = carry;
+	}
+
+	memcpy(a, product, n * sizeof(*a));
+}
+
+// count is below the width
+static void __limbs_shl(uint64_t *a, size_t n, size_t count)
+{
+	size_t words = count / 64, bits = count % 64;
+
+	for (size_t i = n; i-- > words;) {
+		a[i] = a[i - words] << bits;
+		if (bits && i > words)
+			a[i] |= a[i - words - 1] >> (64 - bits);
+	}
+	memset(a, 0, words * sizeof(*a));
+}
+
+static void __limbs_shr(uint64_t *a, size_t n, size_t count)
+{
+	size_t words = count / 64, bits = count % 64;
+
+	for (size_t i = 0; i + words < n; i++) {
+		a[i] = a[i + words] >> bits;
+		if (bits && i + words + 1 < n)
+			a[i] |= a[i + words + 1] << (64 - bits);
+	}
+	memset(a + n - words, 0, words * sizeof(*a));
+}
+
+/*
+ * a / b, or a % b with mod. Divisors of a limb take the dividend a limb at a
+ * time, wider ones a bit at a time.
+ * @return false if b is zero
+ */
+static bool __limbs_div(uint64_t *a, const uint64_t *b, size_t n, bool mod,
+			uint64_t *scratch)
+{
+	uint64_t *q = scratch, *r = scratch + n, d = b[0], carry;
+	size_t nb = __limbs_len(b, n);
+	u128 rem = 0;
+
+	if (!nb) {
+		return false;
+	}
+
+	if (nb == 1) {
+		for (size_t i = n; i--;) {
+			rem = rem << 64 | a[i];
+			a[i] = (uint64_t)(rem / d);
+			rem %= d;
+		}
+		if (mod)
+			__limbs_set(a, n, (uint64_t)rem);
+		return true;
+	}
+
+	memset(scratch, 0, 2 * n * sizeof(*scratch));
+	for (size_t i = __limbs_bits(a, n); i--;) {
+		// r < b, so only the bit shifted out of the top can make r
+		// wider than the width, and then it is over b
+		carry = r[n - 1] >> 63;
+		__limbs_shl(r, n, 1);
+		r[0] |= a[i / 64] >> (i % 64) & 1;
+		if (carry || __limbs_cmp(r, b, n) >= 0) {
+			__limbs_sub(r, b, n);
+			q[i / 64] |= 1ull << (i % 64);
+		}
+	}
+
+	memcpy(a, mod ? r : q, n * sizeof(*a));
+	return true;
+}
+
+// byte k of a, from the least significant one
+static inline uint8_t __limbs_byte(const uint64_t *a, size_t k)
+{
+	return (uint8_t)(a[k / 8] >> (k % 8 * 8));
+}
+
+/*
+ * The builtins at the width, with the arguments from x on, where the result
+ * goes too. mask() and clz() take up to width / 8 bytes, and bswap() swaps
+ * the narrowest power of two bytes that holds its argument, as it does at 64
+ * bits.
+ */
+static enum func_err __call_limbs(struct wide_eval *w, uint64_t id,
+				  uint64_t *x)
+{
+	size_t n = w->nlimbs, bits, bytes;
+	uint64_t *a = x + n, *tmp = w->scratch, v;
+
+	switch (id) {
+	case FUNC_ALIGN:
+		__limbs_dec(a, n);
+		__limbs_add(x, a, n);
+		// fallthrough
+	case FUNC_ALIGN_DOWN:
+		if (id == FUNC_ALIGN_DOWN)
+			__limbs_dec(a, n);
+		for (size_t i = 0; i < n; i++) {
+			x[i] &= ~a[i];
+		}
+		break;
+	case FUNC_BSWAP:
+		bytes = (__limbs_bits(x, n) + 7) / 8;
+		for (v = 1; v < bytes; v *= 2) {
+		}
+		memset(tmp, 0, n * sizeof(*tmp));
+		for (size_t k = 0; k < v; k++) {
+			tmp[(v - 1 - k) / 8] |= (uint64_t)__limbs_byte(x, k)
+						<< ((v - 1 - k) % 8 * 8);
+		}
+		memcpy(x, tmp, n * sizeof(*x));
+		break;
+	case FUNC_CLZ:
+		bits = __limbs_bits(x, n);
+		if (!__limbs_small(a, n, &v) || v < 1 || v > n * 8 ||
+		    bits > v * 8) {
+			__limbs_set(x, n, 0);
+			return FUNC_ERANGE;
+		}
+		__limbs_set(x, n, bits ? v * 8 - bits : 0);
+		break;
+	case FUNC_CTZ:
+		bits = 0;
+		for (size_t i = 0; i < n; i++) {
+			if (x[i]) {
+				bits = i * 64 + __builtin_ctzll(x[i]);
+				break;
+			}
+		}
+		__limbs_set(x, n, bits);
+		break;
+	case FUNC_MASK:
+		if (!__limbs_small(x, n, &v) || v > n * 8) {
+			__limbs_set(x, n, 0);
+			return FUNC_ERANGE;
+		}
+		bits = v * 8;
+		for (size_t i = 0; i < n; i++) {
+			x[i] = bits >= 64 * (i + 1) ? UINT64_MAX :
+			       bits > 64 * i ? (1ull << (bits - 64 * i)) - 1 :
+					       0;
+		}
+		break;
+	case FUNC_POPCNT:
+		bits = 0;
+		for (size_t i = 0; i < n; i++) {
+			bits += __builtin_popcountll(x[i]);
+		}
+		__limbs_set(x, n, bits);
+		break;
+	default:
+		__limbs_set(x, n, 0);
+		return FUNC_EINVAL;
+	}
+
+	return FUNC_ESUCCESS;
+}
+
+static enum program_err __run_limbs(struct wide_eval *w,
+				    const struct bmath_program *prog,
+				    uint64_t *out, size_t *fault,
+				    enum func_err *func_err)
+{
+	const struct program_op *op, *end = prog->ops + prog->len;
+	size_t n = w->nlimbs;
+	uint64_t *top = w->limbs, *a, *b;
+	enum func_err err;
+
+	for (op = prog->ops; op < end; op++) {
+		switch (op->code) {
+		case OP_PUSH:
+			__limbs_set(top, n, op->imm);
+			top += n;
+			continue;
+		case OP_NEG:
+			__limbs_neg(top - n, n);
+			continue;
+		case OP_NOT:
+			__limbs_not(top - n, n);
+			continue;
+		case OP_CALL:
+			top -= op->argc * n;
+			err = __call_limbs(w, op->imm, top);
+			if (err) {
+				*fault = op - prog->ops;
+				*func_err = err;
+				return PROG_EFUNC;
+			}
+			top += n;
+			continue;
+		default:
+			break;
+		}
+
+		top -= n;
+		b = top;
+		a = top - n;
+
+		switch (op->code) {
+		case OP_MUL:
+			__limbs_mul(a, b, n, w->scratch);
+			break;
+		case OP_DIV:
+		case OP_MOD:
+			if (!__limbs_div(a, b, n, op->code == OP_MOD,
+					 w->scratch)) {
+				*fault = op - prog->ops;
+				return PROG_EDIVZERO;
+			}
+			break;
+		case OP_ADD:
+			__limbs_add(a, b, n);
+			break;
+		case OP_SUB:
+			__limbs_sub(a, b, n);
+			break;
+		// the width is a power of two, so the count wraps in b[0]
+		case OP_SHL:
+			__limbs_shl(a, n, b[0] & (w->width - 1));
+			break;
+		case OP_SHR:
+			__limbs_shr(a, n, b[0] & (w->width - 1));
+			break;
+		case OP_AND:
+			for (size_t i = 0; i < n; i++) {
+				a[i] &= b[i];
+			}
+			break;
+		case OP_XOR:
+			for (size_t i = 0; i < n; i++) {
+				a[i] ^= b[i];
+			}
+			break;
+		case OP_OR:
+			for (size_t i = 0; i < n; i++) {
+				a[i] |= b[i];
+			}
+			break;
+		default:
+			break;
+		}
+	}
+
+	memcpy(out, w->limbs, n * sizeof(*out));
+	return PROG_ESUCCESS;
+}
+
+enum program_err wide_run(struct wide_eval *w, const struct bmath_program *prog,
+			  enum wide_tier tier, uint64_t *out, size_t *fault,
+			  enum func_err *func_err)
+{
+	int err;
+
+	if (__reserve(w, prog->max_depth)) {
+		return PROG_ENOMEM;
+	}
+
+	if (tier == WIDE_TIER_64) {
+		if (__run_64(w, prog, out) != WIDE_EFIT) {
+			w->stats.tier_64++;
+			return PROG_ESUCCESS;
+		}
+		w->stats.escalations++;
+		tier = WIDE_TIER_128;
+	}
+
+	// at a width of 128 this tier wraps, and always finishes
+	if (tier == WIDE_TIER_128 || w->width == 128) {
+		err = __run_128(w, prog, out, fault, func_err);
+		if (err != WIDE_EFIT) {
+			w->stats.tier_128++;
+			return err;
+		}
+		w->stats.escalations++;
+	}
+
+	w->stats.tier_limbs++;
+	return __run_limbs(w, prog, out, fault, func_err);
+}
@@ -0,0 +1,47 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "functions.h"
+#include "parser.h"
+#include "program.h"
+
+/*
+ * Evaluation of lines at more than 64 bits, see parser_settings.width. A line
+ * is compiled once and run in the cheapest tier that holds it: uint64_t,
+ * then unsigned __int128, then width / 64 limbs. The tiers narrower than the
+ * width run exactly, with each value the integer it stands for, and give up
+ * as soon as one doesn't fit, so what they finish with is the result at the
+ * width as well. Only the tier of the width itself wraps and reports faults,
+ * the others leave those to it.
+ */
+
+enum wide_tier {
+	WIDE_TIER_64 = 0,
+	WIDE_TIER_128,
+	WIDE_TIER_LIMBS,
+};
+
+struct wide_eval;
+
+/**
+ * @param unsigned int width A power of two from 128 to BMATH_WIDTH_MAX
+ * @return NULL if out of memory
+ */
+struct wide_eval *wide_new(unsigned int width);
+void wide_free(struct wide_eval *w);
+
+/**
+ * Run a line compiled without variables. Stacks only grow when a line is
+ * deeper than any before it, nothing is allocated per op.
+ * @param enum wide_tier tier Narrowest tier the line's literals fit in
+ * @param uint64_t *out width / 64 limbs, least significant first
+ * @param size_t *fault Index of the op that failed, if any
+ * @param enum func_err *func_err Error returned by a failing OP_CALL
+ * @return PROG_ESUCCESS or a program_err
+ */
+enum program_err wide_run(struct wide_eval *w, const struct bmath_program *prog,
+			  enum wide_tier tier, uint64_t *out, size_t *fault,
+			  enum func_err *func_err);
+
+void wide_stats(const struct wide_eval *w, struct bmath_wide_stats *out);
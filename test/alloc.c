@@ -0,0 +1,229 @@
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unity/unity.h>
+
+#include "../src/parser.h"
+
+/*
+ * Counts the heap allocations made by the library. The allocator is replaced
+ * for the whole process and forwards to glibc's, which ASan would replace as
+ * well, so nothing is counted under it.
+ */
+
+#define MAX_LEN 256
+
+#if defined(__SANITIZE_ADDRESS__)
+#define COUNTING false
+#else
+#define COUNTING true
+
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t nmemb, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+extern void __libc_free(void *ptr);
+
+static bool counting;
+static size_t allocations;
+
+void *malloc(size_t size)
+{
+	allocations += counting;
+	return __libc_malloc(size);
+}
+
+void *calloc(size_t nmemb, size_t size)
+{
+	allocations += counting;
+	return __libc_calloc(nmemb, size);
+}
+
+void *realloc(void *ptr, size_t size)
+{
+	allocations += counting;
+	return __libc_realloc(ptr, size);
+}
+
+void free(void *ptr)
+{
+	__libc_free(ptr);
+}
+#endif
+
+static const char *exprs[] = {
+	"1 + 2 * 3",
+	"(0xff00 >> 8) ^ 0x0f",
+	"popcnt(0xf0f0) + ctz(0x80)",
+	"align(mask(2), 1 << 3) - ~-1",
+	"18446744073709551615 % 1000",
+	"1 / 0",
+	"1 + )",
+	"0x1 $ 2",
+};
+
+#define NEXPRS (sizeof(exprs) / sizeof(exprs[0]))
+
+// the most of everything a MAX_LEN line can have
+static char nested[MAX_LEN + 1], unary[MAX_LEN + 1], sums[MAX_LEN + 1];
+
+static FILE *err_stream;
+static char scratch[1 << 16];
+
+static void make_lines(void)
+{
+	size_t half = (MAX_LEN - 1) / 2;
+
+	memset(nested, '(', half);
+	nested[half] = '1';
+	memset(nested + half + 1, ')', half);
+
+	for (size_t i = 0; i < MAX_LEN - 1; i++)
+		unary[i] = "-~"[i % 2];
+	unary[MAX_LEN - 1] = '1';
+
+	for (size_t i = 0; i < MAX_LEN - 1; i++)
+		sums[i] = "1+"[i % 2];
+}
+
+static void parse_all(struct parser_context *ctx, uint64_t *results,
+		      int *errs)
+{
+	const char *lines[] = { nested, unary, sums };
+
+	for (size_t i = 0; i < NEXPRS; i++)
+		errs[i] = parse(ctx, exprs[i], strlen(exprs[i]), &results[i]);
+
+	for (size_t i = 0; i < 3; i++)
+		errs[NEXPRS + i] = parse(ctx, lines[i], strlen(lines[i]),
+					 &results[NEXPRS + i]);
+}
+
+static void start_counting(void)
+{
+#if COUNTING
+	allocations = 0;
+	counting = true;
+#endif
+}
+
+static size_t stop_counting(void)
+{
+#if COUNTING
+	counting = false;
+	return allocations;
+#else
+	return 0;
+#endif
+}
+
+void setUp(void)
+{
+	err_stream = fopen("/dev/null", "w");
+	// stdio allocates a stream's buffer the first time it is written to
+	fputc('\n', err_stream);
+}
+
+void tearDown(void)
+{
+	fclose(err_stream);
+}
+
+void test_scratch_size(void)
+{
+	struct parser_settings settings = { .max_parse_len = MAX_LEN };
+	size_t size = parser_scratch_size(MAX_LEN);
+
+	TEST_ASSERT_EQUAL(0, parser_scratch_size(0));
+	TEST_ASSERT_TRUE(size > 0 && size <= sizeof(scratch));
+	TEST_ASSERT_NULL(parser_init(scratch, size - 1, &settings));
+	TEST_ASSERT_NOT_NULL(parser_init(scratch + 1, size, &settings));
+
+	settings.max_parse_len = 0;
+	TEST_ASSERT_NULL(parser_init(scratch, sizeof(scratch), &settings));
+}
+
+void test_scratch_context(void)
+{
+	struct parser_settings settings = { .max_parse_len = MAX_LEN,
+					    .err_stream = err_stream };
+	struct parser_context *ctx, *heap;
+	uint64_t results[NEXPRS + 3], expected[NEXPRS + 3];
+	int errs[NEXPRS + 3], expected_errs[NEXPRS + 3];
+	char too_long[MAX_LEN + 1];
+	uint64_t result;
+
+	if (!COUNTING)
+		TEST_IGNORE_MESSAGE("the allocator can't be counted under ASan");
+
+	make_lines();
+	heap = parser_new(&settings);
+	TEST_ASSERT_NOT_NULL(heap);
+	parse_all(heap, expected, expected_errs);
+	parser_free(heap);
+
+	// not even the first parse allocates
+	start_counting();
+	ctx = parser_init(scratch, sizeof(scratch), &settings);
+	TEST_ASSERT_NOT_NULL(ctx);
+	parse_all(ctx, results, errs);
+	TEST_ASSERT_EQUAL(0, stop_counting());
+
+	for (size_t i = 0; i < NEXPRS + 3; i++) {
+		TEST_ASSERT_EQUAL(expected_errs[i], errs[i]);
+		TEST_ASSERT_EQUAL(expected[i], results[i]);
+	}
+	TEST_ASSERT_EQUAL(0, errs[NEXPRS]);
+	TEST_ASSERT_EQUAL(0, errs[NEXPRS + 1]);
+	TEST_ASSERT_EQUAL(0, errs[NEXPRS + 2]);
+	TEST_ASSERT_EQUAL(MAX_LEN / 2, results[NEXPRS + 2]);
+
+	memset(too_long, '1', sizeof(too_long));
+	TEST_ASSERT_EQUAL(PE_EXPRESSION_TOO_LONG,
+			  parse(ctx, too_long, sizeof(too_long), &result));
+	TEST_ASSERT_EQUAL(0, parser_free(ctx));
+}
+
+void test_steady_state(void)
+{
+	struct parser_settings settings = { .err_stream = err_stream,
+					    .jit_threshold = 4 };
+	struct parser_context *ctx;
+	struct bmath_program *prog;
+	uint64_t results[NEXPRS + 3], result;
+	int errs[NEXPRS + 3];
+
+	if (!COUNTING)
+		TEST_IGNORE_MESSAGE("the allocator can't be counted under ASan");
+
+	make_lines();
+	ctx = parser_new(&settings);
+	TEST_ASSERT_NOT_NULL(ctx);
+	TEST_ASSERT_EQUAL(0, bmath_compile(ctx, "popcnt(0xff) << 2", 17,
+					   &prog));
+
+	// the first run grows the buffers and may promote the program
+	parse_all(ctx, results, errs);
+	for (int i = 0; i < 8; i++)
+		TEST_ASSERT_EQUAL(0, bmath_exec(ctx, prog, &result));
+
+	start_counting();
+	for (int r = 0; r < 100; r++) {
+		parse_all(ctx, results, errs);
+		bmath_exec(ctx, prog, &result);
+	}
+	TEST_ASSERT_EQUAL(0, stop_counting());
+	TEST_ASSERT_EQUAL(32, result);
+
+	bmath_program_free(prog);
+	parser_free(ctx);
+}
+
+int main(void)
+{
+	UNITY_BEGIN();
+	RUN_TEST(test_scratch_size);
+	RUN_TEST(test_scratch_context);
+	RUN_TEST(test_steady_state);
+	return UNITY_END();
+}
@@ -0,0 +1,355 @@
+#include <stdio.h>
+#include <string.h>
+#include <unity/unity.h>
+
+#include "../src/parser.h"
+
+// not a multiple of the block or vector sizes, so the tail is exercised
+#define BATCH_COUNT 1003
+
+static struct parser_settings pctx_settings;
+static struct parser_context *pctx;
+
+static uint64_t xs[BATCH_COUNT];
+static uint64_t ys[BATCH_COUNT];
+static uint64_t out[BATCH_COUNT];
+
+static const enum bmath_simd levels[] = {
+	BMATH_SIMD_SCALAR,
+	BMATH_SIMD_AVX2,
+	BMATH_SIMD_AVX512,
+};
+
+static const uint64_t edges[] = {
+	0,	    1,		 2,	     7,		  8,	   9,
+	63,	    64,		 255,	     256,	  0xffff,  0x10000,
+	0xffffffff, 0x100000000, INT64_MAX, (uint64_t)INT64_MIN, UINT64_MAX,
+};
+
+static void fill_inputs()
+{
+	const size_t nedges = sizeof(edges) / sizeof(edges[0]);
+	uint64_t state = 0x9e3779b97f4a7c15;
+
+	for (size_t i = 0; i < BATCH_COUNT; i++) {
+		state ^= state << 13;
+		state ^= state >> 7;
+		state ^= state << 17;
+
+		if (i < nedges * nedges) {
+			xs[i] = edges[i % nedges];
+			ys[i] = edges[i / nedges];
+		} else {
+			xs[i] = state;
+			ys[i] = state >> (i % 64);
+		}
+	}
+}
+
+/*
+ * Replaces the variables with literals so the interpreter can compute the
+ * expected value.
+ */
+static void substitute(char *buf, size_t size, const char *expr, uint64_t x,
+		       uint64_t y)
+{
+	size_t len = 0;
+
+	for (const char *c = expr; *c && len < size - 1; c++) {
+		// leave hex prefixes alone
+		if ((*c == 'x' || *c == 'y') && !(c > expr && c[-1] == '0')) {
+			len += snprintf(buf + len, size - len, "(%llu)",
+					(unsigned long long)(*c == 'x' ? x : y));
+			continue;
+		}
+		buf[len++] = *c;
+	}
+	buf[len] = '\0';
+}
+
+static void check(const char *expression)
+{
+	struct bmath_program *prog;
+	char substituted[512];
+	uint64_t expected;
+	int ret;
+
+	ret = bmath_compile(pctx, expression, strlen(expression), &prog);
+	TEST_ASSERT_EQUAL_MESSAGE(0, ret, expression);
+
+	for (size_t l = 0; l < sizeof(levels) / sizeof(levels[0]); l++) {
+		parser_set_simd(pctx, levels[l]);
+		memset(out, 0xa5, sizeof(out));
+
+		ret = bmath_exec_batch(pctx, prog, xs, ys, out, BATCH_COUNT);
+		TEST_ASSERT_EQUAL_MESSAGE(0, ret, expression);
+
+		for (size_t i = 0; i < BATCH_COUNT; i++) {
+			substitute(substituted, sizeof(substituted),
+				   expression, xs[i], ys[i]);
+			ret = parse(pctx, substituted, strlen(substituted),
+				    &expected);
+			TEST_ASSERT_EQUAL_MESSAGE(0, ret, substituted);
+			TEST_ASSERT_EQUAL_MESSAGE(expected, out[i],
+						  substituted);
+		}
+	}
+
+	bmath_program_free(prog);
+}
+
+static void check_fault(const char *expression, size_t fault)
+{
+	struct bmath_program *prog;
+	int ret;
+
+	ret = bmath_compile(pctx, expression, strlen(expression), &prog);
+	TEST_ASSERT_EQUAL_MESSAGE(0, ret, expression);
+
+	for (size_t l = 0; l < sizeof(levels) / sizeof(levels[0]); l++) {
+		parser_set_simd(pctx, levels[l]);
+		memset(out, 0, sizeof(out));
+
+		ret = bmath_exec_batch(pctx, prog, xs, ys, out, BATCH_COUNT);
+		TEST_ASSERT_EQUAL_MESSAGE(PE_EVAL_ERROR, ret, expression);
+		TEST_ASSERT_TRUE_MESSAGE(parser_last_error(pctx)->batch,
+					 expression);
+		TEST_ASSERT_EQUAL_MESSAGE(fault, parser_last_error(pctx)->input,
+					  expression);
+
+		// everything before the fault is still evaluated
+		for (size_t i = 0; i < fault; i++) {
+			TEST_ASSERT_EQUAL_MESSAGE(xs[i] + 1, out[i],
+						  expression);
+		}
+	}
+
+	bmath_program_free(prog);
+}
+
+void setUp(void)
+{
+	FILE *dev_null;
+
+	pctx_settings = (struct parser_settings){ .max_parse_len = 512, NULL };
+
+	dev_null = fopen("/dev/null", "w");
+	if (ferror(dev_null)) {
+		TEST_FAIL_MESSAGE("unable to open /dev/null");
+		return;
+	}
+
+	pctx_settings.err_stream = dev_null;
+	pctx = parser_new(&pctx_settings);
+	fill_inputs();
+}
+
+void tearDown(void)
+{
+	if (pctx_settings.err_stream) {
+		fclose(pctx_settings.err_stream);
+	}
+
+	parser_free(pctx);
+}
+
+void test_variables()
+{
+	struct bmath_program *prog;
+	uint64_t result;
+
+	TEST_ASSERT_EQUAL(PE_PARSE_ERROR, parse(pctx, "x + 1", 5, &result));
+
+	// bmath_exec() binds variables to zero
+	TEST_ASSERT_EQUAL(0, bmath_compile(pctx, "x + y + 5", 9, &prog));
+	TEST_ASSERT_TRUE(bmath_program_has_vars(prog));
+	TEST_ASSERT_EQUAL(0, bmath_exec(pctx, prog, &result));
+	TEST_ASSERT_EQUAL(5, result);
+	bmath_program_free(prog);
+
+	TEST_ASSERT_EQUAL(0, bmath_compile(pctx, "0x10", 4, &prog));
+	TEST_ASSERT_FALSE(bmath_program_has_vars(prog));
+	bmath_program_free(prog);
+
+	// only x and y are variables
+	TEST_ASSERT_EQUAL(PE_PARSE_ERROR,
+			  bmath_compile(pctx, "x + z", 5, &prog));
+}
+
+void test_operators()
+{
+	const char *params[] = {
+		"x",
+		"x + y",
+		"x - y * 3",
+		"-x",
+		"~x ^ y",
+		"x & y | 0xff00",
+		"x * y",
+		"x << y",
+		"x >> (y & 7)",
+		"x / (y | 1)",
+		"x % (y | 1)",
+		"(x + 1) * (y - 1) << 3",
+	};
+
+	for (size_t i = 0; i < sizeof(params) / sizeof(params[0]); i++) {
+		check(params[i]);
+	}
+}
+
+void test_builtins()
+{
+	const char *params[] = {
+		"align(x, 4096) >> 12",
+		"align_down(x, 1 << (y & 15))",
+		"bswap(x)",
+		"bswap(y & 0xffffff)",
+		"clz(x & mask(y % 8 + 1), y % 8 + 1)",
+		"ctz(x)",
+		"mask(y % 9)",
+		"mask() + x",
+		"popcnt(x)",
+		"popcnt(x) + ctz(y) * bswap(x ^ y)",
+	};
+
+	for (size_t i = 0; i < sizeof(params) / sizeof(params[0]); i++) {
+		check(params[i]);
+	}
+}
+
+void test_faults()
+{
+	for (size_t i = 0; i < BATCH_COUNT; i++) {
+		xs[i] = i + 1;
+		ys[i] = 1;
+	}
+
+	ys[517] = 0;
+	check_fault("x + 1 + 1 / y * 0", 517);
+
+	ys[517] = 9;
+	check_fault("x + 1 + mask(y) * 0", 517);
+
+	ys[517] = 0;
+	check_fault("x + 1 + clz(1, y) * 0", 517);
+
+	// the first block faults before the second one is reached
+	xs[100] = 0;
+	check_fault("x + 1 + 5 % x * 0 + clz(1, y) * 0", 100);
+
+	// nothing of the fault is left in the next call's error
+	TEST_ASSERT_EQUAL(PE_PARSE_ERROR, parse(pctx, "1 +", 3, out));
+	TEST_ASSERT_EQUAL(BMATH_EUNEXPECTED, parser_last_error(pctx)->code);
+	TEST_ASSERT_FALSE(parser_last_error(pctx)->batch);
+	TEST_ASSERT_EQUAL(0, parser_last_error(pctx)->input);
+}
+
+// Padding lanes in a partial block read zero, which must not be reported.
+void test_padding()
+{
+	struct bmath_program *prog;
+	uint64_t x[5] = { 1, 2, 3, 4, 5 };
+
+	TEST_ASSERT_EQUAL(0, bmath_compile(pctx, "60 / x", 6, &prog));
+	for (size_t l = 0; l < sizeof(levels) / sizeof(levels[0]); l++) {
+		parser_set_simd(pctx, levels[l]);
+		TEST_ASSERT_EQUAL(0, bmath_exec_batch(pctx, prog, x, NULL, out,
+						      5));
+		TEST_ASSERT_EQUAL(60, out[0]);
+		TEST_ASSERT_EQUAL(12, out[4]);
+	}
+	bmath_program_free(prog);
+}
+
+void test_parse_batch()
+{
+	const char *params[] = {
+		"1 + 2",
+		"0x10 + 7",
+		"align(4097, 4096)",
+		"align(12, 8)",
+		"(1 << 8) * -3",
+		"(5 << 2) * -9",
+		"ctz(8) ^ popcnt(255)",
+		"ctz(16) ^ popcnt(3)",
+		// faults in the middle of a group
+		"1 / 0",
+		"9 + 1",
+		"mask(9)",
+		"mask(2)",
+		"clz(1, 9)",
+		"clz(1, 2)",
+		// parse errors, and lines that are left to parse()
+		"1 +",
+		"",
+		"1 38",
+		"1 37",
+		"x + 1",
+		"0x1234567890abcdef1",
+		"~4 |",
+		"1 2 $",
+		"3 + 4 ) + 5",
+	};
+	const size_t count = sizeof(params) / sizeof(params[0]);
+	size_t lens[sizeof(params) / sizeof(params[0])];
+	uint64_t results[sizeof(params) / sizeof(params[0])], expected;
+	int errs[sizeof(params) / sizeof(params[0])], err;
+	struct bmath_batch_stats stats;
+
+	for (size_t i = 0; i < count; i++) {
+		lens[i] = strlen(params[i]);
+	}
+
+	for (size_t l = 0; l < sizeof(levels) / sizeof(levels[0]); l++) {
+		parser_set_simd(pctx, levels[l]);
+		TEST_ASSERT_EQUAL(0, bmath_parse_batch(pctx, params, lens,
+						       count, results, errs,
+						       &stats));
+
+		for (size_t i = 0; i < count; i++) {
+			err = parse(pctx, params[i], lens[i], &expected);
+			TEST_ASSERT_EQUAL_MESSAGE(err, errs[i], params[i]);
+			TEST_ASSERT_EQUAL_MESSAGE(expected, results[i],
+						  params[i]);
+		}
+	}
+
+	TEST_ASSERT_TRUE(stats.shapes < count);
+	TEST_ASSERT_TRUE(stats.lane_ops > stats.op_dispatches);
+}
+
+// lines can be slices of one buffer, nothing past each length is read
+void test_parse_batch_slices()
+{
+	// each line is followed by garbage that would change its result
+	const char buf[] = "1 + 2" "x" "3 + 4" "9" "5 + 6" "0x1" "0x1 << 2" "f"
+			   "(0x10 + 1)" "(" "popcnt(3)" "ff";
+	const char *lines[] = { buf, buf + 6, buf + 12, buf + 20, buf + 29,
+				buf + 40 };
+	const size_t lens[] = { 5, 5, 5, 8, 10, 9 };
+	const uint64_t expected[] = { 3, 7, 11, 4, 17, 2 };
+	const size_t count = sizeof(lines) / sizeof(lines[0]);
+	uint64_t results[sizeof(lines) / sizeof(lines[0])];
+	int errs[sizeof(lines) / sizeof(lines[0])];
+
+	TEST_ASSERT_EQUAL(0, bmath_parse_batch(pctx, lines, lens, count,
+					       results, errs, NULL));
+	for (size_t i = 0; i < count; i++) {
+		TEST_ASSERT_EQUAL(0, errs[i]);
+		TEST_ASSERT_EQUAL(expected[i], results[i]);
+	}
+}
+
+int main(void)
+{
+	UNITY_BEGIN();
+	RUN_TEST(test_variables);
+	RUN_TEST(test_operators);
+	RUN_TEST(test_builtins);
+	RUN_TEST(test_faults);
+	RUN_TEST(test_padding);
+	RUN_TEST(test_parse_batch);
+	RUN_TEST(test_parse_batch_slices);
+	return UNITY_END();
+}
@@ -1,4 +1,5 @@
 #include <errno.h>
+#include <stdlib.h>
 #include <string.h>
 #include <unity/unity.h>
 
@@ -47,11 +48,20 @@ void test_fail_invalid_hex()
 void test_hex_exceeds_len()
 {
 	uint64_t actual = 0;
-	size_t parsed = str_hex_to_uint64("0xaa", 3, &actual);
+	ssize_t parsed = str_hex_to_uint64("0x10000000000000000", 19, &actual);
 	int err = errno;
 
 	TEST_ASSERT_EQUAL_MESSAGE(E2BIG, err, "error matches");
-	TEST_ASSERT_EQUAL_MESSAGE(-4, parsed, "bytes returned");
+	TEST_ASSERT_EQUAL_MESSAGE(-19, parsed, "bytes returned");
+}
+
+void test_hex_stops_at_len()
+{
+	uint64_t actual = 0;
+	size_t parsed = str_hex_to_uint64("0xaa", 3, &actual);
+
+	TEST_ASSERT_EQUAL_MESSAGE(3, parsed, "bytes returned");
+	TEST_ASSERT_EQUAL_MESSAGE(0xa, actual, "parsed value");
 }
 
 void test_hex_allow_spaces()
@@ -63,6 +73,141 @@ void test_hex_allow_spaces()
 	TEST_ASSERT_EQUAL_MESSAGE(10, actual, "parsed value");
 }
 
+void test_dec()
+{
+	uint64_t actual = 0;
+	ssize_t parsed = str_dec_to_uint64("1234 5", 6, &actual);
+
+	TEST_ASSERT_EQUAL_MESSAGE(4, parsed, "bytes returned");
+	TEST_ASSERT_EQUAL_MESSAGE(1234, actual, "parsed value");
+
+	parsed = str_dec_to_uint64("1234", 2, &actual);
+	TEST_ASSERT_EQUAL_MESSAGE(2, parsed, "stops at len");
+	TEST_ASSERT_EQUAL_MESSAGE(12, actual, "value up to len");
+
+	parsed = str_dec_to_uint64("18446744073709551615", 20, &actual);
+	TEST_ASSERT_EQUAL_MESSAGE(20, parsed, "largest fits");
+	TEST_ASSERT_EQUAL_UINT64_MESSAGE(UINT64_MAX, actual, "largest value");
+
+	parsed = str_dec_to_uint64("00000000000000000000000000000123", 32,
+				   &actual);
+	TEST_ASSERT_EQUAL_MESSAGE(32, parsed, "leading zeros fit");
+	TEST_ASSERT_EQUAL_MESSAGE(123, actual, "leading zeros value");
+
+	parsed = str_dec_to_uint64("x1", 2, &actual);
+	TEST_ASSERT_EQUAL_MESSAGE(EINVAL, errno, "no digits");
+	TEST_ASSERT_EQUAL_MESSAGE(-1, parsed, "no digits returned");
+}
+
+void test_dec_overflow()
+{
+	uint64_t actual = 0;
+	ssize_t parsed;
+
+	errno = 0;
+	parsed = str_dec_to_uint64("18446744073709551616", 20, &actual);
+	TEST_ASSERT_EQUAL_MESSAGE(ERANGE, errno, "one past the largest");
+	TEST_ASSERT_EQUAL_MESSAGE(-20, parsed, "bytes returned");
+
+	errno = 0;
+	parsed = str_dec_to_uint64("99999999999999999999+1", 22, &actual);
+	TEST_ASSERT_EQUAL_MESSAGE(ERANGE, errno, "20 nines");
+	TEST_ASSERT_EQUAL_MESSAGE(-20, parsed, "bytes returned");
+
+	errno = 0;
+	parsed = str_dec_to_uint64("184467440737095516150", 21, &actual);
+	TEST_ASSERT_EQUAL_MESSAGE(ERANGE, errno, "21 digits");
+	TEST_ASSERT_EQUAL_MESSAGE(-21, parsed, "bytes returned");
+}
+
+static uint64_t next(uint64_t *state)
+{
+	*state ^= *state << 13;
+	*state ^= *state >> 7;
+	*state ^= *state << 17;
+	return *state;
+}
+
+// the parsers read by word, so lengths and alignments are all exercised
+void test_against_strtoull()
+{
+	static const char hex[] = "0123456789abcdefABCDEF";
+	uint64_t state = 0x9e3779b97f4a7c15, actual, expected;
+	char buf[64], *input;
+	size_t digits, len;
+	ssize_t parsed;
+	int err;
+
+	for (int i = 0; i < 100000; i++) {
+		input = buf + next(&state) % 16;
+		digits = 1 + next(&state) % 20;
+		for (size_t k = 0; k < digits; k++)
+			input[k] = '0' + next(&state) % 10;
+		input[digits] = next(&state) & 1 ? ' ' : '\0';
+		len = digits + next(&state) % 2;
+
+		errno = 0;
+		expected = strtoull(input, NULL, 10);
+		err = errno;
+		parsed = str_dec_to_uint64(input, len, &actual);
+		if (err) {
+			TEST_ASSERT_EQUAL_MESSAGE(ERANGE, errno, input);
+			TEST_ASSERT_EQUAL_MESSAGE(-(ssize_t)digits, parsed, input);
+			continue;
+		}
+		TEST_ASSERT_EQUAL_MESSAGE(digits, parsed, input);
+		TEST_ASSERT_EQUAL_UINT64_MESSAGE(expected, actual, input);
+
+		input = buf + next(&state) % 16;
+		digits = 1 + next(&state) % 16;
+		memcpy(input, "0x", 2);
+		for (size_t k = 0; k < digits; k++)
+			input[2 + k] = hex[next(&state) % (sizeof(hex) - 1)];
+		input[2 + digits] = '\0';
+
+		expected = strtoull(input, NULL, 16);
+		parsed = str_hex_to_uint64(input, digits + 2, &actual);
+		TEST_ASSERT_EQUAL_MESSAGE(digits + 2, parsed, input);
+		TEST_ASSERT_EQUAL_UINT64_MESSAGE(expected, actual, input);
+	}
+}
+
+void test_limbs()
+{
+	const char dec[] = "340282366920938463463374607431768211457";
+	const char hex[] = "0x1fedcba9876543210FEDCBA9876543210";
+	uint64_t limbs[3];
+	ssize_t parsed;
+
+	parsed = str_dec_to_limbs(dec, strlen(dec), limbs, 3);
+	TEST_ASSERT_EQUAL(strlen(dec), parsed);
+	TEST_ASSERT_EQUAL_UINT64(1, limbs[0]);
+	TEST_ASSERT_EQUAL_UINT64(0, limbs[1]);
+	TEST_ASSERT_EQUAL_UINT64(1, limbs[2]);
+
+	errno = 0;
+	parsed = str_dec_to_limbs(dec, strlen(dec), limbs, 2);
+	TEST_ASSERT_EQUAL(-(ssize_t)strlen(dec), parsed);
+	TEST_ASSERT_EQUAL(ERANGE, errno);
+
+	parsed = str_hex_to_limbs(hex, strlen(hex), limbs, 3);
+	TEST_ASSERT_EQUAL(strlen(hex), parsed);
+	TEST_ASSERT_EQUAL_UINT64(0xfedcba9876543210, limbs[0]);
+	TEST_ASSERT_EQUAL_UINT64(0xfedcba9876543210, limbs[1]);
+	TEST_ASSERT_EQUAL_UINT64(1, limbs[2]);
+
+	errno = 0;
+	parsed = str_hex_to_limbs(hex, strlen(hex), limbs, 2);
+	TEST_ASSERT_EQUAL(-(ssize_t)strlen(hex), parsed);
+	TEST_ASSERT_EQUAL(E2BIG, errno);
+
+	// a number that fits in 64 bits parses the same either way
+	parsed = str_hex_to_limbs("0x1f + 1", 8, limbs, 2);
+	TEST_ASSERT_EQUAL(4, parsed);
+	TEST_ASSERT_EQUAL_UINT64(0x1f, limbs[0]);
+	TEST_ASSERT_EQUAL_UINT64(0, limbs[1]);
+}
+
 int main(void)
 {
 	UNITY_BEGIN();
@@ -70,6 +215,11 @@ int main(void)
 	RUN_TEST(test_verify_uppercase_hex_str_converts_to_uint64_t);
 	//	RUN_TEST(test_fail_invalid_hex);
 	RUN_TEST(test_hex_exceeds_len);
+	RUN_TEST(test_hex_stops_at_len);
 	RUN_TEST(test_hex_allow_spaces);
+	RUN_TEST(test_dec);
+	RUN_TEST(test_dec_overflow);
+	RUN_TEST(test_against_strtoull);
+	RUN_TEST(test_limbs);
 	return UNITY_END();
 }
@@ -0,0 +1,52 @@
+#include <stdio.h>
+#include <string.h>
+#include <unity/unity.h>
+
+#include "../src/parser.h"
+
+#define BMATH_EMIT_TABLE
+#include BMATH_EMIT_HEADER
+
+static struct parser_settings pctx_settings;
+static struct parser_context *pctx;
+
+void setUp(void)
+{
+	pctx_settings = (struct parser_settings){ .max_parse_len = 512,
+						  .err_stream = stderr };
+	pctx = parser_new(&pctx_settings);
+}
+
+void tearDown(void)
+{
+	parser_free(pctx);
+	pctx = NULL;
+}
+
+/*
+ * Every function bmath --emit-c produced must agree with the interpreter on
+ * the expression it was generated from.
+ */
+void test_emitted_functions(void)
+{
+	const struct bmath_emit_entry *entry;
+	uint64_t expected;
+	size_t count = 0;
+	int ret;
+
+	for (entry = bmath_emit_table; entry->expr; entry++, count++) {
+		expected = 0;
+		ret = parse(pctx, entry->expr, strlen(entry->expr), &expected);
+		TEST_ASSERT_EQUAL_MESSAGE(0, ret, entry->expr);
+		TEST_ASSERT_EQUAL_MESSAGE(expected, entry->func(), entry->expr);
+	}
+
+	TEST_ASSERT_GREATER_THAN(0, count);
+}
+
+int main(void)
+{
+	UNITY_BEGIN();
+	RUN_TEST(test_emitted_functions);
+	return UNITY_END();
+}
@@ -14,7 +14,7 @@ struct func_params {
 	uint64_t argv[FUNCTIONS_MAX_OPS];
 };
 
-static void check(struct func_params *param, bmath_func_t func)
+static void check(struct func_params *param, enum func_id id)
 {
 	char call_msg[256];
 	char out_msg[256];
@@ -24,7 +24,10 @@ static void check(struct func_params *param, bmath_func_t func)
 	sprintf(call_msg, "%s: ret is expected", param->name);
 	sprintf(out_msg, "%s: result is expected", param->name);
 
-	ret = func(&out_value, param->argc, param->argv);
+	// the parser checks the arity of each call once, before it runs
+	ret = func_arity(id, param->argc);
+	if (ret == FUNC_ESUCCESS)
+		ret = func_call(&out_value, id, param->argv);
 	TEST_ASSERT_EQUAL_MESSAGE(param->err, ret, call_msg);
 	TEST_ASSERT_EQUAL_MESSAGE(param->expected, out_value, out_msg);
 }
@@ -46,7 +49,7 @@ void test_align()
 	};
 
 	for (size_t i = 0; i < sizeof(params) / sizeof(params[0]); i++) {
-		check(&params[i], align);
+		check(&params[i], FUNC_ALIGN);
 	}
 }
 
@@ -59,7 +62,7 @@ void test_align_down()
 	};
 
 	for (size_t i = 0; i < sizeof(params) / sizeof(params[0]); i++) {
-		check(&params[i], align_down);
+		check(&params[i], FUNC_ALIGN_DOWN);
 	}
 }
 
@@ -71,7 +74,7 @@ void test_bswap()
 	};
 
 	for (size_t i = 0; i < sizeof(params) / sizeof(params[0]); i++) {
-		check(&params[i], popcnt);
+		check(&params[i], FUNC_BSWAP);
 	}
 }
 
@@ -92,7 +95,7 @@ void test_clz()
 	};
 
 	for (size_t i = 0; i < sizeof(params) / sizeof(params[0]); i++) {
-		check(&params[i], clz);
+		check(&params[i], FUNC_CLZ);
 	}
 }
 
@@ -106,7 +109,7 @@ void test_ctz()
 	};
 
 	for (size_t i = 0; i < sizeof(params) / sizeof(params[0]); i++) {
-		check(&params[i], ctz);
+		check(&params[i], FUNC_CTZ);
 	}
 }
 
@@ -121,7 +124,7 @@ void test_mask()
 	};
 
 	for (size_t i = 0; i < sizeof(params) / sizeof(params[0]); i++) {
-		check(&params[i], mask);
+		check(&params[i], FUNC_MASK);
 	}
 }
 
@@ -133,7 +136,7 @@ void test_popcnt()
 	};
 
 	for (size_t i = 0; i < sizeof(params) / sizeof(params[0]); i++) {
-		check(&params[i], popcnt);
+		check(&params[i], FUNC_POPCNT);
 	}
 }
 
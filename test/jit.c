@@ -0,0 +1,188 @@
+#include <stdio.h>
+#include <string.h>
+#include <unity/unity.h>
+
+#include "../src/parser.h"
+
+struct jit_params {
+	char *expression;
+	uint64_t expected;
+	int err;
+};
+
+static struct parser_settings pctx_settings;
+static struct parser_context *pctx;
+
+/*
+ * Runs the expression through the interpreter, forces promotion, and then
+ * runs the native code. Both tiers must agree on results and errors.
+ */
+static void check(const struct jit_params *param)
+{
+	struct bmath_program *prog;
+	uint64_t interpreted = 0, native = 0;
+	int ret;
+
+	ret = bmath_compile(pctx, param->expression, strlen(param->expression),
+			    &prog);
+	TEST_ASSERT_EQUAL_MESSAGE(0, ret, param->expression);
+
+	parser_set_jit_threshold(pctx, 0);
+	ret = bmath_exec(pctx, prog, &interpreted);
+	TEST_ASSERT_EQUAL_MESSAGE(param->err, ret, param->expression);
+	TEST_ASSERT_FALSE(bmath_program_is_jitted(prog));
+
+	parser_set_jit_threshold(pctx, 1);
+	ret = bmath_exec(pctx, prog, &native);
+	TEST_ASSERT_EQUAL_MESSAGE(param->err, ret, param->expression);
+	TEST_ASSERT_TRUE_MESSAGE(bmath_program_is_jitted(prog),
+				 param->expression);
+
+	TEST_ASSERT_EQUAL_MESSAGE(param->expected, interpreted,
+				  param->expression);
+	TEST_ASSERT_EQUAL_MESSAGE(param->expected, native, param->expression);
+	bmath_program_free(prog);
+}
+
+static bool jit_supported()
+{
+	struct bmath_program *prog;
+	uint64_t out;
+	bool jitted;
+
+	parser_set_jit_threshold(pctx, 1);
+	bmath_compile(pctx, "1", 1, &prog);
+	bmath_exec(pctx, prog, &out);
+	jitted = bmath_program_is_jitted(prog);
+	bmath_program_free(prog);
+	return jitted;
+}
+
+void setUp(void)
+{
+	FILE *dev_null;
+
+	pctx_settings = (struct parser_settings){ .max_parse_len = 128, NULL };
+
+	dev_null = fopen("/dev/null", "w");
+	if (ferror(dev_null)) {
+		TEST_FAIL_MESSAGE("unable to open /dev/null");
+		return;
+	}
+
+	pctx_settings.err_stream = dev_null;
+	pctx = parser_new(&pctx_settings);
+}
+
+void tearDown(void)
+{
+	if (pctx_settings.err_stream) {
+		fclose(pctx_settings.err_stream);
+	}
+	parser_free(pctx);
+}
+
+void test_ops()
+{
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wparentheses"
+	struct jit_params params[] = {
+		{ "1", 1, 0 },
+		{ "0x123456789abcdef0", 0x123456789abcdef0, 0 },
+		{ "-~16", -~16, 0 },
+		{ "1 | 2 & 3 ^ 4 >> 1 + 5", 1 | 2 & 3 ^ 4 >> 1 + 5, 0 },
+		{ "2 * 1 - 5 | 2 & 3 ^ 4 << 1 % 2",
+		  2 * 1 - 5 | 2 & 3 ^ 4 << 1 % 2, 0 },
+		{ "100 / 7 + 100 % 7", 100 / 7 + 100 % 7, 0 },
+		{ "1 << 65", 2, 0 },
+		{ "0x8000000000000000 >> 63", 1, 0 },
+		{ "(1 << 0) | (1 << 1) | (1 << 2) | (1 << 3)", 0xf, 0 },
+		{ "2 % 0", 0, PE_EVAL_ERROR },
+		{ "1 + 8 / (4 - 4)", 0, PE_EVAL_ERROR },
+		// bmath_exec() binds variables to zero
+		{ "(x + 7) * (1 - y)", 7, 0 },
+		{ "5 / x", 0, PE_EVAL_ERROR },
+	};
+#pragma GCC diagnostic pop
+
+	if (!jit_supported())
+		TEST_IGNORE();
+
+	for (size_t i = 0; i < sizeof(params) / sizeof(params[0]); i++) {
+		check(&params[i]);
+	}
+}
+
+void test_builtins()
+{
+	struct jit_params params[] = {
+		{ "popcnt(0xff00ff)", 16, 0 },
+		{ "popcnt(0)", 0, 0 },
+		{ "ctz(0)", 0, 0 },
+		{ "ctz(1 << 63)", 63, 0 },
+		{ "clz(1, 8)", 63, 0 },
+		{ "clz(1, 4)", 31, 0 },
+		{ "clz(1, 1)", 7, 0 },
+		{ "clz(0, 1)", 0, 0 },
+		{ "clz(0xff, 1)", 0, 0 },
+		{ "clz(0xffffffff, 1)", 0, PE_EVAL_ERROR },
+		{ "clz(1, 1 + 1)", 15, 0 },
+		{ "clz(1, 9)", 0, PE_EVAL_ERROR },
+		{ "bswap(0xab)", 0xab, 0 },
+		{ "bswap(0xabcd)", 0xcdab, 0 },
+		{ "bswap(0xabcdef)", 0xefcdab00, 0 },
+		{ "bswap(0x1122334455)", 0x5544332211000000, 0 },
+		{ "align(7, 8)", 8, 0 },
+		{ "align(16, 8)", 16, 0 },
+		{ "align_down(15, 8)", 8, 0 },
+		{ "mask(2)", 0xffff, 0 },
+		{ "mask()", 0, 0 },
+		{ "mask(9)", 0, PE_EVAL_ERROR },
+		{ "align_down(mask(2), ctz(8) << 3) + 1", 0xffe9, 0 },
+	};
+
+	if (!jit_supported())
+		TEST_IGNORE();
+
+	for (size_t i = 0; i < sizeof(params) / sizeof(params[0]); i++) {
+		check(&params[i]);
+	}
+}
+
+void test_promotion_threshold()
+{
+	struct bmath_program *prog;
+	uint64_t out;
+
+	if (!jit_supported())
+		TEST_IGNORE();
+
+	parser_set_jit_threshold(pctx, 3);
+	bmath_compile(pctx, "popcnt(7) + 1", strlen("popcnt(7) + 1"), &prog);
+
+	for (int i = 0; i < 2; i++) {
+		bmath_exec(pctx, prog, &out);
+		TEST_ASSERT_EQUAL(4, out);
+		TEST_ASSERT_FALSE(bmath_program_is_jitted(prog));
+	}
+
+	bmath_exec(pctx, prog, &out);
+	TEST_ASSERT_EQUAL(4, out);
+	TEST_ASSERT_TRUE(bmath_program_is_jitted(prog));
+
+	// switching the JIT off at runtime falls back to the interpreter
+	parser_set_jit_threshold(pctx, 0);
+	bmath_exec(pctx, prog, &out);
+	TEST_ASSERT_EQUAL(4, out);
+
+	bmath_program_free(prog);
+}
+
+int main(void)
+{
+	UNITY_BEGIN();
+	RUN_TEST(test_ops);
+	RUN_TEST(test_builtins);
+	RUN_TEST(test_promotion_threshold);
+	return UNITY_END();
+}
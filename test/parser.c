@@ -1,7 +1,13 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <errno.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 #include <unity/unity.h>
 
+#include "../src/cache.h"
 #include "../src/parser.h"
 
 struct expr_expected_params {
@@ -79,6 +85,12 @@ void test_basic_validation()
 		{ "1.0", 0, PE_PARSE_ERROR },
 		{ "1 || 3", 0, PE_PARSE_ERROR },
 		{ "2 % 0", 0, PE_PARSE_ERROR },
+		// bytes with the high bit set are illegal, not table indexes
+		{ "\x80", 0, PE_PARSE_ERROR },
+		{ "1 + \xb1", 0, PE_PARSE_ERROR },
+		{ "0x1\xc3\xa9", 0, PE_PARSE_ERROR },
+		{ "\xff\xff" "1", 0, PE_PARSE_ERROR },
+		{ "1 + \xb2", 0, PE_PARSE_ERROR },
 	};
 
 	for (size_t i = 0; i < sizeof(params) / sizeof(params[0]); i++) {
@@ -92,6 +104,11 @@ void test_factors()
 		// parsing hex assumes 0 results by default, this was because of optmizations
 		{ "0x", 0, 0 },	 { "(1)", 1, 0 },    { "1", 1, 0 },
 		{ "0x1", 1, 0 }, { "(0xa)", 10, 0 }, { "~(0)", ~0, 0 },
+		// decimals don't wrap
+		{ "18446744073709551615", UINT64_MAX, 0 },
+		{ "18446744073709551616", 0, PE_PARSE_ERROR },
+		{ "0000000000000000000000042", 42, 0 },
+		{ "0xffffffffffffffff", UINT64_MAX, 0 },
 	};
 
 	for (size_t i = 0; i < sizeof(params) / sizeof(params[0]); i++) {
@@ -150,8 +167,9 @@ void test_signed_factors()
 
 		// let this one slide. this tool has no concept of ++ as a thing
 		{ "1++1", 1 + 1, 0 },
-		// max depth
-		{ "~~~~~~~~~~~16", 0, PE_PARSE_ERROR },
+		// unary chains aren't capped
+		{ "~~~~~~~~~~~16", ~16, 0 },
+		{ "-~-~-~-~-~-~-~-~-~-~-~-~16", 16 + 12, 0 },
 	};
 
 	for (size_t i = 0; i < sizeof(params) / sizeof(params[0]); i++) {
@@ -249,6 +267,1143 @@ void test_concat_expressions()
 	}
 }
 
+// nesting is only bounded by memory
+void test_deep_expressions()
+{
+	struct parser_settings settings = { .max_parse_len = 0, NULL };
+	struct parser_context *deep;
+	size_t depth = 100000, len = 0;
+	char *expr = calloc(2 * depth + 2, 1);
+	uint64_t actual;
+
+	settings.err_stream = pctx_settings.err_stream;
+	deep = parser_new(&settings);
+
+	TEST_ASSERT_NOT_NULL(deep);
+	TEST_ASSERT_NOT_NULL(expr);
+
+	for (size_t i = 0; i < depth; i++)
+		expr[len++] = '(';
+	expr[len++] = '1';
+	for (size_t i = 0; i < depth; i++)
+		expr[len++] = ')';
+	TEST_ASSERT_EQUAL(0, parse(deep, expr, len, &actual));
+	TEST_ASSERT_EQUAL(1, actual);
+
+	// an unclosed parenthesis at the bottom is still an error
+	TEST_ASSERT_EQUAL(PE_PARSE_ERROR, parse(deep, expr, len - 1, &actual));
+
+	len = 0;
+	for (size_t i = 0; i < 2 * depth; i++)
+		expr[len++] = i & 1 ? '~' : '-';
+	expr[len++] = '1';
+	expr[len] = '\0';
+	// each -~ adds one
+	TEST_ASSERT_EQUAL(0, parse(deep, expr, len, &actual));
+	TEST_ASSERT_EQUAL(depth + 1, actual);
+
+	free(expr);
+	parser_free(deep);
+}
+
+void test_large_expressions()
+{
+	struct parser_settings settings = { .max_parse_len = 0, NULL };
+	struct parser_context *large;
+	struct bmath_program *prog;
+	size_t size = 1 << 20, len = 0;
+	char *expr = malloc(size + 32);
+	uint64_t actual;
+
+	settings.err_stream = pctx_settings.err_stream;
+	large = parser_new(&settings);
+
+	TEST_ASSERT_NOT_NULL(large);
+	TEST_ASSERT_NOT_NULL(expr);
+
+	// an OR-reduction of every flag, over and over
+	for (unsigned int i = 0; len < size; i++)
+		len += sprintf(expr + len, "(1 << %u) | ", i % 64);
+	len += sprintf(expr + len, "0");
+
+	TEST_ASSERT_EQUAL(0, parse(large, expr, len, &actual));
+	TEST_ASSERT_EQUAL_UINT64(~0ull, actual);
+
+	TEST_ASSERT_EQUAL(0, bmath_compile(large, expr, len, &prog));
+	TEST_ASSERT_EQUAL(0, bmath_exec(large, prog, &actual));
+	TEST_ASSERT_EQUAL_UINT64(~0ull, actual);
+	bmath_program_free(prog);
+
+	// a limit still applies when one is set
+	TEST_ASSERT_EQUAL(PE_EXPRESSION_TOO_LONG,
+			  parse(pctx, expr, len, &actual));
+
+	free(expr);
+	parser_free(large);
+}
+
+/*
+ * parse() must not read past len. Each expression is copied into a buffer of
+ * exactly len bytes, and again with garbage right after it that would change
+ * the result if it were lexed.
+ */
+void test_slices()
+{
+	struct expr_expected_err_params params[] = {
+		{ "1", 1, 0 },
+		{ "0x1f", 0x1f, 0 },
+		{ "12 + 3", 15, 0 },
+		{ "1 << 4", 16, 0 },
+		{ "popcnt(7)", 3, 0 },
+		{ "(1 | 2)", 3, 0 },
+		{ "-~5", 6, 0 },
+		{ "1 +", 0, PE_PARSE_ERROR },
+		{ "align(7, 8", 0, PE_PARSE_ERROR },
+		{ "1 <", 0, PE_PARSE_ERROR },
+		{ "0x", 0, 0 },
+		{ "popcnt", 0, PE_PARSE_ERROR },
+	};
+	const char *garbage[] = { "", "0", "ff", "<<", "(", "x", "cnt(1)", "$" };
+	char buf[64];
+	char *exact;
+	size_t len;
+	uint64_t actual;
+	int ret;
+
+	for (size_t i = 0; i < sizeof(params) / sizeof(params[0]); i++) {
+		len = strlen(params[i].expression);
+
+		exact = malloc(len);
+		TEST_ASSERT_NOT_NULL(exact);
+		memcpy(exact, params[i].expression, len);
+		ret = parse(pctx, exact, len, &actual);
+		TEST_ASSERT_EQUAL_MESSAGE(params[i].err, ret,
+					  params[i].expression);
+		if (!ret)
+			TEST_ASSERT_EQUAL_MESSAGE(params[i].expected, actual,
+						  params[i].expression);
+		free(exact);
+
+		for (size_t g = 0; g < sizeof(garbage) / sizeof(garbage[0]);
+		     g++) {
+			snprintf(buf, sizeof(buf), "%s%s",
+				 params[i].expression, garbage[g]);
+			ret = parse(pctx, buf, len, &actual);
+			TEST_ASSERT_EQUAL_MESSAGE(params[i].err, ret, buf);
+			if (!ret)
+				TEST_ASSERT_EQUAL_MESSAGE(params[i].expected,
+							  actual, buf);
+		}
+	}
+}
+
+/*
+ * Lines are pre-scanned as a whole, so an illegal character is rejected even
+ * where parsing would have stopped before it. Whitespace runs cross the
+ * 64-byte words of the whitespace bitmap. Short lines are only scanned when
+ * lexing stops early, which must not change what is reported.
+ */
+void test_prescan()
+{
+	struct expr_expected_err_params params[] = {
+		{ "1 2 $", 0, PE_PARSE_ERROR },
+		{ "1 ) $", 0, PE_PARSE_ERROR },
+		{ "popcnt(1)$", 0, PE_PARSE_ERROR },
+		{ "1 +                                                                      2",
+		  3, 0 },
+		{ "                                                                1 + 2 ",
+		  3, 0 },
+		{ "(1                                                               )",
+		  1, 0 },
+		{ "\t\r\n1\t\r\n<<\t\r\n2\t\r\n", 4, 0 },
+	};
+	const enum bmath_simd levels[] = { BMATH_SIMD_SCALAR, BMATH_SIMD_AUTO };
+	const char *short_line = "99999999999999999999 + $";
+	const char *long_line = "99999999999999999999 +                                            $";
+	uint64_t actual;
+
+	for (size_t l = 0; l < sizeof(levels) / sizeof(levels[0]); l++) {
+		parser_set_simd(pctx, levels[l]);
+
+		for (size_t i = 0; i < sizeof(params) / sizeof(params[0]); i++) {
+			check(&params[i]);
+		}
+
+		// the line ends at the NUL, so the $ is never looked at
+		TEST_ASSERT_EQUAL(0, parse(pctx, "1 + 2\0$", 7, &actual));
+		TEST_ASSERT_EQUAL(3, actual);
+
+		// lexing stops at the number, but the $ is still what's reported
+		for (size_t n = 0; n < 2; n++) {
+			const char *line = n ? long_line : short_line;
+
+			TEST_ASSERT_EQUAL(PE_PARSE_ERROR,
+					  parse(pctx, line, strlen(line),
+						&actual));
+			TEST_ASSERT_EQUAL(BMATH_EILLEGAL,
+					  parser_last_error(pctx)->code);
+			TEST_ASSERT_EQUAL(strchr(line, '$') - line,
+					  parser_last_error(pctx)->pos);
+		}
+	}
+}
+
+/*
+ * Errors point at the start of the token they are about. The line is lexed
+ * before it's parsed, but a lexical error is only reported if the parser
+ * gets that far.
+ */
+void test_error_positions()
+{
+	const struct {
+		const char *expression;
+		const char *caret;
+	} params[] = {
+		{ "1 + 2 / 0", "~~~~~~^ Division by zero\n" },
+		{ "1 + )", "~~~~^ Expecting a number, but got ) instead.\n" },
+		{ "(1 + 2", "~~~~~~^ Expecting a ), but got null instead.\n" },
+		{ "1 + 99999999999999999999", "~~~~^ Number exceeds 8 bytes\n" },
+		{ "mask(0x1 +", "~~~~~~~~~~^ Expecting a number, but got null instead.\n" },
+	};
+	char line[256];
+	uint64_t actual;
+
+	parser_free(pctx);
+	fclose(pctx_settings.err_stream);
+	pctx_settings.err_stream = tmpfile();
+	pctx = parser_new(&pctx_settings);
+
+	for (size_t i = 0; i < sizeof(params) / sizeof(params[0]); i++) {
+		rewind(pctx_settings.err_stream);
+		TEST_ASSERT_EQUAL(PE_PARSE_ERROR,
+				  parse(pctx, params[i].expression,
+					strlen(params[i].expression), &actual));
+
+		// the caret comes after the banner and the line
+		rewind(pctx_settings.err_stream);
+		for (int k = 0; k < 3; k++) {
+			TEST_ASSERT_NOT_NULL(fgets(line, sizeof(line),
+						   pctx_settings.err_stream));
+		}
+		TEST_ASSERT_EQUAL_STRING_MESSAGE(params[i].caret, line,
+						 params[i].expression);
+	}
+
+	// never reached, the parse stops after the 1
+	TEST_ASSERT_EQUAL(0, parse(pctx, "1 2 99999999999999999999", 24,
+				   &actual));
+	TEST_ASSERT_EQUAL(1, actual);
+}
+
+/*
+ * A quiet context writes nothing, but keeps the same error a loud one shows,
+ * and rendering it gives the same text.
+ */
+void test_error_records()
+{
+	const struct {
+		const char *expression;
+		enum bmath_error_code code;
+		uint32_t pos;
+	} params[] = {
+		{ "1 + 2 / 0", BMATH_EDIVZERO, 6 },
+		{ "1 + )", BMATH_EUNEXPECTED, 4 },
+		{ "1 + 99999999999999999999", BMATH_ENUMBER_RANGE, 4 },
+		{ "1 + 0x11111111111111111", BMATH_EHEX_RANGE, 4 },
+		{ "1 $ 2", BMATH_EILLEGAL, 2 },
+		{ "x + 1", BMATH_EVARIABLE, 0 },
+		{ "mask(9)", BMATH_EFUNC, 0 },
+	};
+	const struct bmath_error *error;
+	struct parser_context *quiet;
+	struct bmath_program *prog;
+	FILE *rendered = tmpfile();
+	char loud[512], again[512];
+	size_t loud_len, again_len;
+	uint64_t actual;
+
+	parser_free(pctx);
+	fclose(pctx_settings.err_stream);
+	pctx_settings.err_stream = tmpfile();
+	pctx = parser_new(&pctx_settings);
+	pctx_settings.quiet = true;
+	quiet = parser_new(&pctx_settings);
+	pctx_settings.quiet = false;
+
+	for (size_t i = 0; i < sizeof(params) / sizeof(params[0]); i++) {
+		rewind(pctx_settings.err_stream);
+		TEST_ASSERT_EQUAL(PE_PARSE_ERROR,
+				  parse(quiet, params[i].expression,
+					strlen(params[i].expression), &actual));
+		TEST_ASSERT_EQUAL(0, ftell(pctx_settings.err_stream));
+
+		error = parser_last_error(quiet);
+		TEST_ASSERT_EQUAL_MESSAGE(params[i].code, error->code,
+					  params[i].expression);
+		TEST_ASSERT_EQUAL_MESSAGE(params[i].pos, error->pos,
+					  params[i].expression);
+
+		parse(pctx, params[i].expression, strlen(params[i].expression),
+		      &actual);
+		loud_len = ftell(pctx_settings.err_stream);
+		rewind(pctx_settings.err_stream);
+		TEST_ASSERT_EQUAL(loud_len, fread(loud, 1, loud_len,
+						 pctx_settings.err_stream));
+
+		rewind(rendered);
+		bmath_error_render(rendered, error, params[i].expression,
+				   strlen(params[i].expression));
+		again_len = ftell(rendered);
+		rewind(rendered);
+		TEST_ASSERT_EQUAL(again_len, fread(again, 1, again_len,
+						  rendered));
+		TEST_ASSERT_EQUAL_MESSAGE(loud_len, again_len,
+					  params[i].expression);
+		TEST_ASSERT_EQUAL_MESSAGE(0, memcmp(loud, again, loud_len),
+					  params[i].expression);
+	}
+
+	// a call that succeeds clears it
+	error = parser_last_error(quiet);
+	TEST_ASSERT_EQUAL(0, parse(quiet, "1", 1, &actual));
+	TEST_ASSERT_EQUAL(BMATH_ENONE, error->code);
+
+	// lines that are never looked at still get a code
+	TEST_ASSERT_EQUAL(PE_NOTHING_TO_PARSE, parse(quiet, "", 0, &actual));
+	TEST_ASSERT_EQUAL(BMATH_EEMPTY, error->code);
+	memset(loud, '1', sizeof(loud));
+	TEST_ASSERT_EQUAL(PE_EXPRESSION_TOO_LONG,
+			  bmath_compile(quiet, loud, sizeof(loud), &prog));
+	TEST_ASSERT_EQUAL(BMATH_ETOO_LONG, error->code);
+
+	parse(quiet, "(1 + 2", 6, &actual);
+	bmath_error_message(error, loud, sizeof(loud));
+	TEST_ASSERT_EQUAL_STRING("Expecting a ), but got null instead.", loud);
+
+	// faults in compiled programs point at the op's token
+	TEST_ASSERT_EQUAL(0, bmath_compile(quiet, "x + 8 % y", 9, &prog));
+	TEST_ASSERT_EQUAL(PE_EVAL_ERROR, bmath_exec(quiet, prog, &actual));
+	TEST_ASSERT_EQUAL(BMATH_EDIVZERO, error->code);
+	TEST_ASSERT_EQUAL(6, error->pos);
+	bmath_program_free(prog);
+
+	parser_free(quiet);
+	fclose(rendered);
+}
+
+/*
+ * Cache keys collapse whitespace 16 bytes at a time and byte by byte in the
+ * tail, and both must agree on what whitespace is.
+ */
+void test_cache_whitespace()
+{
+	char line[32], one[1], key[32];
+	bool space;
+
+	for (int c = 1; c < 256; c++) {
+		one[0] = (char)c;
+		TEST_ASSERT_EQUAL(1, cache_canonicalize(one, 1, key));
+		space = key[0] == ' ';
+
+		memset(line, c, sizeof(line));
+		TEST_ASSERT_EQUAL_MESSAGE(space ? 1 : sizeof(line),
+					  cache_canonicalize(line, sizeof(line),
+							     key),
+					  "vector and scalar whitespace differ");
+	}
+}
+
+/*
+ * Lines that only differ in their whitespace share an entry, and a cached
+ * outcome is exactly what parsing the line again would give, errors and
+ * where they point included.
+ */
+void test_result_cache()
+{
+	const char *exprs[] = {
+		"1 + 2 * 3", "1\t+  2 *\r3", "1 + )",     "1 +\t\t )",
+		"(1 + 2 ",   "(1   +  2\t", "1 + 2 / 0", "1 + 2\t/ 0",
+		"mask(9)",   "mask(9)",      "1 $ 2",     "1   $ 2",
+	};
+	const size_t nexprs = sizeof(exprs) / sizeof(exprs[0]);
+	struct parser_context *cached, *plain;
+	struct bmath_cache_stats stats;
+	FILE *dev_null = pctx_settings.err_stream;
+	FILE *cached_err = tmpfile(), *plain_err = tmpfile();
+	const struct bmath_error *a, *b;
+	char cached_out[4096], plain_out[4096];
+	size_t cached_len, plain_len;
+	uint64_t x, y;
+
+	pctx_settings.cache_size = 64;
+	pctx_settings.err_stream = cached_err;
+	cached = parser_new(&pctx_settings);
+	pctx_settings.cache_size = 0;
+	pctx_settings.err_stream = plain_err;
+	plain = parser_new(&pctx_settings);
+	pctx_settings.err_stream = dev_null;
+
+	TEST_ASSERT_FALSE(parser_cache_stats(plain, &stats));
+
+	for (size_t i = 0; i < nexprs; i++) {
+		TEST_ASSERT_EQUAL_MESSAGE(parse(plain, exprs[i],
+						strlen(exprs[i]), &y),
+					  parse(cached, exprs[i],
+						strlen(exprs[i]), &x),
+					  exprs[i]);
+		TEST_ASSERT_EQUAL_MESSAGE(y, x, exprs[i]);
+
+		a = parser_last_error(cached);
+		b = parser_last_error(plain);
+		TEST_ASSERT_EQUAL_MESSAGE(b->code, a->code, exprs[i]);
+		TEST_ASSERT_EQUAL_MESSAGE(b->pos, a->pos, exprs[i]);
+	}
+
+	cached_len = ftell(cached_err);
+	plain_len = ftell(plain_err);
+	rewind(cached_err);
+	rewind(plain_err);
+	TEST_ASSERT_EQUAL(plain_len, cached_len);
+	TEST_ASSERT_TRUE(cached_len <= sizeof(cached_out));
+	TEST_ASSERT_EQUAL(cached_len, fread(cached_out, 1, cached_len,
+					    cached_err));
+	TEST_ASSERT_EQUAL(plain_len, fread(plain_out, 1, plain_len, plain_err));
+	TEST_ASSERT_EQUAL(0, memcmp(cached_out, plain_out, cached_len));
+
+	TEST_ASSERT_TRUE(parser_cache_stats(cached, &stats));
+	TEST_ASSERT_EQUAL(nexprs / 2, stats.hits);
+	TEST_ASSERT_EQUAL(nexprs / 2, stats.misses);
+	TEST_ASSERT_EQUAL(nexprs / 2, stats.entries);
+
+	// whitespace between tokens isn't dropped, it separates them
+	TEST_ASSERT_EQUAL(0, parse(cached, "1 2", 3, &x));
+	TEST_ASSERT_EQUAL(0, parse(cached, "12", 2, &y));
+	TEST_ASSERT_EQUAL(1, x);
+	TEST_ASSERT_EQUAL(12, y);
+
+	parser_free(cached);
+	parser_free(plain);
+	fclose(cached_err);
+	fclose(plain_err);
+
+	// a single entry only ever holds the last line
+	pctx_settings.cache_size = 1;
+	cached = parser_new(&pctx_settings);
+	pctx_settings.cache_size = 0;
+	parse(cached, "1", 1, &x);
+	parse(cached, "2", 1, &x);
+	parse(cached, "1", 1, &x);
+	parse(cached, "1", 1, &x);
+	TEST_ASSERT_TRUE(parser_cache_stats(cached, &stats));
+	TEST_ASSERT_EQUAL(1, stats.hits);
+	TEST_ASSERT_EQUAL(3, stats.misses);
+	TEST_ASSERT_EQUAL(2, stats.evictions);
+	TEST_ASSERT_EQUAL(1, stats.entries);
+	TEST_ASSERT_EQUAL(1, stats.capacity);
+	parser_free(cached);
+}
+
+/*
+ * A context picks up what another one stored in the same cache file, like a
+ * later process would.
+ */
+void test_cache_file()
+{
+	char path[] = "/tmp/bmath-cache-XXXXXX";
+	struct parser_context *first, *second;
+	struct bmath_cache_stats stats;
+	FILE *fp;
+	uint64_t x;
+	int fd;
+
+	fd = mkstemp(path);
+	TEST_ASSERT_TRUE(fd >= 0);
+	close(fd);
+
+	pctx_settings.cache_file = path;
+	first = parser_new(&pctx_settings);
+	second = parser_new(&pctx_settings);
+	TEST_ASSERT_NOT_NULL(first);
+	TEST_ASSERT_NOT_NULL(second);
+
+	TEST_ASSERT_EQUAL(0, parse(first, "0x1000 * 4 + 7", 14, &x));
+	TEST_ASSERT_EQUAL(PE_PARSE_ERROR, parse(first, "1 + )", 5, &x));
+	parser_free(first);
+
+	TEST_ASSERT_EQUAL(0, parse(second, "0x1000  *\t4 + 7", 16, &x));
+	TEST_ASSERT_EQUAL(0x4007, x);
+	// errors aren't kept, so it is still reported
+	TEST_ASSERT_EQUAL(PE_PARSE_ERROR, parse(second, "1 + )", 5, &x));
+	TEST_ASSERT_EQUAL(BMATH_EUNEXPECTED, parser_last_error(second)->code);
+
+	TEST_ASSERT_TRUE(parser_cache_stats(second, &stats));
+	TEST_ASSERT_EQUAL(1, stats.file_hits);
+	TEST_ASSERT_EQUAL(1, stats.file_misses);
+	TEST_ASSERT_EQUAL(0, stats.capacity);
+	parser_free(second);
+
+	// anything else is left alone
+	fp = fopen(path, "w");
+	fputs("1 + 1\n", fp);
+	fclose(fp);
+	TEST_ASSERT_NULL(parser_new(&pctx_settings));
+	TEST_ASSERT_EQUAL(EINVAL, errno);
+	pctx_settings.cache_file = NULL;
+
+	unlink(path);
+}
+
+void test_cse()
+{
+	const char *exprs[] = {
+		// the first subterm's id is the literal 0
+		"(1 + 1) * 5 + 0 * 5",
+		"align(0x1234 + 5, 4096) | align(0x1234 + 5, 4096)",
+		"(1 << 3) - (1 << 3) * -(1 << 3) + ~(1 << 3)",
+		"popcnt(7) + popcnt(7) + popcnt(7)",
+		"(2 + 3) + (2 + 3) / (2 - 2)",
+		"mask(9) + mask(9)",
+		"(4 + 4) $ 2",
+		"align(0x1234 + 5, 4096) + 1",
+		"(1 + 1) * 5",
+	};
+	const size_t nexprs = sizeof(exprs) / sizeof(exprs[0]);
+	struct parser_context *shared, *plain;
+	struct bmath_cse_stats stats;
+	const struct bmath_error *a, *b;
+	uint64_t x, y;
+
+	pctx_settings.cse = true;
+	pctx_settings.cse_window = 4;
+	shared = parser_new(&pctx_settings);
+	pctx_settings.cse = false;
+	pctx_settings.cse_window = 0;
+	plain = parser_new(&pctx_settings);
+
+	TEST_ASSERT_FALSE(parser_cse_stats(plain, &stats));
+
+	for (size_t i = 0; i < nexprs; i++) {
+		TEST_ASSERT_EQUAL_MESSAGE(parse(plain, exprs[i],
+						strlen(exprs[i]), &y),
+					  parse(shared, exprs[i],
+						strlen(exprs[i]), &x),
+					  exprs[i]);
+		TEST_ASSERT_EQUAL_MESSAGE(y, x, exprs[i]);
+
+		a = parser_last_error(shared);
+		b = parser_last_error(plain);
+		TEST_ASSERT_EQUAL_MESSAGE(b->code, a->code, exprs[i]);
+		TEST_ASSERT_EQUAL_MESSAGE(b->pos, a->pos, exprs[i]);
+	}
+
+	parser_free(shared);
+	parser_free(plain);
+
+	pctx_settings.cse = true;
+	shared = parser_new(&pctx_settings);
+	TEST_ASSERT_EQUAL(0, parse(shared, "(1 + 2) * (1 + 2) + (1 + 2)", 27,
+				   &x));
+	TEST_ASSERT_EQUAL(12, x);
+	TEST_ASSERT_TRUE(parser_cse_stats(shared, &stats));
+	TEST_ASSERT_EQUAL(5, stats.ops);
+	TEST_ASSERT_EQUAL(3, stats.computed);
+
+	// without a window, lines share nothing
+	TEST_ASSERT_EQUAL(0, parse(shared, "1 + 2", 5, &x));
+	TEST_ASSERT_TRUE(parser_cse_stats(shared, &stats));
+	TEST_ASSERT_EQUAL(4, stats.computed);
+	TEST_ASSERT_EQUAL(0, stats.earlier_lines);
+	parser_free(shared);
+
+	// a subterm is forgotten window lines after it was last used
+	pctx_settings.cse_window = 1;
+	shared = parser_new(&pctx_settings);
+	TEST_ASSERT_EQUAL(0, parse(shared, "1 + 2", 5, &x));
+	TEST_ASSERT_EQUAL(0, parse(shared, "1 + 2", 5, &x));
+	TEST_ASSERT_EQUAL(0, parse(shared, "7", 1, &x));
+	TEST_ASSERT_EQUAL(0, parse(shared, "7", 1, &x));
+	TEST_ASSERT_EQUAL(0, parse(shared, "1 + 2", 5, &x));
+	TEST_ASSERT_EQUAL(3, x);
+	TEST_ASSERT_TRUE(parser_cse_stats(shared, &stats));
+	TEST_ASSERT_EQUAL(3, stats.ops);
+	TEST_ASSERT_EQUAL(2, stats.computed);
+	TEST_ASSERT_EQUAL(1, stats.earlier_lines);
+	parser_free(shared);
+
+	pctx_settings.cse = false;
+	pctx_settings.cse_window = 0;
+}
+
+static void parse_file(struct parser_context *ctx, const char *const *lines,
+		       size_t n, uint64_t *results, int *errs)
+{
+	parser_reset_symbols(ctx);
+	for (size_t i = 0; i < n; i++) {
+		errs[i] = parse(ctx, lines[i], strlen(lines[i]), &results[i]);
+	}
+}
+
+/*
+ * Names are bound in order and read by the lines after them, and `_` is the
+ * last result. Incrementally, a pass over the same lines only evaluates the
+ * ones that changed and the ones that read a binding whose value did, and
+ * ends up where evaluating every line does.
+ */
+void test_symbols()
+{
+	const char *file[] = {
+		"base = 0x1000", "size = 0x40",
+		"end = base + size", "align(end, 0x100)",
+		"_ * 2", "other = 7",
+		"other + 1", "later",
+		"later = 1", "_ + 1",
+		"_ + 1",
+	};
+	// a definition changed
+	const char *edited[] = {
+		"base = 0x1000", "size = 0x400",
+		"end = base + size", "align(end, 0x100)",
+		"_ * 2", "other = 7",
+		"other + 1", "later",
+		"later = 1", "_ + 1",
+		"_ + 1",
+	};
+	// and one added in front, which changes what a later line reads
+	const char *inserted[] = {
+		"later = 5", "base = 0x1000",
+		"size = 0x400", "end = base + size",
+		"align(end, 0x100)", "_ * 2",
+		"other = 7", "other + 1",
+		"later", "later = 1",
+		"_ + 1", "_ + 1",
+	};
+	const struct {
+		const char *const *lines;
+		size_t n;
+		size_t evaluated;
+	} passes[] = {
+		{ file, 11, 11 },
+		{ file, 11, 0 },
+		{ edited, 11, 4 },
+		{ inserted, 12, 2 },
+	};
+	struct parser_context *incremental, *fixed;
+	struct bmath_recalc_stats stats;
+	uint64_t results[12], expected[12], x;
+	int errs[12], expected_errs[12];
+	static char scratch[1 << 14];
+
+	pctx_settings.incremental = true;
+	incremental = parser_new(&pctx_settings);
+	pctx_settings.incremental = false;
+	TEST_ASSERT_FALSE(parser_recalc_stats(pctx, &stats));
+
+	for (size_t p = 0; p < sizeof(passes) / sizeof(passes[0]); p++) {
+		parse_file(pctx, passes[p].lines, passes[p].n, expected,
+			   expected_errs);
+		parse_file(incremental, passes[p].lines, passes[p].n, results,
+			   errs);
+		for (size_t i = 0; i < passes[p].n; i++) {
+			TEST_ASSERT_EQUAL_MESSAGE(expected_errs[i], errs[i],
+						  passes[p].lines[i]);
+			TEST_ASSERT_EQUAL_MESSAGE(expected[i], results[i],
+						  passes[p].lines[i]);
+		}
+
+		TEST_ASSERT_TRUE(parser_recalc_stats(incremental, &stats));
+		TEST_ASSERT_EQUAL(passes[p].evaluated, stats.evaluated);
+		TEST_ASSERT_EQUAL(passes[p].n - passes[p].evaluated,
+				  stats.reused);
+	}
+	TEST_ASSERT_EQUAL(0x1400, expected[4]);
+	TEST_ASSERT_EQUAL(0x2800, expected[5]);
+	TEST_ASSERT_EQUAL(5, expected[8]);
+	TEST_ASSERT_EQUAL(3, expected[11]);
+	parser_free(incremental);
+
+	// x and y can be bound, a failed binding isn't made
+	TEST_ASSERT_EQUAL(0, parse(pctx, "x = 3", 5, &x));
+	TEST_ASSERT_EQUAL(0, parse(pctx, "x * x", 5, &x));
+	TEST_ASSERT_EQUAL(9, x);
+	TEST_ASSERT_EQUAL(PE_PARSE_ERROR, parse(pctx, "a = 1 / 0", 9, &x));
+	TEST_ASSERT_EQUAL(PE_PARSE_ERROR, parse(pctx, "1 + a", 5, &x));
+	TEST_ASSERT_EQUAL(BMATH_EUNDEFINED, parser_last_error(pctx)->code);
+	TEST_ASSERT_EQUAL(4, parser_last_error(pctx)->pos);
+
+	// lines with names aren't cached
+	parser_free(pctx);
+	pctx_settings.cache_size = 64;
+	pctx = parser_new(&pctx_settings);
+	pctx_settings.cache_size = 0;
+	TEST_ASSERT_EQUAL(0, parse(pctx, "a = 1", 5, &x));
+	TEST_ASSERT_EQUAL(0, parse(pctx, "a + 1", 5, &x));
+	TEST_ASSERT_EQUAL(0, parse(pctx, "a = 5", 5, &x));
+	TEST_ASSERT_EQUAL(0, parse(pctx, "a + 1", 5, &x));
+	TEST_ASSERT_EQUAL(6, x);
+
+	// nor can a context in scratch bind anything
+	fixed = parser_init(scratch, sizeof(scratch), &pctx_settings);
+	TEST_ASSERT_NOT_NULL(fixed);
+	TEST_ASSERT_EQUAL(PE_PARSE_ERROR, parse(fixed, "a = 1", 5, &x));
+	TEST_ASSERT_EQUAL(BMATH_ENOMEM, parser_last_error(fixed)->code);
+}
+
+void test_definitions()
+{
+	const char *defs[] = {
+		"def pfn(x) = (x >> 12) & mask(5)",
+		"def pte(addr, level) = (addr >> (12 + 9 * level)) & 0x1ff",
+		"def both(a) = pfn(a) + pte(a, 1)",
+		"def page() = 4096",
+	};
+	// calls, and the same expressions written out
+	const char *calls[][2] = {
+		{ "pfn(0x7f1234567000)", "(0x7f1234567000 >> 12) & mask(5)" },
+		{ "both(x + 1) * page()",
+		  "((((x + 1) >> 12) & mask(5)) + "
+		  "(((x + 1) >> (12 + 9 * 1)) & 0x1ff)) * 4096" },
+		{ "pte(x, y)", "(x >> (12 + 9 * y)) & 0x1ff" },
+	};
+	const struct {
+		const char *def;
+		enum bmath_error_code code;
+		uint32_t pos;
+	} invalid[] = {
+		{ "def align(a) = a", BMATH_EDEFINED, 4 },
+		{ "def pfn(a) = a", BMATH_EDEFINED, 4 },
+		{ "def f(a, a) = a", BMATH_EDEFINED, 9 },
+		{ "def f(a) = x", BMATH_EUNDEFINED, 11 },
+		{ "def f(a) = f(a)", BMATH_EUNDEFINED, 11 },
+		{ "def f(a) = a )", BMATH_EUNEXPECTED, 13 },
+		{ "f(a) = a", BMATH_EUNEXPECTED, 0 },
+	};
+	const char *nested = "sq(sq(sq(sq(sq(sq(sq(sq(sq(sq(sq(sq(sq(sq(sq(sq("
+			     "sq(x)))))))))))))))))";
+	const uint64_t xs[] = { 0, 0x7f1234567000, UINT64_MAX };
+	const uint64_t ys[] = { 3, 1, 0 };
+	struct bmath_program *prog, *expanded;
+	struct parser_context *incremental, *fixed;
+	uint64_t results[3], expected[3], x;
+	int errs[3];
+	static char scratch[1 << 14];
+
+	for (size_t i = 0; i < sizeof(defs) / sizeof(defs[0]); i++)
+		TEST_ASSERT_EQUAL_MESSAGE(0, bmath_define(pctx, defs[i],
+							  strlen(defs[i])),
+					  defs[i]);
+
+	TEST_ASSERT_EQUAL(0, parse(pctx, calls[0][0], strlen(calls[0][0]),
+				   &x));
+	TEST_ASSERT_EQUAL(0x7f1234567, x);
+
+	// compiled calls are the body written out, op for op
+	for (size_t i = 0; i < sizeof(calls) / sizeof(calls[0]); i++) {
+		TEST_ASSERT_EQUAL(0, bmath_compile(pctx, calls[i][0],
+						   strlen(calls[i][0]), &prog));
+		TEST_ASSERT_EQUAL(0, bmath_compile(pctx, calls[i][1],
+						   strlen(calls[i][1]),
+						   &expanded));
+		TEST_ASSERT_EQUAL_MESSAGE(bmath_program_len(expanded),
+					  bmath_program_len(prog),
+					  calls[i][0]);
+		TEST_ASSERT_EQUAL(0, bmath_exec_batch(pctx, prog, xs, ys,
+						      results, 3));
+		TEST_ASSERT_EQUAL(0, bmath_exec_batch(pctx, expanded, xs, ys,
+						      expected, 3));
+		for (size_t j = 0; j < 3; j++)
+			TEST_ASSERT_EQUAL_MESSAGE(expected[j], results[j],
+						  calls[i][0]);
+		bmath_program_free(prog);
+		bmath_program_free(expanded);
+	}
+
+	for (size_t i = 0; i < sizeof(invalid) / sizeof(invalid[0]); i++) {
+		TEST_ASSERT_EQUAL_MESSAGE(PE_PARSE_ERROR,
+					  bmath_define(pctx, invalid[i].def,
+						       strlen(invalid[i].def)),
+					  invalid[i].def);
+		TEST_ASSERT_EQUAL_MESSAGE(invalid[i].code,
+					  parser_last_error(pctx)->code,
+					  invalid[i].def);
+		TEST_ASSERT_EQUAL_MESSAGE(invalid[i].pos,
+					  parser_last_error(pctx)->pos,
+					  invalid[i].def);
+	}
+
+	// calls are checked like builtins, and errors in the body point at
+	// the call
+	TEST_ASSERT_EQUAL(PE_PARSE_ERROR, parse(pctx, "1 + pfn(1, 2)", 13, &x));
+	TEST_ASSERT_EQUAL(BMATH_EFUNC, parser_last_error(pctx)->code);
+	TEST_ASSERT_EQUAL(4, parser_last_error(pctx)->pos);
+	TEST_ASSERT_EQUAL(0, bmath_define(pctx, "def per(a, b) = a / b", 21));
+	TEST_ASSERT_EQUAL(PE_PARSE_ERROR, parse(pctx, "1 + per(1, 0)", 13, &x));
+	TEST_ASSERT_EQUAL(BMATH_EDIVZERO, parser_last_error(pctx)->code);
+	TEST_ASSERT_EQUAL(4, parser_last_error(pctx)->pos);
+
+	// nested calls that read their parameters twice stop growing
+	TEST_ASSERT_EQUAL(0, bmath_define(pctx, "def sq(a) = a * a", 17));
+	TEST_ASSERT_EQUAL(PE_PARSE_ERROR,
+			  bmath_compile(pctx, nested, strlen(nested), &prog));
+	TEST_ASSERT_EQUAL(BMATH_EEXPANSION, parser_last_error(pctx)->code);
+
+	// a line that called a name before it was defined doesn't keep failing
+	pctx_settings.incremental = true;
+	incremental = parser_new(&pctx_settings);
+	pctx_settings.incremental = false;
+	parse_file(incremental, calls[0], 1, results, errs);
+	TEST_ASSERT_EQUAL(PE_PARSE_ERROR, errs[0]);
+	TEST_ASSERT_EQUAL(0, bmath_define(incremental, defs[0],
+					  strlen(defs[0])));
+	parse_file(incremental, calls[0], 1, results, errs);
+	TEST_ASSERT_EQUAL(0, errs[0]);
+	TEST_ASSERT_EQUAL(0x7f1234567, results[0]);
+	parser_free(incremental);
+
+	fixed = parser_init(scratch, sizeof(scratch), &pctx_settings);
+	TEST_ASSERT_NOT_NULL(fixed);
+	TEST_ASSERT_EQUAL(PE_PARSE_ERROR,
+			  bmath_define(fixed, defs[0], strlen(defs[0])));
+	TEST_ASSERT_EQUAL(BMATH_ENOMEM, parser_last_error(fixed)->code);
+}
+
+void test_budget()
+{
+	const struct {
+		const char *expression;
+		struct bmath_budget budget;
+		enum bmath_limit limit;
+		uint32_t pos;
+	} params[] = {
+		// the end of the line is a token too
+		{ "1 + 2", { .max_tokens = 4 }, BMATH_LIMIT_NONE, 0 },
+		{ "1 + 2 + 3", { .max_tokens = 4 }, BMATH_LIMIT_TOKENS, 8 },
+		{ "((1))", { .max_depth = 2 }, BMATH_LIMIT_NONE, 0 },
+		{ "1 + ((-1))", { .max_depth = 2 }, BMATH_LIMIT_DEPTH, 5 },
+		{ "1 | 2 ^ 3", { .max_depth = 2 }, BMATH_LIMIT_NONE, 0 },
+		{ "1 | 2 ^ 3 & 4", { .max_depth = 2 }, BMATH_LIMIT_DEPTH, 10 },
+		{ "popcnt(ctz(1))", { .max_calls = 2 }, BMATH_LIMIT_NONE, 0 },
+		{ "popcnt(ctz(1)) + mask(1)", { .max_calls = 2 },
+		  BMATH_LIMIT_CALLS, 17 },
+		// pc() is one call, and one more in its body
+		{ "pc(1) + pc(2)", { .max_calls = 3 }, BMATH_LIMIT_CALLS, 8 },
+		{ "1 + 2", { .max_steps = 3 }, BMATH_LIMIT_NONE, 0 },
+		{ "1 + 2 * 3", { .max_steps = 3 }, BMATH_LIMIT_STEPS, 6 },
+	};
+	struct bmath_budget forever = { .deadline_ns = UINT64_MAX };
+	struct bmath_program *prog;
+	struct parser_context *cached;
+	const struct bmath_error *error;
+	char msg[128], *chain;
+	size_t len = 0;
+	uint64_t x;
+	int ret;
+
+	TEST_ASSERT_EQUAL(0, bmath_define(pctx, "def pc(a) = popcnt(a)", 21));
+	for (size_t i = 0; i < sizeof(params) / sizeof(params[0]); i++) {
+		parser_set_budget(pctx, &params[i].budget);
+		ret = parse(pctx, params[i].expression,
+			    strlen(params[i].expression), &x);
+		error = parser_last_error(pctx);
+		if (params[i].limit == BMATH_LIMIT_NONE) {
+			TEST_ASSERT_EQUAL_MESSAGE(0, ret, params[i].expression);
+			continue;
+		}
+
+		TEST_ASSERT_EQUAL_MESSAGE(PE_BUDGET_EXCEEDED, ret,
+					  params[i].expression);
+		TEST_ASSERT_EQUAL_MESSAGE(BMATH_EBUDGET, error->code,
+					  params[i].expression);
+		TEST_ASSERT_EQUAL_MESSAGE(params[i].limit, error->limit,
+					  params[i].expression);
+		TEST_ASSERT_EQUAL_MESSAGE(params[i].pos, error->pos,
+					  params[i].expression);
+
+		// compiling a line takes the same work as evaluating it
+		ret = bmath_compile(pctx, params[i].expression,
+				    strlen(params[i].expression), &prog);
+		TEST_ASSERT_EQUAL_MESSAGE(PE_BUDGET_EXCEEDED, ret,
+					  params[i].expression);
+		TEST_ASSERT_NULL(prog);
+	}
+
+	bmath_error_message(&(struct bmath_error){ .code = BMATH_EBUDGET,
+						   .limit = BMATH_LIMIT_CALLS },
+			    msg, sizeof(msg));
+	TEST_ASSERT_EQUAL_STRING("Over budget, too many calls", msg);
+
+	// a deadline that passes stops a long line, whatever else it allows
+	chain = malloc(4 * 100000 + 1);
+	TEST_ASSERT_NOT_NULL(chain);
+	for (size_t i = 0; i < 100000; i++)
+		len += sprintf(chain + len, "%s1", i ? " + " : "");
+	pctx_settings.max_parse_len = 0;
+	pctx_settings.budget.deadline_ns = 1;
+	pctx_settings.cache_size = 16;
+	cached = parser_new(&pctx_settings);
+	pctx_settings = (struct parser_settings){
+		.max_parse_len = 128,
+		.err_stream = pctx_settings.err_stream,
+	};
+	TEST_ASSERT_EQUAL(PE_BUDGET_EXCEEDED, parse(cached, chain, len, &x));
+	TEST_ASSERT_EQUAL(BMATH_LIMIT_DEADLINE,
+			  parser_last_error(cached)->limit);
+
+	// and isn't remembered, with all the time there is it goes through
+	parser_set_budget(cached, &forever);
+	TEST_ASSERT_EQUAL(0, parse(cached, chain, len, &x));
+	TEST_ASSERT_EQUAL(100000, x);
+	parser_free(cached);
+	free(chain);
+}
+
+// the bits of the tier each line finishes in, with zero for limbs
+static size_t wide_tier_lines(const struct bmath_wide_stats *s,
+			      unsigned int tier)
+{
+	return tier == 64 ? s->tier_64 : tier == 128 ? s->tier_128 :
+						      s->tier_limbs;
+}
+
+void test_wide()
+{
+	const struct {
+		unsigned int width;
+		const char *expression;
+		uint64_t expected[4];
+		unsigned int tier;
+	} params[] = {
+		{ 128, "1 + 2", { 3 }, 64 },
+		{ 128, "~0", { UINT64_MAX, UINT64_MAX }, 128 },
+		{ 128, "0xffffffffffffffff * 0xffffffffffffffff",
+		  { 1, 0xfffffffffffffffe }, 128 },
+		// wide literals start in a tier that holds them
+		{ 128, "340282366920938463463374607431768211455",
+		  { UINT64_MAX, UINT64_MAX }, 128 },
+		{ 128, "-1 / 3", { 0x5555555555555555, 0x5555555555555555 },
+		  128 },
+		{ 128, "1 << 127 >> 127", { 1 }, 128 },
+		{ 128, "1 << 128", { 1 }, 64 },
+		{ 128, "mask(16)", { UINT64_MAX, UINT64_MAX }, 128 },
+		{ 128, "clz(1, 16)", { 127 }, 128 },
+		{ 128, "bswap(0x0102030405060708090a0b0c0d0e0f10)",
+		  { 0x0807060504030201, 0x100f0e0d0c0b0a09 }, 128 },
+		{ 256, "1 << 200", { 0, 0, 0, 1 << 8 }, 0 },
+		{ 256, "(1 << 200) / 3",
+		  { 0x5555555555555555, 0x5555555555555555,
+		    0x5555555555555555, 0x55 },
+		  0 },
+		{ 256, "(1 << 200) % 0x10000000000000001",
+		  { 0xffffffffffffff01 }, 0 },
+		{ 256, "popcnt(~0) + ctz(1 << 255)", { 256 + 255 }, 0 },
+		{ 256, "align(1 << 100, 1 << 64) - (1 << 100)", { 0 }, 128 },
+	};
+	// the low limb wraps the same at any width
+	const char *wrapping[] = {
+		"0xdeadbeef * 0xcafebabe * 0x12345678 - 99",
+		"~0x1234 ^ -5 + (7 << 60)",
+		"align(0xffffffffffffff01, 0x100) | mask(3)",
+	};
+	struct parser_settings settings = { .err_stream = stderr,
+					    .quiet = true };
+	struct parser_context *ctx[2];
+	struct bmath_wide_stats before, after;
+	uint64_t out[4], x;
+	size_t k;
+
+	settings.width = 96;
+	errno = 0;
+	TEST_ASSERT_NULL(parser_new(&settings));
+	TEST_ASSERT_EQUAL(EINVAL, errno);
+
+	// at 64 bits it is parse()
+	TEST_ASSERT_FALSE(parser_wide_stats(pctx, &before));
+	TEST_ASSERT_EQUAL(0, bmath_parse_wide(pctx, "~0", 2, out));
+	TEST_ASSERT_EQUAL_UINT64(UINT64_MAX, out[0]);
+
+	for (k = 0; k < 2; k++) {
+		settings.width = 128 << k;
+		ctx[k] = parser_new(&settings);
+		TEST_ASSERT_NOT_NULL(ctx[k]);
+	}
+
+	for (size_t i = 0; i < sizeof(params) / sizeof(params[0]); i++) {
+		k = params[i].width == 256;
+		parser_wide_stats(ctx[k], &before);
+		TEST_ASSERT_EQUAL_MESSAGE(
+			0,
+			bmath_parse_wide(ctx[k], params[i].expression,
+					 strlen(params[i].expression), out),
+			params[i].expression);
+		for (size_t l = 0; l < params[i].width / 64; l++)
+			TEST_ASSERT_EQUAL_UINT64_MESSAGE(params[i].expected[l],
+							 out[l],
+							 params[i].expression);
+		parser_wide_stats(ctx[k], &after);
+		TEST_ASSERT_EQUAL_MESSAGE(
+			1,
+			wide_tier_lines(&after, params[i].tier) -
+				wide_tier_lines(&before, params[i].tier),
+			params[i].expression);
+	}
+
+	for (size_t i = 0; i < sizeof(wrapping) / sizeof(wrapping[0]); i++) {
+		TEST_ASSERT_EQUAL(0, parse(pctx, wrapping[i],
+					   strlen(wrapping[i]), &x));
+		TEST_ASSERT_EQUAL(0, bmath_parse_wide(ctx[1], wrapping[i],
+						      strlen(wrapping[i]),
+						      out));
+		TEST_ASSERT_EQUAL_UINT64_MESSAGE(x, out[0], wrapping[i]);
+	}
+
+	// faults are reported by the tier of the width, where they are
+	TEST_ASSERT_EQUAL(PE_PARSE_ERROR,
+			  bmath_parse_wide(ctx[0], "2 / (0 * 3)", 11, out));
+	TEST_ASSERT_EQUAL(BMATH_EDIVZERO, parser_last_error(ctx[0])->code);
+	TEST_ASSERT_EQUAL(2, parser_last_error(ctx[0])->pos);
+	TEST_ASSERT_EQUAL(PE_PARSE_ERROR,
+			  bmath_parse_wide(ctx[0], "1 + mask(17)", 12, out));
+	TEST_ASSERT_EQUAL(BMATH_EFUNC, parser_last_error(ctx[0])->code);
+	TEST_ASSERT_EQUAL(4, parser_last_error(ctx[0])->pos);
+	TEST_ASSERT_EQUAL(0, bmath_parse_wide(ctx[1], "mask(17)", 8, out));
+	TEST_ASSERT_EQUAL_UINT64(0xff, out[2]);
+
+	TEST_ASSERT_EQUAL(PE_PARSE_ERROR,
+			  bmath_parse_wide(ctx[0],
+					   "0x100000000000000000000000000000000",
+					   35, out));
+	TEST_ASSERT_EQUAL(BMATH_EWIDTH, parser_last_error(ctx[0])->code);
+	TEST_ASSERT_EQUAL(PE_PARSE_ERROR,
+			  bmath_parse_wide(ctx[0], "x + 1", 5, out));
+	TEST_ASSERT_EQUAL(BMATH_EVARIABLE, parser_last_error(ctx[0])->code);
+
+	parser_free(ctx[0]);
+	parser_free(ctx[1]);
+}
+
+void test_compiled_programs()
+{
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wparentheses"
+	struct expr_expected_params params[] = {
+		{ "1", 1 },
+		{ "-~16", -~16 },
+		{ "1 | 2 & 3 ^ 4 >> 1 + 5", 1 | 2 & 3 ^ 4 >> 1 + 5 },
+		{ "2 * 1 - 5 | 2 & 3 ^ 4 << 1 % 2",
+		  2 * 1 - 5 | 2 & 3 ^ 4 << 1 % 2 },
+		{ "22+align(7,8)+22", 8 + 22 * 2 },
+		{ "align_down(mask(2), ctz(8) << 3)", 0xffe8 },
+		{ "1 << 65", 2 },
+	};
+#pragma GCC diagnostic pop
+	struct bmath_program *prog;
+	uint64_t parsed, executed;
+	int ret;
+
+	for (size_t i = 0; i < sizeof(params) / sizeof(params[0]); i++) {
+		check_basic(&params[i]);
+
+		ret = bmath_compile(pctx, params[i].expression,
+				    strlen(params[i].expression), &prog);
+		TEST_ASSERT_EQUAL_MESSAGE(0, ret, params[i].expression);
+
+		// run twice to make sure programs are reusable
+		for (int j = 0; j < 2; j++) {
+			ret = bmath_exec(pctx, prog, &executed);
+			TEST_ASSERT_EQUAL_MESSAGE(0, ret, params[i].expression);
+			TEST_ASSERT_EQUAL_MESSAGE(params[i].expected, executed,
+						  params[i].expression);
+		}
+
+		parse(pctx, params[i].expression,
+		      strlen(params[i].expression), &parsed);
+		TEST_ASSERT_EQUAL_MESSAGE(parsed, executed,
+					  params[i].expression);
+		bmath_program_free(prog);
+	}
+}
+
+void test_compile_errors()
+{
+	struct expr_expected_err_params params[] = {
+		{ "", 0, PE_NOTHING_TO_PARSE },
+		{ "align(7,", 0, PE_PARSE_ERROR },
+		{ "align(7, 8, 9)", 0, PE_PARSE_ERROR },
+		{ "popcnt()", 0, PE_PARSE_ERROR },
+		{ "1 || 3", 0, PE_PARSE_ERROR },
+		{ "2 % 0", 0, PE_EVAL_ERROR },
+		{ "mask(9)", 0, PE_EVAL_ERROR },
+	};
+	struct bmath_program *prog;
+	uint64_t actual;
+	int ret;
+
+	for (size_t i = 0; i < sizeof(params) / sizeof(params[0]); i++) {
+		ret = bmath_compile(pctx, params[i].expression,
+				    strlen(params[i].expression), &prog);
+		if (params[i].err != PE_EVAL_ERROR) {
+			TEST_ASSERT_EQUAL_MESSAGE(params[i].err, ret,
+						  params[i].expression);
+			TEST_ASSERT_NULL(prog);
+			continue;
+		}
+
+		TEST_ASSERT_EQUAL_MESSAGE(0, ret, params[i].expression);
+		ret = bmath_exec(pctx, prog, &actual);
+		TEST_ASSERT_EQUAL_MESSAGE(params[i].err, ret,
+					  params[i].expression);
+		bmath_program_free(prog);
+	}
+}
+
+void test_optimize()
+{
+	struct optimize_params {
+		char *expression;
+		uint64_t expected;
+		int err;
+		size_t ops_after;
+	} params[] = {
+		{ "(((1 << 0))) | popcnt(0xff) & mask(8)", 1 | 8, 0, 1 },
+		{ "bswap(0xabcd) + -~-~3", 0xcdab + 5, 0, 1 },
+		{ "2 % 0", 0, PE_EVAL_ERROR, 3 },
+		{ "(2 % 0) * 0", 0, PE_EVAL_ERROR, 5 },
+		{ "mask(9) << 0", 0, PE_EVAL_ERROR, 2 },
+		{ "~~mask(9)", 0, PE_EVAL_ERROR, 2 },
+		{ "0 + mask(9) + 0", 0, PE_EVAL_ERROR, 2 },
+		{ "(mask(9) | 1) | 2", 0, PE_EVAL_ERROR, 4 },
+		{ "1 * mask(9) * 0", 0, PE_EVAL_ERROR, 4 },
+		// calls can only fail with arguments outside of their range
+		{ "popcnt(x) * 0", 0, 0, 1 },
+		{ "mask(x) * 0", 0, 0, 4 },
+		{ "clz(x, 8) * 0", 0, 0, 5 },
+	};
+	struct bmath_optimize_stats stats;
+	struct bmath_program *prog;
+	uint64_t actual;
+	int ret;
+
+	for (size_t i = 0; i < sizeof(params) / sizeof(params[0]); i++) {
+		ret = bmath_compile(pctx, params[i].expression,
+				    strlen(params[i].expression), &prog);
+		TEST_ASSERT_EQUAL_MESSAGE(0, ret, params[i].expression);
+
+		ret = bmath_optimize(prog, &stats);
+		TEST_ASSERT_EQUAL_MESSAGE(0, ret, params[i].expression);
+		TEST_ASSERT_EQUAL_MESSAGE(params[i].ops_after, stats.ops_after,
+					  params[i].expression);
+		TEST_ASSERT_EQUAL_MESSAGE(stats.ops_after,
+					  bmath_program_len(prog),
+					  params[i].expression);
+
+		ret = bmath_exec(pctx, prog, &actual);
+		TEST_ASSERT_EQUAL_MESSAGE(params[i].err, ret,
+					  params[i].expression);
+		TEST_ASSERT_EQUAL_MESSAGE(params[i].expected, actual,
+					  params[i].expression);
+		bmath_program_free(prog);
+	}
+}
+
 int main(void)
 {
 	UNITY_BEGIN();
@@ -260,5 +1415,22 @@ int main(void)
 	RUN_TEST(test_order_of_operations);
 	RUN_TEST(test_functions);
 	RUN_TEST(test_concat_expressions);
+	RUN_TEST(test_deep_expressions);
+	RUN_TEST(test_large_expressions);
+	RUN_TEST(test_slices);
+	RUN_TEST(test_prescan);
+	RUN_TEST(test_error_positions);
+	RUN_TEST(test_error_records);
+	RUN_TEST(test_cache_whitespace);
+	RUN_TEST(test_result_cache);
+	RUN_TEST(test_cache_file);
+	RUN_TEST(test_cse);
+	RUN_TEST(test_symbols);
+	RUN_TEST(test_definitions);
+	RUN_TEST(test_budget);
+	RUN_TEST(test_wide);
+	RUN_TEST(test_compiled_programs);
+	RUN_TEST(test_compile_errors);
+	RUN_TEST(test_optimize);
 	return UNITY_END();
 }
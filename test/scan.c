@@ -0,0 +1,152 @@
+#include <stdio.h>
+#include <string.h>
+#include <unity/unity.h>
+
+#include "../src/scan.h"
+
+// longer than a block, so both full blocks and the tail are exercised
+#define SCAN_LEN 150
+
+static const struct {
+	const char *label;
+	scan_line_t scan;
+} scanners[] = {
+	{ "scalar", scan_line_scalar },
+#ifdef __x86_64__
+	{ "sse2", scan_line_sse2 },
+	{ "avx2", scan_line_avx2 },
+#endif
+};
+
+static bool supported(scan_line_t scan)
+{
+#ifdef __x86_64__
+	return scan != scan_line_avx2 ||
+	       scan_select(BMATH_SIMD_AUTO) == scan_line_avx2;
+#else
+	return true;
+#endif
+}
+
+struct scan_result {
+	bool illegal;
+	size_t len;
+	uint64_t spaces[SCAN_WORDS(SCAN_LEN)];
+};
+
+static void run(scan_line_t scan, const char *line, size_t len,
+		struct scan_result *res)
+{
+	memset(res, 0xa5, sizeof(*res));
+	res->illegal = scan(line, len, res->spaces, &res->len);
+}
+
+// every scanner has to agree with the scalar one
+static void check(const char *line, size_t len)
+{
+	struct scan_result expected, actual;
+	char msg[64];
+
+	run(scan_line_scalar, line, len, &expected);
+
+	for (size_t s = 1; s < sizeof(scanners) / sizeof(scanners[0]); s++) {
+		if (!supported(scanners[s].scan))
+			continue;
+
+		snprintf(msg, sizeof(msg), "%s, %zu bytes", scanners[s].label,
+			 len);
+		run(scanners[s].scan, line, len, &actual);
+		TEST_ASSERT_EQUAL_MESSAGE(expected.illegal, actual.illegal, msg);
+		TEST_ASSERT_EQUAL_MESSAGE(expected.len, actual.len, msg);
+		for (size_t w = 0; w < SCAN_WORDS(expected.len); w++) {
+			TEST_ASSERT_EQUAL_UINT64_MESSAGE(expected.spaces[w],
+							 actual.spaces[w], msg);
+		}
+	}
+}
+
+void setUp(void)
+{
+}
+
+void tearDown(void)
+{
+}
+
+void test_scalar()
+{
+	struct scan_result res;
+
+	run(scan_line_scalar, " 1 +\t0x2", 8, &res);
+	TEST_ASSERT_FALSE(res.illegal);
+	TEST_ASSERT_EQUAL(8, res.len);
+	TEST_ASSERT_EQUAL_UINT64(0x15, res.spaces[0]);
+
+	run(scan_line_scalar, "1 + 2 $ 3", 9, &res);
+	TEST_ASSERT_TRUE(res.illegal);
+	TEST_ASSERT_EQUAL(6, res.len);
+	TEST_ASSERT_EQUAL_UINT64(0x2a, res.spaces[0]);
+
+	// a NUL ends the line, whatever comes after it
+	run(scan_line_scalar, "1 \0$", 4, &res);
+	TEST_ASSERT_FALSE(res.illegal);
+	TEST_ASSERT_EQUAL(2, res.len);
+	TEST_ASSERT_EQUAL_UINT64(0x2, res.spaces[0]);
+
+	run(scan_line_scalar, "", 0, &res);
+	TEST_ASSERT_FALSE(res.illegal);
+	TEST_ASSERT_EQUAL(0, res.len);
+}
+
+// each byte value at each position of a line of whitespace
+void test_every_byte()
+{
+	char line[SCAN_LEN];
+
+	for (int c = 0; c < 256; c++) {
+		for (size_t pos = 0; pos < SCAN_LEN; pos += 7) {
+			memset(line, ' ', sizeof(line));
+			line[pos] = (char)c;
+			check(line, SCAN_LEN);
+			check(line, pos + 1);
+		}
+	}
+}
+
+void test_random_lines()
+{
+	static const char alphabet[] = " \t\n\r0123456789abcdefxyXA()<>|&^~+-*/%,_`$.\x80\xff";
+	uint64_t state = 0x9e3779b97f4a7c15;
+	// the tail is read as aligned blocks, so move the line around in them
+	char buf[SCAN_LEN + 64], *line;
+	size_t len;
+
+	for (int i = 0; i < 20000; i++) {
+		state ^= state << 13;
+		state ^= state >> 7;
+		state ^= state << 17;
+		len = state % (SCAN_LEN + 1);
+		line = buf + (state >> 32) % 64;
+
+		for (size_t k = 0; k < len; k++) {
+			state ^= state << 13;
+			state ^= state >> 7;
+			state ^= state << 17;
+			// mostly legal, so the scan gets far into the line
+			line[k] = alphabet[state % (state & 0x300 ?
+							    sizeof(alphabet) - 5 :
+							    sizeof(alphabet) - 1)];
+		}
+
+		check(line, len);
+	}
+}
+
+int main(void)
+{
+	UNITY_BEGIN();
+	RUN_TEST(test_scalar);
+	RUN_TEST(test_every_byte);
+	RUN_TEST(test_random_lines);
+	return UNITY_END();
+}
@@ -0,0 +1,275 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <unity/unity.h>
+
+#include "../src/parser.h"
+#include "../src/print.h"
+#include "../src/program.h"
+
+/*
+ * Every thread gets its own parser and print context and runs the same
+ * expressions as the main thread did on its own. Nothing is shared, so any
+ * difference in the results or in the printed text is state leaking between
+ * contexts. The one exception is a cache file, which all of them read and
+ * write at once like separate processes would. Compiled programs can be
+ * shared too, and are promoted by whichever thread gets there first.
+ */
+
+#define THREADS 64
+#define ROUNDS 50
+
+// threads racing to promote one program, and how many programs they race on
+#define PROMOTERS 8
+#define PROMOTE_ROUNDS 500
+
+static const char *exprs[] = {
+	"1 + 2 * 3",
+	"(0xff00 >> 8) ^ 0x0f",
+	"popcnt(0xf0f0) + ctz(0x80)",
+	"mask(2) & ~0x3",
+	"-1",
+	"0x41",
+	"0x1f600",
+	"0x10000 * 0x10000",
+	"bswap(0x1122) | align(13, 8)",
+	"123456789 % 1000",
+	"1 / 0",
+	"1 + )",
+};
+
+#define NEXPRS (sizeof(exprs) / sizeof(exprs[0]))
+
+struct run {
+	int errs[NEXPRS];
+	uint64_t results[NEXPRS];
+	// everything print_number() and friends wrote
+	char *out;
+	size_t out_len;
+	// everything the parser reported
+	char *err;
+	size_t err_len;
+};
+
+struct worker {
+	pthread_t thread;
+	// failed to set up, or a round didn't match the reference
+	int failed;
+};
+
+static struct run reference;
+// shared by every context when set
+static const char *cache_file;
+
+static int run_exprs(struct run *run)
+{
+	struct parser_settings settings = { 0 };
+	struct parser_context *pctx;
+	struct print_context *print;
+	FILE *out, *err;
+
+	memset(run, 0, sizeof(*run));
+	out = open_memstream(&run->out, &run->out_len);
+	err = open_memstream(&run->err, &run->err_len);
+	if (!out || !err) {
+		return -1;
+	}
+
+	settings.err_stream = err;
+	settings.cache_file = cache_file;
+	pctx = parser_new(&settings);
+	print = print_new(out);
+	if (!pctx || !print) {
+		return -1;
+	}
+
+	for (size_t i = 0; i < NEXPRS; i++) {
+		run->errs[i] = parse(pctx, exprs[i], strlen(exprs[i]),
+				     &run->results[i]);
+		if (run->errs[i]) {
+			continue;
+		}
+
+		print_number(print, run->results[i], i % 2, ENC_ALL);
+		print_alignment(print, 16, run->results[i], i % 2);
+		print_binary(print, run->results[i]);
+	}
+
+	print_free(print);
+	parser_free(pctx);
+	fclose(out);
+	fclose(err);
+	return 0;
+}
+
+static int same_run(const struct run *a, const struct run *b)
+{
+	return !memcmp(a->errs, b->errs, sizeof(a->errs)) &&
+	       !memcmp(a->results, b->results, sizeof(a->results)) &&
+	       a->out_len == b->out_len &&
+	       !memcmp(a->out, b->out, a->out_len) &&
+	       a->err_len == b->err_len && !memcmp(a->err, b->err, a->err_len);
+}
+
+static void *work(void *arg)
+{
+	struct worker *worker = arg;
+	struct run run;
+
+	for (int r = 0; r < ROUNDS && !worker->failed; r++) {
+		if (run_exprs(&run) || !same_run(&run, &reference)) {
+			worker->failed = 1;
+		}
+
+		free(run.out);
+		free(run.err);
+	}
+
+	return NULL;
+}
+
+static struct bmath_program *shared_prog;
+static int go;
+
+static void *promote(void *arg)
+{
+	struct worker *worker = arg;
+	struct parser_settings settings = { .jit_threshold = 1 };
+	struct parser_context *pctx = parser_new(&settings);
+	uint64_t result;
+
+	if (!pctx) {
+		worker->failed = 1;
+		return NULL;
+	}
+
+	while (!__atomic_load_n(&go, __ATOMIC_ACQUIRE))
+		sched_yield();
+	if (bmath_exec(pctx, shared_prog, &result) || result != 42) {
+		worker->failed = 1;
+	}
+
+	parser_free(pctx);
+	return NULL;
+}
+
+void setUp(void)
+{
+}
+
+void tearDown(void)
+{
+}
+
+void test_reference(void)
+{
+	TEST_ASSERT_EQUAL(0, run_exprs(&reference));
+
+	TEST_ASSERT_EQUAL(7, reference.results[0]);
+	TEST_ASSERT_EQUAL(0xf0, reference.results[1]);
+	TEST_ASSERT_EQUAL(15, reference.results[2]);
+	TEST_ASSERT_EQUAL(0xfffc, reference.results[3]);
+	TEST_ASSERT_EQUAL(PE_PARSE_ERROR, reference.errs[NEXPRS - 2]);
+	TEST_ASSERT_EQUAL(PE_PARSE_ERROR, reference.errs[NEXPRS - 1]);
+
+	// the unicode converters were used, and both errors were reported
+	TEST_ASSERT_NOT_NULL(strstr(reference.out, "UTF-16: "));
+	TEST_ASSERT_NOT_NULL(strstr(reference.err, "Division by zero"));
+	TEST_ASSERT_TRUE(reference.out_len > 0);
+}
+
+static void run_workers(void)
+{
+	struct worker workers[THREADS] = { 0 };
+	int started;
+
+	for (started = 0; started < THREADS; started++) {
+		if (pthread_create(&workers[started].thread, NULL, work,
+				   &workers[started])) {
+			break;
+		}
+	}
+
+	// at least some must run side by side for this to mean anything
+	TEST_ASSERT_TRUE(started > 1);
+
+	for (int i = 0; i < started; i++) {
+		pthread_join(workers[i].thread, NULL);
+		TEST_ASSERT_EQUAL(0, workers[i].failed);
+	}
+}
+
+void test_threads(void)
+{
+	run_workers();
+}
+
+// The mapping recorded with the native code must be the one it lives in,
+// not one a thread that lost the race unmapped again.
+void test_threads_promote(void)
+{
+	struct parser_settings settings = { 0 };
+	struct parser_context *pctx = parser_new(&settings);
+	struct worker workers[PROMOTERS] = { 0 };
+	uint8_t *jit, *map;
+	int started;
+
+	TEST_ASSERT_NOT_NULL(pctx);
+	for (int r = 0; r < PROMOTE_ROUNDS; r++) {
+		TEST_ASSERT_EQUAL(0, bmath_compile(pctx, "(6 * 7) | 0", 11,
+						   &shared_prog));
+		go = 0;
+		for (started = 0; started < PROMOTERS; started++) {
+			if (pthread_create(&workers[started].thread, NULL,
+					   promote, &workers[started])) {
+				break;
+			}
+		}
+		__atomic_store_n(&go, 1, __ATOMIC_RELEASE);
+
+		for (int i = 0; i < started; i++) {
+			pthread_join(workers[i].thread, NULL);
+			TEST_ASSERT_EQUAL(0, workers[i].failed);
+		}
+
+		jit = shared_prog->jit;
+		map = shared_prog->jit_map;
+		if (jit) {
+			TEST_ASSERT_TRUE(jit >= map &&
+					 jit < map + shared_prog->jit_size);
+		}
+		bmath_program_free(shared_prog);
+	}
+	parser_free(pctx);
+}
+
+void test_threads_cache_file(void)
+{
+	char path[] = "/tmp/bmath-cache-XXXXXX";
+	int fd = mkstemp(path);
+
+	TEST_ASSERT_TRUE(fd >= 0);
+	close(fd);
+
+	cache_file = path;
+	run_workers();
+	cache_file = NULL;
+	unlink(path);
+}
+
+int main(void)
+{
+	UNITY_BEGIN();
+	RUN_TEST(test_reference);
+	RUN_TEST(test_threads);
+	RUN_TEST(test_threads_promote);
+	RUN_TEST(test_threads_cache_file);
+	free(reference.out);
+	free(reference.err);
+	return UNITY_END();
+}